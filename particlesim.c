@@ -0,0 +1,11492 @@
+// Particle Simulator, written by misha soup
+// Project started in October 2023
+// The physics, on its own. particlesimSDL.c is the window, and uses it
+// through particlesim.h like any other program
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+// the metrics can be read from a local socket where there are Unix sockets,
+// the particles shared with other programs through POSIX shared memory
+// and the world split between processes
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#define HAS_UNIX_SOCKETS 1
+#define HAS_SHARED_MEMORY 1
+#endif
+
+// checkpoints are flushed to the disk with _commit on windows
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "particlesim.h"
+
+// The physics doesn't need SDL, so it brings its own threads, locks and clock:
+// C11 atomics for the lock free parts, and pthreads or the Windows API for the rest
+
+typedef uint8_t Uint8;
+typedef uint16_t Uint16;
+typedef uint32_t Uint32;
+typedef uint64_t Uint64;
+typedef int32_t Sint32;
+
+// a thread running function(data), and what it needs to get going
+typedef struct physicsThread {
+	
+	int (*function)(void*);
+	void* data;
+	
+#ifdef _WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+	
+} physicsThread;
+
+#ifdef _WIN32
+
+static DWORD WINAPI runPhysicsThread(LPVOID thread){
+	
+	return (DWORD)((physicsThread*)thread)->function(((physicsThread*)thread)->data);
+	
+}
+
+#else
+
+static void* runPhysicsThread(void* thread){
+	
+	((physicsThread*)thread)->function(((physicsThread*)thread)->data);
+	
+	return 0;
+	
+}
+
+#endif
+
+// start a thread, 0 if it couldn't be
+static inline physicsThread* startThread(int (*function)(void*), void* data){
+	
+	physicsThread* thread = malloc(sizeof(physicsThread));
+	
+	if(thread == 0){
+		
+		return 0;
+		
+	}
+	
+	thread->function = function;
+	thread->data = data;
+	
+#ifdef _WIN32
+	thread->thread = CreateThread(0, 0, runPhysicsThread, thread, 0, 0);
+	
+	if(thread->thread == 0){
+#else
+	if(pthread_create(&thread->thread, 0, runPhysicsThread, thread) != 0){
+#endif
+		
+		free(thread);
+		
+		return 0;
+		
+	}
+	
+	return thread;
+	
+}
+
+// wait for a thread to return, and forget it
+static inline void waitThread(physicsThread* thread){
+	
+#ifdef _WIN32
+	WaitForSingleObject(thread->thread, INFINITE);
+	CloseHandle(thread->thread);
+#else
+	pthread_join(thread->thread, 0);
+#endif
+	
+	free(thread);
+	
+	return;
+	
+}
+
+// a lock for the slow paths, which can go to sleep waiting
+typedef struct physicsMutex {
+	
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	
+} physicsMutex;
+
+static inline physicsMutex* createMutex(){
+	
+	physicsMutex* mutex = malloc(sizeof(physicsMutex));
+	
+	if(mutex == 0){
+		
+		return 0;
+		
+	}
+	
+#ifdef _WIN32
+	InitializeCriticalSection(&mutex->lock);
+#else
+	pthread_mutex_init(&mutex->lock, 0);
+#endif
+	
+	return mutex;
+	
+}
+
+static inline void destroyMutex(physicsMutex* mutex){
+	
+	if(mutex == 0){
+		
+		return;
+		
+	}
+	
+#ifdef _WIN32
+	DeleteCriticalSection(&mutex->lock);
+#else
+	pthread_mutex_destroy(&mutex->lock);
+#endif
+	
+	free(mutex);
+	
+	return;
+	
+}
+
+static inline void lockMutex(physicsMutex* mutex){
+	
+#ifdef _WIN32
+	EnterCriticalSection(&mutex->lock);
+#else
+	pthread_mutex_lock(&mutex->lock);
+#endif
+	
+	return;
+	
+}
+
+// 1 if it got the lock, without waiting for it
+static inline char tryLockMutex(physicsMutex* mutex){
+	
+#ifdef _WIN32
+	return TryEnterCriticalSection(&mutex->lock) != 0;
+#else
+	return pthread_mutex_trylock(&mutex->lock) == 0;
+#endif
+	
+}
+
+static inline void unlockMutex(physicsMutex* mutex){
+	
+#ifdef _WIN32
+	LeaveCriticalSection(&mutex->lock);
+#else
+	pthread_mutex_unlock(&mutex->lock);
+#endif
+	
+	return;
+	
+}
+
+// a counting semaphore. Windows has them, pthreads gets one from a mutex
+// and a condition (sem_init isn't there on macOS)
+typedef struct physicsSemaphore {
+	
+#ifdef _WIN32
+	HANDLE semaphore;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t posted;
+	int count;
+#endif
+	
+} physicsSemaphore;
+
+static inline physicsSemaphore* createSemaphore(){
+	
+	physicsSemaphore* semaphore = malloc(sizeof(physicsSemaphore));
+	
+	if(semaphore == 0){
+		
+		return 0;
+		
+	}
+	
+#ifdef _WIN32
+	semaphore->semaphore = CreateSemaphore(0, 0, INT32_MAX, 0);
+	
+	if(semaphore->semaphore == 0){
+		
+		free(semaphore);
+		
+		return 0;
+		
+	}
+#else
+	pthread_mutex_init(&semaphore->lock, 0);
+	pthread_cond_init(&semaphore->posted, 0);
+	semaphore->count = 0;
+#endif
+	
+	return semaphore;
+	
+}
+
+static inline void destroySemaphore(physicsSemaphore* semaphore){
+	
+	if(semaphore == 0){
+		
+		return;
+		
+	}
+	
+#ifdef _WIN32
+	CloseHandle(semaphore->semaphore);
+#else
+	pthread_cond_destroy(&semaphore->posted);
+	pthread_mutex_destroy(&semaphore->lock);
+#endif
+	
+	free(semaphore);
+	
+	return;
+	
+}
+
+static inline void postSemaphore(physicsSemaphore* semaphore){
+	
+#ifdef _WIN32
+	ReleaseSemaphore(semaphore->semaphore, 1, 0);
+#else
+	pthread_mutex_lock(&semaphore->lock);
+	semaphore->count++;
+	pthread_cond_signal(&semaphore->posted);
+	pthread_mutex_unlock(&semaphore->lock);
+#endif
+	
+	return;
+	
+}
+
+static inline void waitSemaphore(physicsSemaphore* semaphore){
+	
+#ifdef _WIN32
+	WaitForSingleObject(semaphore->semaphore, INFINITE);
+#else
+	pthread_mutex_lock(&semaphore->lock);
+	
+	while(semaphore->count == 0){
+		
+		pthread_cond_wait(&semaphore->posted, &semaphore->lock);
+		
+	}
+	
+	semaphore->count--;
+	pthread_mutex_unlock(&semaphore->lock);
+#endif
+	
+	return;
+	
+}
+
+// a spin lock, for the worker deques where the wait is a few instructions
+static inline void spinLock(atomic_flag* lock){
+	
+	while(atomic_flag_test_and_set_explicit(lock, memory_order_acquire)){}
+	
+	return;
+	
+}
+
+static inline void spinUnlock(atomic_flag* lock){
+	
+	atomic_flag_clear_explicit(lock, memory_order_release);
+	
+	return;
+	
+}
+
+// a clock that only goes forwards, in ticks of 1 / performanceFrequency() seconds
+static inline Uint64 performanceCounter(){
+	
+#ifdef _WIN32
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	
+	return (Uint64)counter.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return ((Uint64)now.tv_sec * 1000000000ull) + (Uint64)now.tv_nsec;
+#endif
+	
+}
+
+static inline Uint64 performanceFrequency(){
+	
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	
+	return (Uint64)frequency.QuadPart;
+#else
+	return 1000000000ull;
+#endif
+	
+}
+
+static inline void sleepMilliseconds(Uint32 milliseconds){
+	
+#ifdef _WIN32
+	Sleep(milliseconds);
+#else
+	struct timespec wait = {(time_t)(milliseconds / 1000), (long)(milliseconds % 1000) * 1000000L};
+	nanosleep(&wait, 0);
+#endif
+	
+	return;
+	
+}
+
+// how many cores there are to run workers on
+static inline int cpuCount(){
+	
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	
+	return (int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	
+	return (count > 0) ? (int)count : 1;
+#endif
+	
+}
+
+// the longest path a socket can have, on every system
+#define METRICS_PATH_LENGTH 104
+
+// all these variables are explained in the config file
+typedef struct configOptions{
+	
+	int MAX_PARTICLE_COUNT;
+	double MAX_PARTICLE_SPEED;
+	double MIN_PARTICLE_SPEED;
+	double MAX_DIRECTION;
+	char ENABLE_STARTING_PARTICLES;
+	char ENABLE_CIRCLE_PARTICLES;
+	char ENABLE_BORDER_COLLISION;
+	char ENABLE_BORDER_CLAMP;
+	char ENABLE_PARTICLE_COLLISION;
+	int MAX_MEMORY_ALLOCATION;
+	char ENABLE_GENERATE_ONCE;
+	int WINDOW_WIDTH;
+	int WINDOW_HEIGHT;
+	double FRICTION;
+	double NEIGHBOUR_SKIN;
+	int WORKER_THREADS;
+	char ENABLE_DETERMINISTIC;
+	int DETERMINISTIC_SEED;
+	double FIXED_TIMESTEP;
+	int STATE_HASH_INTERVAL;
+	int STARTING_PARTICLE_COUNT;
+	int REORDER_INTERVAL;
+	char ENABLE_CHARGE;
+	double CHARGE_STRENGTH;
+	double CHARGE_MESH_SIZE;
+	int MAX_SUBSTEP_LEVEL;
+	double SUBSTEP_TRAVEL;
+	char ENABLE_BORDER_WRAP;
+	char ENABLE_BORDER_ABSORB;
+	int WORLD_WIDTH;
+	int WORLD_HEIGHT;
+	char METRICS_SOCKET[METRICS_PATH_LENGTH];
+	char METRICS_FILE[METRICS_PATH_LENGTH];
+	double METRICS_INTERVAL;
+	char ENABLE_COLLISION_EVENTS;
+	char COLLISION_LOG[METRICS_PATH_LENGTH];
+	char ENABLE_REFERENCE_CHECK;
+	double REFERENCE_TOLERANCE;
+	char SHARED_MEMORY_NAME[METRICS_PATH_LENGTH];
+	int SLAB_PROCESSES;
+	char CHECKPOINT_FILE[METRICS_PATH_LENGTH];
+	int CHECKPOINT_STEPS;
+	double CHECKPOINT_MINUTES;
+	int CHECKPOINT_KEEP;
+	char ENABLE_RESTART;
+	char ENABLE_COMPACT_PARTICLES;
+	
+} configOptions;
+
+const char optStr1[] = "MAX_PARTICLE_COUNT";
+const char optStr2[] = "MAX_PARTICLE_SPEED";
+const char optStr3[] = "MIN_PARTICLE_SPEED";
+const char optStr7[] = "MAX_DIRECTION";
+const char optStr8[] = "ENABLE_STARTING_PARTICLES";
+const char optStr12[] = "ENABLE_CIRCLE_PARTICLES";
+const char optStr16[] = "ENABLE_BORDER_COLLISION";
+const char optStr17[] = "ENABLE_BORDER_CLAMP";
+const char optStr18[] = "ENABLE_PARTICLE_COLLISION";
+const char optStr19[] = "MAX_MEMORY_ALLOCATION";
+const char optStr27[] = "ENABLE_GENERATE_ONCE";
+const char optStr33[] = "WINDOW_WIDTH";
+const char optStr34[] = "WINDOW_HEIGHT";
+const char optStr35[] = "FRICTION";
+const char optStr36[] = "NEIGHBOUR_SKIN";
+const char optStr37[] = "WORKER_THREADS";
+const char optStr38[] = "ENABLE_DETERMINISTIC";
+const char optStr39[] = "DETERMINISTIC_SEED";
+const char optStr40[] = "FIXED_TIMESTEP";
+const char optStr41[] = "STATE_HASH_INTERVAL";
+const char optStr43[] = "STARTING_PARTICLE_COUNT";
+const char optStr44[] = "REORDER_INTERVAL";
+
+// force fields, there can be more than one of each
+const char optStr45[] = "UNIFORM_GRAVITY";
+const char optStr46[] = "POINT_GRAVITY";
+const char optStr47[] = "LINE_GRAVITY";
+const char optStr48[] = "MOVING_LINE_GRAVITY";
+const char optStr49[] = "SINE_GRAVITY";
+const char optStr50[] = "AIR_DRAG";
+
+const char optStr51[] = "ENABLE_CHARGE";
+const char optStr52[] = "CHARGE_STRENGTH";
+const char optStr53[] = "CHARGE_MESH_SIZE";
+const char optStr54[] = "MAX_SUBSTEP_LEVEL";
+const char optStr55[] = "SUBSTEP_TRAVEL";
+const char optStr56[] = "ENABLE_BORDER_WRAP";
+const char optStr57[] = "ENABLE_BORDER_ABSORB";
+const char optStr58[] = "WORLD_WIDTH";
+const char optStr59[] = "WORLD_HEIGHT";
+
+// the metrics paths are read from the rest of the line
+const char optStr63[] = "METRICS_SOCKET";
+const char optStr64[] = "METRICS_FILE";
+const char optStr65[] = "METRICS_INTERVAL";
+const char optStr66[] = "ENABLE_COLLISION_EVENTS";
+const char optStr67[] = "COLLISION_LOG";
+const char optStr68[] = "ENABLE_REFERENCE_CHECK";
+const char optStr69[] = "REFERENCE_TOLERANCE";
+const char optStr70[] = "SHARED_MEMORY_NAME";
+const char optStr71[] = "SLAB_PROCESSES";
+const char optStr72[] = "CHECKPOINT_FILE";
+const char optStr73[] = "CHECKPOINT_STEPS";
+const char optStr74[] = "CHECKPOINT_MINUTES";
+const char optStr75[] = "CHECKPOINT_KEEP";
+const char optStr76[] = "ENABLE_RESTART";
+const char optStr77[] = "ENABLE_COMPACT_PARTICLES";
+
+// list of particles types. Each particle share some or all of the 
+// forces, and interact with each other in unique ways.
+// particles can change into a different type, emit,
+// absorb, bond or be annihilated depending on the type
+typedef enum {
+	
+	red_particle,
+	blue_particle,
+	green_particle,
+	yellow_particle,
+	pink_particle,
+	
+	numOfParticleTypes
+	
+} particleType;
+
+// A particle's number changes whenever the array is compacted or reordered,
+// so anything that has to keep pointing at the same particle uses a handle.
+// The low 32 bits are a slot in the handle table, which knows the particle's
+// current number. The high 32 bits are the slot's generation, which goes up when
+// the particle is removed, so an old handle can never find the slot's next owner
+typedef Uint64 particleHandle;
+
+// generations start at 1, so this is never a real particle
+#define NULL_PARTICLE_HANDLE 0
+
+// the particle structure with all the properties each particle will have.
+// Anything that only depends on the type (size, charge) is looked up in
+// particleTemplates and particleSizes instead, and the fields are in order of size
+// so there are no gaps between them. That keeps it at 80 bytes, and
+// MAX_MEMORY_ALLOCATION holds that many more particles
+typedef struct particle {
+	
+	double x;
+	double y;
+	
+	double velocityX;
+	double velocityY;
+	
+	// the mass changes while the particle is bonded, so it can't come from the type
+	double mass;
+	
+	double nearestNeighbourDistance;
+	
+	// this particle's own handle
+	particleHandle handle;
+	
+	// bondingWith is the partner's number, for the physics to use.
+	// bondedTo is the same partner as a handle, which stays right after a reorder
+	particleHandle bondedTo;
+	int bondingWith;
+	
+	int nearestNeighbour;
+	
+	int collidingAwayFrom;
+	
+	// one of particleType
+	Uint8 type;
+	
+} particle;
+
+// every kind of force field that can be set in config.txt
+typedef enum forceFieldType {
+	
+	uniformGravity,
+	pointGravity,
+	lineGravity,
+	movingLineGravity,
+	sineGravity,
+	airDrag
+	
+} forceFieldType;
+
+// a force field acting on every particle. The first part comes from config.txt,
+// the second part is worked out once per step so the kernels only have to add
+typedef struct forceField {
+	
+	forceFieldType type;
+	
+	double x1;
+	double y1;
+	double x2;
+	double y2;
+	
+	double strength;
+	double minimum;
+	double maximum;
+	double angle;
+	
+	double amplitudeX;
+	double amplitudeY;
+	double frequency;
+	
+	// the velocity change this step, for uniform and sine gravity
+	double accelerationX;
+	double accelerationY;
+	
+	// where the line is this step, for line and moving line gravity
+	double lineX;
+	double lineY;
+	double lineDX;
+	double lineDY;
+	double inverseLengthSquared;
+	
+	// strength multiplied by the frame delta time
+	double scaledStrength;
+	
+} forceField;
+
+// what every new particle of each type starts with
+typedef struct particleTemplate {
+	
+	double size;
+	
+	double mass;
+	
+	double charge;
+	
+} particleTemplate;
+
+static const particleTemplate particleTemplates[numOfParticleTypes] = {
+	
+	// red is large, and light
+	[red_particle] = {20.0, 1.0, 1.0},
+	
+	// blue is larger, and a bit heavier, with the opposite charge to red
+	[blue_particle] = {25.0, 1.2f, -1.0},
+	
+	// green is small and very light, and has no charge
+	[green_particle] = {10.0, 0.01f, 0.0},
+	
+	// yellow is very small and very heavy, like a nucleus
+	[yellow_particle] = {5.0, 10.0, 1.0},
+	
+	// pink is extremely small and extremely light, like an electron
+	[pink_particle] = {2.0, 0.0001f, -1.0}
+	
+};
+
+// the names of the types, for anything that prints them
+static const char* const particleTypeNames[numOfParticleTypes] = {"red", "blue", "green", "yellow", "pink"};
+
+// With ENABLE_COMPACT_PARTICLES there is no particles array at all. Each value
+// has an array of its own instead, as small as it can be. It's only a way of
+// keeping the particles: the passes unpack each particle they work on into a
+// whole one (see loadParticle()), do the same sums on it as usual, and pack what
+// they changed up again, so the physics is the same as without it.
+// - x and y are fixed point numbers, compactScale of them to a pixel
+// - the velocities are half precision floats
+// - the mass comes from the type, and from the partner's type while it's bonded
+// - only the handle's slot is kept, the handle table has its generation, and the
+//   partner's handle comes from the partner
+// - the nearest neighbour's distance is a float
+typedef struct compactParticles {
+	
+	Sint32* restrict x;
+	Sint32* restrict y;
+	
+	Uint16* restrict velocityX;
+	Uint16* restrict velocityY;
+	
+	int* restrict bondingWith;
+	int* restrict nearestNeighbour;
+	int* restrict collidingAwayFrom;
+	float* restrict nearestNeighbourDistance;
+	
+	Uint32* restrict handleSlot;
+	
+	Uint8* restrict type;
+	
+} compactParticles;
+
+// the bytes each compact particle takes
+#define COMPACT_PARTICLE_BYTES ((2 * sizeof(Sint32)) + (2 * sizeof(Uint16)) + (3 * sizeof(int)) + sizeof(float) + sizeof(Uint32) + sizeof(Uint8))
+
+// the force fields from config.txt
+#define MAX_FORCE_FIELDS 16
+
+// Fast particles take more than one smaller step per frame. A particle at
+// level L takes 2^L steps of delta / 2^L, the highest level allowed is this
+#define SUBSTEP_LEVEL_LIMIT 8
+
+// What the boundary pass did to each particle it checked. The pass itself only
+// writes to the particle it is looking at, so the bonded partners and the
+// removal queue are seen to afterwards, in one go
+#define BORDER_FLIPPED_X 1
+#define BORDER_FLIPPED_Y 2
+#define BORDER_ABSORBED 4
+
+// the broad phase. The world is split into cells at least as wide as the
+// largest interaction distance, so anything that can touch a particle is either in
+// the same cell or one of the 8 around it. Particles outside the world are
+// put in the nearest edge cell. When the border wraps round, the cells fit the
+// world exactly, and the cells on one edge are next to the ones on the other.
+// The world can be far bigger than the screen and mostly empty, so only the cells
+// that have particles in them are kept. They are numbered in row major order,
+// skipping the empty ones, and a hash table finds a cell's number from its row and column
+typedef struct spatialGrid {
+	
+	double cellWidth;
+	double cellHeight;
+	int columns;
+	int rows;
+	
+	// how many cells have particles in them
+	int cellCount;
+	
+	// the particles in cell c are particleIndices[cellStart[c]] up to
+	// (but not including) particleIndices[cellStart[c + 1]], in ascending order
+	int* restrict cellStart;
+	int cellCapacity;
+	
+	// where each cell is
+	int* restrict cellRow;
+	int* restrict cellColumn;
+	
+	// used while building, the (row, column) key of each cell and its final number
+	Uint64* restrict cellKeys;
+	int* restrict cellRank;
+	
+	// open addressing, from a cell's key to its number. Never more than half full
+	Uint64* restrict tableKeys;
+	int* restrict tableCells;
+	int tableCapacity;
+	
+	int* restrict particleIndices;
+	
+	// which cell each particle is in
+	int* restrict particleCell;
+	
+	// set whenever particles move, spawn or disappear
+	char isStale;
+	
+} spatialGrid;
+
+// no cell has this key, rows and columns are never negative
+#define GRID_EMPTY_KEY 0xFFFFFFFFFFFFFFFFull
+
+// the work given to each thread is a range of positions in grid.particleIndices,
+// so each task covers a run of neighbouring cells (or part of one crowded cell)
+typedef struct workerTask {
+	
+	int start;
+	int end;
+	
+} workerTask;
+
+// each thread takes tasks from the back of its own deque, and once it runs
+// dry it steals from the front of the others. The tasks are handed out before the
+// workers start, so a deque is just a range of the tasks array.
+// The padding keeps each deque on its own cache line, so threads
+// don't fight over the same line when they grab tasks
+typedef struct workerDeque {
+	
+	int head;
+	int tail;
+	atomic_flag lock;
+	
+	char padding[64 - (2 * sizeof(int)) - sizeof(atomic_flag)];
+	
+} workerDeque;
+
+// what a worker thread is given when it starts
+typedef struct workerStart {
+	
+	particlesim* simulation;
+	int workerNum;
+	
+} workerStart;
+
+// counters each thread adds to as it works, without locks or atomics because
+// every thread has its own (on its own cache line, like the deques).
+// The simulation thread only reads them between runs, when the workers are waiting
+typedef struct workerCounters {
+	
+	// pairs of particles checked to see if they touch
+	Uint64 candidatePairs;
+	
+	// tasks run, and how many of them were stolen from another thread
+	Uint64 tasksRun;
+	Uint64 tasksStolen;
+	
+	char padding[64 - (3 * sizeof(Uint64))];
+	
+} workerCounters;
+
+// two particles that need to bounce off each other this step
+typedef struct collisionContact {
+	
+	int particleNumA;
+	int particleNumB;
+	double distance;
+	int colour;
+	
+} collisionContact;
+
+// A collision changes the velocity of both particles and of whatever they are
+// bonded to, so two collisions that share any of those can't run at the same time.
+// The contacts get coloured so that no two of the same colour share a particle,
+// then each colour is handed to the workers as one batch
+#define MAX_CONTACT_COLOURS 64
+
+// Every collision and bond can be written to a log as it happens. Each thread
+// has a ring of events of its own that only it writes to, and the log thread
+// empties them all into COLLISION_LOG. A thread only ever moves the head of its
+// ring and the log thread only the tail, so neither takes a lock
+typedef enum{
+	
+	elasticCollision,
+	redBlueBond,
+	numOfEventKinds
+	
+} collisionEventKind;
+
+// one event as it's written to the log, 32 bytes
+typedef struct collisionEvent {
+	
+	Uint64 step;
+	
+	// the two particles, as handles so they can be followed through the log
+	particleHandle particleA;
+	particleHandle particleB;
+	
+	// the momentum each particle gained or lost
+	float impulse;
+	
+	Uint8 kind;
+	Uint8 typeA;
+	Uint8 typeB;
+	Uint8 padding;
+	
+} collisionEvent;
+
+// events each ring holds, a power of two. If the log thread falls this
+// far behind a thread, that thread's new events are dropped and counted
+#define EVENT_RING_SIZE 16384
+
+typedef struct eventRing {
+	
+	collisionEvent* restrict events;
+	
+	// only the thread writing the events uses these: where the next one goes,
+	// and the tail as it was last seen, so it doesn't have to look every time
+	Uint32 writeHead;
+	Uint32 seenTail;
+	
+	char writerPadding[64 - sizeof(collisionEvent*) - (2 * sizeof(Uint32))];
+	
+	// how far the events are written, moved on by the writing thread
+	atomic_int head;
+	atomic_int dropped;
+	
+	char headPadding[64 - (2 * sizeof(atomic_int))];
+	
+	// how far the log thread has read, moved on by it
+	atomic_int tail;
+	
+	char tailPadding[64 - sizeof(atomic_int)];
+	
+} eventRing;
+
+// the function each task runs, given the range and the number of the thread running it
+typedef void (*workerKernel)(int start, int end, int workerNum);
+
+// a list of tasks that can be handed to the workers
+typedef struct workerTaskList {
+	
+	workerTask* tasks;
+	int count;
+	int capacity;
+	
+} workerTaskList;
+
+// cos() and sin() are slow, and the direction of a new particle doesn't need
+// to be perfect, so we look them up in a table instead
+#define DIRECTION_TABLE_SIZE 4096
+
+// what the spawn kernel needs to know about the particles it's making
+typedef struct spawnRequest {
+	
+	int first;
+	int x;
+	int y;
+	int type;
+	unsigned int seed;
+	
+} spawnRequest;
+
+// how wide the Gaussian is in mesh cells. Any narrower and the mesh
+// can't follow it, any wider and the short range part reaches too far
+#define CHARGE_WIDTH_CELLS 1.5
+
+// the short range part is ignored past this many Gaussian widths
+#define CHARGE_CUTOFF_WIDTHS 4.0
+
+// the short range force is closer than this is treated as being this close, in pixels
+#define CHARGE_SOFTENING 2.0
+
+// how many entries the short range force table has
+#define CHARGE_TABLE_SIZE 4096
+
+// how many grid cells each charge task works on
+#define CHARGE_CHUNK 4
+
+// The charged particles around one grid cell, copied next to each other
+// so every particle in the cell can go through them quickly.
+// Each worker has its own, and it grows when a cell needs more room
+typedef struct chargeNeighbourhood {
+	
+	int* restrict indices;
+	double* restrict x;
+	double* restrict y;
+	double* restrict charge;
+	int capacity;
+	
+	char padding[64 - (4 * sizeof(void*)) - sizeof(int)];
+	
+} chargeNeighbourhood;
+
+// The mesh covers the window with chargeColumns by chargeRows points, and is
+// padded with zeros to meshWidth by meshHeight (powers of two, at least double)
+// so the FFT doesn't wrap the charges around onto the other side of the window.
+// The mesh is stored as pairs of real and imaginary parts
+typedef struct chargeMeshState {
+	
+	int chargeColumns;
+	int chargeRows;
+	int meshWidth;
+	int meshHeight;
+	
+	double spacing;
+	double width;
+	double cutoff;
+	
+	double* restrict mesh;
+	
+	// the FFT of the long range part, divided by the mesh size so the inverse
+	// FFT comes out the right size. Stored a column at a time
+	double* restrict greens;
+	
+	// the electric field at each mesh point in the window
+	double* restrict fieldX;
+	double* restrict fieldY;
+	
+	// cos and sin for the largest FFT, the smaller ones skip through it
+	double* restrict twiddles;
+	int twiddleSize;
+	
+	// every worker gets a column to work on and a neighbourhood
+	double* restrict scratch;
+	chargeNeighbourhood* restrict neighbourhoods;
+	
+	// the short range force divided by the distance, indexed by distance squared
+	double shortRangeTable[CHARGE_TABLE_SIZE + 1];
+	
+} chargeMeshState;
+
+// With SHARED_MEMORY_NAME, every step copies the particles into a POSIX shared
+// memory object, so other programs can map it and read them while it runs.
+// It starts with this header, then has an array for each value, with room for
+// every particle that fits in MAX_MEMORY_ALLOCATION. The header says where each
+// array starts, in bytes from the start of the object.
+// The header's sequence is a seqlock: it is odd while the particles are being
+// written and goes up by 2 every step. A reader waits for an even sequence,
+// copies what it wants, then checks the sequence again. If it changed, the copy
+// might be half of one step and half of the next, so it tries again
+typedef struct sharedStateHeader {
+	
+	char magic[4];
+	Uint32 version;
+	
+	atomic_int sequence;
+	
+	Uint32 capacity;
+	Uint32 length;
+	Uint32 padding;
+	
+	Uint64 step;
+	double time;
+	
+	Uint64 xOffset;
+	Uint64 yOffset;
+	Uint64 velocityXOffset;
+	Uint64 velocityYOffset;
+	Uint64 handleOffset;
+	Uint64 typeOffset;
+	
+} sharedStateHeader;
+
+// the parts of a step that are timed for the metrics
+typedef enum{
+	
+	removalPhase,
+	reorderPhase,
+	updatePhase,
+	borderPhase,
+	interactionPhase,
+	subStepPhase,
+	publishPhase,
+	numOfPhases
+	
+} stepPhase;
+
+static const char* const phaseNames[numOfPhases] = {"removal", "reorder", "update", "border", "interaction", "substep", "publish"};
+
+// What the metrics report, put together by the simulation thread after
+// each step from the threads' counters and handed to the metrics thread
+typedef struct metricsSample {
+	
+	Uint64 step;
+	double stepsPerSecond;
+	
+	int particles;
+	int bondedPairs;
+	int workers;
+	
+	// in the last step, and since the start
+	Uint64 collisions;
+	Uint64 collisionsTotal;
+	Uint64 candidatePairs;
+	Uint64 candidatePairsTotal;
+	
+	Uint64 tasksRun;
+	Uint64 tasksStolen;
+	
+	double phaseSeconds[numOfPhases];
+	
+	Uint64 particleBytes;
+	
+} metricsSample;
+
+// the start of a checkpoint. The particles follow it, then the generation of every
+// handle slot, the free handle slots, the handles of the particles that were
+// waiting to be removed, and how many of the particles each slab had
+typedef struct checkpointHeader {
+	
+	char magic[4];
+	Uint32 version;
+	Uint32 particleSize;
+	int length;
+	int removalCount;
+	unsigned int randState;
+	Uint32 handleSlots;
+	Uint32 freeHandleCount;
+	
+	// 0 unless the particles are every slab's, one slab after the other,
+	// and the slabs would have carried on with them as they are
+	Uint32 slabRuns;
+	
+	// counts up across runs, so the newest checkpoint has the biggest one
+	Uint64 sequence;
+	Uint64 step;
+	double time;
+	
+} checkpointHeader;
+
+// what goes over a boundary first: how many particles come after it, and how far
+// the particles of the slab sending it reach over the boundary (see
+// gatherSlabClusters()). Exchanges that don't need the reach leave it 0
+typedef struct slabHeader {
+	
+	int count;
+	double reach;
+	
+} slabHeader;
+
+// a boundary with the slab on one side, and what goes over it each way
+typedef struct slabLink {
+	
+	// -1 if there isn't a slab on that side
+	int socket;
+	
+	slabHeader outgoingHeader;
+	particle* outgoing;
+	int outgoingCapacity;
+	
+	slabHeader incomingHeader;
+	particle* incoming;
+	int incomingCapacity;
+	
+} slabLink;
+
+// everything that belongs to one simulation. Every function below works on sim,
+// which each thread points at the simulation it is working for
+struct particlesim {
+	
+	// our options struct
+	configOptions* restrict options;
+	
+	// how long the step being taken is, in seconds
+	double delta;
+	
+	// how many steps we have simulated
+	Uint64 simulationStep;
+	
+	// which particle the simulation is adding right now, -1 for random ones
+	int spawnType;
+	
+	// stores the state for the PRNG
+	unsigned int randState;
+	
+	// the diameter of each type, which is the template's size, or 1 pixel
+	// if the particles are drawn as pixels. Set once the options are read
+	double particleSizes[numOfParticleTypes];
+	
+	// how many particles are currently on the screen
+	int length;
+	
+	// the restrict keyword tells the compiler that
+	// this pointer will never change - ie, this pointer wil be pointing
+	// at the same address for the entirety of the program's life,
+	// allowing the compiler to do optimisations on it
+	particle* restrict particles;
+	
+	compactParticles compact;
+	
+	// set when the particles are in compact rather than particles
+	char isCompact;
+	
+	// how many fixed point steps there are to a pixel, a power of two so going
+	// between them and doubles is exact. compactUnit is one step in pixels
+	double compactScale;
+	double compactUnit;
+	
+	// a block of unpacked particles for each worker to do its sums on
+	particle* restrict compactBlocks;
+	
+	// compact particles have no neighbour lists, so each worker finds a particle's
+	// neighbours again when it gets to it, and keeps them here
+	int** compactNeighbours;
+	int* restrict compactNeighbourCapacity;
+	
+	// how many bonding there are between particles
+	int bondLength;
+	
+	// a 2D array containing the particle numbers of bonding particles
+	int* restrict bonding;
+	
+	// how many particles fit inside MAX_MEMORY_ALLOCATION
+	int particleCapacity;
+	
+	forceField forceFields[MAX_FORCE_FIELDS];
+	int forceFieldCount;
+	
+	// how long the simulation has been running, for the fields that move
+	double simulationTime;
+	
+	// the level of every particle this step
+	unsigned char* restrict subStepLevel;
+	
+	// every particle above level 0, the highest levels first. The particles
+	// that move in a sub-step are always the first subStepAtLeast[level] of them
+	int* restrict subStepOrder;
+	int subStepAtLeast[SUBSTEP_LEVEL_LIMIT + 2];
+	int highestSubStepLevel;
+	
+	unsigned char* restrict borderEvents;
+	
+	// the handle table. handleIndex[slot] is the particle number that slot points at,
+	// and handleGeneration[slot] is the generation a handle needs to be still valid.
+	// Released slots go on the freeHandles stack to be used again, the smallest first
+	int* restrict handleIndex;
+	Uint32* restrict handleGeneration;
+	Uint32* restrict freeHandles;
+	int freeHandleCount;
+	char freeHandlesSorted;
+	int handleSlotsUsed;
+	
+	// Verlet neighbour lists. Each particle owns neighbourCount[i] entries of
+	// neighbourIndices starting at neighbourStart[i], which are all the particles
+	// within the interaction radius plus NEIGHBOUR_SKIN. The lists are only rebuilt
+	// once a particle has moved more than half the skin, so between rebuilds
+	// nobody needs to look at every other particle
+	int* restrict neighbourStart;
+	int* restrict neighbourCount;
+	int* restrict neighbourIndices;
+	int neighbourCapacity;
+	
+	// where each particle was when the lists were last built
+	double* restrict neighbourBuiltX;
+	double* restrict neighbourBuiltY;
+	
+	// how many particles there were on the last build, -1 forces a rebuild
+	int neighbourBuiltLength;
+	
+	// Particles can't be removed straight away, other particles might still be looking
+	// at them. They get queued up instead, and the queue is emptied at the start of each step
+	int* restrict killQueue;
+	atomic_int killQueueLength;
+	char* restrict isQueuedForRemoval;
+	
+	// Removing a particle moves the last one into its place. Bonds get fixed straight away,
+	// but the nearest neighbours and neighbour lists are fixed by the interaction pass,
+	// which looks at all of them anyway. Particle number n from before the removal is now
+	// particle removalRemap[n] (-1 if it was removed), but only if removalStamp[n] is
+	// the current removalEpoch. Everything without a stamp stayed where it was
+	int* restrict removalRemap;
+	unsigned int* restrict removalStamp;
+	unsigned int removalEpoch;
+	
+	// which particle (by its number from before the removal) ended up in each slot,
+	// stamped the same way
+	int* restrict slotOrigin;
+	unsigned int* restrict slotOriginStamp;
+	
+	// set when the interaction pass has references to fix
+	char removalPending;
+	
+	spatialGrid grid;
+	
+	// the diameter of the biggest particle spawned so far, the grid cells have to fit it
+	double largestParticleSize;
+	
+	// a red particle that has touched an unbonded blue one (or the other way around)
+	// in the interaction pass. Bonding changes both particles, so the bonds are made
+	// afterwards, one at a time, in particle order
+	int* restrict bondCandidate;
+	
+	// how many pairs of particles are bonded together right now
+	int bondedPairs;
+	
+	collisionContact* restrict contacts;
+	collisionContact* restrict colouredContacts;
+	int contactCount;
+	
+	// how many contacts have been resolved in this step, sub-steps included
+	Uint64 stepCollisions;
+	
+	// one ring for each worker. The simulation thread is worker 0
+	eventRing* eventRings;
+	
+	// set once at the start, the collisions only look at it outside their loops
+	char isRecordingEvents;
+	
+	// where each colour starts in colouredContacts
+	int colourStart[MAX_CONTACT_COLOURS + 1];
+	
+	// the colours already used by contacts touching each particle, one bit per colour
+	Uint64* restrict usedColours;
+	
+	// how many threads do physics work, including the main thread
+	int workerCount;
+	
+	// how many of the worker threads have been started, so a simulation
+	// that couldn't start all of them can still stop the ones it did
+	int workersStarted;
+	
+	physicsThread** workerThreads;
+	workerStart* workerStarts;
+	workerDeque* workerDeques;
+	workerCounters* workerMetrics;
+	
+	// the interaction pass is split up by cells
+	workerTaskList cellTasks;
+	
+	// how many particles there were when the cell tasks were made
+	int cellTasksLength;
+	
+	// fixed size chunks of a plain range of numbers
+	workerTaskList rangeTasks;
+	
+	// the list the workers are taking tasks from right now
+	workerTaskList* currentTasks;
+	
+	workerKernel currentKernel;
+	
+	// the main thread posts workStart once for every worker when there is work to do,
+	// and each worker posts workDone when there is nothing left to steal
+	physicsSemaphore* workStart;
+	physicsSemaphore* workDone;
+	char workersQuit;
+	
+	// the direction of a new particle is looked up in these
+	double cosTable[DIRECTION_TABLE_SIZE + 1];
+	double sinTable[DIRECTION_TABLE_SIZE + 1];
+	
+	spawnRequest spawning;
+	
+	// the particles the boundary pass is checking. 0 means every particle in order,
+	// the sub-steps pass in just the fast ones
+	const int* restrict borderOrder;
+	
+	// the sort key and particle number of every particle.
+	// Each radix pass reads from one pair and writes to the other
+	Uint32* restrict mortonKeys;
+	int* restrict mortonOrder;
+	Uint32* restrict mortonKeysSorted;
+	int* restrict mortonOrderSorted;
+	
+	// reorderedTo[i] is the new number of particle i
+	int* restrict reorderedTo;
+	
+	// the particles are copied here in their new order, then the two arrays swap over
+	particle* restrict reorderBuffer;
+	
+	// set when the neighbour lists are from before the last removal
+	char remapNeighbourLists;
+	
+	// The reference check (ENABLE_REFERENCE_CHECK) checks the fast passes against the
+	// rules they are meant to follow. Every step the border and interaction passes run
+	// twice from the same particles: the normal way, then on a copy one particle at a time
+	// on this thread alone, sharing none of the normal pass's code. The interaction
+	// checks every particle against every other one, instead of the grid and the
+	// neighbour lists, and works out the contact colours by looking back at every
+	// earlier contact. The two are compared particle by particle, along with the total
+	// momentum and energy. Each pass carries on from the normal result, so each one is
+	// checked on its own, and a tiny difference can't snowball into a big one later.
+	// Not checked: the update (the charges, the force fields and the moving), the
+	// sub-steps, the slab coordinator and the compact particles
+	particle* restrict referenceParticles;
+	
+	// what the reference has to remember for each particle between its loops:
+	// the border events, then the bond candidates, then the contact colours
+	int* restrict referenceScratch;
+	
+	// the removals the normal pass had to remap, so the reference does too
+	char referenceRemovalPending;
+	
+	Uint64 referenceStepsChecked;
+	Uint64 referenceStepsDiverged;
+	char referenceHasDiverged;
+	
+	chargeMeshState chargeMesh;
+	
+	// the velocity change from the charges for each particle, per second
+	double* restrict chargeAccelerationX;
+	double* restrict chargeAccelerationY;
+	
+	Uint64* restrict blockHashes;
+	
+	sharedStateHeader* sharedState;
+	size_t sharedStateSize;
+	
+	// where each of the arrays is in the shared object
+	double* restrict sharedX;
+	double* restrict sharedY;
+	double* restrict sharedVelocityX;
+	double* restrict sharedVelocityY;
+	Uint64* restrict sharedHandles;
+	Uint8* restrict sharedTypes;
+	
+	// how many slabs there are, 0 if everything runs in this process
+	int slabCount;
+	
+	// set in the slab processes
+	char isSlabProcess;
+	
+	// set when particles were added, removed or changed here, so the slabs
+	// need to be given their particles again before the next step
+	char slabsNeedScatter;
+	
+	// how long each phase of the last step took, in performance counter ticks
+	Uint64 phaseTicks[numOfPhases];
+	
+	// the snapshot particlesimTakeSnapshot() is copying the particles into
+	particlesimSnapshot* snapshotting;
+	
+	// where the live queries put particle numbers, before they're turned into handles
+	int* queryResults;
+	int queryCapacity;
+	
+	// the metrics are only put together if something is going to read them
+	char isMeasuring;
+	
+	// the simulation thread builds its sample here, then copies it to latestMetrics
+	// whenever the metrics thread isn't in the middle of reading it
+	metricsSample simulationMetrics;
+	metricsSample latestMetrics;
+	physicsMutex* metricsLock;
+	
+	// the collision events counted by the log thread for each pair of types
+	// (the lower type first), also handed over under metricsLock
+	Uint64 latestEventCounts[numOfEventKinds][numOfParticleTypes][numOfParticleTypes];
+	double latestEventImpulses[numOfEventKinds][numOfParticleTypes][numOfParticleTypes];
+	
+	// where the steps per second are counted from
+	Uint64 rateStartTick;
+	Uint64 rateStartStep;
+	
+	physicsThread* metricsThreadHandle;
+	
+	// set when the simulation is destroyed, so the metrics thread writes its file one last time and stops
+	atomic_int isMetricsFinished;
+	
+	// the text the metrics thread sends and writes
+	char metricsText[8192];
+	
+	// where the log thread writes the events, if anywhere
+	FILE* collisionLog;
+	
+	// what the log thread has counted so far
+	Uint64 eventCounts[numOfEventKinds][numOfParticleTypes][numOfParticleTypes];
+	double eventImpulses[numOfEventKinds][numOfParticleTypes][numOfParticleTypes];
+	
+	// set once the simulation has stopped, so the log thread empties the rings one last time
+	atomic_int isEventLogFinished;
+	
+	physicsThread* eventLogThreadHandle;
+	
+	// the copy waiting to be written, or being written
+	checkpointHeader checkpointCopy;
+	particle* restrict checkpointParticles;
+	Uint32* restrict checkpointGenerations;
+	Uint32* restrict checkpointFreeHandles;
+	particleHandle* restrict checkpointRemovals;
+	int* restrict checkpointSlabRuns;
+	
+	// posted once a copy is ready, or to wake the thread up to finish
+	physicsSemaphore* checkpointReady;
+	
+	// 1 from when the copy is made until it has been written
+	atomic_int isCheckpointBusy;
+	atomic_int isCheckpointFinished;
+	
+	physicsThread* checkpointThreadHandle;
+	
+	char isCheckpointing;
+	char isCheckpointDue;
+	Uint64 nextCheckpointTick;
+	Uint64 checkpointPeriod;
+	
+	// only the checkpoint thread touches this once it has started
+	int nextCheckpointFile;
+	
+	double slabWidth;
+	double slabHaloWidth;
+	
+	// in a slab process, which slab it is and its socket to the coordinator
+	int slabNum;
+	int slabCoordinator;
+	
+	// the boundaries to the left (0) and right (1) of a slab
+	slabLink slabLinks[2];
+	
+	// in a slab process, the room gatherSlabClusters() works in. Each particle has a
+	// mark, and the queue goes through them. The absorbed particles are put aside
+	// while the ones leaving are taken out
+	unsigned char* slabClusterMarks;
+	int* slabClusterQueue;
+	int* slabAbsorbed;
+	int* slabNeighbours;
+	int slabNeighbourCapacity;
+	
+	// on the coordinator, its socket to each slab and the slab's process id
+	int* slabSockets;
+	int* slabProcesses;
+	
+	// on the coordinator, SLAB_SCATTER_CHUNK particles for each slab waiting to be
+	// sent to it, and how many of them there are
+	particle* restrict slabBuffer;
+	int* slabCounts;
+	
+	// how many particles there were after the last scatter or gather
+	int gatheredLength;
+	
+	// set once the slabs have taken a step, until their particles are gathered
+	char slabsHaveStepped;
+	
+	// how many particles each slab gave back at the last gather. While the particles
+	// here are still the slabs' own, one slab after the other (slabsInOrder), a scatter
+	// gives each slab back the ones it had, in the same order, rather than sorting them
+	// by where they are. That's what lets a restart carry on just like the run it's from
+	int* slabLengths;
+	char slabsInOrder;
+	
+};
+
+static _Thread_local particlesim* sim;
+
+// C doesn't have standard integer min() and max()???? WTF?????
+// this is the closest thing we have to lambda functions in C
+static inline int max(int a, int b){ return ((a > b) ? a : b); }
+static inline int min(int a, int b){ return ((a < b) ? a : b); }
+
+// fmin() and fmax() have to care about NaNs, so they end up as a function call
+// in the middle of the hot loops. These don't
+static inline double maxDouble(double a, double b){ return ((a > b) ? a : b); }
+static inline double minDouble(double a, double b){ return ((a < b) ? a : b); }
+
+// generate a pseudo random number between 0 and 2^32
+// Uses the xorshift32 algorithm, and is thread safe
+static inline unsigned int randu(unsigned int* seed){
+	
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	
+	return *seed;
+	
+}
+
+// get the random number, cast to double & divide by the maximum
+// possible number for an unsigned int so it will return 
+// a nunber between 0 and 1
+// Thread safe as well
+static inline double randf(unsigned int* seed){
+	
+	return (double)(randu(seed)) / (double)(0xFFFFFFFFu);
+	
+}
+
+// take a task from the back of our own deque
+static inline char popWorkerTask(int workerNum, workerTask* task){
+	
+	char found = 0;
+	workerDeque* deque = &sim->workerDeques[workerNum];
+	
+	spinLock(&deque->lock);
+	
+	if(deque->tail > deque->head){
+		
+		deque->tail--;
+		*task = sim->currentTasks->tasks[deque->tail];
+		found = 1;
+		
+	}
+	
+	spinUnlock(&deque->lock);
+	
+	return found;
+	
+}
+
+// take a task from the front of somebody else's deque
+static inline char stealWorkerTask(int victim, workerTask* task){
+	
+	char found = 0;
+	workerDeque* deque = &sim->workerDeques[victim];
+	
+	spinLock(&deque->lock);
+	
+	if(deque->tail > deque->head){
+		
+		*task = sim->currentTasks->tasks[deque->head];
+		deque->head++;
+		found = 1;
+		
+	}
+	
+	spinUnlock(&deque->lock);
+	
+	return found;
+	
+}
+
+// run tasks until every deque is empty. No new tasks get added while the
+// workers run, so once nobody has anything left we are done
+static inline void runWorker(int workerNum){
+	
+	workerTask task;
+	
+	while(1){
+		
+		if(popWorkerTask(workerNum, &task)){
+			
+			sim->currentKernel(task.start, task.end, workerNum);
+			sim->workerMetrics[workerNum].tasksRun++;
+			continue;
+			
+		}
+		
+		char stolen = 0;
+		
+		// start with the thread after us, so the thieves spread out
+		for(int offset = 1; offset < sim->workerCount; offset++){
+			
+			if(stealWorkerTask((workerNum + offset) % sim->workerCount, &task)){
+				
+				stolen = 1;
+				break;
+				
+			}
+			
+		}
+		
+		if(!stolen){ break; }
+		
+		sim->currentKernel(task.start, task.end, workerNum);
+		sim->workerMetrics[workerNum].tasksRun++;
+		sim->workerMetrics[workerNum].tasksStolen++;
+		
+	}
+	
+	return;
+	
+}
+
+static int workerThread(void* data){
+	
+	const workerStart* start = data;
+	int workerNum = start->workerNum;
+	
+	sim = start->simulation;
+	
+	postSemaphore(sim->workDone);
+	
+	while(1){
+		
+		waitSemaphore(sim->workStart);
+		
+		if(sim->workersQuit){ break; }
+		
+		runWorker(workerNum);
+		
+		postSemaphore(sim->workDone);
+		
+	}
+	
+	return 0;
+	
+}
+
+// run the kernel over every task in the list and wait for it to finish.
+// The main thread works too, as worker 0
+static inline void runWorkerTasks(workerTaskList* list, workerKernel kernel){
+	
+	if(list->count == 0){ return; }
+	
+	// not worth waking anyone up for a single task
+	if(list->count == 1){
+		
+		kernel(list->tasks[0].start, list->tasks[0].end, 0);
+		
+		return;
+		
+	}
+	
+	sim->currentKernel = kernel;
+	sim->currentTasks = list;
+	
+	// hand out the tasks in blocks, so each thread starts on
+	// its own part of the window and only steals when it runs dry
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		sim->workerDeques[workerNum].head = (list->count * workerNum) / sim->workerCount;
+		sim->workerDeques[workerNum].tail = (list->count * (workerNum + 1)) / sim->workerCount;
+		
+	}
+	
+	for(int workerNum = 1; workerNum < sim->workerCount; workerNum++){
+		
+		postSemaphore(sim->workStart);
+		
+	}
+	
+	runWorker(0);
+	
+	for(int workerNum = 1; workerNum < sim->workerCount; workerNum++){
+		
+		waitSemaphore(sim->workDone);
+		
+	}
+	
+	return;
+	
+}
+
+// make room for at least count tasks. 0 if there wasn't the memory,
+// in which case the list is left as it was
+static inline char reserveWorkerTasks(workerTaskList* list, int count){
+	
+	if(count <= list->capacity){
+		
+		return 1;
+		
+	}
+	
+	// doubling keeps adding one at a time cheap
+	int capacity = max(max(count, list->capacity << 1), 256);
+	workerTask* tasks = realloc(list->tasks, (size_t)capacity * sizeof(workerTask));
+	
+	if(tasks == 0){
+		
+		return 0;
+		
+	}
+	
+	list->tasks = tasks;
+	list->capacity = capacity;
+	
+	return 1;
+	
+}
+
+static inline void addWorkerTask(workerTaskList* list, int start, int end){
+	
+	if(!reserveWorkerTasks(list, list->count + 1)){ exit(0); }
+	
+	list->tasks[list->count].start = start;
+	list->tasks[list->count].end = end;
+	list->count++;
+	
+	return;
+	
+}
+
+// split start to end into chunks of a fixed size and run them on the workers.
+// The chunks never depend on the number of threads, so anything worked out
+// per chunk comes out the same however many there are
+static inline void runParallelFor(int start, int end, int chunk, workerKernel kernel){
+	
+	sim->rangeTasks.count = 0;
+	
+	for(int from = start; from < end; from += chunk){
+		
+		addWorkerTask(&sim->rangeTasks, from, min(from + chunk, end));
+		
+	}
+	
+	runWorkerTasks(&sim->rangeTasks, kernel);
+	
+	return;
+	
+}
+
+// split the grid into tasks of roughly the same cost. Every particle has to be
+// checked against everything around it, so a cell costs about the square of how
+// many particles are in it. Cells are joined together until a task is big enough,
+// and a cell that is too expensive on its own (particles piled up in a corner,
+// a big red/blue cluster...) gets split into a few tasks of its own
+static inline void buildCellTasks(){
+	
+	int cellCount = sim->grid.cellCount;
+	double totalCost = 0.0;
+	
+	for(int cell = 0; cell < cellCount; cell++){
+		
+		double population = (double)(sim->grid.cellStart[cell + 1] - sim->grid.cellStart[cell]);
+		
+		totalCost += population * population;
+		
+	}
+	
+	// around 8 tasks for each thread gives the thieves something to take
+	double targetCost = totalCost / (double)(sim->workerCount << 3);
+	
+	if(targetCost < 1.0){ targetCost = 1.0; }
+	
+	sim->cellTasks.count = 0;
+	sim->cellTasksLength = sim->length;
+	
+	int taskStart = 0;
+	double taskCost = 0.0;
+	
+	for(int cell = 0; cell < cellCount; cell++){
+		
+		int cellStart = sim->grid.cellStart[cell];
+		int cellEnd = sim->grid.cellStart[cell + 1];
+		double population = (double)(cellEnd - cellStart);
+		double cellCost = population * population;
+		
+		if(cellCost > targetCost){
+			
+			// finish off the task we were building
+			if(taskStart < cellStart){
+				
+				addWorkerTask(&sim->cellTasks, taskStart, cellStart);
+				
+			}
+			
+			// then split the cell so that each piece costs about the target
+			int pieces = (int)ceil(cellCost / targetCost);
+			
+			for(int piece = 0; piece < pieces; piece++){
+				
+				int start = cellStart + (int)(((double)piece * population) / (double)pieces);
+				int end = cellStart + (int)(((double)(piece + 1) * population) / (double)pieces);
+				
+				if(start < end){
+					
+					addWorkerTask(&sim->cellTasks, start, end);
+					
+				}
+				
+			}
+			
+			taskStart = cellEnd;
+			taskCost = 0.0;
+			
+			continue;
+			
+		}
+		
+		taskCost += cellCost;
+		
+		if(taskCost >= targetCost){
+			
+			addWorkerTask(&sim->cellTasks, taskStart, cellEnd);
+			
+			taskStart = cellEnd;
+			taskCost = 0.0;
+			
+		}
+		
+	}
+	
+	if(taskStart < sim->length){
+		
+		addWorkerTask(&sim->cellTasks, taskStart, sim->length);
+		
+	}
+	
+	return;
+	
+}
+
+// how many random numbers we make at once, each one from its own xorshift state.
+// The loop over the lanes doesn't depend on itself, so the compiler turns it into SIMD
+#define RANDOM_LANES 8
+
+typedef struct randomLanes {
+	
+	unsigned int state[RANDOM_LANES];
+	
+} randomLanes;
+
+// give every lane its own starting state. The stream number lets each chunk of a
+// spawn have its own numbers, so the particles come out the same however the
+// chunks are spread over the threads
+static inline void seedRandomLanes(randomLanes* restrict lanes, unsigned int seed, unsigned int stream){
+	
+	for(unsigned int lane = 0; lane < RANDOM_LANES; lane++){
+		
+		// scramble the seed so neighbouring streams don't look alike
+		unsigned int z = seed + (((stream * RANDOM_LANES) + lane + 1u) * 0x9E3779B9u);
+		z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+		z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+		z ^= z >> 16;
+		
+		// xorshift gets stuck on 0 forever
+		lanes->state[lane] = z ? z : 1u;
+		
+	}
+	
+	return;
+	
+}
+
+// RANDOM_LANES numbers between 0 and 1 (never 1 itself) at once
+static inline void nextRandomLanes(randomLanes* restrict lanes, double* restrict out){
+	
+	for(int lane = 0; lane < RANDOM_LANES; lane++){
+		
+		unsigned int seed = lanes->state[lane];
+		
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		
+		lanes->state[lane] = seed;
+		out[lane] = (double)seed * (1.0 / 4294967296.0);
+		
+	}
+	
+	return;
+	
+}
+
+static inline void buildDirectionTable(){
+	
+	for(int i = 0; i <= DIRECTION_TABLE_SIZE; i++){
+		
+		double angle = (2.0 * M_PI * (double)i) / (double)DIRECTION_TABLE_SIZE;
+		
+		sim->cosTable[i] = cos(angle);
+		sim->sinTable[i] = sin(angle);
+		
+	}
+	
+	return;
+	
+}
+
+// look up the direction in degrees, blending between the two closest entries
+static inline void directionLookup(double degrees, double* restrict cosine, double* restrict sine){
+	
+	double position = degrees * ((double)DIRECTION_TABLE_SIZE / 360.0);
+	
+	// wrap it around so that it's between 0 and the table size
+	position -= floor(position / (double)DIRECTION_TABLE_SIZE) * (double)DIRECTION_TABLE_SIZE;
+	
+	int index = min((int)position, DIRECTION_TABLE_SIZE - 1);
+	double blend = position - (double)index;
+	
+	*cosine = sim->cosTable[index] + (blend * (sim->cosTable[index + 1] - sim->cosTable[index]));
+	*sine = sim->sinTable[index] + (blend * (sim->sinTable[index + 1] - sim->sinTable[index]));
+	
+	return;
+	
+}
+
+static int compareSlotsDescending(const void* a, const void* b){
+	
+	Uint32 slotA = *(const Uint32*)a;
+	Uint32 slotB = *(const Uint32*)b;
+	
+	return (slotA < slotB) - (slotA > slotB);
+	
+}
+
+// give particle particleNum a handle, reusing a released slot if there is one.
+// The handles decide the order the particles bump into each other in, so the
+// smallest slot is always used first. Then it doesn't matter what order the
+// slots were released in, which isn't the same with slabs as without
+static inline particleHandle allocateParticleHandle(int particleNum){
+	
+	Uint32 slot;
+	
+	if((sim->freeHandleCount > 0) && !sim->freeHandlesSorted){
+		
+		qsort(sim->freeHandles, (size_t)sim->freeHandleCount, sizeof(Uint32), compareSlotsDescending);
+		
+		sim->freeHandlesSorted = 1;
+		
+	}
+	
+	if(sim->freeHandleCount > 0){
+		
+		sim->freeHandleCount--;
+		slot = sim->freeHandles[sim->freeHandleCount];
+		
+	}
+	
+	else{
+		
+		slot = (Uint32)sim->handleSlotsUsed;
+		sim->handleSlotsUsed++;
+		
+		// a slot that was used before a reset has to move on to a new generation
+		sim->handleGeneration[slot]++;
+		
+		if(sim->handleGeneration[slot] == 0){
+			
+			sim->handleGeneration[slot] = 1;
+			
+		}
+		
+	}
+	
+	sim->handleIndex[slot] = particleNum;
+	
+	return ((particleHandle)sim->handleGeneration[slot] << 32) | (particleHandle)slot;
+	
+}
+
+// the particle is gone, so every handle to it stops working
+static inline void releaseParticleHandle(particleHandle handle){
+	
+	Uint32 slot = (Uint32)handle;
+	
+	sim->handleGeneration[slot]++;
+	
+	if(sim->handleGeneration[slot] == 0){
+		
+		sim->handleGeneration[slot] = 1;
+		
+	}
+	
+	sim->freeHandles[sim->freeHandleCount] = slot;
+	sim->freeHandleCount++;
+	sim->freeHandlesSorted = 0;
+	
+	return;
+	
+}
+
+// forget every handle at once, for when all the particles are removed
+static inline void releaseAllParticleHandles(){
+	
+	for(int slot = 0; slot < sim->handleSlotsUsed; slot++){
+		
+		sim->handleGeneration[slot]++;
+		
+	}
+	
+	sim->handleSlotsUsed = 0;
+	sim->freeHandleCount = 0;
+	
+	return;
+	
+}
+
+// the particle's number, or -1 if it has been removed
+static inline int resolveParticleHandle(particleHandle handle){
+	
+	Uint32 slot = (Uint32)handle;
+	
+	if((handle == NULL_PARTICLE_HANDLE) || (slot >= (Uint32)sim->handleSlotsUsed) || (sim->handleGeneration[slot] != (Uint32)(handle >> 32))){
+		
+		return -1;
+		
+	}
+	
+	return sim->handleIndex[slot];
+	
+}
+
+// tell the handle table where particle particleNum is now
+static inline void moveParticleHandle(int particleNum){
+	
+	sim->handleIndex[(Uint32)sim->particles[particleNum].handle] = particleNum;
+	
+	return;
+	
+}
+
+// take on the handle a particle already has, that another process gave out.
+// The slab processes never give out handles of their own, they only keep the
+// ones the coordinator gave out, so a particle keeps its handle wherever it goes
+static inline void adoptParticleHandle(int particleNum){
+	
+	Uint32 slot = (Uint32)sim->particles[particleNum].handle;
+	
+	sim->handleGeneration[slot] = (Uint32)(sim->particles[particleNum].handle >> 32);
+	sim->handleIndex[slot] = particleNum;
+	sim->handleSlotsUsed = max(sim->handleSlotsUsed, (int)slot + 1);
+	
+	return;
+	
+}
+
+// Packing a compact particle rounds its values to what the arrays can hold.
+// Always rounding to the nearest would lose anything smaller than half a step,
+// like a slow particle's friction, so they round up or down by chance instead,
+// in proportion to how close they are. That's right on average, and the
+// chances come from the particle's number and the step, so it's still deterministic.
+// A bonded pair share the lower number's chances, so the velocity they share
+// packs the same for both and they don't drift apart
+static inline Uint64 compactRounding(int particleNum){
+	
+	int partner = sim->compact.bondingWith[particleNum];
+	int key = ((partner > -1) && (partner < particleNum)) ? partner : particleNum;
+	
+	Uint64 z = (((Uint64)sim->simulationStep << 32) | (Uint64)(Uint32)key) + 0x9E3779B97F4A7C15ull;
+	
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	
+	return z ^ (z >> 31);
+	
+}
+
+// a position in fixed point. rounding is a random 16 bits, and a position
+// that won't fit stops at the biggest (or smallest) one that does
+static inline Sint32 packPosition(double position, Uint32 rounding){
+	
+	double scaled = position * sim->compactScale;
+	double whole = floor(scaled);
+	
+	whole += (double)(((scaled - whole) * 65536.0) > (double)rounding);
+	
+	return (Sint32)minDouble(maxDouble(whole, -2147483647.0), 2147483647.0);
+	
+}
+
+static inline double unpackPosition(Sint32 position){ return (double)position * sim->compactUnit; }
+
+// a velocity as a half precision float: a sign bit, 5 bits of exponent and 10 of
+// mantissa. It's made from the float's bits, dropping the 13 bits of mantissa a
+// half hasn't got room for (more if it's too small for the exponent), and rounding
+// up if they're bigger than the random 16 bits in rounding.
+// Anything too big for a half is the biggest one there is
+static inline Uint16 packHalf(double value, Uint32 rounding){
+	
+	float single = (float)value;
+	Uint32 bits;
+	
+	memcpy(&bits, &single, sizeof(float));
+	
+	Uint32 sign = (bits >> 16) & 0x8000u;
+	Uint32 magnitude = bits & 0x7FFFFFFFu;
+	
+	// 65504, the biggest half
+	if(magnitude > 0x477FE000u){
+		
+		return (Uint16)(sign | 0x7BFFu);
+		
+	}
+	
+	// smaller than 2^-14 is a subnormal half, which is a count of 2^-24s
+	if(magnitude < 0x38800000u){
+		
+		int shift = 126 - (int)(magnitude >> 23);
+		
+		if(shift > 24){
+			
+			return (Uint16)sign;
+			
+		}
+		
+		Uint32 mantissa = (magnitude & 0x7FFFFFu) | 0x800000u;
+		Uint32 dropped = mantissa & ((1u << shift) - 1u);
+		
+		return (Uint16)(sign | ((mantissa >> shift) + (Uint32)((dropped << (32 - shift)) > (rounding << 16))));
+		
+	}
+	
+	// move the exponent from the float's bias of 127 to the half's 15.
+	// Rounding up a mantissa of all ones carries into the exponent, which is still right
+	Uint32 rebiased = magnitude - 0x38000000u;
+	
+	return (Uint16)(sign | ((rebiased >> 13) + (Uint32)(((rebiased & 0x1FFFu) << 19) > (rounding << 16))));
+	
+}
+
+static inline double unpackHalf(Uint16 half){
+	
+	Uint32 magnitude = half & 0x7FFFu;
+	double value;
+	
+	if(magnitude < 0x0400u){
+		
+		value = (double)magnitude * (1.0 / 16777216.0);
+		
+	}
+	
+	else{
+		
+		Uint32 bits = (magnitude << 13) + 0x38000000u;
+		float single;
+		
+		memcpy(&single, &bits, sizeof(float));
+		
+		value = (double)single;
+		
+	}
+	
+	return (half & 0x8000u) ? -value : value;
+	
+}
+
+// a compact particle's mass, the same as particle.mass would be
+static inline double compactMass(int particleNum){
+	
+	double mass = particleTemplates[sim->compact.type[particleNum]].mass;
+	
+	if(sim->compact.bondingWith[particleNum] > -1){
+		
+		mass += particleTemplates[sim->compact.type[sim->compact.bondingWith[particleNum]]].mass;
+		
+	}
+	
+	return mass;
+	
+}
+
+// the particle's full handle, from the slot it keeps
+static inline particleHandle compactHandle(int particleNum){
+	
+	Uint32 slot = sim->compact.handleSlot[particleNum];
+	
+	return ((particleHandle)sim->handleGeneration[slot] << 32) | (particleHandle)slot;
+	
+}
+
+// unpack a compact particle into a whole one
+static inline void unpackCompactParticle(int particleNum, particle* restrict to){
+	
+	to->x = unpackPosition(sim->compact.x[particleNum]);
+	to->y = unpackPosition(sim->compact.y[particleNum]);
+	to->velocityX = unpackHalf(sim->compact.velocityX[particleNum]);
+	to->velocityY = unpackHalf(sim->compact.velocityY[particleNum]);
+	to->type = sim->compact.type[particleNum];
+	to->mass = compactMass(particleNum);
+	to->handle = compactHandle(particleNum);
+	to->bondingWith = sim->compact.bondingWith[particleNum];
+	to->bondedTo = (to->bondingWith > -1) ? compactHandle(to->bondingWith) : NULL_PARTICLE_HANDLE;
+	to->nearestNeighbour = sim->compact.nearestNeighbour[particleNum];
+	to->nearestNeighbourDistance = (double)sim->compact.nearestNeighbourDistance[particleNum];
+	to->collidingAwayFrom = sim->compact.collidingAwayFrom[particleNum];
+	
+	return;
+	
+}
+
+// pack where a particle is and how fast it's going
+static inline void packCompactMotion(int particleNum, double x, double y, double velocityX, double velocityY){
+	
+	Uint64 rounding = compactRounding(particleNum);
+	
+	sim->compact.x[particleNum] = packPosition(x, (Uint32)(rounding & 0xFFFFu));
+	sim->compact.y[particleNum] = packPosition(y, (Uint32)((rounding >> 16) & 0xFFFFu));
+	sim->compact.velocityX[particleNum] = packHalf(velocityX, (Uint32)((rounding >> 32) & 0xFFFFu));
+	sim->compact.velocityY[particleNum] = packHalf(velocityY, (Uint32)(rounding >> 48));
+	
+	return;
+	
+}
+
+// pack just the velocity, after a bond or a collision. It rounds with the bits
+// packCompactMotion used for the position, so it doesn't round the same way twice
+static inline void packCompactVelocity(int particleNum, double velocityX, double velocityY){
+	
+	Uint64 rounding = compactRounding(particleNum);
+	
+	sim->compact.velocityX[particleNum] = packHalf(velocityX, (Uint32)(rounding & 0xFFFFu));
+	sim->compact.velocityY[particleNum] = packHalf(velocityY, (Uint32)((rounding >> 16) & 0xFFFFu));
+	
+	return;
+	
+}
+
+// The passes that are shared with compact particles get at a particle with
+// loadParticle(), which is the particle itself, or a whole copy of a compact one
+// in unpacked. After changing it they store what they changed, which packs it
+// up again, and does nothing for a particle that isn't compact
+static inline particle* loadParticle(int particleNum, particle* restrict unpacked){
+	
+	if(!sim->isCompact){
+		
+		return &sim->particles[particleNum];
+		
+	}
+	
+	unpackCompactParticle(particleNum, unpacked);
+	
+	return unpacked;
+	
+}
+
+static inline void storeVelocity(int particleNum, const particle* restrict from){
+	
+	if(sim->isCompact){
+		
+		packCompactVelocity(particleNum, from->velocityX, from->velocityY);
+		
+	}
+	
+	return;
+	
+}
+
+// the bond and who it's touching. The mass and the partner's handle
+// of a compact particle come from the bond, so they don't need storing
+static inline void storeLinks(int particleNum, const particle* restrict from){
+	
+	if(sim->isCompact){
+		
+		sim->compact.bondingWith[particleNum] = from->bondingWith;
+		sim->compact.nearestNeighbour[particleNum] = from->nearestNeighbour;
+		sim->compact.nearestNeighbourDistance[particleNum] = (float)from->nearestNeighbourDistance;
+		sim->compact.collidingAwayFrom[particleNum] = from->collidingAwayFrom;
+		
+	}
+	
+	return;
+	
+}
+
+// who a particle is bonded to, whole or compact
+static inline int bondOf(int particleNum){
+	
+	return sim->isCompact ? sim->compact.bondingWith[particleNum] : sim->particles[particleNum].bondingWith;
+	
+}
+
+// where a particle is and what it is, without unpacking the rest of it
+static inline double xOf(int particleNum){
+	
+	return sim->isCompact ? unpackPosition(sim->compact.x[particleNum]) : sim->particles[particleNum].x;
+	
+}
+
+static inline double yOf(int particleNum){
+	
+	return sim->isCompact ? unpackPosition(sim->compact.y[particleNum]) : sim->particles[particleNum].y;
+	
+}
+
+static inline int typeOf(int particleNum){
+	
+	return sim->isCompact ? (int)sim->compact.type[particleNum] : (int)sim->particles[particleNum].type;
+	
+}
+
+static inline particleHandle particleHandleOf(int particleNum){
+	
+	return sim->isCompact ? compactHandle(particleNum) : sim->particles[particleNum].handle;
+	
+}
+
+// the slot of a particle's handle. Whenever two particles could go either way,
+// the one with the smaller slot goes first, so the particles come out the same
+// whatever order they're in, and with slabs the same as without
+static inline Uint32 handleSlotOf(int particleNum){
+	
+	return (Uint32)particleHandleOf(particleNum);
+	
+}
+
+// the particle with the handle in slot, or -1 if there isn't one here
+static inline int particleAtSlot(int slot){
+	
+	int particleNum = sim->handleIndex[slot];
+	
+	return ((particleNum > -1) && (particleNum < sim->length) && (handleSlotOf(particleNum) == (Uint32)slot)) ? particleNum : -1;
+	
+}
+
+// how much memory each particle takes, for anything that reports it
+static inline size_t particleBytes(){
+	
+	return sim->isCompact ? COMPACT_PARTICLE_BYTES : sizeof(particle);
+	
+}
+
+// how many particles each spawn task fills in
+#define SPAWN_CHUNK 4096
+
+static void spawnKernel(int start, int end, int workerNum){
+	
+	randomLanes lanes;
+	double posX[RANDOM_LANES], posY[RANDOM_LANES], types[RANDOM_LANES], directions[RANDOM_LANES], speeds[RANDOM_LANES];
+	
+	seedRandomLanes(&lanes, sim->spawning.seed, (unsigned int)(start / SPAWN_CHUNK));
+	
+	for(int group = start; group < end; group += RANDOM_LANES){
+		
+		nextRandomLanes(&lanes, posX);
+		nextRandomLanes(&lanes, posY);
+		nextRandomLanes(&lanes, types);
+		nextRandomLanes(&lanes, directions);
+		nextRandomLanes(&lanes, speeds);
+		
+		for(int lane = 0; lane < min(RANDOM_LANES, end - group); lane++){
+			
+			// compact particles are made in the worker's block, then packed
+			particle* restrict newParticle = sim->isCompact ? &sim->compactBlocks[(workerNum * SPAWN_CHUNK) + (group - start) + lane] : &sim->particles[sim->spawning.first + group + lane];
+			
+			if(sim->spawning.x < 0 || sim->spawning.y < 0){
+				
+				newParticle->x = posX[lane] * (double)sim->options->WORLD_WIDTH;
+				newParticle->y = posY[lane] * (double)sim->options->WORLD_HEIGHT;
+				
+			}
+			
+			else{
+				
+				newParticle->x = (double)sim->spawning.x;
+				newParticle->y = (double)sim->spawning.y;
+				
+			}
+			
+			// select a random particle type, or the one the user picked
+			newParticle->type = (sim->spawning.type == -1) ? (particleType)(types[lane] * (double)numOfParticleTypes) : (particleType)sim->spawning.type;
+			
+			// the mass comes from the type, and so do the size and colour,
+			// which never change so they are looked up instead of stored
+			newParticle->mass = particleTemplates[newParticle->type].mass;
+			
+			// select a random direction and speed
+			double direction = ((directions[lane] * (sim->options->MAX_DIRECTION)) - (0.5 * sim->options->MAX_DIRECTION)) - 90.0;
+			double speed = (speeds[lane] * (sim->options->MAX_PARTICLE_SPEED - sim->options->MIN_PARTICLE_SPEED)) + sim->options->MIN_PARTICLE_SPEED;
+			
+			//calculate the velocity from direction and speed
+			double cosine, sine;
+			
+			directionLookup(direction, &cosine, &sine);
+			
+			newParticle->velocityX = cosine * speed;
+			newParticle->velocityY = sine * speed;
+			
+			newParticle->nearestNeighbour = -1;
+			newParticle->nearestNeighbourDistance = 0.0;
+			
+			newParticle->collidingAwayFrom = -1;
+			
+			newParticle->bondingWith = -1;
+			newParticle->bondedTo = NULL_PARTICLE_HANDLE;
+			
+		}
+		
+	}
+	
+	if(sim->isCompact){
+		
+		for(int n = start; n < end; n++){
+			
+			const particle* restrict made = &sim->compactBlocks[(workerNum * SPAWN_CHUNK) + (n - start)];
+			int i = sim->spawning.first + n;
+			
+			// the rounding looks at the bond, so that goes first
+			storeLinks(i, made);
+			packCompactMotion(i, made->x, made->y, made->velocityX, made->velocityY);
+			sim->compact.type[i] = made->type;
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// add particleCount particles at x, y position. If either is negative,
+// then the particles will be spread over the window.
+// Big spawns are split into chunks for the workers
+static inline void spawnParticles(int particleCount, int x, int y){
+	
+	if(particleCount <= 0){
+		
+		return;
+		
+	}
+	
+	// we need to check if the allocated memory is enough to hold
+	// the amount of particles, if it's too much particles will stop generating 
+	if((sim->length + particleCount) > sim->particleCapacity){
+		
+		return;
+		
+	}
+	
+	sim->spawning.first = sim->length;
+	sim->spawning.x = x;
+	sim->spawning.y = y;
+	sim->spawning.type = sim->spawnType;
+	sim->spawning.seed = randu(&sim->randState);
+	
+	runParallelFor(0, particleCount, SPAWN_CHUNK, spawnKernel);
+	
+	// the handles come from a stack, so they are handed out here in order
+	for(int i = sim->length; i < (sim->length + particleCount); i++){
+		
+		if(sim->isCompact){
+			
+			sim->compact.handleSlot[i] = (Uint32)allocateParticleHandle(i);
+			
+		}
+		
+		else{
+			
+			sim->particles[i].handle = allocateParticleHandle(i);
+			
+		}
+		
+	}
+	
+	// make sure the grid cells are big enough for the new particles
+	for(int type = 0; type < numOfParticleTypes; type++){
+		
+		if((sim->spawnType == -1) || (sim->spawnType == type)){
+			
+			if(sim->particleSizes[type] > sim->largestParticleSize){
+				
+				sim->largestParticleSize = sim->particleSizes[type];
+				
+			}
+			
+		}
+		
+	}
+	
+	sim->length += particleCount; // add to total amount
+	
+	sim->grid.isStale = 1;
+	sim->neighbourBuiltLength = -1;
+	
+	return;
+	
+}
+
+// generate a random number of random particles at x, y
+// position. if either is negative, then the particles
+// will be spread over the window. If once is set, only one is added
+static inline void generateRandomParticles(int x, int y, char once){
+	
+	// generate a random number of particles to add
+	int particleCount = (int)(randf(&sim->randState) * (double)sim->options->MAX_PARTICLE_COUNT);
+	
+	if(once){
+		
+		particleCount = 1;
+		
+	}
+	
+	spawnParticles(particleCount, x, y);
+	
+	return;
+	
+}
+
+// which column or row of the grid a position falls in
+static inline int gridColumnOf(double x){ return min(max((int)floor(x / sim->grid.cellWidth), 0), sim->grid.columns - 1); }
+static inline int gridRowOf(double y){ return min(max((int)floor(y / sim->grid.cellHeight), 0), sim->grid.rows - 1); }
+
+// the shortest way from one particle to another along one axis. When the border
+// wraps round, the other particle might be closer going across the edge.
+// Positions are always inside the world then, so one period is enough
+static inline double minimumImage(double difference, double period){
+	
+	if(sim->options->ENABLE_BORDER_WRAP){
+		
+		difference -= period * (double)(difference > (0.5 * period));
+		difference += period * (double)(difference < (-0.5 * period));
+		
+	}
+	
+	return difference;
+	
+}
+
+// a cell's key, which sorts the same way as row major order
+static inline Uint64 gridKey(int row, int column){ return ((Uint64)(Uint32)row << 32) | (Uint64)(Uint32)column; }
+
+// where a key is in the hash table, or the empty place it would go
+static inline int gridTablePosition(Uint64 key){
+	
+	Uint32 mask = (Uint32)sim->grid.tableCapacity - 1u;
+	Uint32 position = (Uint32)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+	
+	while((sim->grid.tableKeys[position] != key) && (sim->grid.tableKeys[position] != GRID_EMPTY_KEY)){
+		
+		position = (position + 1u) & mask;
+		
+	}
+	
+	return (int)position;
+	
+}
+
+// the number of the cell at a row and column, or -1 if it's empty or off the grid
+static inline int gridCellAt(int row, int column){
+	
+	if((row < 0) || (row >= sim->grid.rows) || (column < 0) || (column >= sim->grid.columns)){
+		
+		return -1;
+		
+	}
+	
+	Uint64 key = gridKey(row, column);
+	int position = gridTablePosition(key);
+	
+	return (sim->grid.tableKeys[position] == key) ? sim->grid.tableCells[position] : -1;
+	
+}
+
+static int compareGridKeys(const void* a, const void* b){
+	
+	Uint64 keyA = *(const Uint64*)a;
+	Uint64 keyB = *(const Uint64*)b;
+	
+	return (keyA > keyB) - (keyA < keyB);
+	
+}
+
+// make room for a cell for every particle, and a hash table twice that size
+static inline void reserveSpatialGrid(){
+	
+	if((sim->length + 1) > sim->grid.cellCapacity){
+		
+		sim->grid.cellCapacity = max(sim->length + 1, sim->grid.cellCapacity << 1);
+		sim->grid.cellStart = realloc(sim->grid.cellStart, (size_t)sim->grid.cellCapacity * sizeof(int));
+		sim->grid.cellRow = realloc(sim->grid.cellRow, (size_t)sim->grid.cellCapacity * sizeof(int));
+		sim->grid.cellColumn = realloc(sim->grid.cellColumn, (size_t)sim->grid.cellCapacity * sizeof(int));
+		sim->grid.cellKeys = realloc(sim->grid.cellKeys, (size_t)sim->grid.cellCapacity * sizeof(Uint64));
+		sim->grid.cellRank = realloc(sim->grid.cellRank, (size_t)sim->grid.cellCapacity * sizeof(int));
+		
+		if(sim->grid.cellStart == 0 || sim->grid.cellRow == 0 || sim->grid.cellColumn == 0 || sim->grid.cellKeys == 0 || sim->grid.cellRank == 0){ exit(0); }
+		
+	}
+	
+	if(sim->grid.tableCapacity < (sim->length << 1) || sim->grid.tableCapacity == 0){
+		
+		sim->grid.tableCapacity = max(sim->grid.tableCapacity, 64);
+		
+		while(sim->grid.tableCapacity < (sim->length << 1)){
+			
+			sim->grid.tableCapacity <<= 1;
+			
+		}
+		
+		sim->grid.tableKeys = realloc(sim->grid.tableKeys, (size_t)sim->grid.tableCapacity * sizeof(Uint64));
+		sim->grid.tableCells = realloc(sim->grid.tableCells, (size_t)sim->grid.tableCapacity * sizeof(int));
+		
+		if(sim->grid.tableKeys == 0 || sim->grid.tableCells == 0){ exit(0); }
+		
+	}
+	
+	return;
+	
+}
+
+// sort every particle into its cell with a counting sort,
+// which keeps the particles of each cell in ascending order
+static inline void buildSpatialGrid(){
+	
+	// the compact step has no neighbour lists, so it doesn't need the skin
+	double cellSize = sim->largestParticleSize + 1.0 + (sim->isCompact ? 0.0 : sim->options->NEIGHBOUR_SKIN);
+	
+	if(sim->options->ENABLE_BORDER_WRAP){
+		
+		// round down, so the cells across the edge are still big enough
+		sim->grid.columns = max(1, (int)floor((double)sim->options->WORLD_WIDTH / cellSize));
+		sim->grid.rows = max(1, (int)floor((double)sim->options->WORLD_HEIGHT / cellSize));
+		sim->grid.cellWidth = (double)sim->options->WORLD_WIDTH / (double)sim->grid.columns;
+		sim->grid.cellHeight = (double)sim->options->WORLD_HEIGHT / (double)sim->grid.rows;
+		
+	}
+	
+	else{
+		
+		sim->grid.columns = max(1, (int)ceil((double)sim->options->WORLD_WIDTH / cellSize));
+		sim->grid.rows = max(1, (int)ceil((double)sim->options->WORLD_HEIGHT / cellSize));
+		sim->grid.cellWidth = cellSize;
+		sim->grid.cellHeight = cellSize;
+		
+	}
+	
+	reserveSpatialGrid();
+	
+	memset(sim->grid.tableKeys, 0xFF, (size_t)sim->grid.tableCapacity * sizeof(Uint64));
+	
+	sim->grid.cellCount = 0;
+	
+	// find (or make) each particle's cell. Particles next to each other in memory
+	// are usually in the same cell, so the last one is remembered
+	Uint64 lastKey = GRID_EMPTY_KEY;
+	int lastCell = -1;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		Uint64 key = sim->isCompact ? gridKey(gridRowOf(unpackPosition(sim->compact.y[i])), gridColumnOf(unpackPosition(sim->compact.x[i]))) :
+			gridKey(gridRowOf(sim->particles[i].y), gridColumnOf(sim->particles[i].x));
+		
+		if(key != lastKey){
+			
+			int position = gridTablePosition(key);
+			
+			if(sim->grid.tableKeys[position] == GRID_EMPTY_KEY){
+				
+				sim->grid.tableKeys[position] = key;
+				sim->grid.tableCells[position] = sim->grid.cellCount;
+				sim->grid.cellKeys[sim->grid.cellCount] = key;
+				sim->grid.cellCount++;
+				
+			}
+			
+			lastKey = key;
+			lastCell = sim->grid.tableCells[position];
+			
+		}
+		
+		sim->grid.particleCell[i] = lastCell;
+		
+	}
+	
+	// the cells were numbered in the order they were found, so renumber them in row major order
+	qsort(sim->grid.cellKeys, (size_t)sim->grid.cellCount, sizeof(Uint64), compareGridKeys);
+	
+	for(int cell = 0; cell < sim->grid.cellCount; cell++){
+		
+		int position = gridTablePosition(sim->grid.cellKeys[cell]);
+		
+		sim->grid.cellRank[sim->grid.tableCells[position]] = cell;
+		sim->grid.tableCells[position] = cell;
+		sim->grid.cellRow[cell] = (int)(sim->grid.cellKeys[cell] >> 32);
+		sim->grid.cellColumn[cell] = (int)(Uint32)sim->grid.cellKeys[cell];
+		
+	}
+	
+	memset(sim->grid.cellStart, 0, (size_t)(sim->grid.cellCount + 1) * sizeof(int));
+	
+	// count how many particles are in each cell
+	for(int i = 0; i < sim->length; i++){
+		
+		int cell = sim->grid.cellRank[sim->grid.particleCell[i]];
+		
+		sim->grid.particleCell[i] = cell;
+		sim->grid.cellStart[cell]++;
+		
+	}
+	
+	// turn the counts into the end of each cell...
+	for(int cell = 1; cell < sim->grid.cellCount; cell++){
+		
+		sim->grid.cellStart[cell] += sim->grid.cellStart[cell - 1];
+		
+	}
+	
+	// ...and walk backwards, so each end becomes the start of the cell
+	for(int i = sim->length - 1; i >= 0; i--){
+		
+		sim->grid.cellStart[sim->grid.particleCell[i]]--;
+		sim->grid.particleIndices[sim->grid.cellStart[sim->grid.particleCell[i]]] = i;
+		
+	}
+	
+	sim->grid.cellStart[sim->grid.cellCount] = sim->length;
+	
+	sim->grid.isStale = 0;
+	
+	return;
+	
+}
+
+static inline void updateSpatialGrid(){
+	
+	if(sim->grid.isStale){
+		
+		buildSpatialGrid();
+		
+	}
+	
+	return;
+	
+}
+
+// What the spatial queries look through. It's either the live grid, whose cells
+// hold particle numbers, or a snapshot of it, whose particles are already in cell
+// order. Both keep their cells in row major order, so the queries work the same on either
+typedef struct spatialSource {
+	
+	const Uint64* cellKeys;
+	const int* cellStart;
+	int cellCount;
+	
+	double cellWidth;
+	double cellHeight;
+	int columns;
+	int rows;
+	
+	const double* typeSizes;
+	double largestParticleSize;
+	
+	// the live grid's particle numbers in cell order, or 0 for a snapshot
+	const int* particleIndices;
+	
+	// where the particles are, whole or compact for the live grid
+	const particle* particles;
+	const compactParticles* compact;
+	double compactUnit;
+	const particlesimSnapshotParticle* snapshotParticles;
+	
+	// how far it is round the world each way if the border wraps, otherwise 0
+	double wrapWidth;
+	double wrapHeight;
+	
+} spatialSource;
+
+// the live grid as a source. It has to be up to date (updateSpatialGrid()) before it's
+// asked anything. The charges don't reach round the world, so they ask without wrapping
+static inline void liveSpatialSource(spatialSource* restrict source, char isWrapping){
+	
+	source->cellKeys = sim->grid.cellKeys;
+	source->cellStart = sim->grid.cellStart;
+	source->cellCount = sim->grid.cellCount;
+	source->cellWidth = sim->grid.cellWidth;
+	source->cellHeight = sim->grid.cellHeight;
+	source->columns = sim->grid.columns;
+	source->rows = sim->grid.rows;
+	source->typeSizes = sim->particleSizes;
+	source->largestParticleSize = sim->largestParticleSize;
+	source->particleIndices = sim->grid.particleIndices;
+	source->particles = sim->isCompact ? 0 : sim->particles;
+	source->compact = sim->isCompact ? &sim->compact : 0;
+	source->compactUnit = sim->compactUnit;
+	source->snapshotParticles = 0;
+	source->wrapWidth = (isWrapping && sim->options->ENABLE_BORDER_WRAP) ? (double)sim->options->WORLD_WIDTH : 0.0;
+	source->wrapHeight = (isWrapping && sim->options->ENABLE_BORDER_WRAP) ? (double)sim->options->WORLD_HEIGHT : 0.0;
+	
+	return;
+	
+}
+
+// a snapshot as a source. It doesn't touch the simulation, so any thread can use it
+static inline void snapshotSpatialSource(spatialSource* restrict source, const particlesimSnapshot* restrict snapshot){
+	
+	source->cellKeys = snapshot->cellKeys;
+	source->cellStart = snapshot->cellStart;
+	source->cellCount = snapshot->cellCount;
+	source->cellWidth = snapshot->cellWidth;
+	source->cellHeight = snapshot->cellHeight;
+	source->columns = snapshot->columns;
+	source->rows = snapshot->rows;
+	source->typeSizes = snapshot->typeSizes;
+	source->largestParticleSize = snapshot->largestParticleSize;
+	source->particleIndices = 0;
+	source->particles = 0;
+	source->compact = 0;
+	source->compactUnit = 0.0;
+	source->snapshotParticles = snapshot->particles;
+	source->wrapWidth = snapshot->wrapWidth;
+	source->wrapHeight = snapshot->wrapHeight;
+	
+	return;
+	
+}
+
+// where the particle n places into the source's cell order is, and how big it is
+static inline void sourceParticle(const spatialSource* restrict source, int n, double* restrict x, double* restrict y, double* restrict size){
+	
+	if(source->snapshotParticles){
+		
+		const particlesimSnapshotParticle* restrict from = &source->snapshotParticles[n];
+		
+		*x = (double)from->x;
+		*y = (double)from->y;
+		*size = source->typeSizes[from->type];
+		
+		return;
+		
+	}
+	
+	int i = source->particleIndices[n];
+	
+	if(source->compact){
+		
+		*x = (double)source->compact->x[i] * source->compactUnit;
+		*y = (double)source->compact->y[i] * source->compactUnit;
+		*size = source->typeSizes[source->compact->type[i]];
+		
+		return;
+		
+	}
+	
+	*x = source->particles[i].x;
+	*y = source->particles[i].y;
+	*size = source->typeSizes[source->particles[i].type];
+	
+	return;
+	
+}
+
+// what a query hands back for the particle n places into the cell order:
+// its particle number for the live grid, its place in the snapshot for a snapshot
+static inline int sourceResult(const spatialSource* restrict source, int n){ return source->particleIndices ? source->particleIndices[n] : n; }
+
+// minimumImage() for a source, which knows for itself if it wraps
+static inline double sourceImage(double difference, double period){
+	
+	if(period > 0.0){
+		
+		difference -= period * (double)(difference > (0.5 * period));
+		difference += period * (double)(difference < (-0.5 * period));
+		
+	}
+	
+	return difference;
+	
+}
+
+// which of cells cells of cellSize a position falls in, like gridColumnOf() and gridRowOf()
+static inline int gridSpanOf(double position, double cellSize, int cells){ return min(max((int)floor(position / cellSize), 0), cells - 1); }
+
+// The cells from low to high along one side of the grid, as one or two spans of
+// cell numbers. Across a wrapping border, a range that goes off one side comes
+// back on the other, which is the second span. The spans never overlap, so no
+// cell is looked at twice
+static inline int gridSpans(double low, double high, double cellSize, int cells, double period, int spans[2][2]){
+	
+	if((period > 0.0) && ((high - low) < period) && ((low < 0.0) || (high >= period))){
+		
+		int first = (low < 0.0) ? gridSpanOf(low + period, cellSize, cells) : gridSpanOf(low, cellSize, cells);
+		int last = (low < 0.0) ? gridSpanOf(high, cellSize, cells) : gridSpanOf(high - period, cellSize, cells);
+		
+		if(last < first){
+			
+			spans[0][0] = first;
+			spans[0][1] = cells - 1;
+			spans[1][0] = 0;
+			spans[1][1] = last;
+			
+			return 2;
+			
+		}
+		
+		// the two ends meet in the middle, so it's all of them
+		spans[0][0] = 0;
+		spans[0][1] = cells - 1;
+		
+		return 1;
+		
+	}
+	
+	// all the way round is every cell
+	if((period > 0.0) && ((high - low) >= period)){
+		
+		spans[0][0] = 0;
+		spans[0][1] = cells - 1;
+		
+		return 1;
+		
+	}
+	
+	spans[0][0] = gridSpanOf(low, cellSize, cells);
+	spans[0][1] = gridSpanOf(high, cellSize, cells);
+	
+	return 1;
+	
+}
+
+// Goes through the cells in use in a rectangle of the world, in row major order for
+// each block of rows and columns it covers (one block, or up to four across a wrapping
+// border). A cell left of the block skips ahead to where the block starts on its row,
+// and one right of it skips to the next row, so a block that is mostly empty
+// (zoomed out over a big empty world) still only takes a few binary searches
+// for each row with something in it
+typedef struct gridWalk {
+	
+	const spatialSource* source;
+	
+	int rowSpans[2][2];
+	int columnSpans[2][2];
+	int rowSpanCount;
+	int columnSpanCount;
+	
+	// the block being walked, and the next cell to check in it
+	int rowSpan;
+	int columnSpan;
+	int cell;
+	
+} gridWalk;
+
+// the first cell from low onwards whose key isn't below key
+static inline int gridCellFrom(const spatialSource* restrict source, Uint64 key, int low){
+	
+	int high = source->cellCount;
+	
+	while(low < high){
+		
+		int middle = (low + high) >> 1;
+		
+		if(source->cellKeys[middle] < key){
+			
+			low = middle + 1;
+			
+		}
+		
+		else{
+			
+			high = middle;
+			
+		}
+		
+	}
+	
+	return low;
+	
+}
+
+static inline void startGridWalk(gridWalk* restrict walk, const spatialSource* restrict source, double left, double top, double right, double bottom){
+	
+	walk->source = source;
+	walk->rowSpanCount = gridSpans(top, bottom, source->cellHeight, source->rows, source->wrapHeight, walk->rowSpans);
+	walk->columnSpanCount = gridSpans(left, right, source->cellWidth, source->columns, source->wrapWidth, walk->columnSpans);
+	walk->rowSpan = 0;
+	walk->columnSpan = 0;
+	walk->cell = gridCellFrom(source, gridKey(walk->rowSpans[0][0], walk->columnSpans[0][0]), 0);
+	
+	return;
+	
+}
+
+// the next cell in use in the rectangle, or -1 once there are no more
+static inline int nextGridCell(gridWalk* restrict walk){
+	
+	const spatialSource* restrict source = walk->source;
+	
+	while(walk->rowSpan < walk->rowSpanCount){
+		
+		int lastRow = walk->rowSpans[walk->rowSpan][1];
+		int firstColumn = walk->columnSpans[walk->columnSpan][0];
+		int lastColumn = walk->columnSpans[walk->columnSpan][1];
+		
+		while(walk->cell < source->cellCount){
+			
+			int cell = walk->cell;
+			int row = (int)(source->cellKeys[cell] >> 32);
+			int column = (int)(Uint32)source->cellKeys[cell];
+			
+			if(row > lastRow){
+				
+				break;
+				
+			}
+			
+			if(column < firstColumn){
+				
+				walk->cell = gridCellFrom(source, gridKey(row, firstColumn), cell);
+				
+			}
+			
+			else if(column > lastColumn){
+				
+				walk->cell = gridCellFrom(source, gridKey(row + 1, firstColumn), cell);
+				
+			}
+			
+			else{
+				
+				walk->cell++;
+				
+				return cell;
+				
+			}
+			
+		}
+		
+		// on to the next block
+		walk->columnSpan++;
+		
+		if(walk->columnSpan == walk->columnSpanCount){
+			
+			walk->columnSpan = 0;
+			walk->rowSpan++;
+			
+		}
+		
+		if(walk->rowSpan < walk->rowSpanCount){
+			
+			walk->cell = gridCellFrom(source, gridKey(walk->rowSpans[walk->rowSpan][0], walk->columnSpans[walk->columnSpan][0]), 0);
+			
+		}
+		
+	}
+	
+	return -1;
+	
+}
+
+// The spatial queries. None of them allocate, they write what sourceResult() gives for
+// each particle into the array given by the caller (up to maxResults) and return how
+// many were written. They only look at the cells that can hold an answer, so they take
+// time close to the number of particles found rather than the total amount.
+// Across a wrapping border, distances are measured the short way round
+
+// find the particle under a point, or -1 if there is none.
+// If the point is over a few particles, the one with the closest centre is picked
+static inline int spatialPick(const spatialSource* restrict source, double x, double y){
+	
+	int picked = -1;
+	double pickedDistance = 0.0;
+	double reach = 0.5 * source->largestParticleSize;
+	
+	gridWalk walk;
+	
+	startGridWalk(&walk, source, x - reach, y - reach, x + reach, y + reach);
+	
+	for(int cell = nextGridCell(&walk); cell > -1; cell = nextGridCell(&walk)){
+		
+		for(int n = source->cellStart[cell]; n < source->cellStart[cell + 1]; n++){
+			
+			double particleX, particleY, size;
+			
+			sourceParticle(source, n, &particleX, &particleY, &size);
+			
+			double w = sourceImage(x - particleX, source->wrapWidth);
+			double h = sourceImage(y - particleY, source->wrapHeight);
+			double distance = (w * w) + (h * h);
+			double radius = 0.5 * size;
+			
+			if((distance < (radius * radius)) && ((picked == -1) || (distance < pickedDistance))){
+				
+				picked = sourceResult(source, n);
+				pickedDistance = distance;
+				
+			}
+			
+		}
+		
+	}
+	
+	return picked;
+	
+}
+
+// every particle with its centre within radius of the point
+static inline int spatialQueryRadius(const spatialSource* restrict source, double x, double y, double radius, int* restrict results, int maxResults){
+	
+	int found = 0;
+	
+	gridWalk walk;
+	
+	startGridWalk(&walk, source, x - radius, y - radius, x + radius, y + radius);
+	
+	for(int cell = nextGridCell(&walk); cell > -1; cell = nextGridCell(&walk)){
+		
+		for(int n = source->cellStart[cell]; n < source->cellStart[cell + 1]; n++){
+			
+			double particleX, particleY, size;
+			
+			sourceParticle(source, n, &particleX, &particleY, &size);
+			
+			double w = sourceImage(x - particleX, source->wrapWidth);
+			double h = sourceImage(y - particleY, source->wrapHeight);
+			
+			if(((w * w) + (h * h)) <= (radius * radius)){
+				
+				if(found == maxResults){ return found; }
+				
+				results[found] = sourceResult(source, n);
+				found++;
+				
+			}
+			
+		}
+		
+	}
+	
+	return found;
+	
+}
+
+// every particle that overlaps the rectangle, even if only its edge does
+static inline int spatialQueryRect(const spatialSource* restrict source, double left, double top, double right, double bottom, int* restrict results, int maxResults){
+	
+	int found = 0;
+	double reach = 0.5 * source->largestParticleSize;
+	double centreX = 0.5 * (left + right);
+	double centreY = 0.5 * (top + bottom);
+	
+	gridWalk walk;
+	
+	startGridWalk(&walk, source, left - reach, top - reach, right + reach, bottom + reach);
+	
+	for(int cell = nextGridCell(&walk); cell > -1; cell = nextGridCell(&walk)){
+		
+		for(int n = source->cellStart[cell]; n < source->cellStart[cell + 1]; n++){
+			
+			double particleX, particleY, size;
+			
+			sourceParticle(source, n, &particleX, &particleY, &size);
+			
+			// across the border, the particle is wherever it's closest to the rectangle
+			if(source->wrapWidth > 0.0){ particleX = centreX - sourceImage(centreX - particleX, source->wrapWidth); }
+			if(source->wrapHeight > 0.0){ particleY = centreY - sourceImage(centreY - particleY, source->wrapHeight); }
+			
+			double radius = 0.5 * size;
+			
+			if(((particleX + radius) < left) || ((particleX - radius) > right)){ continue; }
+			if(((particleY + radius) < top) || ((particleY - radius) > bottom)){ continue; }
+			
+			if(found == maxResults){ return found; }
+			
+			results[found] = sourceResult(source, n);
+			found++;
+			
+		}
+		
+	}
+	
+	return found;
+	
+}
+
+// insertion sort the particle n places into the cell order into the k nearest
+// so far, dropping the furthest if we are full
+static inline void keepNearest(const spatialSource* restrict source, int n, double x, double y, int k, int* restrict results, double* restrict distances, int* restrict found){
+	
+	double particleX, particleY, size;
+	
+	sourceParticle(source, n, &particleX, &particleY, &size);
+	
+	double w = sourceImage(x - particleX, source->wrapWidth);
+	double h = sourceImage(y - particleY, source->wrapHeight);
+	double distance = sqrt((w * w) + (h * h));
+	
+	if((*found == k) && (distance >= distances[k - 1])){
+		
+		return;
+		
+	}
+	
+	int slot = (*found < k) ? (*found)++ : (k - 1);
+	
+	while((slot > 0) && (distances[slot - 1] > distance)){
+		
+		results[slot] = results[slot - 1];
+		distances[slot] = distances[slot - 1];
+		slot--;
+		
+	}
+	
+	results[slot] = sourceResult(source, n);
+	distances[slot] = distance;
+	
+	return;
+	
+}
+
+// the k closest particles to a point, closest first. distances gets the
+// distance of each one, so both arrays need room for k entries.
+// We look in a square around the point, and if it doesn't hold k particles
+// that are closer than its edge, in one twice as wide. Each square is four
+// times the size of the last, so all of them together are less than half as
+// much again as the last one, and the last one is never more than the whole world
+static inline int spatialQueryNearest(const spatialSource* restrict source, double x, double y, int k, int* restrict results, double* restrict distances){
+	
+	int found = 0;
+	
+	if((k < 1) || (source->cellCount == 0)){ return 0; }
+	
+	for(double reach = maxDouble(source->cellWidth, source->cellHeight); ; reach *= 2.0){
+		
+		gridWalk walk;
+		
+		startGridWalk(&walk, source, x - reach, y - reach, x + reach, y + reach);
+		
+		found = 0;
+		
+		for(int cell = nextGridCell(&walk); cell > -1; cell = nextGridCell(&walk)){
+			
+			for(int n = source->cellStart[cell]; n < source->cellStart[cell + 1]; n++){
+				
+				keepNearest(source, n, x, y, k, results, distances, &found);
+				
+			}
+			
+		}
+		
+		// anything outside the square is further away than its edge
+		if((found == k) && (distances[k - 1] <= reach)){
+			
+			break;
+			
+		}
+		
+		// the square already had every cell in it, so there isn't anything else
+		if((walk.rowSpanCount == 1) && (walk.rowSpans[0][0] == 0) && (walk.rowSpans[0][1] == (source->rows - 1)) &&
+			(walk.columnSpanCount == 1) && (walk.columnSpans[0][0] == 0) && (walk.columnSpans[0][1] == (source->columns - 1))){
+			
+			break;
+			
+		}
+		
+	}
+	
+	return found;
+	
+}
+
+// check if two particles are bonded to anything
+static inline char isBonding(int particleNum, int particleNumTo){
+	
+	for(int i = 0; i < sim->bondLength; i+= 2){
+		
+		if((*(sim->bonding + i) == particleNum) || (*(sim->bonding + i + 1) == particleNum)
+		|| (*(sim->bonding + i) == particleNumTo) || (*(sim->bonding + i + 1) == particleNumTo)){
+			
+			return 1;
+			
+		}
+		
+	}
+	
+	return 0;
+	
+}
+
+// where the next event in a thread's ring goes, or 0 if the ring is full
+// and it has to be dropped. The caller fills it in and moves writeHead on
+static inline collisionEvent* nextEvent(eventRing* restrict ring){
+	
+	if((ring->writeHead - ring->seenTail) == EVENT_RING_SIZE){
+		
+		ring->seenTail = (Uint32)atomic_load(&ring->tail);
+		
+		if((ring->writeHead - ring->seenTail) == EVENT_RING_SIZE){
+			
+			atomic_fetch_add(&ring->dropped, 1);
+			
+			return 0;
+			
+		}
+		
+	}
+	
+	return &ring->events[ring->writeHead & (EVENT_RING_SIZE - 1)];
+	
+}
+
+// add an event to a thread's ring. It isn't seen by the log thread until publishEvents
+static inline void recordEvent(int workerNum, collisionEventKind kind, int particleNumA, int particleNumB, double impulse){
+	
+	eventRing* restrict ring = &sim->eventRings[workerNum];
+	collisionEvent* restrict event = nextEvent(ring);
+	
+	if(event == 0){
+		
+		return;
+		
+	}
+	
+	event->step = sim->simulationStep;
+	event->particleA = sim->particles[particleNumA].handle;
+	event->particleB = sim->particles[particleNumB].handle;
+	event->impulse = (float)impulse;
+	event->kind = (Uint8)kind;
+	event->typeA = (Uint8)sim->particles[particleNumA].type;
+	event->typeB = (Uint8)sim->particles[particleNumB].type;
+	event->padding = 0;
+	
+	ring->writeHead++;
+	
+	return;
+	
+}
+
+// let the log thread see the events a thread has recorded since last time
+static inline void publishEvents(int workerNum){
+	
+	eventRing* restrict ring = &sim->eventRings[workerNum];
+	
+	// the events have to be written before the head says they're there
+	atomic_thread_fence(memory_order_release);
+	
+	atomic_exchange(&ring->head, (int)ring->writeHead);
+	
+	return;
+	
+}
+
+// every thread gets an event ring, which the log thread empties
+// (or in a slab process, the slab sending them to the coordinator).
+// 0 if there wasn't the memory, destroySimulation() frees what there was
+static inline char createEventRings(){
+	
+	sim->eventRings = calloc((size_t)sim->workerCount, sizeof(eventRing));
+	
+	if(sim->eventRings == 0){ return 0; }
+	
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		sim->eventRings[workerNum].events = malloc(EVENT_RING_SIZE * sizeof(collisionEvent));
+		
+		if(sim->eventRings[workerNum].events == 0){ return 0; }
+		
+	}
+	
+	sim->isRecordingEvents = 1;
+	
+	return 1;
+	
+}
+
+// handle elastic collision (for particles
+// that only exchanges kinetic energy on collison)
+static inline double handleElasticCollision(int particleNumA, int particleNumB, double distance){
+	
+	particle unpackedA, unpackedB;
+	particle* a = loadParticle(particleNumA, &unpackedA);
+	particle* b = loadParticle(particleNumB, &unpackedB);
+	
+	double velXA = a->velocityX;
+	double velYA = a->velocityY;
+	double velXB = b->velocityX;
+	double velYB = b->velocityY;
+	double massA = a->mass;
+	double massB = b->mass;
+	
+	// stolen from Javidx9's circle vs circle collision video, thanks! :)
+	// some sort of maths magic going on here.... I have no idea what's
+	// happening but it works great
+	
+	// get the normal vector between the two particles
+	double nx = minimumImage(b->x - a->x, (double)sim->options->WORLD_WIDTH) / distance;
+	double ny = minimumImage(b->y - a->y, (double)sim->options->WORLD_HEIGHT) / distance;
+	
+	double kx = (velXA - velXB);
+	double ky = (velYA - velYB);
+	double p = 2.0 * (nx * kx + ny * ky) / (massA + massB);
+	velXA = velXA - p * massB * nx;
+	velYA = velYA - p * massB * ny;
+	velXB = velXB + p * massA * nx;
+	velYB = velYB + p * massA * ny;
+	
+	// apply the new velocities to both particles
+	a->velocityX = velXA;
+	a->velocityY = velYA;
+	b->velocityX = velXB;
+	b->velocityY = velYB;
+	
+	storeVelocity(particleNumA, a);
+	storeVelocity(particleNumB, b);
+	
+	// also collide with bonded particles
+	// The particles have spin 0 for now, which means that they don't rotate. Therefore, any collision
+	// affect both particles equally
+	particle unpackedPartner;
+	
+	if(a->bondingWith > -1){
+		
+		particle* partner = loadParticle(a->bondingWith, &unpackedPartner);
+		
+		partner->velocityX = velXA;
+		partner->velocityY = velYA;
+		
+		storeVelocity(a->bondingWith, partner);
+		
+	}
+		
+	if(b->bondingWith > -1){
+		
+		particle* partner = loadParticle(b->bondingWith, &unpackedPartner);
+		
+		partner->velocityX = velXB;
+		partner->velocityY = velYB;
+		
+		storeVelocity(b->bondingWith, partner);
+		
+	}
+	
+	// how much momentum went from one to the other
+	return fabs(p) * massA * massB;
+	
+}
+
+// handle red and blue particle bonding
+static inline void handleRedBlueBond(int i, int j){
+	
+	particle unpackedI, unpackedJ;
+	particle* a = loadParticle(i, &unpackedI);
+	particle* b = loadParticle(j, &unpackedJ);
+	
+	// bonds are only made by the simulation thread, one at a time
+	if(sim->isRecordingEvents){
+		
+		// each particle's velocity changes by half the difference, so on average
+		// the momentum they gain or lose is a quarter of it times both masses
+		double dx = a->velocityX - b->velocityX;
+		double dy = a->velocityY - b->velocityY;
+		
+		recordEvent(0, redBlueBond, i, j, 0.25 * sqrt((dx * dx) + (dy * dy)) * (a->mass + b->mass));
+		publishEvents(0);
+		
+	}
+	
+	// the new velocities of the particles will be the average of both old ones
+	double avgVelX = (a->velocityX + b->velocityX) / 2.0;
+	double avgVelY = (a->velocityY + b->velocityY) / 2.0;
+	
+	a->velocityX = avgVelX;
+	a->velocityY = avgVelY;
+	b->velocityX = avgVelX;
+	b->velocityY = avgVelY;
+	
+	double temp = a->mass;
+	
+	a->mass += b->mass;
+	b->mass += temp;
+	
+	a->bondingWith = j;
+	b->bondingWith = i;
+	
+	a->bondedTo = b->handle;
+	b->bondedTo = a->handle;
+	
+	// the bond first, a compact pair round their velocities the same way
+	storeLinks(i, a);
+	storeLinks(j, b);
+	storeVelocity(i, a);
+	storeVelocity(j, b);
+	
+	sim->bondedPairs++;
+	
+}
+
+// handle particle repulsion
+// Assume that I is the closest to J.
+static void collisionKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int c = start; c < end; c++){
+		
+		handleElasticCollision(sim->colouredContacts[c].particleNumA, sim->colouredContacts[c].particleNumB, sim->colouredContacts[c].distance);
+		
+	}
+	
+	return;
+	
+}
+
+// the same, but every collision is written to the thread's event ring.
+// It's a kernel of its own so the one above doesn't check for the log every time
+static void recordedCollisionKernel(int start, int end, int workerNum){
+	
+	for(int c = start; c < end; c++){
+		
+		double impulse = handleElasticCollision(sim->colouredContacts[c].particleNumA, sim->colouredContacts[c].particleNumB, sim->colouredContacts[c].distance);
+		
+		recordEvent(workerNum, elasticCollision, sim->colouredContacts[c].particleNumA, sim->colouredContacts[c].particleNumB, impulse);
+		
+	}
+	
+	publishEvents(workerNum);
+	
+	return;
+	
+}
+
+// give the contact the lowest colour that none of the particles it
+// touches already have. If all of them are taken it goes in the last colour,
+// which doesn't get split up between the workers
+static inline int colourContact(int particleNumA, int particleNumB){
+	
+	int touched[4] = {particleNumA, particleNumB, bondOf(particleNumA), bondOf(particleNumB)};
+	Uint64 taken = 0;
+	
+	for(int k = 0; k < 4; k++){
+		
+		if(touched[k] > -1){
+			
+			taken |= sim->usedColours[touched[k]];
+			
+		}
+		
+	}
+	
+	int colour = 0;
+	
+	while((colour < (MAX_CONTACT_COLOURS - 1)) && (taken & ((Uint64)1 << colour))){
+		
+		colour++;
+		
+	}
+	
+	for(int k = 0; k < 4; k++){
+		
+		if(touched[k] > -1){
+			
+			sim->usedColours[touched[k]] |= ((Uint64)1 << colour);
+			
+		}
+		
+	}
+	
+	return colour;
+	
+}
+
+// are particles of typeA and typeB at these places touching? The + 1 is for floating point error
+static inline char areTouching(double xa, double ya, int typeA, double xb, double yb, int typeB){
+	
+	double dx = minimumImage(xa - xb, (double)sim->options->WORLD_WIDTH);
+	double dy = minimumImage(ya - yb, (double)sim->options->WORLD_HEIGHT);
+	
+	return sqrt(((dx * dx) + (dy * dy))) < ((0.5 * sim->particleSizes[typeA]) + (0.5 * sim->particleSizes[typeB]) + 1.0);
+	
+}
+
+// add particle i's contact with its nearest neighbour, if it has one
+static inline void collectContact(int i){
+	
+	particle unpacked;
+	particle* current = loadParticle(i, &unpacked);
+	
+	if(current->nearestNeighbour == -1) return;
+	
+	// both particles aren't bonded, but we still need to check if the other particle is closer to another.
+	if((current->bondingWith == -1) && (bondOf(current->nearestNeighbour) == -1)){
+		
+		//if(i == 0) fprintf(debug, "particle 1 - nearestNeighbour = %d, distance = %d, nearestNeighbour's nearestNeighbour = %d", );
+		
+		if(current->collidingAwayFrom != current->nearestNeighbour){
+			
+			sim->contacts[sim->contactCount].particleNumA = i;
+			sim->contacts[sim->contactCount].particleNumB = current->nearestNeighbour;
+			sim->contacts[sim->contactCount].distance = current->nearestNeighbourDistance;
+			sim->contactCount++;
+			
+			current->collidingAwayFrom = current->nearestNeighbour;
+			
+			storeLinks(i, current);
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+static int compareContactsByHandle(const void* a, const void* b){
+	
+	Uint32 slotA = handleSlotOf(((const collisionContact*)a)->particleNumA);
+	Uint32 slotB = handleSlotOf(((const collisionContact*)b)->particleNumA);
+	
+	return (slotA > slotB) - (slotA < slotB);
+	
+}
+
+// put the first count contacts in the order of their first particle's handle.
+// Each particle collects one contact at most, so no two are the same
+static inline void sortContactsByHandle(int count){
+	
+	qsort(sim->contacts, (size_t)count, sizeof(collisionContact), compareContactsByHandle);
+	
+	return;
+	
+}
+
+// colour the collected contacts and sort them into colouredContacts by colour
+static inline void colourContacts(){
+	
+	// colour them in the same order, so the batches
+	// never depend on how many threads there are
+	memset(sim->colourStart, 0, sizeof(sim->colourStart));
+	
+	for(int c = 0; c < sim->contactCount; c++){
+		
+		sim->contacts[c].colour = colourContact(sim->contacts[c].particleNumA, sim->contacts[c].particleNumB);
+		sim->colourStart[sim->contacts[c].colour + 1]++;
+		
+	}
+	
+	// only clear the particles we touched, not all of them
+	for(int c = 0; c < sim->contactCount; c++){
+		
+		sim->usedColours[sim->contacts[c].particleNumA] = 0;
+		sim->usedColours[sim->contacts[c].particleNumB] = 0;
+		
+		if(bondOf(sim->contacts[c].particleNumA) > -1){ sim->usedColours[bondOf(sim->contacts[c].particleNumA)] = 0; }
+		if(bondOf(sim->contacts[c].particleNumB) > -1){ sim->usedColours[bondOf(sim->contacts[c].particleNumB)] = 0; }
+		
+	}
+	
+	// sort the contacts by colour, keeping them in handle order within each colour
+	for(int colour = 1; colour <= MAX_CONTACT_COLOURS; colour++){
+		
+		sim->colourStart[colour] += sim->colourStart[colour - 1];
+		
+	}
+	
+	for(int c = 0; c < sim->contactCount; c++){
+		
+		int colour = sim->contacts[c].colour;
+		
+		sim->colouredContacts[sim->colourStart[colour]] = sim->contacts[c];
+		sim->colourStart[colour]++;
+		
+	}
+	
+	// that moved every start along to the next colour, so shift them back
+	for(int colour = MAX_CONTACT_COLOURS; colour > 0; colour--){
+		
+		sim->colourStart[colour] = sim->colourStart[colour - 1];
+		
+	}
+	
+	sim->colourStart[0] = 0;
+	
+	return;
+	
+}
+
+// how many contacts each collision task resolves
+#define CONTACT_CHUNK 256
+
+// colour the collected contacts and run them in batches
+static inline void resolveContacts(){
+	
+	sim->stepCollisions += (Uint64)sim->contactCount;
+	
+	if(sim->contactCount == 0){ return; }
+	
+	colourContacts();
+	
+	workerKernel kernel = sim->isRecordingEvents ? recordedCollisionKernel : collisionKernel;
+	
+	// run the colours one after the other, the contacts
+	// inside a colour can run in any order on any thread
+	for(int colour = 0; colour < MAX_CONTACT_COLOURS; colour++){
+		
+		int start = sim->colourStart[colour];
+		int end = sim->colourStart[colour + 1];
+		
+		if(start == end){ continue; }
+		
+		// the last colour can have contacts that share particles, so it stays in
+		// one piece. The others are cut into chunks of the same size whatever
+		// WORKER_THREADS is, like everything else that goes to the workers
+		if(colour == (MAX_CONTACT_COLOURS - 1)){
+			
+			kernel(start, end, 0);
+			
+		}
+		
+		else{
+			
+			runParallelFor(start, end, CONTACT_CHUNK, kernel);
+			
+		}
+		
+	}
+	
+	/*
+	
+	// particle I is bonded, while J is not
+	else if(particles[i].bondingWith > -1 && particles[j].bondingWith == -1){
+		
+		if(particles[particles[i].bondingWith].nearestNeighbour > -1){
+			
+			// we need to ckeck if our bonded particle is closer to another particle
+			if(particles[i].nearestNeighbourDistance < particles[particles[i].bondingWith].nearestNeighbourDistance){
+				
+				handleElasticCollision(i, j, particles[i].nearestNeighbour);
+				
+			}
+			
+		}
+		
+		else{
+			
+			handleElasticCollision(i, j, particles[i].nearestNeighbour);
+			
+		}
+		
+	}
+	
+	// vice versa
+	else if(particles[i].bondingWith == -1 && particles[j].bondingWith > -1){
+		
+		if(particles[particles[j].bondingWith].nearestNeighbour > -1){
+			
+			// we need to ckeck if our bonded particle is closer to another particle
+			if(particles[i].nearestNeighbourDistance < particles[particles[j].bondingWith].nearestNeighbourDistance){
+				
+				if(particles[i].nearestNeighbourDistance < particles[j].nearestNeighbourDistance){
+					
+					handleElasticCollision(i, j, particles[i].nearestNeighbour);
+					
+				}
+				
+			}
+			
+		}
+		
+		else{
+			
+			if(particles[i].nearestNeighbourDistance < particles[j].nearestNeighbourDistance){
+				
+				handleElasticCollision(i, j, particles[i].nearestNeighbour);
+				
+			}
+			
+		}
+		
+	}
+	
+	else{
+		
+		
+		
+	}
+	
+	*/
+	
+}
+
+static inline void handleCollision(){
+	
+	sim->contactCount = 0;
+	
+	// collect every contact, then put them in handle order
+	for(int i = 0; i < sim->length; i++){
+		
+		collectContact(i);
+		
+	}
+	
+	sortContactsByHandle(sim->contactCount);
+	
+	resolveContacts();
+	
+	return;
+	
+}
+
+// mark a particle to be removed at the start of the next step.
+// Calling it twice does nothing. The check and the mark aren't one atomic
+// step, so only call it from one thread at a time, never from the workers
+static inline void queueParticleRemoval(int particleNum){
+	
+	if(sim->isQueuedForRemoval[particleNum]){
+		
+		return;
+		
+	}
+	
+	sim->isQueuedForRemoval[particleNum] = 1;
+	
+	sim->killQueue[atomic_fetch_add(&sim->killQueueLength, 1)] = particleNum;
+	
+	return;
+	
+}
+
+static int compareDescending(const void* a, const void* b){
+	
+	return *(const int*)b - *(const int*)a;
+	
+}
+
+// where a particle number from before the last removal points to now
+static inline int remapRemoved(int particleNum){
+	
+	if((particleNum > -1) && (sim->removalStamp[particleNum] == sim->removalEpoch)){
+		
+		return sim->removalRemap[particleNum];
+		
+	}
+	
+	return particleNum;
+	
+}
+
+// move particle from into to's place, and point its handle at where it is now
+static inline void moveParticleSlot(int to, int from){
+	
+	if(sim->isCompact){
+		
+		sim->compact.x[to] = sim->compact.x[from];
+		sim->compact.y[to] = sim->compact.y[from];
+		sim->compact.velocityX[to] = sim->compact.velocityX[from];
+		sim->compact.velocityY[to] = sim->compact.velocityY[from];
+		sim->compact.bondingWith[to] = sim->compact.bondingWith[from];
+		sim->compact.nearestNeighbour[to] = sim->compact.nearestNeighbour[from];
+		sim->compact.collidingAwayFrom[to] = sim->compact.collidingAwayFrom[from];
+		sim->compact.nearestNeighbourDistance[to] = sim->compact.nearestNeighbourDistance[from];
+		sim->compact.handleSlot[to] = sim->compact.handleSlot[from];
+		sim->compact.type[to] = sim->compact.type[from];
+		
+		sim->handleIndex[sim->compact.handleSlot[to]] = to;
+		
+		return;
+		
+	}
+	
+	sim->particles[to] = sim->particles[from];
+	sim->neighbourStart[to] = sim->neighbourStart[from];
+	sim->neighbourCount[to] = sim->neighbourCount[from];
+	sim->neighbourBuiltX[to] = sim->neighbourBuiltX[from];
+	sim->neighbourBuiltY[to] = sim->neighbourBuiltY[from];
+	
+	moveParticleHandle(to);
+	
+	return;
+	
+}
+
+// remove every queued particle by moving the last particle into its place.
+// This only touches the removed particles and the ones moved into their place,
+// so removing a few thousand particles doesn't go anywhere near the rest
+static inline void removeQueuedParticles(){
+	
+	int queued = atomic_load(&sim->killQueueLength);
+	
+	if(queued == 0){
+		
+		return;
+		
+	}
+	
+	// going from the highest number down means the last particle
+	// is never one that is about to be removed too
+	qsort(sim->killQueue, (size_t)queued, sizeof(int), compareDescending);
+	
+	// a fresh epoch makes every old stamp invalid without clearing anything
+	sim->removalEpoch++;
+	
+	char listsWereValid = (sim->neighbourBuiltLength == sim->length);
+	
+	particle unpacked;
+	
+	for(int k = 0; k < queued; k++){
+		
+		int dead = sim->killQueue[k];
+		int last = sim->length - 1;
+		
+		sim->isQueuedForRemoval[dead] = 0;
+		
+		// the particle it was bonded to goes back to being on its own
+		if(bondOf(dead) > -1){
+			
+			int partnerNum = bondOf(dead);
+			particle* partner = loadParticle(partnerNum, &unpacked);
+			
+			partner->bondingWith = -1;
+			partner->bondedTo = NULL_PARTICLE_HANDLE;
+			partner->mass = particleTemplates[partner->type].mass;
+			
+			storeLinks(partnerNum, partner);
+			
+			sim->bondedPairs--;
+			
+		}
+		
+		releaseParticleHandle(particleHandleOf(dead));
+		
+		sim->removalRemap[dead] = -1;
+		sim->removalStamp[dead] = sim->removalEpoch;
+		
+		if(dead != last){
+			
+			// the last one might have been moved already in this loop
+			int origin = (sim->slotOriginStamp[last] == sim->removalEpoch) ? sim->slotOrigin[last] : last;
+			
+			moveParticleSlot(dead, last);
+			
+			sim->removalRemap[origin] = dead;
+			sim->removalStamp[origin] = sim->removalEpoch;
+			sim->slotOrigin[dead] = origin;
+			sim->slotOriginStamp[dead] = sim->removalEpoch;
+			
+			if(bondOf(dead) > -1){
+				
+				particle* partner = loadParticle(bondOf(dead), &unpacked);
+				
+				partner->bondingWith = dead;
+				
+				storeLinks(bondOf(dead), partner);
+				
+			}
+			
+		}
+		
+		sim->length--;
+		
+	}
+	
+	atomic_exchange(&sim->killQueueLength, 0);
+	
+	// the lists moved along with their particles, so they are still good
+	if(listsWereValid){
+		
+		sim->neighbourBuiltLength = sim->length;
+		
+	}
+	
+	sim->removalPending = 1;
+	sim->grid.isStale = 1;
+	
+	return;
+	
+}
+
+// how many particles each boundary task checks
+#define BORDER_CHUNK 4096
+
+// how many particles are checked side by side
+#define BORDER_LANES 8
+
+// The boundary pass. Each group of particles is copied into lanes, every lane
+// does the same sums and the borders only pick which result is kept, so there
+// are no branches and no lane depends on another, which the compiler turns
+// into SIMD. The results and what happened are then copied back.
+// borderLanes is the sums, for up to BORDER_LANES particles
+static inline void borderLanes(int lanes, double* restrict x, double* restrict y, double* restrict velX, double* restrict velY, const double* restrict radius, unsigned char* restrict events){
+	
+	double width = (double)sim->options->WORLD_WIDTH;
+	double height = (double)sim->options->WORLD_HEIGHT;
+	char clamp = sim->options->ENABLE_BORDER_CLAMP;
+	
+	if(sim->options->ENABLE_BORDER_WRAP){
+		
+		// leave one side, come back in on the other. A particle can go more than once
+		// round in a step, so take off how many windows it is past, rounded down
+		// (the cast rounds towards zero, so negative ones need one more)
+		for(int lane = 0; lane < lanes; lane++){
+			
+			double acrossX = x[lane] / width;
+			double acrossY = y[lane] / height;
+			double windowsX = (double)(long long)acrossX;
+			double windowsY = (double)(long long)acrossY;
+			
+			windowsX -= (double)(acrossX < windowsX);
+			windowsY -= (double)(acrossY < windowsY);
+			
+			x[lane] -= width * windowsX;
+			y[lane] -= height * windowsY;
+			
+			// a tiny bit below zero can round up to the far edge
+			x[lane] -= width * (double)(x[lane] >= width);
+			y[lane] -= height * (double)(y[lane] >= height);
+			
+			events[lane] = 0;
+			
+		}
+		
+	}
+	
+	else if(sim->options->ENABLE_BORDER_ABSORB){
+		
+		// once a particle is all the way out, it's gone
+		for(int lane = 0; lane < lanes; lane++){
+			
+			char outside = ((x[lane] + radius[lane]) < 0.0) | ((x[lane] - radius[lane]) > width) |
+				((y[lane] + radius[lane]) < 0.0) | ((y[lane] - radius[lane]) > height);
+			
+			events[lane] = (unsigned char)(outside * BORDER_ABSORBED);
+			
+		}
+		
+	}
+	
+	else{
+		
+		// bounce off the borders, but only if the particle is still heading out
+		for(int lane = 0; lane < lanes; lane++){
+			
+			char left = (x[lane] - radius[lane]) < 0.0;
+			char right = ((x[lane] + radius[lane]) > width) & !left;
+			char top = (y[lane] - radius[lane]) < 0.0;
+			char bottom = ((y[lane] + radius[lane]) > height) & !top;
+			
+			char flipX = (left & (velX[lane] < 0.0)) | (right & (velX[lane] > 0.0));
+			char flipY = (top & (velY[lane] < 0.0)) | (bottom & (velY[lane] > 0.0));
+			
+			velX[lane] = flipX ? -velX[lane] : velX[lane];
+			velY[lane] = flipY ? -velY[lane] : velY[lane];
+			
+			if(clamp){
+				
+				x[lane] = left ? radius[lane] : (right ? (width - radius[lane]) : x[lane]);
+				y[lane] = top ? radius[lane] : (bottom ? (height - radius[lane]) : y[lane]);
+				
+			}
+			
+			events[lane] = (unsigned char)((flipX * BORDER_FLIPPED_X) | (flipY * BORDER_FLIPPED_Y));
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+static void borderKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	int index[BORDER_LANES];
+	double x[BORDER_LANES], y[BORDER_LANES], velX[BORDER_LANES], velY[BORDER_LANES], radius[BORDER_LANES];
+	unsigned char events[BORDER_LANES];
+	
+	for(int group = start; group < end; group += BORDER_LANES){
+		
+		int lanes = min(BORDER_LANES, end - group);
+		
+		for(int lane = 0; lane < lanes; lane++){
+			
+			int i = sim->borderOrder ? sim->borderOrder[group + lane] : (group + lane);
+			
+			index[lane] = i;
+			x[lane] = sim->particles[i].x;
+			y[lane] = sim->particles[i].y;
+			velX[lane] = sim->particles[i].velocityX;
+			velY[lane] = sim->particles[i].velocityY;
+			radius[lane] = 0.5 * sim->particleSizes[sim->particles[i].type];
+			
+		}
+		
+		borderLanes(lanes, x, y, velX, velY, radius, events);
+		
+		for(int lane = 0; lane < lanes; lane++){
+			
+			int i = index[lane];
+			
+			sim->particles[i].x = x[lane];
+			sim->particles[i].y = y[lane];
+			sim->particles[i].velocityX = velX[lane];
+			sim->particles[i].velocityY = velY[lane];
+			sim->borderEvents[i] = events[lane];
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// A bounce sends the bonded partner back too, unless the partner bounced
+// off the same border itself. Bonded partners always take the same sub-steps,
+// so the partner was checked in this pass as well.
+// The old pass flipped the partner straight away, so a partner that was
+// checked after it saw the flipped velocity, and could bounce both of them
+// back again. Here every particle is checked first, so in that case the
+// result is different, but it doesn't depend on the order or the threads
+static inline void finishBorderEvents(const int* restrict order, int count){
+	
+	particle unpacked, unpackedPartner;
+	
+	for(int k = 0; k < count; k++){
+		
+		int i = order ? order[k] : k;
+		
+		if(sim->borderEvents[i] == 0){
+			
+			continue;
+			
+		}
+		
+		if(sim->borderEvents[i] & BORDER_ABSORBED){
+			
+			queueParticleRemoval(i);
+			
+			continue;
+			
+		}
+		
+		particle* current = loadParticle(i, &unpacked);
+		
+		current->nearestNeighbour = -1;
+		current->collidingAwayFrom = -1;
+		
+		storeLinks(i, current);
+		
+		int partner = current->bondingWith;
+		
+		if(partner > -1){
+			
+			unsigned char flipped = sim->borderEvents[i] & ~sim->borderEvents[partner];
+			particle* bonded = loadParticle(partner, &unpackedPartner);
+			
+			bonded->velocityX = (flipped & BORDER_FLIPPED_X) ? -bonded->velocityX : bonded->velocityX;
+			bonded->velocityY = (flipped & BORDER_FLIPPED_Y) ? -bonded->velocityY : bonded->velocityY;
+			bonded->nearestNeighbour = -1;
+			bonded->collidingAwayFrom = -1;
+			
+			// turning a half round is just its sign bit, so a compact partner bounces back exactly
+			storeLinks(partner, bonded);
+			storeVelocity(partner, bonded);
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// border collision for count particles, all of them if order is 0
+static inline void handleBorderCollision(const int* restrict order, int count){
+	
+	if(!(sim->options->ENABLE_BORDER_COLLISION || sim->options->ENABLE_BORDER_WRAP || sim->options->ENABLE_BORDER_ABSORB)){
+		
+		return;
+		
+	}
+	
+	sim->borderOrder = order;
+	
+	runParallelFor(0, count, BORDER_CHUNK, borderKernel);
+	
+	finishBorderEvents(order, count);
+	
+	return;
+	
+}
+
+// Particles are spawned all over the window, so the particles next to each other
+// on screen end up all over memory. Every REORDER_INTERVAL steps the particles are
+// sorted by the Z-order (Morton) code of their grid cell, which walks the grid in
+// small squares, so particles that are close on screen are close in memory too
+
+// how many particles each reorder task moves
+#define REORDER_CHUNK 4096
+
+// put a zero bit in front of each of the bottom 16 bits
+static inline Uint32 spreadBits(Uint32 value){
+	
+	value &= 0x0000FFFF;
+	value = (value | (value << 8)) & 0x00FF00FF;
+	value = (value | (value << 4)) & 0x0F0F0F0F;
+	value = (value | (value << 2)) & 0x33333333;
+	value = (value | (value << 1)) & 0x55555555;
+	
+	return value;
+	
+}
+
+static void reorderTargetsKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int position = start; position < end; position++){
+		
+		sim->reorderedTo[sim->mortonOrder[position]] = position;
+		
+	}
+	
+	return;
+	
+}
+
+// copy the particles into their new places, and fix the numbers they
+// keep of other particles on the way
+static void reorderGatherKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int position = start; position < end; position++){
+		
+		particle* restrict moved = &sim->reorderBuffer[position];
+		
+		*moved = sim->particles[sim->mortonOrder[position]];
+		
+		// numbers from before a removal this step have to be fixed first
+		int nearest = sim->removalPending ? remapRemoved(moved->nearestNeighbour) : moved->nearestNeighbour;
+		int awayFrom = sim->removalPending ? remapRemoved(moved->collidingAwayFrom) : moved->collidingAwayFrom;
+		
+		// in a slab process they can be below -1 too, which is a handle slot
+		// (see encodeSlabReference()) and doesn't change in a reorder
+		moved->nearestNeighbour = (nearest > -1) ? sim->reorderedTo[nearest] : nearest;
+		moved->collidingAwayFrom = (awayFrom > -1) ? sim->reorderedTo[awayFrom] : awayFrom;
+		
+	}
+	
+	return;
+	
+}
+
+// point the handles at the new numbers, then use them to find the bond partners.
+// Every handle has to be moved before any bond is looked up
+static void moveHandlesKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int i = start; i < end; i++){
+		
+		moveParticleHandle(i);
+		
+	}
+	
+	return;
+	
+}
+
+static void resolveBondsKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int i = start; i < end; i++){
+		
+		sim->particles[i].bondingWith = resolveParticleHandle(sim->particles[i].bondedTo);
+		
+	}
+	
+	return;
+	
+}
+
+// sort the particles into Morton order. The radix sort is stable, so particles
+// in the same cell keep their order and the result doesn't depend on the threads
+static inline void reorderParticles(){
+	
+	if(sim->length < 2){
+		
+		return;
+		
+	}
+	
+	buildSpatialGrid();
+	
+	Uint32 largestKey = 0;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		Uint32 column = (Uint32)sim->grid.cellColumn[sim->grid.particleCell[i]];
+		Uint32 row = (Uint32)sim->grid.cellRow[sim->grid.particleCell[i]];
+		
+		sim->mortonKeys[i] = spreadBits(column) | (spreadBits(row) << 1);
+		sim->mortonOrder[i] = i;
+		
+		if(sim->mortonKeys[i] > largestKey){
+			
+			largestKey = sim->mortonKeys[i];
+			
+		}
+		
+	}
+	
+	// 8 bits at a time, stopping once the rest of the bits are all zero
+	for(int shift = 0; (shift < 32) && ((largestKey >> shift) != 0); shift += 8){
+		
+		int bucketStart[257] = {0};
+		
+		for(int i = 0; i < sim->length; i++){
+			
+			bucketStart[((sim->mortonKeys[i] >> shift) & 0xFF) + 1]++;
+			
+		}
+		
+		for(int bucket = 1; bucket < 257; bucket++){
+			
+			bucketStart[bucket] += bucketStart[bucket - 1];
+			
+		}
+		
+		for(int i = 0; i < sim->length; i++){
+			
+			int position = bucketStart[(sim->mortonKeys[i] >> shift) & 0xFF]++;
+			
+			sim->mortonKeysSorted[position] = sim->mortonKeys[i];
+			sim->mortonOrderSorted[position] = sim->mortonOrder[i];
+			
+		}
+		
+		Uint32* restrict keys = sim->mortonKeys;
+		sim->mortonKeys = sim->mortonKeysSorted;
+		sim->mortonKeysSorted = keys;
+		
+		int* restrict order = sim->mortonOrder;
+		sim->mortonOrder = sim->mortonOrderSorted;
+		sim->mortonOrderSorted = order;
+		
+	}
+	
+	runParallelFor(0, sim->length, REORDER_CHUNK, reorderTargetsKernel);
+	runParallelFor(0, sim->length, REORDER_CHUNK, reorderGatherKernel);
+	
+	particle* restrict sorted = sim->reorderBuffer;
+	sim->reorderBuffer = sim->particles;
+	sim->particles = sorted;
+	
+	runParallelFor(0, sim->length, REORDER_CHUNK, moveHandlesKernel);
+	runParallelFor(0, sim->length, REORDER_CHUNK, resolveBondsKernel);
+	
+	// the removal numbers have been dealt with, and the lists
+	// are rebuilt so their entries are in the new order too
+	sim->removalPending = 0;
+	sim->neighbourBuiltLength = -1;
+	sim->grid.isStale = 1;
+	
+	return;
+	
+}
+
+// check if any particle has moved more than half the skin since the lists
+// were built. If two particles both moved towards each other by less than half the skin,
+// they can't have closed a gap bigger than the skin, so the old lists are still good
+static inline char neighbourListsNeedRebuild(){
+	
+	if(sim->length != sim->neighbourBuiltLength){
+		
+		return 1;
+		
+	}
+	
+	double halfSkinSquared = 0.25 * sim->options->NEIGHBOUR_SKIN * sim->options->NEIGHBOUR_SKIN;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		double dx = minimumImage(sim->particles[i].x - sim->neighbourBuiltX[i], (double)sim->options->WORLD_WIDTH);
+		double dy = minimumImage(sim->particles[i].y - sim->neighbourBuiltY[i], (double)sim->options->WORLD_HEIGHT);
+		
+		if(((dx * dx) + (dy * dy)) > halfSkinSquared){
+			
+			return 1;
+			
+		}
+		
+	}
+	
+	return 0;
+	
+}
+
+// go through every particle within the cut off of particle i (plus the skin).
+// If list is 0 we only count them, otherwise they get written to the list
+static inline int findNeighbours(int i, int* restrict list){
+	
+	int found = 0;
+	
+	double xa = xOf(i);
+	double ya = yOf(i);
+	double radiusA = 0.5 * sim->particleSizes[typeOf(i)];
+	
+	int column = sim->grid.cellColumn[sim->grid.particleCell[i]];
+	int row = sim->grid.cellRow[sim->grid.particleCell[i]];
+	
+	// the block of cells around ours. Without wrapping it stops at the edges,
+	// with wrapping it goes round, but never visits the same cell twice
+	int firstRow = max(row - 1, 0);
+	int lastRow = min(row + 1, sim->grid.rows - 1);
+	int firstColumn = max(column - 1, 0);
+	int lastColumn = min(column + 1, sim->grid.columns - 1);
+	
+	if(sim->options->ENABLE_BORDER_WRAP){
+		
+		firstRow = (sim->grid.rows < 3) ? 0 : (row - 1);
+		lastRow = (sim->grid.rows < 3) ? (sim->grid.rows - 1) : (row + 1);
+		firstColumn = (sim->grid.columns < 3) ? 0 : (column - 1);
+		lastColumn = (sim->grid.columns < 3) ? (sim->grid.columns - 1) : (column + 1);
+		
+	}
+	
+	for(int blockRow = firstRow; blockRow <= lastRow; blockRow++){
+		
+		int cellRow = (blockRow + sim->grid.rows) % sim->grid.rows;
+		
+		for(int blockColumn = firstColumn; blockColumn <= lastColumn; blockColumn++){
+			
+			int cell = gridCellAt(cellRow, (blockColumn + sim->grid.columns) % sim->grid.columns);
+			
+			if(cell == -1){ continue; }
+			
+			for(int n = sim->grid.cellStart[cell]; n < sim->grid.cellStart[cell + 1]; n++){
+				
+				int j = sim->grid.particleIndices[n];
+				
+				if(i == j){ continue; }
+				
+				double dx = minimumImage(xa - xOf(j), (double)sim->options->WORLD_WIDTH);
+				double dy = minimumImage(ya - yOf(j), (double)sim->options->WORLD_HEIGHT);
+				
+				// same cut off as the collision check, plus the skin
+				double cutOff = radiusA + (0.5 * sim->particleSizes[typeOf(j)]) + 1.0 + sim->options->NEIGHBOUR_SKIN;
+				
+				if(((dx * dx) + (dy * dy)) < (cutOff * cutOff)){
+					
+					if(list){
+						
+						list[found] = j;
+						
+					}
+					
+					found++;
+					
+				}
+				
+			}
+			
+		}
+		
+	}
+	
+	return found;
+	
+}
+
+static void countNeighboursKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int n = start; n < end; n++){
+		
+		int i = sim->grid.particleIndices[n];
+		
+		sim->neighbourCount[i] = findNeighbours(i, 0);
+		
+	}
+	
+	return;
+	
+}
+
+// insertion sort, the lists are short and usually nearly sorted already
+static inline void sortNeighbourList(int* restrict list, int count){
+	
+	for(int k = 1; k < count; k++){
+		
+		int j = list[k];
+		int slot = k;
+		
+		while((slot > 0) && (list[slot - 1] > j)){
+			
+			list[slot] = list[slot - 1];
+			slot--;
+			
+		}
+		
+		list[slot] = j;
+		
+	}
+	
+	return;
+	
+}
+
+static void fillNeighboursKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int n = start; n < end; n++){
+		
+		int i = sim->grid.particleIndices[n];
+		int* restrict list = sim->neighbourIndices + sim->neighbourStart[i];
+		
+		findNeighbours(i, list);
+		
+		// the cells come in any order, so sort the list to keep the
+		// same order (and the same results) as checking every particle
+		sortNeighbourList(list, sim->neighbourCount[i]);
+		
+		sim->neighbourBuiltX[i] = sim->particles[i].x;
+		sim->neighbourBuiltY[i] = sim->particles[i].y;
+		
+	}
+	
+	return;
+	
+}
+
+// rebuild every particle's neighbour list from scratch.
+// The cut off is never bigger than a grid cell, so we only have to look through
+// the 3x3 cells around each particle. The workers count the neighbours first so
+// everyone knows where their list starts, then go around again to fill them in
+static inline void buildNeighbourLists(){
+	
+	buildSpatialGrid();
+	buildCellTasks();
+	
+	runWorkerTasks(&sim->cellTasks, countNeighboursKernel);
+	
+	int total = 0;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		sim->neighbourStart[i] = total;
+		total += sim->neighbourCount[i];
+		
+	}
+	
+	// out of room, double the size of the list until it fits
+	if(total > sim->neighbourCapacity){
+		
+		while(total > sim->neighbourCapacity){
+			
+			sim->neighbourCapacity = (sim->neighbourCapacity > 0) ? (sim->neighbourCapacity << 1) : 1024;
+			
+		}
+		
+		sim->neighbourIndices = realloc(sim->neighbourIndices, (size_t)sim->neighbourCapacity * sizeof(int));
+		
+		if(sim->neighbourIndices == 0){ exit(0); }
+		
+	}
+	
+	runWorkerTasks(&sim->cellTasks, fillNeighboursKernel);
+	
+	sim->neighbourBuiltLength = sim->length;
+	
+	return;
+	
+}
+
+// is j, distance away, nearer to a than its nearest neighbour so far? The same
+// distance goes to the smaller handle
+static inline char isNearerNeighbour(const particle* restrict a, int j, double distance){
+	
+	if(distance != a->nearestNeighbourDistance){
+		
+		return distance < a->nearestNeighbourDistance;
+		
+	}
+	
+	return (a->nearestNeighbour == -1) || (handleSlotOf(j) < handleSlotOf(a->nearestNeighbour));
+	
+}
+
+// check particle i against the neighbours given (its neighbour list, in ascending
+// order), and remember the closest one it's touching and the one with the smallest
+// handle it could bond with
+static inline void interactParticle(int i, const int* restrict neighbours, int count){
+	
+	particle unpacked;
+	particle* a = loadParticle(i, &unpacked);
+	
+	// a nearest neighbour it's stopped touching is forgotten, so it's always one
+	// it's touching (only the nearest distance it's been is remembered)
+	int nearest = a->nearestNeighbour;
+	
+	if((nearest > -1) && !areTouching(a->x, a->y, a->type, xOf(nearest), yOf(nearest), typeOf(nearest))){
+		
+		a->nearestNeighbour = -1;
+		
+	}
+	
+	// we need to check if the particle is colliding with anything
+	char hasCollided = 0;
+	
+	for(int n = 0; n < count; n++){
+		
+		int j = neighbours[n];
+		
+		// particles that are bonded do not act on any force against each other, they simply
+		// behave as one big, with mass equal to the sum of the two particles, FOR NOW.....
+		if(a->bondingWith == j){
+			
+			continue;
+			
+		}
+		
+		// the other workers are changing j's neighbours, so only the parts of j that stay put are read
+		int typeB = typeOf(j);
+		
+		// copy to the stack for faster processing & syntatic sugar :P
+		double xa = a->x;
+		double ya = a->y;
+		double radiusA = 0.5 * sim->particleSizes[a->type];
+		
+		double xb = xOf(j);
+		double yb = yOf(j);
+		double radiusB = 0.5 * sim->particleSizes[typeB];
+		
+		// getting the distance with good old Pythagoras' Theorem
+		double dx = minimumImage(xa - xb, (double)sim->options->WORLD_WIDTH);
+		double dy = minimumImage(ya - yb, (double)sim->options->WORLD_HEIGHT);
+		double distance = sqrt(((dx * dx) + (dy * dy)));
+		
+		// check if the distance between them is
+		// less than their radiuses combined
+		// the + 1 is for floating point error
+		if(distance < (radiusA + radiusB + 1.0)){
+			
+			hasCollided = 1;
+			
+			if(a->nearestNeighbour == -1){
+				
+				a->nearestNeighbourDistance = radiusA + radiusB + 2.0;
+				
+			}
+			
+			switch (a->type){
+			
+				case red_particle:
+					
+					if(typeB == red_particle){
+						
+						if(isNearerNeighbour(a, j, distance)){
+							
+							a->nearestNeighbourDistance = distance;
+							a->nearestNeighbour = j;
+							
+						}
+						
+					}
+					
+					else if(typeB == blue_particle){
+						
+						if((a->bondingWith == -1) && (bondOf(j) == -1)){
+							
+							// remember the one with the smallest handle, the bond is made after the workers finish
+							if((sim->bondCandidate[i] == -1) || (handleSlotOf(j) < handleSlotOf(sim->bondCandidate[i]))){
+								
+								sim->bondCandidate[i] = j;
+								
+							}
+							
+						}
+						
+						else{
+							
+							if(isNearerNeighbour(a, j, distance)){
+								
+								a->nearestNeighbourDistance = distance;
+								a->nearestNeighbour = j;
+								
+							}
+							
+						}
+						
+					}
+					
+					break;
+					
+				case blue_particle:
+					
+					if(typeB == blue_particle){
+						
+						if(isNearerNeighbour(a, j, distance)){
+							
+							a->nearestNeighbourDistance = distance;
+							a->nearestNeighbour = j;
+							
+						}
+							
+					}
+					
+					else if(typeB == red_particle){
+						
+						if((a->bondingWith == -1) && (bondOf(j) == -1)){
+							
+							// remember the one with the smallest handle, the bond is made after the workers finish
+							if((sim->bondCandidate[i] == -1) || (handleSlotOf(j) < handleSlotOf(sim->bondCandidate[i]))){
+								
+								sim->bondCandidate[i] = j;
+								
+							}
+							
+						}
+						
+						else{
+							
+							if(isNearerNeighbour(a, j, distance)){
+								
+								a->nearestNeighbourDistance = distance;
+								a->nearestNeighbour = j;
+								
+							}
+							
+						}
+						
+					}
+					
+					break;
+					
+				case green_particle:
+					
+					break;
+					
+				case yellow_particle:
+					
+					break;
+					
+				case pink_particle:
+					
+					break;
+					
+				default:
+					
+					break;
+					
+			}
+			
+			continue;
+			
+		}
+		
+	}
+	
+	if(hasCollided == 0){
+		
+		a->nearestNeighbour = -1;
+		
+	}
+	
+	storeLinks(i, a);
+	
+	return;
+	
+}
+
+// check a range of particles for collisions, then update their closest neighbours.
+// Only the particles in the neighbour list can be close enough to touch.
+// Each particle only writes to itself here, so the workers can run this on
+// any part of the grid at the same time
+static void interactionKernel(int start, int end, int workerNum){
+	
+	Uint64 candidatePairs = 0;
+	
+	for(int position = start; position < end; position++){
+		
+		int i = sim->grid.particleIndices[position];
+		
+		// point everything at where the particles are after the last removal
+		if(sim->removalPending){
+			
+			sim->particles[i].nearestNeighbour = remapRemoved(sim->particles[i].nearestNeighbour);
+			sim->particles[i].collidingAwayFrom = remapRemoved(sim->particles[i].collidingAwayFrom);
+			
+			if(sim->remapNeighbourLists){
+				
+				int kept = sim->neighbourStart[i];
+				
+				for(int n = sim->neighbourStart[i]; n < (sim->neighbourStart[i] + sim->neighbourCount[i]); n++){
+					
+					int j = remapRemoved(sim->neighbourIndices[n]);
+					
+					if(j > -1){
+						
+						sim->neighbourIndices[kept] = j;
+						kept++;
+						
+					}
+					
+				}
+				
+				sim->neighbourCount[i] = kept - sim->neighbourStart[i];
+				
+				// moved particles have lower numbers now, put them back in order
+				sortNeighbourList(sim->neighbourIndices + sim->neighbourStart[i], sim->neighbourCount[i]);
+				
+			}
+			
+		}
+		
+		interactParticle(i, sim->neighbourIndices + sim->neighbourStart[i], sim->neighbourCount[i]);
+		
+		candidatePairs += (Uint64)sim->neighbourCount[i];
+		
+	}
+	
+	sim->workerMetrics[workerNum].candidatePairs += candidatePairs;
+	
+	return;
+	
+}
+
+// the same as interactionKernel, but the neighbours are found as it goes
+static void compactInteractionKernel(int start, int end, int workerNum){
+	
+	Uint64 candidatePairs = 0;
+	
+	for(int position = start; position < end; position++){
+		
+		int i = sim->grid.particleIndices[position];
+		
+		// point everything at where the particles are after the last removal
+		if(sim->removalPending){
+			
+			sim->compact.nearestNeighbour[i] = remapRemoved(sim->compact.nearestNeighbour[i]);
+			sim->compact.collidingAwayFrom[i] = remapRemoved(sim->compact.collidingAwayFrom[i]);
+			
+		}
+		
+		int count = findNeighbours(i, 0);
+		
+		// out of room, double the size of the list until it fits
+		if(count > sim->compactNeighbourCapacity[workerNum]){
+			
+			while(count > sim->compactNeighbourCapacity[workerNum]){
+				
+				sim->compactNeighbourCapacity[workerNum] = (sim->compactNeighbourCapacity[workerNum] > 0) ? (sim->compactNeighbourCapacity[workerNum] << 1) : 64;
+				
+			}
+			
+			sim->compactNeighbours[workerNum] = realloc(sim->compactNeighbours[workerNum], (size_t)sim->compactNeighbourCapacity[workerNum] * sizeof(int));
+			
+			if(sim->compactNeighbours[workerNum] == 0){ exit(0); }
+			
+		}
+		
+		int* restrict list = sim->compactNeighbours[workerNum];
+		
+		findNeighbours(i, list);
+		sortNeighbourList(list, count);
+		
+		interactParticle(i, list, count);
+		
+		candidatePairs += (Uint64)count;
+		
+	}
+	
+	sim->workerMetrics[workerNum].candidatePairs += candidatePairs;
+	
+	return;
+	
+}
+
+// If particles are touching each other, we need to decide what to do with each 
+static inline void handleParticleInteraction(){ // new name, suits it better
+	
+	// check for collision with other particles
+	if(sim->options->ENABLE_PARTICLE_COLLISION){
+		
+		sim->remapNeighbourLists = sim->removalPending;
+		
+		if(sim->isCompact){
+			
+			// without lists, the grid is built again every step
+			buildSpatialGrid();
+			buildCellTasks();
+			
+		}
+		
+		else if(neighbourListsNeedRebuild()){
+			
+			buildNeighbourLists();
+			
+			// the new lists already have the right numbers in them
+			sim->remapNeighbourLists = 0;
+			
+		}
+		
+		else if(sim->cellTasksLength != sim->length){
+			
+			// particles were removed. The lists are still fine, but
+			// the tasks have to be made again for the particles that are left
+			updateSpatialGrid();
+			buildCellTasks();
+			
+		}
+		
+		for(int i = 0; i < sim->length; i++){
+			
+			sim->bondCandidate[i] = -1;
+			
+		}
+		
+		runWorkerTasks(&sim->cellTasks, sim->isCompact ? compactInteractionKernel : interactionKernel);
+		
+		sim->removalPending = 0;
+		
+		// now make the bonds in handle order, skipping any particle that got bonded
+		// to someone else earlier on. The contacts aren't collected until
+		// after the bonds, so their room holds the pairs until then
+		int pairs = 0;
+		
+		for(int i = 0; i < sim->length; i++){
+			
+			if(sim->bondCandidate[i] > -1){
+				
+				sim->contacts[pairs].particleNumA = i;
+				sim->contacts[pairs].particleNumB = sim->bondCandidate[i];
+				pairs++;
+				
+			}
+			
+		}
+		
+		sortContactsByHandle(pairs);
+		
+		for(int k = 0; k < pairs; k++){
+			
+			int i = sim->contacts[k].particleNumA;
+			int j = sim->contacts[k].particleNumB;
+			
+			if((bondOf(i) == -1) && (bondOf(j) == -1)){
+				
+				handleRedBlueBond(i, j);
+				
+			}
+			
+		}
+		
+		handleCollision();
+		
+	}
+	
+	return;
+	
+}
+
+// copy the particles before the normal pass changes them
+static inline void startReferenceCheck(){
+	
+	memcpy(sim->referenceParticles, sim->particles, (size_t)sim->length * sizeof(particle));
+	
+	sim->referenceRemovalPending = sim->removalPending;
+	
+	return;
+	
+}
+
+// check one value against the reference. The first one that is off by more than
+// REFERENCE_TOLERANCE (relative to its size, or absolute below 1) is printed.
+// The step is numbered like the state hashes, the one this step will print
+static inline void referenceDiffers(const char* restrict pass, const char* restrict name, int particleNum, double value, double reference){
+	
+	double allowed = sim->options->REFERENCE_TOLERANCE * maxDouble(1.0, maxDouble(fabs(value), fabs(reference)));
+	
+	// NaN is never less than or equal to anything
+	if(fabs(value - reference) <= allowed){
+		
+		return;
+		
+	}
+	
+	if((sim->referenceStepsDiverged == 0) && (sim->referenceHasDiverged == 0)){
+		
+		if(particleNum > -1){
+			
+			printf("reference check: step %llu %s particle %d (handle %016llx) %s is %.17g, reference %.17g\n", (unsigned long long)(sim->simulationStep + 1),
+				pass, particleNum, (unsigned long long)sim->particles[particleNum].handle, name, value, reference);
+			
+		}
+		
+		else{
+			
+			printf("reference check: step %llu %s total %s is %.17g, reference %.17g\n", (unsigned long long)(sim->simulationStep + 1), pass, name, value, reference);
+			
+		}
+		
+		fflush(stdout);
+		
+	}
+	
+	sim->referenceHasDiverged = 1;
+	
+	return;
+	
+}
+
+// compare the normal result with the copy the reference has worked on
+static inline void compareWithReference(const char* restrict pass){
+	
+	double momentum[2][2] = {{0.0, 0.0}, {0.0, 0.0}};
+	double energy[2] = {0.0, 0.0};
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		const particle* restrict normal = &sim->particles[i];
+		const particle* restrict reference = &sim->referenceParticles[i];
+		
+		// only the first difference is printed, the rest are probably because of it
+		referenceDiffers(pass, "x", i, normal->x, reference->x);
+		referenceDiffers(pass, "y", i, normal->y, reference->y);
+		referenceDiffers(pass, "velocityX", i, normal->velocityX, reference->velocityX);
+		referenceDiffers(pass, "velocityY", i, normal->velocityY, reference->velocityY);
+		referenceDiffers(pass, "mass", i, normal->mass, reference->mass);
+		referenceDiffers(pass, "bondingWith", i, normal->bondingWith, reference->bondingWith);
+		referenceDiffers(pass, "nearestNeighbour", i, normal->nearestNeighbour, reference->nearestNeighbour);
+		referenceDiffers(pass, "collidingAwayFrom", i, normal->collidingAwayFrom, reference->collidingAwayFrom);
+		
+		momentum[0][0] += normal->mass * normal->velocityX;
+		momentum[0][1] += normal->mass * normal->velocityY;
+		momentum[1][0] += reference->mass * reference->velocityX;
+		momentum[1][1] += reference->mass * reference->velocityY;
+		
+		energy[0] += 0.5 * normal->mass * ((normal->velocityX * normal->velocityX) + (normal->velocityY * normal->velocityY));
+		energy[1] += 0.5 * reference->mass * ((reference->velocityX * reference->velocityX) + (reference->velocityY * reference->velocityY));
+		
+	}
+	
+	referenceDiffers(pass, "momentumX", -1, momentum[0][0], momentum[1][0]);
+	referenceDiffers(pass, "momentumY", -1, momentum[0][1], momentum[1][1]);
+	referenceDiffers(pass, "energy", -1, energy[0], energy[1]);
+	
+	return;
+	
+}
+
+// the border, one particle at a time on the copy. Each particle bounces off
+// what it's past, then the bonded partners follow once every particle has been
+// done, the same rule the lanes have
+static inline void referenceBorder(particle* restrict copy){
+	
+	if(!(sim->options->ENABLE_BORDER_COLLISION || sim->options->ENABLE_BORDER_WRAP || sim->options->ENABLE_BORDER_ABSORB)){
+		
+		return;
+		
+	}
+	
+	double width = (double)sim->options->WORLD_WIDTH;
+	double height = (double)sim->options->WORLD_HEIGHT;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		double radius = 0.5 * sim->particleSizes[copy[i].type];
+		int events = 0;
+		
+		if(sim->options->ENABLE_BORDER_WRAP){
+			
+			copy[i].x -= width * floor(copy[i].x / width);
+			copy[i].y -= height * floor(copy[i].y / height);
+			
+			if(copy[i].x >= width){ copy[i].x -= width; }
+			if(copy[i].y >= height){ copy[i].y -= height; }
+			
+		}
+		
+		else if(sim->options->ENABLE_BORDER_ABSORB){
+			
+			if(((copy[i].x + radius) < 0.0) || ((copy[i].x - radius) > width) || ((copy[i].y + radius) < 0.0) || ((copy[i].y - radius) > height)){
+				
+				events = BORDER_ABSORBED;
+				
+			}
+			
+			// the normal pass queues it to be removed next step
+			referenceDiffers("border", "absorbed", i, sim->isQueuedForRemoval[i], events == BORDER_ABSORBED);
+			
+		}
+		
+		else{
+			
+			if((copy[i].x - radius) < 0.0){
+				
+				if(copy[i].velocityX < 0.0){ copy[i].velocityX = -copy[i].velocityX; events |= BORDER_FLIPPED_X; }
+				if(sim->options->ENABLE_BORDER_CLAMP){ copy[i].x = radius; }
+				
+			}
+			
+			else if((copy[i].x + radius) > width){
+				
+				if(copy[i].velocityX > 0.0){ copy[i].velocityX = -copy[i].velocityX; events |= BORDER_FLIPPED_X; }
+				if(sim->options->ENABLE_BORDER_CLAMP){ copy[i].x = width - radius; }
+				
+			}
+			
+			if((copy[i].y - radius) < 0.0){
+				
+				if(copy[i].velocityY < 0.0){ copy[i].velocityY = -copy[i].velocityY; events |= BORDER_FLIPPED_Y; }
+				if(sim->options->ENABLE_BORDER_CLAMP){ copy[i].y = radius; }
+				
+			}
+			
+			else if((copy[i].y + radius) > height){
+				
+				if(copy[i].velocityY > 0.0){ copy[i].velocityY = -copy[i].velocityY; events |= BORDER_FLIPPED_Y; }
+				if(sim->options->ENABLE_BORDER_CLAMP){ copy[i].y = height - radius; }
+				
+			}
+			
+		}
+		
+		sim->referenceScratch[i] = events;
+		
+	}
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		int events = sim->referenceScratch[i];
+		
+		if((events == 0) || (events == BORDER_ABSORBED)){
+			
+			continue;
+			
+		}
+		
+		copy[i].nearestNeighbour = -1;
+		copy[i].collidingAwayFrom = -1;
+		
+		int partner = copy[i].bondingWith;
+		
+		if(partner > -1){
+			
+			// the partner only turns round on the borders it didn't bounce off itself
+			if((events & BORDER_FLIPPED_X) && !(sim->referenceScratch[partner] & BORDER_FLIPPED_X)){ copy[partner].velocityX = -copy[partner].velocityX; }
+			if((events & BORDER_FLIPPED_Y) && !(sim->referenceScratch[partner] & BORDER_FLIPPED_Y)){ copy[partner].velocityY = -copy[partner].velocityY; }
+			
+			copy[partner].nearestNeighbour = -1;
+			copy[partner].collidingAwayFrom = -1;
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// the elastic collision, on the copy
+static inline void referenceCollision(particle* restrict copy, int a, int b, double distance){
+	
+	double nx = minimumImage(copy[b].x - copy[a].x, (double)sim->options->WORLD_WIDTH) / distance;
+	double ny = minimumImage(copy[b].y - copy[a].y, (double)sim->options->WORLD_HEIGHT) / distance;
+	
+	double p = 2.0 * ((nx * (copy[a].velocityX - copy[b].velocityX)) + (ny * (copy[a].velocityY - copy[b].velocityY))) / (copy[a].mass + copy[b].mass);
+	
+	copy[a].velocityX -= p * copy[b].mass * nx;
+	copy[a].velocityY -= p * copy[b].mass * ny;
+	copy[b].velocityX += p * copy[a].mass * nx;
+	copy[b].velocityY += p * copy[a].mass * ny;
+	
+	// a bonded particle goes wherever its partner goes
+	if(copy[a].bondingWith > -1){
+		
+		copy[copy[a].bondingWith].velocityX = copy[a].velocityX;
+		copy[copy[a].bondingWith].velocityY = copy[a].velocityY;
+		
+	}
+	
+	if(copy[b].bondingWith > -1){
+		
+		copy[copy[b].bondingWith].velocityX = copy[b].velocityX;
+		copy[copy[b].bondingWith].velocityY = copy[b].velocityY;
+		
+	}
+	
+	return;
+	
+}
+
+// the bond, on the copy
+static inline void referenceBond(particle* restrict copy, int i, int j){
+	
+	double velocityX = (copy[i].velocityX + copy[j].velocityX) / 2.0;
+	double velocityY = (copy[i].velocityY + copy[j].velocityY) / 2.0;
+	double massI = copy[i].mass;
+	
+	copy[i].velocityX = velocityX;
+	copy[i].velocityY = velocityY;
+	copy[j].velocityX = velocityX;
+	copy[j].velocityY = velocityY;
+	
+	copy[i].mass += copy[j].mass;
+	copy[j].mass += massI;
+	
+	copy[i].bondingWith = j;
+	copy[j].bondingWith = i;
+	
+	return;
+	
+}
+
+// do contacts a and b (the particle that collected each one) share a particle?
+// A bonded partner counts, since the collision moves it too
+static inline char referenceContactsMeet(const particle* restrict copy, int a, int b){
+	
+	int touchedA[4] = {a, copy[a].nearestNeighbour, copy[a].bondingWith, copy[copy[a].nearestNeighbour].bondingWith};
+	int touchedB[4] = {b, copy[b].nearestNeighbour, copy[b].bondingWith, copy[copy[b].nearestNeighbour].bondingWith};
+	
+	for(int k = 0; k < 4; k++){
+		
+		for(int l = 0; l < 4; l++){
+			
+			if((touchedA[k] > -1) && (touchedA[k] == touchedB[l])){
+				
+				return 1;
+				
+			}
+			
+		}
+		
+	}
+	
+	return 0;
+	
+}
+
+// handleParticleInteraction() the slow way, on the copy, with none of its
+// code. Every particle is checked against every other one (a nearest neighbour
+// from before only counts if it's still touching), then:
+// - each particle bonds with the red or blue it could with the smallest handle,
+//   after every particle has been checked, going in handle order and skipping
+//   any that got bonded earlier on
+// - each particle collides with its nearest neighbour (the smaller handle if two
+//   are as near), unless it's already moving away from it. The contacts take the
+//   lowest colour none of the earlier ones they share a particle with has, and go
+//   colour by colour, in handle order
+static inline void referenceInteraction(particle* restrict copy){
+	
+	for(int i = 0; (i < sim->length) && sim->referenceRemovalPending; i++){
+		
+		copy[i].nearestNeighbour = remapRemoved(copy[i].nearestNeighbour);
+		copy[i].collidingAwayFrom = remapRemoved(copy[i].collidingAwayFrom);
+		
+	}
+	
+	// first, who each particle is touching. Only bonds from before this step count
+	for(int i = 0; i < sim->length; i++){
+		
+		char hasCollided = 0;
+		
+		sim->referenceScratch[i] = -1;
+		
+		int nearest = copy[i].nearestNeighbour;
+		
+		// a nearest neighbour it isn't touching now doesn't count
+		if(nearest > -1){
+			
+			double dx = minimumImage(copy[i].x - copy[nearest].x, (double)sim->options->WORLD_WIDTH);
+			double dy = minimumImage(copy[i].y - copy[nearest].y, (double)sim->options->WORLD_HEIGHT);
+			
+			if(sqrt((dx * dx) + (dy * dy)) >= ((0.5 * sim->particleSizes[copy[i].type]) + (0.5 * sim->particleSizes[copy[nearest].type]) + 1.0)){
+				
+				copy[i].nearestNeighbour = -1;
+				
+			}
+			
+		}
+		
+		for(int j = 0; j < sim->length; j++){
+			
+			if((i == j) || (copy[i].bondingWith == j)){
+				
+				continue;
+				
+			}
+			
+			double dx = minimumImage(copy[i].x - copy[j].x, (double)sim->options->WORLD_WIDTH);
+			double dy = minimumImage(copy[i].y - copy[j].y, (double)sim->options->WORLD_HEIGHT);
+			double distance = sqrt((dx * dx) + (dy * dy));
+			double touching = (0.5 * sim->particleSizes[copy[i].type]) + (0.5 * sim->particleSizes[copy[j].type]);
+			
+			if(distance >= (touching + 1.0)){
+				
+				continue;
+				
+			}
+			
+			hasCollided = 1;
+			
+			if(copy[i].nearestNeighbour == -1){
+				
+				copy[i].nearestNeighbourDistance = touching + 2.0;
+				
+			}
+			
+			// only red and blue do anything, and a red and a blue on their own can bond
+			char isRedOrBlue = (copy[i].type == red_particle) || (copy[i].type == blue_particle);
+			char isSameType = copy[i].type == copy[j].type;
+			char isOther = ((copy[i].type == red_particle) && (copy[j].type == blue_particle)) || ((copy[i].type == blue_particle) && (copy[j].type == red_particle));
+			
+			if(!isRedOrBlue || !(isSameType || isOther)){
+				
+				continue;
+				
+			}
+			
+			if(isOther && (copy[i].bondingWith == -1) && (copy[j].bondingWith == -1)){
+				
+				if((sim->referenceScratch[i] == -1) || ((Uint32)copy[j].handle < (Uint32)copy[sim->referenceScratch[i]].handle)){
+					
+					sim->referenceScratch[i] = j;
+					
+				}
+				
+				continue;
+				
+			}
+			
+			char isTied = (distance == copy[i].nearestNeighbourDistance) && (copy[i].nearestNeighbour > -1) &&
+				((Uint32)copy[j].handle < (Uint32)copy[copy[i].nearestNeighbour].handle);
+			
+			if((distance < copy[i].nearestNeighbourDistance) || isTied){
+				
+				copy[i].nearestNeighbourDistance = distance;
+				copy[i].nearestNeighbour = j;
+				
+			}
+			
+		}
+		
+		if(hasCollided == 0){
+			
+			copy[i].nearestNeighbour = -1;
+			
+		}
+		
+	}
+	
+	// then the bonds
+	for(int slot = 0; slot < sim->handleSlotsUsed; slot++){
+		
+		int i = particleAtSlot(slot);
+		int j = (i > -1) ? sim->referenceScratch[i] : -1;
+		
+		if((j > -1) && (copy[i].bondingWith == -1) && (copy[j].bondingWith == -1)){
+			
+			referenceBond(copy, i, j);
+			
+		}
+		
+	}
+	
+	// then the contacts. The scratch holds each particle's contact colour, -1 for none
+	for(int i = 0; i < sim->length; i++){
+		
+		sim->referenceScratch[i] = -1;
+		
+	}
+	
+	for(int slot = 0; slot < sim->handleSlotsUsed; slot++){
+		
+		int i = particleAtSlot(slot);
+		int j = (i > -1) ? copy[i].nearestNeighbour : -1;
+		
+		if((j == -1) || (copy[i].bondingWith > -1) || (copy[j].bondingWith > -1) || (copy[i].collidingAwayFrom == j)){
+			
+			continue;
+			
+		}
+		
+		copy[i].collidingAwayFrom = j;
+		
+		Uint64 taken = 0;
+		
+		for(int earlierSlot = 0; earlierSlot < slot; earlierSlot++){
+			
+			int earlier = particleAtSlot(earlierSlot);
+			
+			if((earlier > -1) && (sim->referenceScratch[earlier] > -1) && referenceContactsMeet(copy, i, earlier)){
+				
+				taken |= (Uint64)1 << sim->referenceScratch[earlier];
+				
+			}
+			
+		}
+		
+		// the last colour takes whatever is left
+		int colour = 0;
+		
+		while((colour < (MAX_CONTACT_COLOURS - 1)) && (taken & ((Uint64)1 << colour))){
+			
+			colour++;
+			
+		}
+		
+		sim->referenceScratch[i] = colour;
+		
+	}
+	
+	for(int colour = 0; colour < MAX_CONTACT_COLOURS; colour++){
+		
+		for(int slot = 0; slot < sim->handleSlotsUsed; slot++){
+			
+			int i = particleAtSlot(slot);
+			
+			if((i > -1) && (sim->referenceScratch[i] == colour)){
+				
+				referenceCollision(copy, i, copy[i].nearestNeighbour, copy[i].nearestNeighbourDistance);
+				
+			}
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// run a reference pass on the copy, then compare it with the normal result
+static inline void checkReferenceBorder(){
+	
+	referenceBorder(sim->referenceParticles);
+	
+	compareWithReference("border");
+	
+	return;
+	
+}
+
+static inline void checkReferenceInteraction(){
+	
+	referenceInteraction(sim->referenceParticles);
+	
+	compareWithReference("interaction");
+	
+	return;
+	
+}
+
+// count the step, once every pass in it has been checked
+static inline void finishReferenceCheck(){
+	
+	sim->referenceStepsChecked++;
+	sim->referenceStepsDiverged += (Uint64)sim->referenceHasDiverged;
+	sim->referenceHasDiverged = 0;
+	
+	return;
+	
+}
+
+// how many particles each sub-step task works on
+#define SUBSTEP_CHUNK 1024
+
+// how many levels a particle needs so that it moves no more than SUBSTEP_TRAVEL
+// of its radius in each step. Bonded particles move together, so they both take the faster one's
+static inline int particleSubStepLevel(int i){
+	
+	double speed = sqrt((sim->particles[i].velocityX * sim->particles[i].velocityX) + (sim->particles[i].velocityY * sim->particles[i].velocityY));
+	double travel = speed * sim->delta;
+	double allowed = sim->options->SUBSTEP_TRAVEL * 0.5 * sim->particleSizes[sim->particles[i].type];
+	
+	int level = 0;
+	
+	while((level < sim->options->MAX_SUBSTEP_LEVEL) && (travel > (allowed * (double)(1 << level)))){
+		
+		level++;
+		
+	}
+	
+	return level;
+	
+}
+
+static void subStepLevelKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int i = start; i < end; i++){
+		
+		int level = particleSubStepLevel(i);
+		
+		if(sim->particles[i].bondingWith > -1){
+			
+			level = max(level, particleSubStepLevel(sim->particles[i].bondingWith));
+			
+		}
+		
+		sim->subStepLevel[i] = (unsigned char)level;
+		
+	}
+	
+	return;
+	
+}
+
+// put every particle in a level and list the fast ones, highest level first
+static inline void sortSubStepLevels(){
+	
+	runParallelFor(0, sim->length, SUBSTEP_CHUNK, subStepLevelKernel);
+	
+	int counts[SUBSTEP_LEVEL_LIMIT + 1] = {0};
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		counts[sim->subStepLevel[i]]++;
+		
+	}
+	
+	sim->highestSubStepLevel = 0;
+	sim->subStepAtLeast[SUBSTEP_LEVEL_LIMIT + 1] = 0;
+	
+	for(int level = SUBSTEP_LEVEL_LIMIT; level > 0; level--){
+		
+		sim->subStepAtLeast[level] = sim->subStepAtLeast[level + 1] + counts[level];
+		
+		if((counts[level] > 0) && (sim->highestSubStepLevel == 0)){
+			
+			sim->highestSubStepLevel = level;
+			
+		}
+		
+	}
+	
+	// where the next particle of each level goes, in particle order inside each level
+	int next[SUBSTEP_LEVEL_LIMIT + 1];
+	
+	for(int level = 1; level <= SUBSTEP_LEVEL_LIMIT; level++){
+		
+		next[level] = sim->subStepAtLeast[level + 1];
+		
+	}
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		if(sim->subStepLevel[i] > 0){
+			
+			sim->subStepOrder[next[sim->subStepLevel[i]]] = i;
+			next[sim->subStepLevel[i]]++;
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+static void subStepMoveKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int k = start; k < end; k++){
+		
+		int i = sim->subStepOrder[k];
+		double moveDelta = sim->delta / (double)(1 << sim->subStepLevel[i]);
+		
+		sim->particles[i].x += sim->particles[i].velocityX * moveDelta;
+		sim->particles[i].y += sim->particles[i].velocityY * moveDelta;
+		
+	}
+	
+	return;
+	
+}
+
+static void subStepInteractionKernel(int start, int end, int workerNum){
+	
+	Uint64 candidatePairs = 0;
+	
+	for(int k = start; k < end; k++){
+		
+		int i = sim->subStepOrder[k];
+		
+		interactParticle(i, sim->neighbourIndices + sim->neighbourStart[i], sim->neighbourCount[i]);
+		
+		candidatePairs += (Uint64)sim->neighbourCount[i];
+		
+	}
+	
+	sim->workerMetrics[workerNum].candidatePairs += candidatePairs;
+	
+	return;
+	
+}
+
+// collide just the particles that moved this sub-step
+static inline void subStepInteraction(int moving){
+	
+	// only the moving particles can have gone past half the skin
+	double halfSkinSquared = 0.25 * sim->options->NEIGHBOUR_SKIN * sim->options->NEIGHBOUR_SKIN;
+	char needsRebuild = (sim->neighbourBuiltLength != sim->length);
+	
+	for(int k = 0; (k < moving) && (needsRebuild == 0); k++){
+		
+		int i = sim->subStepOrder[k];
+		double dx = minimumImage(sim->particles[i].x - sim->neighbourBuiltX[i], (double)sim->options->WORLD_WIDTH);
+		double dy = minimumImage(sim->particles[i].y - sim->neighbourBuiltY[i], (double)sim->options->WORLD_HEIGHT);
+		
+		needsRebuild = (((dx * dx) + (dy * dy)) > halfSkinSquared);
+		
+	}
+	
+	if(needsRebuild){
+		
+		buildNeighbourLists();
+		
+	}
+	
+	for(int k = 0; k < moving; k++){
+		
+		sim->bondCandidate[sim->subStepOrder[k]] = -1;
+		
+	}
+	
+	runParallelFor(0, moving, SUBSTEP_CHUNK, subStepInteractionKernel);
+	
+	for(int k = 0; k < moving; k++){
+		
+		int i = sim->subStepOrder[k];
+		int j = sim->bondCandidate[i];
+		
+		if((j > -1) && (sim->particles[i].bondingWith == -1) && (sim->particles[j].bondingWith == -1)){
+			
+			handleRedBlueBond(i, j);
+			
+		}
+		
+	}
+	
+	sim->contactCount = 0;
+	
+	for(int k = 0; k < moving; k++){
+		
+		collectContact(sim->subStepOrder[k]);
+		
+	}
+	
+	resolveContacts();
+	
+	return;
+	
+}
+
+// The whole step already moved every particle once, fast ones by only their
+// first sub-step. Now the rest of the sub-steps move and collide just the fast
+// particles. Sub-step s moves every level that takes a step at s, which is every
+// level at least the highest level minus the number of times 2 goes into s
+static inline void runSubSteps(){
+	
+	if((sim->options->MAX_SUBSTEP_LEVEL == 0) || (sim->highestSubStepLevel == 0)){
+		
+		return;
+		
+	}
+	
+	for(int subStep = 1; subStep < (1 << sim->highestSubStepLevel); subStep++){
+		
+		int twos = 0;
+		
+		while(((subStep >> twos) & 1) == 0){
+			
+			twos++;
+			
+		}
+		
+		int moving = sim->subStepAtLeast[sim->highestSubStepLevel - twos];
+		
+		runParallelFor(0, moving, SUBSTEP_CHUNK, subStepMoveKernel);
+		
+		handleBorderCollision(sim->subStepOrder, moving);
+		
+		if(sim->options->ENABLE_PARTICLE_COLLISION){
+			
+			subStepInteraction(moving);
+			
+		}
+		
+	}
+	
+	sim->grid.isStale = 1;
+	
+	return;
+	
+}
+
+// Stops the pull from blowing up when a particle is right on top of a
+// gravity point or line. In pixels
+#define FORCE_FIELD_SOFTENING 10.0
+
+// how many particles each worker task updates
+#define UPDATE_CHUNK 4096
+
+// Every force field runs over a block of particles while the block is still in
+// the cache, then the block is moved. So the particles are only read from memory
+// once per step, however many fields there are. This many particles fit in L1
+#define FORCE_FIELD_BLOCK 128
+
+// read a force field from the numbers after its name in config.txt.
+// Lines without enough numbers are ignored
+static inline void addForceField(forceFieldType type, const char* numbers){
+	
+	if(sim->forceFieldCount == MAX_FORCE_FIELDS){
+		
+		return;
+		
+	}
+	
+	forceField* restrict field = &sim->forceFields[sim->forceFieldCount];
+	int read = 0;
+	int needed = 0;
+	
+	memset(field, 0, sizeof(forceField));
+	field->type = type;
+	
+	switch(type){
+		
+		case uniformGravity:
+			
+			needed = 2;
+			read = sscanf(numbers, "%lf %lf", &field->strength, &field->angle);
+			
+			break;
+			
+		case pointGravity:
+			
+			needed = 3;
+			read = sscanf(numbers, "%lf %lf %lf", &field->x1, &field->y1, &field->strength);
+			
+			break;
+			
+		case lineGravity:
+			
+			needed = 5;
+			read = sscanf(numbers, "%lf %lf %lf %lf %lf", &field->x1, &field->y1, &field->x2, &field->y2, &field->strength);
+			
+			break;
+			
+		case movingLineGravity:
+			
+			needed = 8;
+			read = sscanf(numbers, "%lf %lf %lf %lf %lf %lf %lf %lf", &field->x1, &field->y1, &field->x2, &field->y2,
+				&field->strength, &field->amplitudeX, &field->amplitudeY, &field->frequency);
+			
+			break;
+			
+		case sineGravity:
+			
+			needed = 4;
+			read = sscanf(numbers, "%lf %lf %lf %lf", &field->minimum, &field->maximum, &field->frequency, &field->angle);
+			
+			break;
+			
+		case airDrag:
+			
+			needed = 1;
+			read = sscanf(numbers, "%lf", &field->strength);
+			
+			break;
+			
+	}
+	
+	if(read == needed){
+		
+		sim->forceFieldCount++;
+		
+	}
+	
+	return;
+	
+}
+
+// work out everything about the fields that is the same for every particle this step
+static inline void prepareForceFields(){
+	
+	double wave;
+	
+	for(int f = 0; f < sim->forceFieldCount; f++){
+		
+		forceField* restrict field = &sim->forceFields[f];
+		
+		field->scaledStrength = field->strength * sim->delta;
+		
+		switch(field->type){
+			
+			case uniformGravity:
+				
+				field->accelerationX = cos(field->angle * (M_PI / 180.0)) * field->scaledStrength;
+				field->accelerationY = sin(field->angle * (M_PI / 180.0)) * field->scaledStrength;
+				
+				break;
+				
+			case sineGravity:
+				
+				// goes between minimum and maximum frequency times a second
+				wave = 0.5 + (0.5 * sin(2.0 * M_PI * field->frequency * sim->simulationTime));
+				
+				field->scaledStrength = (field->minimum + ((field->maximum - field->minimum) * wave)) * sim->delta;
+				field->accelerationX = cos(field->angle * (M_PI / 180.0)) * field->scaledStrength;
+				field->accelerationY = sin(field->angle * (M_PI / 180.0)) * field->scaledStrength;
+				
+				break;
+				
+			case lineGravity:
+			case movingLineGravity:
+				
+				// the moving line swings back and forth by the amplitude
+				wave = (field->type == movingLineGravity) ? sin(2.0 * M_PI * field->frequency * sim->simulationTime) : 0.0;
+				
+				field->lineX = field->x1 + (field->amplitudeX * wave);
+				field->lineY = field->y1 + (field->amplitudeY * wave);
+				field->lineDX = field->x2 - field->x1;
+				field->lineDY = field->y2 - field->y1;
+				
+				// a line with no length is just a point
+				double lengthSquared = (field->lineDX * field->lineDX) + (field->lineDY * field->lineDY);
+				
+				field->inverseLengthSquared = (lengthSquared > 0.0) ? (1.0 / lengthSquared) : 0.0;
+				
+				break;
+				
+			case pointGravity:
+			case airDrag:
+				
+				break;
+				
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// The force fields and the update work on moving[start] to moving[end - 1].
+// That's the particles array itself, or a block of unpacked compact particles
+
+// how much mass friction and drag push against. A bonded particle's mass is
+// already both of theirs, and its partner has the same, so the pair is twice it.
+// The partner isn't looked up, as it might not be in the same block
+static inline double movingMass(const particle* restrict current){
+	
+	return (current->bondingWith > -1) ? (2.0 * current->mass) : current->mass;
+	
+}
+
+// the same pull everywhere, used by uniform and sine gravity
+static inline void applyUniformField(const forceField* restrict field, particle* restrict moving, int start, int end){
+	
+	for(int i = start; i < end; i++){
+		
+		moving[i].velocityX += field->accelerationX;
+		moving[i].velocityY += field->accelerationY;
+		
+	}
+	
+	return;
+	
+}
+
+// pulls towards a point, weaker with the distance squared
+static inline void applyPointField(const forceField* restrict field, particle* restrict moving, int start, int end){
+	
+	for(int i = start; i < end; i++){
+		
+		double dx = field->x1 - moving[i].x;
+		double dy = field->y1 - moving[i].y;
+		double distanceSquared = (dx * dx) + (dy * dy) + (FORCE_FIELD_SOFTENING * FORCE_FIELD_SOFTENING);
+		double pull = field->scaledStrength / (distanceSquared * sqrt(distanceSquared));
+		
+		moving[i].velocityX += dx * pull;
+		moving[i].velocityY += dy * pull;
+		
+	}
+	
+	return;
+	
+}
+
+// pulls towards the closest point on a line, weaker with the distance.
+// Used by line and moving line gravity
+static inline void applyLineField(const forceField* restrict field, particle* restrict moving, int start, int end){
+	
+	for(int i = start; i < end; i++){
+		
+		// how far along the line the closest point is, from 0 to 1
+		double along = (((moving[i].x - field->lineX) * field->lineDX) + ((moving[i].y - field->lineY) * field->lineDY)) * field->inverseLengthSquared;
+		
+		along = minDouble(maxDouble(along, 0.0), 1.0);
+		
+		double dx = (field->lineX + (along * field->lineDX)) - moving[i].x;
+		double dy = (field->lineY + (along * field->lineDY)) - moving[i].y;
+		double pull = field->scaledStrength / ((dx * dx) + (dy * dy) + (FORCE_FIELD_SOFTENING * FORCE_FIELD_SOFTENING));
+		
+		moving[i].velocityX += dx * pull;
+		moving[i].velocityY += dy * pull;
+		
+	}
+	
+	return;
+	
+}
+
+// slows particles down in proportion to their speed, heavier ones less so.
+// Bonded particles share their mass, the same as with friction
+static inline void applyDragField(const forceField* restrict field, particle* restrict moving, int start, int end){
+	
+	for(int i = start; i < end; i++){
+		
+		// never take away more than all of the speed
+		double slowdown = minDouble(field->scaledStrength / movingMass(&moving[i]), 1.0);
+		
+		moving[i].velocityX -= moving[i].velocityX * slowdown;
+		moving[i].velocityY -= moving[i].velocityY * slowdown;
+		
+	}
+	
+	return;
+	
+}
+
+// move the particles from start to end and slow them down by friction
+static inline void updateParticleRange(particle* restrict moving, int start, int end){
+	
+	// loop through each particle
+	for(int particleNum = start; particleNum < end; particleNum++){
+		
+		// move the x and y position by the velocity and frame delta time.
+		// Fast particles only take their first sub-step here
+		double moveDelta = (sim->options->MAX_SUBSTEP_LEVEL > 0) ? (sim->delta / (double)(1 << sim->subStepLevel[particleNum])) : sim->delta;
+		
+		moving[particleNum].x += moving[particleNum].velocityX * moveDelta;
+		moving[particleNum].y += moving[particleNum].velocityY * moveDelta;
+		
+		// check if we need to reduce the speed via friction
+		if(sim->options->FRICTION > 0.0){
+		
+			// if both velocities are already at zero, no need to reduce them anymore, otherwise sqrt() will
+			// return an undefined double
+			if((moving[particleNum].velocityX != 0.0) && (moving[particleNum].velocityY != 0.0)){
+				
+				// reduce the speed of the vector by the friction * mass
+				double speed = sqrt((moving[particleNum].velocityX * moving[particleNum].velocityX) +
+					(moving[particleNum].velocityY * moving[particleNum].velocityY));
+				
+				double speedToReduce = (1.0 / movingMass(&moving[particleNum])) * sim->options->FRICTION;
+				
+				// we need to check if the velocity has hit zero, if so, then stop drcreasing the magnitude
+				char zero = moving[particleNum].velocityX > 0.0;
+				
+				moving[particleNum].velocityX -= ((moving[particleNum].velocityX / speed) * speedToReduce);
+				
+				if((zero && (moving[particleNum].velocityX < 0.0)) || ((zero == 0) && (moving[particleNum].velocityX > 0.0))){
+					
+					moving[particleNum].velocityX = 0.0;
+					
+				}
+				
+				
+				
+				zero = moving[particleNum].velocityY > 0.0;
+				
+				moving[particleNum].velocityY -= ((moving[particleNum].velocityY / speed) * speedToReduce);
+				
+				if((zero && (moving[particleNum].velocityY < 0.0)) || ((zero == 0) && (moving[particleNum].velocityY > 0.0))){
+					
+					moving[particleNum].velocityY = 0.0;
+					
+				}
+				
+			}
+		
+		}
+	
+	}
+	
+	return;
+	
+}
+
+// Charges. Working out the pull between every pair of charged particles takes
+// time n squared, so the force is split in two with a Gaussian a bit wider
+// than the mesh spacing. The smooth long range part is worked out on a mesh: the charge
+// is spread onto the mesh (cloud in cell), the potential comes from a convolution
+// with the long range part done with an FFT, and the force is read back off the
+// mesh. The short range part only reaches a few mesh cells, so it's added up
+// directly over the particles the grid finds close by
+
+static inline int nextPowerOfTwo(int value){
+	
+	int power = 1;
+	
+	while(power < value){
+		
+		power <<= 1;
+		
+	}
+	
+	return power;
+	
+}
+
+// in place radix 2 FFT of size points, stored as real and imaginary pairs.
+// The inverse leaves out dividing by the size, the Green's function does that
+static inline void fftInPlace(double* restrict data, int size, char inverse){
+	
+	// put the points in bit reversed order
+	for(int i = 1, j = 0; i < size; i++){
+		
+		int bit = size >> 1;
+		
+		for(; j & bit; bit >>= 1){
+			
+			j ^= bit;
+			
+		}
+		
+		j ^= bit;
+		
+		if(i < j){
+			
+			double re = data[2 * i];
+			double im = data[(2 * i) + 1];
+			
+			data[2 * i] = data[2 * j];
+			data[(2 * i) + 1] = data[(2 * j) + 1];
+			data[2 * j] = re;
+			data[(2 * j) + 1] = im;
+			
+		}
+		
+	}
+	
+	double sign = inverse ? -1.0 : 1.0;
+	
+	for(int half = 1; half < size; half <<= 1){
+		
+		int step = sim->chargeMesh.twiddleSize / (half << 1);
+		
+		for(int start = 0; start < size; start += (half << 1)){
+			
+			for(int k = 0; k < half; k++){
+				
+				double wr = sim->chargeMesh.twiddles[2 * k * step];
+				double wi = sign * sim->chargeMesh.twiddles[(2 * k * step) + 1];
+				
+				double* restrict a = &data[2 * (start + k)];
+				double* restrict b = &data[2 * (start + k + half)];
+				
+				double tr = (b[0] * wr) - (b[1] * wi);
+				double ti = (b[0] * wi) + (b[1] * wr);
+				
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+				
+			}
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// FFT the rows with charge in them, the rows below are all zero
+static void chargeRowsForwardKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int row = start; row < end; row++){
+		
+		fftInPlace(sim->chargeMesh.mesh + (2 * (size_t)row * (size_t)sim->chargeMesh.meshWidth), sim->chargeMesh.meshWidth, 0);
+		
+	}
+	
+	return;
+	
+}
+
+static void chargeRowsInverseKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int row = start; row < end; row++){
+		
+		fftInPlace(sim->chargeMesh.mesh + (2 * (size_t)row * (size_t)sim->chargeMesh.meshWidth), sim->chargeMesh.meshWidth, 1);
+		
+	}
+	
+	return;
+	
+}
+
+// Each column is copied out once, then the forward FFT, the convolution
+// and the inverse FFT all happen before it's copied back.
+// Only the rows inside the window are needed after this, so only they are copied back
+static void chargeColumnsKernel(int start, int end, int workerNum){
+	
+	int height = sim->chargeMesh.meshHeight;
+	int width = sim->chargeMesh.meshWidth;
+	double* restrict column = sim->chargeMesh.scratch + (2 * (size_t)height * (size_t)workerNum);
+	
+	for(int c = start; c < end; c++){
+		
+		for(int row = 0; row < sim->chargeMesh.chargeRows; row++){
+			
+			column[2 * row] = sim->chargeMesh.mesh[2 * (((size_t)row * (size_t)width) + (size_t)c)];
+			column[(2 * row) + 1] = sim->chargeMesh.mesh[(2 * (((size_t)row * (size_t)width) + (size_t)c)) + 1];
+			
+		}
+		
+		memset(column + (2 * sim->chargeMesh.chargeRows), 0, 2 * (size_t)(height - sim->chargeMesh.chargeRows) * sizeof(double));
+		
+		fftInPlace(column, height, 0);
+		
+		const double* restrict greens = sim->chargeMesh.greens + ((size_t)c * (size_t)height);
+		
+		for(int row = 0; row < height; row++){
+			
+			column[2 * row] *= greens[row];
+			column[(2 * row) + 1] *= greens[row];
+			
+		}
+		
+		fftInPlace(column, height, 1);
+		
+		for(int row = 0; row < sim->chargeMesh.chargeRows; row++){
+			
+			sim->chargeMesh.mesh[2 * (((size_t)row * (size_t)width) + (size_t)c)] = column[2 * row];
+			sim->chargeMesh.mesh[(2 * (((size_t)row * (size_t)width) + (size_t)c)) + 1] = column[(2 * row) + 1];
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// the field is the slope of the potential, pointing downhill
+static void chargeFieldKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	int width = sim->chargeMesh.meshWidth;
+	
+	for(int row = start; row < end; row++){
+		
+		int up = max(row - 1, 0);
+		int down = min(row + 1, sim->chargeMesh.chargeRows - 1);
+		
+		for(int c = 0; c < sim->chargeMesh.chargeColumns; c++){
+			
+			int left = max(c - 1, 0);
+			int right = min(c + 1, sim->chargeMesh.chargeColumns - 1);
+			
+			double potentialLeft = sim->chargeMesh.mesh[2 * ((row * width) + left)];
+			double potentialRight = sim->chargeMesh.mesh[2 * ((row * width) + right)];
+			double potentialUp = sim->chargeMesh.mesh[2 * ((up * width) + c)];
+			double potentialDown = sim->chargeMesh.mesh[2 * ((down * width) + c)];
+			
+			int node = (row * sim->chargeMesh.chargeColumns) + c;
+			
+			sim->chargeMesh.fieldX[node] = -(potentialRight - potentialLeft) / ((double)(right - left) * sim->chargeMesh.spacing);
+			sim->chargeMesh.fieldY[node] = -(potentialDown - potentialUp) / ((double)(down - up) * sim->chargeMesh.spacing);
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// which mesh point is up and to the left of a position, and how far
+// past it the position is (0 to 1). Positions outside the window use the edge
+static inline void chargeMeshPosition(double x, double y, int* restrict column, int* restrict row, double* restrict fractionX, double* restrict fractionY){
+	
+	double meshX = minDouble(maxDouble(x / sim->chargeMesh.spacing, 0.0), (double)(sim->chargeMesh.chargeColumns - 1) - 1e-9);
+	double meshY = minDouble(maxDouble(y / sim->chargeMesh.spacing, 0.0), (double)(sim->chargeMesh.chargeRows - 1) - 1e-9);
+	
+	*column = (int)meshX;
+	*row = (int)meshY;
+	*fractionX = meshX - (double)(*column);
+	*fractionY = meshY - (double)(*row);
+	
+	return;
+	
+}
+
+// find every charged particle within the cutoff of the cell's particles
+static inline int gatherChargeNeighbourhood(chargeNeighbourhood* restrict around, double left, double top, double right, double bottom){
+	
+	// the charges only act inside the world, so they don't look across the border
+	spatialSource source;
+	
+	liveSpatialSource(&source, 0);
+	
+	int found = spatialQueryRect(&source, left, top, right, bottom, around->indices, around->capacity);
+	
+	// it didn't fit, so make room and ask again
+	while(found == around->capacity){
+		
+		around->capacity *= 2;
+		around->indices = realloc(around->indices, (size_t)around->capacity * sizeof(int));
+		around->x = realloc(around->x, (size_t)around->capacity * sizeof(double));
+		around->y = realloc(around->y, (size_t)around->capacity * sizeof(double));
+		around->charge = realloc(around->charge, (size_t)around->capacity * sizeof(double));
+		
+		if(around->indices == 0 || around->x == 0 || around->y == 0 || around->charge == 0){ exit(0); }
+		
+		found = spatialQueryRect(&source, left, top, right, bottom, around->indices, around->capacity);
+		
+	}
+	
+	int count = 0;
+	
+	for(int n = 0; n < found; n++){
+		
+		int j = around->indices[n];
+		double charge = particleTemplates[sim->particles[j].type].charge;
+		
+		if(charge != 0.0){
+			
+			around->x[count] = sim->particles[j].x;
+			around->y[count] = sim->particles[j].y;
+			around->charge[count] = charge;
+			count++;
+			
+		}
+		
+	}
+	
+	return count;
+	
+}
+
+// Read the long range force off the mesh and add up the short range force from
+// the charged particles close by. It goes a grid cell at a time: the neighbourhood
+// of the whole cell is found once and copied next to each other, then every
+// particle in the cell goes through it. The particle itself is in there too,
+// but it's at zero distance so it adds nothing, and anything past the cutoff
+// reads a zero from the end of the table, so the inner loop doesn't need any ifs
+static void chargeForceKernel(int start, int end, int workerNum){
+	
+	chargeNeighbourhood* restrict around = &sim->chargeMesh.neighbourhoods[workerNum];
+	double cutoffSquared = sim->chargeMesh.cutoff * sim->chargeMesh.cutoff;
+	double tableScale = (double)CHARGE_TABLE_SIZE / cutoffSquared;
+	const double* restrict table = sim->chargeMesh.shortRangeTable;
+	
+	for(int cell = start; cell < end; cell++){
+		
+		int first = sim->grid.cellStart[cell];
+		int last = sim->grid.cellStart[cell + 1];
+		
+		if(first == last){
+			
+			continue;
+			
+		}
+		
+		// particles off the window are kept in the edge cells,
+		// so go by where the particles are rather than where the cell is
+		double left = sim->particles[sim->grid.particleIndices[first]].x;
+		double right = left;
+		double top = sim->particles[sim->grid.particleIndices[first]].y;
+		double bottom = top;
+		
+		for(int n = first + 1; n < last; n++){
+			
+			int i = sim->grid.particleIndices[n];
+			
+			left = minDouble(left, sim->particles[i].x);
+			right = maxDouble(right, sim->particles[i].x);
+			top = minDouble(top, sim->particles[i].y);
+			bottom = maxDouble(bottom, sim->particles[i].y);
+			
+		}
+		
+		int count = gatherChargeNeighbourhood(around, left - sim->chargeMesh.cutoff, top - sim->chargeMesh.cutoff,
+			right + sim->chargeMesh.cutoff, bottom + sim->chargeMesh.cutoff);
+		
+		for(int n = first; n < last; n++){
+			
+			int i = sim->grid.particleIndices[n];
+			double charge = particleTemplates[sim->particles[i].type].charge;
+			
+			if(charge == 0.0){
+				
+				sim->chargeAccelerationX[i] = 0.0;
+				sim->chargeAccelerationY[i] = 0.0;
+				
+				continue;
+				
+			}
+			
+			int column, row;
+			double fractionX, fractionY;
+			
+			chargeMeshPosition(sim->particles[i].x, sim->particles[i].y, &column, &row, &fractionX, &fractionY);
+			
+			int node = (row * sim->chargeMesh.chargeColumns) + column;
+			int below = node + sim->chargeMesh.chargeColumns;
+			
+			double weightTopLeft = (1.0 - fractionX) * (1.0 - fractionY);
+			double weightTopRight = fractionX * (1.0 - fractionY);
+			double weightBottomLeft = (1.0 - fractionX) * fractionY;
+			double weightBottomRight = fractionX * fractionY;
+			
+			double fieldX = (weightTopLeft * sim->chargeMesh.fieldX[node]) + (weightTopRight * sim->chargeMesh.fieldX[node + 1]) +
+				(weightBottomLeft * sim->chargeMesh.fieldX[below]) + (weightBottomRight * sim->chargeMesh.fieldX[below + 1]);
+			double fieldY = (weightTopLeft * sim->chargeMesh.fieldY[node]) + (weightTopRight * sim->chargeMesh.fieldY[node + 1]) +
+				(weightBottomLeft * sim->chargeMesh.fieldY[below]) + (weightBottomRight * sim->chargeMesh.fieldY[below + 1]);
+			
+			double x = sim->particles[i].x;
+			double y = sim->particles[i].y;
+			
+			for(int k = 0; k < count; k++){
+				
+				double dx = x - around->x[k];
+				double dy = y - around->y[k];
+				
+				// straight from the table, blending between the two closest entries
+				double position = minDouble(((dx * dx) + (dy * dy)) * tableScale, (double)CHARGE_TABLE_SIZE - 1e-9);
+				int entry = (int)position;
+				double blend = position - (double)entry;
+				double push = around->charge[k] * (table[entry] + (blend * (table[entry + 1] - table[entry])));
+				
+				fieldX += push * dx;
+				fieldY += push * dy;
+				
+			}
+			
+			sim->chargeAccelerationX[i] = (charge * fieldX) / sim->particles[i].mass;
+			sim->chargeAccelerationY[i] = (charge * fieldY) / sim->particles[i].mass;
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// work out the velocity change from the charges for every particle
+static inline void solveCharges(){
+	
+	int width = sim->chargeMesh.meshWidth;
+	
+	// the rows below the window are never read, the columns fill them in with zeros
+	memset(sim->chargeMesh.mesh, 0, 2 * (size_t)width * (size_t)sim->chargeMesh.chargeRows * sizeof(double));
+	
+	// spread each charge over the four closest mesh points. This is quick
+	// enough that it isn't worth splitting between the workers
+	for(int i = 0; i < sim->length; i++){
+		
+		double charge = particleTemplates[sim->particles[i].type].charge;
+		
+		if(charge == 0.0){
+			
+			continue;
+			
+		}
+		
+		int column, row;
+		double fractionX, fractionY;
+		
+		chargeMeshPosition(sim->particles[i].x, sim->particles[i].y, &column, &row, &fractionX, &fractionY);
+		
+		double* restrict top = sim->chargeMesh.mesh + (2 * (((size_t)row * (size_t)width) + (size_t)column));
+		double* restrict bottom = top + (2 * (size_t)width);
+		
+		top[0] += charge * (1.0 - fractionX) * (1.0 - fractionY);
+		top[2] += charge * fractionX * (1.0 - fractionY);
+		bottom[0] += charge * (1.0 - fractionX) * fractionY;
+		bottom[2] += charge * fractionX * fractionY;
+		
+	}
+	
+	runParallelFor(0, sim->chargeMesh.chargeRows, 1, chargeRowsForwardKernel);
+	runParallelFor(0, width, 8, chargeColumnsKernel);
+	runParallelFor(0, sim->chargeMesh.chargeRows, 1, chargeRowsInverseKernel);
+	runParallelFor(0, sim->chargeMesh.chargeRows, 8, chargeFieldKernel);
+	
+	// the queries only read the grid, so it has to be up to date before the workers start
+	updateSpatialGrid();
+	
+	runParallelFor(0, sim->grid.cellCount, CHARGE_CHUNK, chargeForceKernel);
+	
+	return;
+	
+}
+
+// the velocity change from the charges this step
+static inline void applyChargeField(int start, int end){
+	
+	for(int i = start; i < end; i++){
+		
+		sim->particles[i].velocityX += sim->chargeAccelerationX[i] * sim->delta;
+		sim->particles[i].velocityY += sim->chargeAccelerationY[i] * sim->delta;
+		
+	}
+	
+	return;
+	
+}
+
+// size the mesh for the window and work out everything that never changes.
+// 0 if there wasn't the memory, destroyChargeMesh() frees what there was
+static inline char createChargeMesh(){
+	
+	sim->chargeMesh.spacing = sim->options->CHARGE_MESH_SIZE;
+	sim->chargeMesh.width = CHARGE_WIDTH_CELLS * sim->options->CHARGE_MESH_SIZE;
+	sim->chargeMesh.cutoff = CHARGE_CUTOFF_WIDTHS * sim->chargeMesh.width;
+	
+	sim->chargeMesh.chargeColumns = (int)ceil((double)sim->options->WORLD_WIDTH / sim->chargeMesh.spacing) + 1;
+	sim->chargeMesh.chargeRows = (int)ceil((double)sim->options->WORLD_HEIGHT / sim->chargeMesh.spacing) + 1;
+	sim->chargeMesh.meshWidth = nextPowerOfTwo(2 * sim->chargeMesh.chargeColumns);
+	sim->chargeMesh.meshHeight = nextPowerOfTwo(2 * sim->chargeMesh.chargeRows);
+	sim->chargeMesh.twiddleSize = max(sim->chargeMesh.meshWidth, sim->chargeMesh.meshHeight);
+	
+	size_t meshPoints = (size_t)sim->chargeMesh.meshWidth * (size_t)sim->chargeMesh.meshHeight;
+	size_t windowPoints = (size_t)sim->chargeMesh.chargeColumns * (size_t)sim->chargeMesh.chargeRows;
+	
+	sim->chargeMesh.mesh = malloc(2 * meshPoints * sizeof(double));
+	sim->chargeMesh.greens = malloc(meshPoints * sizeof(double));
+	sim->chargeMesh.fieldX = malloc(windowPoints * sizeof(double));
+	sim->chargeMesh.fieldY = malloc(windowPoints * sizeof(double));
+	sim->chargeMesh.twiddles = malloc((size_t)sim->chargeMesh.twiddleSize * sizeof(double));
+	sim->chargeMesh.scratch = malloc(2 * (size_t)sim->chargeMesh.meshHeight * (size_t)sim->workerCount * sizeof(double));
+	sim->chargeMesh.neighbourhoods = calloc((size_t)sim->workerCount, sizeof(chargeNeighbourhood));
+	
+	sim->chargeAccelerationX = malloc((size_t)sim->particleCapacity * sizeof(double));
+	sim->chargeAccelerationY = malloc((size_t)sim->particleCapacity * sizeof(double));
+	
+	if(sim->chargeMesh.mesh == 0 || sim->chargeMesh.greens == 0 || sim->chargeMesh.fieldX == 0 || sim->chargeMesh.fieldY == 0 ||
+		sim->chargeMesh.twiddles == 0 || sim->chargeMesh.scratch == 0 || sim->chargeMesh.neighbourhoods == 0 ||
+		sim->chargeAccelerationX == 0 || sim->chargeAccelerationY == 0){ return 0; }
+	
+	// the neighbourhoods start out small and grow with the busiest cell
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		chargeNeighbourhood* restrict around = &sim->chargeMesh.neighbourhoods[workerNum];
+		
+		around->capacity = 1024;
+		around->indices = malloc((size_t)around->capacity * sizeof(int));
+		around->x = malloc((size_t)around->capacity * sizeof(double));
+		around->y = malloc((size_t)around->capacity * sizeof(double));
+		around->charge = malloc((size_t)around->capacity * sizeof(double));
+		
+		if(around->indices == 0 || around->x == 0 || around->y == 0 || around->charge == 0){ return 0; }
+		
+	}
+	
+	// only the first half of the turn is ever needed
+	for(int k = 0; k < (sim->chargeMesh.twiddleSize / 2); k++){
+		
+		double angle = (-2.0 * M_PI * (double)k) / (double)sim->chargeMesh.twiddleSize;
+		
+		sim->chargeMesh.twiddles[2 * k] = cos(angle);
+		sim->chargeMesh.twiddles[(2 * k) + 1] = sin(angle);
+		
+	}
+	
+	// the long range potential of a unit charge, erf(r / (sqrt(2) * width)) / r,
+	// which doesn't blow up at zero. Distances past half the mesh wrap around to negative
+	double rootTwoWidth = M_SQRT2 * sim->chargeMesh.width;
+	
+	for(int row = 0; row < sim->chargeMesh.meshHeight; row++){
+		
+		double dy = (double)((row <= (sim->chargeMesh.meshHeight / 2)) ? row : (row - sim->chargeMesh.meshHeight)) * sim->chargeMesh.spacing;
+		
+		for(int c = 0; c < sim->chargeMesh.meshWidth; c++){
+			
+			double dx = (double)((c <= (sim->chargeMesh.meshWidth / 2)) ? c : (c - sim->chargeMesh.meshWidth)) * sim->chargeMesh.spacing;
+			double distance = sqrt((dx * dx) + (dy * dy));
+			double* restrict point = sim->chargeMesh.mesh + (2 * (((size_t)row * (size_t)sim->chargeMesh.meshWidth) + (size_t)c));
+			
+			point[0] = sim->options->CHARGE_STRENGTH * ((distance > 0.0) ? (erf(distance / rootTwoWidth) / distance) : (M_2_SQRTPI / rootTwoWidth));
+			point[1] = 0.0;
+			
+		}
+		
+	}
+	
+	// The potential is real and the same both ways, so its FFT is real too.
+	// This only happens once, so it doesn't bother with the workers
+	for(int row = 0; row < sim->chargeMesh.meshHeight; row++){
+		
+		fftInPlace(sim->chargeMesh.mesh + (2 * (size_t)row * (size_t)sim->chargeMesh.meshWidth), sim->chargeMesh.meshWidth, 0);
+		
+	}
+	
+	for(int c = 0; c < sim->chargeMesh.meshWidth; c++){
+		
+		double* restrict column = sim->chargeMesh.scratch;
+		
+		for(int row = 0; row < sim->chargeMesh.meshHeight; row++){
+			
+			column[2 * row] = sim->chargeMesh.mesh[2 * (((size_t)row * (size_t)sim->chargeMesh.meshWidth) + (size_t)c)];
+			column[(2 * row) + 1] = sim->chargeMesh.mesh[(2 * (((size_t)row * (size_t)sim->chargeMesh.meshWidth) + (size_t)c)) + 1];
+			
+		}
+		
+		fftInPlace(column, sim->chargeMesh.meshHeight, 0);
+		
+		for(int row = 0; row < sim->chargeMesh.meshHeight; row++){
+			
+			sim->chargeMesh.greens[((size_t)c * (size_t)sim->chargeMesh.meshHeight) + (size_t)row] = column[2 * row] / (double)meshPoints;
+			
+		}
+		
+	}
+	
+	// the short range force divided by the distance, so multiplying it
+	// by dx and dy gives the two parts of the force. Closer than
+	// CHARGE_SOFTENING is treated as CHARGE_SOFTENING
+	for(int entry = 0; entry <= CHARGE_TABLE_SIZE; entry++){
+		
+		double distanceSquared = ((double)entry / (double)CHARGE_TABLE_SIZE) * sim->chargeMesh.cutoff * sim->chargeMesh.cutoff;
+		double distance = maxDouble(sqrt(distanceSquared), CHARGE_SOFTENING);
+		double scaled = distance / rootTwoWidth;
+		
+		double force = (erfc(scaled) / (distance * distance)) + ((M_2_SQRTPI / rootTwoWidth) * exp(-(scaled * scaled)) / distance);
+		
+		sim->chargeMesh.shortRangeTable[entry] = sim->options->CHARGE_STRENGTH * force / distance;
+		
+	}
+	
+	// nothing past the cutoff
+	sim->chargeMesh.shortRangeTable[CHARGE_TABLE_SIZE] = 0.0;
+	
+	return 1;
+	
+}
+
+static inline void destroyChargeMesh(){
+	
+	free(sim->chargeMesh.mesh);
+	sim->chargeMesh.mesh = 0;
+	
+	free(sim->chargeMesh.greens);
+	sim->chargeMesh.greens = 0;
+	
+	free(sim->chargeMesh.fieldX);
+	sim->chargeMesh.fieldX = 0;
+	
+	free(sim->chargeMesh.fieldY);
+	sim->chargeMesh.fieldY = 0;
+	
+	free(sim->chargeMesh.twiddles);
+	sim->chargeMesh.twiddles = 0;
+	
+	free(sim->chargeMesh.scratch);
+	sim->chargeMesh.scratch = 0;
+	
+	// the mesh is only made with ENABLE_CHARGE
+	if(sim->chargeMesh.neighbourhoods != 0){
+		
+		for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+			
+			free(sim->chargeMesh.neighbourhoods[workerNum].indices);
+			free(sim->chargeMesh.neighbourhoods[workerNum].x);
+			free(sim->chargeMesh.neighbourhoods[workerNum].y);
+			free(sim->chargeMesh.neighbourhoods[workerNum].charge);
+			
+		}
+		
+	}
+	
+	free(sim->chargeMesh.neighbourhoods);
+	sim->chargeMesh.neighbourhoods = 0;
+	
+	free(sim->chargeAccelerationX);
+	sim->chargeAccelerationX = 0;
+	
+	free(sim->chargeAccelerationY);
+	sim->chargeAccelerationY = 0;
+	
+	return;
+	
+}
+
+// run every force field over a block, then move it
+static inline void moveParticleBlock(particle* restrict moving, int start, int end){
+	
+	for(int f = 0; f < sim->forceFieldCount; f++){
+		
+		switch(sim->forceFields[f].type){
+			
+			case uniformGravity:
+			case sineGravity:
+				
+				applyUniformField(&sim->forceFields[f], moving, start, end);
+				
+				break;
+				
+			case pointGravity:
+				
+				applyPointField(&sim->forceFields[f], moving, start, end);
+				
+				break;
+				
+			case lineGravity:
+			case movingLineGravity:
+				
+				applyLineField(&sim->forceFields[f], moving, start, end);
+				
+				break;
+				
+			case airDrag:
+				
+				applyDragField(&sim->forceFields[f], moving, start, end);
+				
+				break;
+				
+		}
+		
+	}
+	
+	updateParticleRange(moving, start, end);
+	
+	return;
+	
+}
+
+// the charges, then every force field over each block, then move the block
+static void updateKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int blockStart = start; blockStart < end; blockStart += FORCE_FIELD_BLOCK){
+		
+		int blockEnd = min(blockStart + FORCE_FIELD_BLOCK, end);
+		
+		if(sim->options->ENABLE_CHARGE){
+			
+			applyChargeField(blockStart, blockEnd);
+			
+		}
+		
+		moveParticleBlock(sim->particles, blockStart, blockEnd);
+		
+	}
+	
+	return;
+	
+}
+
+// update the position of each particle
+// and handle border collision
+static inline void updateParticles(){
+	
+	if(sim->options->ENABLE_CHARGE){
+		
+		solveCharges();
+		
+	}
+	
+	prepareForceFields();
+	
+	runParallelFor(0, sim->length, UPDATE_CHUNK, updateKernel);
+	
+	sim->simulationTime += sim->delta;
+	
+	sim->grid.isStale = 1;
+	
+	return;
+	
+}
+
+// hash everything that affects how the simulation carries on with FNV-1a.
+// The particles go in the order of their handles, not where they are in memory,
+// so the hash doesn't change when they're reordered or put back together from
+// the slabs, and a bond is hashed as the partner's handle slot. They're hashed
+// in blocks of a fixed number of slots so the workers can each take a few, then
+// the block hashes are combined in order, so the result is the same no matter
+// how many threads there are
+#define STATE_HASH_BLOCK 4096
+
+static inline Uint64 hashBytes(Uint64 hash, const void* data, size_t size){
+	
+	const Uint8* bytes = (const Uint8*)data;
+	
+	for(size_t k = 0; k < size; k++){
+		
+		hash ^= bytes[k];
+		hash *= 1099511628211ull;
+		
+	}
+	
+	return hash;
+	
+}
+
+static void hashStateKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int block = start; block < end; block++){
+		
+		Uint64 hash = 14695981039346656037ull;
+		int last = min((block + 1) * STATE_HASH_BLOCK, sim->handleSlotsUsed);
+		
+		for(int slot = block * STATE_HASH_BLOCK; slot < last; slot++){
+			
+			int i = particleAtSlot(slot);
+			
+			if(i == -1){
+				
+				continue;
+				
+			}
+			
+			int partner = bondOf(i);
+			int partnerSlot = (partner > -1) ? (int)handleSlotOf(partner) : -1;
+			
+			// the compact particles are hashed as they're stored, the mass comes from the rest
+			if(sim->isCompact){
+				
+				hash = hashBytes(hash, &sim->compact.x[i], sizeof(Sint32));
+				hash = hashBytes(hash, &sim->compact.y[i], sizeof(Sint32));
+				hash = hashBytes(hash, &sim->compact.velocityX[i], sizeof(Uint16));
+				hash = hashBytes(hash, &sim->compact.velocityY[i], sizeof(Uint16));
+				hash = hashBytes(hash, &sim->compact.type[i], sizeof(Uint8));
+				
+			}
+			
+			else{
+				
+				hash = hashBytes(hash, &sim->particles[i].x, sizeof(double));
+				hash = hashBytes(hash, &sim->particles[i].y, sizeof(double));
+				hash = hashBytes(hash, &sim->particles[i].velocityX, sizeof(double));
+				hash = hashBytes(hash, &sim->particles[i].velocityY, sizeof(double));
+				hash = hashBytes(hash, &sim->particles[i].mass, sizeof(double));
+				
+				// hashed as a whole particleType, whatever size it's stored in
+				particleType type = (particleType)sim->particles[i].type;
+				
+				hash = hashBytes(hash, &type, sizeof(particleType));
+				
+			}
+			
+			hash = hashBytes(hash, &partnerSlot, sizeof(int));
+			
+		}
+		
+		sim->blockHashes[block] = hash;
+		
+	}
+	
+	return;
+	
+}
+
+static inline Uint64 hashSimulationState(){
+	
+	int blocks = (sim->handleSlotsUsed + STATE_HASH_BLOCK - 1) / STATE_HASH_BLOCK;
+	
+	runParallelFor(0, blocks, 1, hashStateKernel);
+	
+	Uint64 hash = hashBytes(14695981039346656037ull, &sim->length, sizeof(int));
+	
+	for(int block = 0; block < blocks; block++){
+		
+		hash = hashBytes(hash, &sim->blockHashes[block], sizeof(Uint64));
+		
+	}
+	
+	return hash;
+	
+}
+
+// the arrays start on a cache line of their own
+#define SHARED_STATE_HEADER_SIZE 128
+
+#define SHARED_STATE_CHUNK 4096
+
+static inline void openSharedState(){
+	
+#ifdef HAS_SHARED_MEMORY
+	
+	Uint64 capacity = (Uint64)sim->particleCapacity;
+	
+	sim->sharedStateSize = SHARED_STATE_HEADER_SIZE + (size_t)(capacity * ((5 * sizeof(double)) + sizeof(Uint8)));
+	
+	int descriptor = shm_open(sim->options->SHARED_MEMORY_NAME, O_CREAT | O_RDWR, 0644);
+	
+	if((descriptor < 0) || (ftruncate(descriptor, (off_t)sim->sharedStateSize) != 0)){
+		
+		fprintf(stderr, "could not open the shared memory %s\n", sim->options->SHARED_MEMORY_NAME);
+		
+		if(descriptor >= 0){ close(descriptor); }
+		
+		return;
+		
+	}
+	
+	void* mapped = mmap(0, sim->sharedStateSize, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+	
+	// the mapping stays after the descriptor is closed
+	close(descriptor);
+	
+	if(mapped == MAP_FAILED){
+		
+		fprintf(stderr, "could not map the shared memory %s\n", sim->options->SHARED_MEMORY_NAME);
+		
+		return;
+		
+	}
+	
+	sim->sharedState = (sharedStateHeader*)mapped;
+	
+	memset(sim->sharedState, 0, SHARED_STATE_HEADER_SIZE);
+	
+	sim->sharedState->xOffset = SHARED_STATE_HEADER_SIZE;
+	sim->sharedState->yOffset = sim->sharedState->xOffset + (capacity * sizeof(double));
+	sim->sharedState->velocityXOffset = sim->sharedState->yOffset + (capacity * sizeof(double));
+	sim->sharedState->velocityYOffset = sim->sharedState->velocityXOffset + (capacity * sizeof(double));
+	sim->sharedState->handleOffset = sim->sharedState->velocityYOffset + (capacity * sizeof(double));
+	sim->sharedState->typeOffset = sim->sharedState->handleOffset + (capacity * sizeof(Uint64));
+	
+	sim->sharedX = (double*)((char*)mapped + sim->sharedState->xOffset);
+	sim->sharedY = (double*)((char*)mapped + sim->sharedState->yOffset);
+	sim->sharedVelocityX = (double*)((char*)mapped + sim->sharedState->velocityXOffset);
+	sim->sharedVelocityY = (double*)((char*)mapped + sim->sharedState->velocityYOffset);
+	sim->sharedHandles = (Uint64*)((char*)mapped + sim->sharedState->handleOffset);
+	sim->sharedTypes = (Uint8*)((char*)mapped + sim->sharedState->typeOffset);
+	
+	sim->sharedState->version = 1;
+	sim->sharedState->capacity = (Uint32)capacity;
+	
+	// readers check the magic last, so they never see a header that isn't finished
+	atomic_thread_fence(memory_order_release);
+	memcpy(sim->sharedState->magic, "PSSM", 4);
+	
+#endif
+	
+	return;
+	
+}
+
+static inline void closeSharedState(){
+	
+#ifdef HAS_SHARED_MEMORY
+	
+	if(sim->sharedState){
+		
+		munmap(sim->sharedState, sim->sharedStateSize);
+		
+		// programs that have it mapped keep it, but no new ones can find it
+		shm_unlink(sim->options->SHARED_MEMORY_NAME);
+		
+	}
+	
+#endif
+	
+	sim->sharedState = 0;
+	sim->sharedX = 0;
+	sim->sharedY = 0;
+	sim->sharedVelocityX = 0;
+	sim->sharedVelocityY = 0;
+	sim->sharedHandles = 0;
+	sim->sharedTypes = 0;
+	
+	return;
+	
+}
+
+static void sharedStateKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int i = start; i < end; i++){
+		
+		sim->sharedX[i] = sim->particles[i].x;
+		sim->sharedY[i] = sim->particles[i].y;
+		sim->sharedVelocityX[i] = sim->particles[i].velocityX;
+		sim->sharedVelocityY[i] = sim->particles[i].velocityY;
+		sim->sharedHandles[i] = sim->particles[i].handle;
+		sim->sharedTypes[i] = sim->particles[i].type;
+		
+	}
+	
+	return;
+	
+}
+
+// copy the particles into the shared memory, inside the seqlock
+static inline void writeSharedState(){
+	
+	// odd, the readers keep away. The add is a full barrier,
+	// so none of the writes below can happen before it
+	atomic_fetch_add(&sim->sharedState->sequence, 1);
+	
+	runParallelFor(0, sim->length, SHARED_STATE_CHUNK, sharedStateKernel);
+	
+	sim->sharedState->length = (Uint32)sim->length;
+	sim->sharedState->step = sim->simulationStep;
+	sim->sharedState->time = sim->simulationTime;
+	
+	// and even again once everything is written
+	atomic_fetch_add(&sim->sharedState->sequence, 1);
+	
+	return;
+	
+}
+
+// The slab processes (SLAB_PROCESSES) are further down, after everything they
+// use. The step, the simulation thread and createSimulation() only need these
+
+static inline void sendSlabParticles(void);
+static inline void receiveSlabParticles(void);
+static inline void gatherSlabClusters(void);
+static inline void encodeSlabReferences(void);
+static inline void stepSlabs(void);
+static inline void gatherSlabs(void);
+static inline int saveSlabLengths(int* restrict runs);
+static inline void loadSlabLengths(const int* restrict runs);
+static inline char startSlabProcesses(void);
+static inline void stopSlabProcesses(void);
+static inline void runSlab(void);
+static inline void adoptLoadedParticles(void);
+
+// note how long a phase took, and start timing the next one
+static inline Uint64 endPhase(stepPhase phase, Uint64 startTick){
+	
+	Uint64 now = performanceCounter();
+	
+	sim->phaseTicks[phase] = now - startTick;
+	
+	return now;
+	
+}
+
+// what comes after the physics, on every step
+static inline void finishStep(){
+	
+	sim->simulationStep++;
+	
+	if(sim->options->ENABLE_DETERMINISTIC && (sim->options->STATE_HASH_INTERVAL > 0) && ((sim->simulationStep % (Uint64)sim->options->STATE_HASH_INTERVAL) == 0)){
+		
+		// with slabs, the particles here are only brought up to date when they're needed
+		gatherSlabs();
+		
+		printf("step %llu particles %d hash %016llx\n", (unsigned long long)sim->simulationStep, sim->length, (unsigned long long)hashSimulationState());
+		fflush(stdout);
+		
+	}
+	
+	if(sim->sharedState){
+		
+		gatherSlabs();
+		
+		writeSharedState();
+		
+	}
+	
+	return;
+	
+}
+
+// The step for compact particles. The particles are only stored differently,
+// the physics is the same as simulateStep's:
+// - the update unpacks a block of particles, runs the force fields, friction
+//   and the borders on it, and packs it again
+// - the interaction, bonds and collisions are the same passes, which unpack
+//   each particle they get to with loadParticle() and pack what they change
+// - without neighbour lists, each particle's neighbours are found on the grid
+//   again every step
+
+// unpack each block, move it and bounce it off the borders, then pack it again
+static void compactUpdateKernel(int start, int end, int workerNum){
+	
+	particle* restrict block = &sim->compactBlocks[workerNum * SPAWN_CHUNK];
+	char hasBorder = sim->options->ENABLE_BORDER_COLLISION || sim->options->ENABLE_BORDER_WRAP || sim->options->ENABLE_BORDER_ABSORB;
+	
+	double x[BORDER_LANES], y[BORDER_LANES], velX[BORDER_LANES], velY[BORDER_LANES], radius[BORDER_LANES];
+	unsigned char events[BORDER_LANES];
+	
+	for(int blockStart = start; blockStart < end; blockStart += FORCE_FIELD_BLOCK){
+		
+		int count = min(FORCE_FIELD_BLOCK, end - blockStart);
+		
+		for(int n = 0; n < count; n++){
+			
+			unpackCompactParticle(blockStart + n, &block[n]);
+			
+		}
+		
+		moveParticleBlock(block, 0, count);
+		
+		for(int group = 0; hasBorder && (group < count); group += BORDER_LANES){
+			
+			int lanes = min(BORDER_LANES, count - group);
+			
+			for(int lane = 0; lane < lanes; lane++){
+				
+				x[lane] = block[group + lane].x;
+				y[lane] = block[group + lane].y;
+				velX[lane] = block[group + lane].velocityX;
+				velY[lane] = block[group + lane].velocityY;
+				radius[lane] = 0.5 * sim->particleSizes[block[group + lane].type];
+				
+			}
+			
+			borderLanes(lanes, x, y, velX, velY, radius, events);
+			
+			for(int lane = 0; lane < lanes; lane++){
+				
+				block[group + lane].x = x[lane];
+				block[group + lane].y = y[lane];
+				block[group + lane].velocityX = velX[lane];
+				block[group + lane].velocityY = velY[lane];
+				sim->borderEvents[blockStart + group + lane] = events[lane];
+				
+			}
+			
+		}
+		
+		for(int n = 0; n < count; n++){
+			
+			packCompactMotion(blockStart + n, block[n].x, block[n].y, block[n].velocityX, block[n].velocityY);
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+static inline void stepCompactParticles(){
+	
+	Uint64 tick = performanceCounter();
+	
+	removeQueuedParticles();
+	
+	tick = endPhase(removalPhase, tick);
+	
+	prepareForceFields();
+	
+	runParallelFor(0, sim->length, UPDATE_CHUNK, compactUpdateKernel);
+	
+	sim->simulationTime += sim->delta;
+	sim->grid.isStale = 1;
+	
+	tick = endPhase(updatePhase, tick);
+	
+	if(sim->options->ENABLE_BORDER_COLLISION || sim->options->ENABLE_BORDER_WRAP || sim->options->ENABLE_BORDER_ABSORB){
+		
+		finishBorderEvents(0, sim->length);
+		
+	}
+	
+	tick = endPhase(borderPhase, tick);
+	
+	handleParticleInteraction();
+	
+	endPhase(interactionPhase, tick);
+	
+	return;
+	
+}
+
+// move the simulation forward by one step of delta seconds
+static inline void simulateStep(){
+	
+	Uint64 tick = performanceCounter();
+	
+	sim->stepCollisions = 0;
+	
+	if(sim->isCompact){
+		
+		stepCompactParticles();
+		
+		finishStep();
+		
+		return;
+		
+	}
+	
+	// the slab processes do the physics, this one only gathers it up
+	if((sim->slabCount > 0) && !sim->isSlabProcess){
+		
+		stepSlabs();
+		
+		finishStep();
+		
+		return;
+		
+	}
+	
+	// particles that left this slab are removed along with everything else. One
+	// that was gathered into another slab's group (see gatherSlabClusters()) can
+	// be a few slabs from its own, and gets one slab nearer each time round
+	for(int round = 1; sim->isSlabProcess && (round < sim->slabCount); round++){
+		
+		sendSlabParticles();
+		
+		removeQueuedParticles();
+		
+		receiveSlabParticles();
+		
+	}
+	
+	removeQueuedParticles();
+	
+	tick = endPhase(removalPhase, tick);
+	
+	if((sim->options->REORDER_INTERVAL > 0) && ((sim->simulationStep % (Uint64)sim->options->REORDER_INTERVAL) == 0)){
+		
+		reorderParticles();
+		
+	}
+	
+	tick = endPhase(reorderPhase, tick);
+	
+	if(sim->options->MAX_SUBSTEP_LEVEL > 0){
+		
+		sortSubStepLevels();
+		
+	}
+	
+	updateParticles();
+	
+	tick = endPhase(updatePhase, tick);
+	
+	char isChecking = sim->options->ENABLE_REFERENCE_CHECK;
+	
+	if(isChecking){
+		
+		startReferenceCheck();
+		
+	}
+	
+	handleBorderCollision(0, sim->length);
+	
+	if(isChecking){
+		
+		checkReferenceBorder();
+		
+	}
+	
+	tick = endPhase(borderPhase, tick);
+	
+	char isCheckingInteraction = isChecking && sim->options->ENABLE_PARTICLE_COLLISION;
+	char isGatheringClusters = sim->isSlabProcess && sim->options->ENABLE_PARTICLE_COLLISION;
+	
+	if(isGatheringClusters){
+		
+		gatherSlabClusters();
+		
+	}
+	
+	if(isCheckingInteraction){
+		
+		startReferenceCheck();
+		
+	}
+	
+	handleParticleInteraction();
+	
+	if(isCheckingInteraction){
+		
+		checkReferenceInteraction();
+		
+	}
+	
+	if(isChecking){
+		
+		finishReferenceCheck();
+		
+	}
+	
+	if(isGatheringClusters){
+		
+		encodeSlabReferences();
+		
+	}
+	
+	tick = endPhase(interactionPhase, tick);
+	
+	runSubSteps();
+	
+	endPhase(subStepPhase, tick);
+	
+	finishStep();
+	
+	return;
+	
+}
+
+// the metrics thread checks the socket and the file this often, in milliseconds
+#define METRICS_POLL_WAIT 100
+
+// how long a client that connects gets to send a request, in milliseconds
+#define METRICS_REQUEST_WAIT 50
+
+// add up the threads' counters and hand them to the metrics thread.
+// The simulation thread never waits for it, if it's busy reading the
+// last sample this one is skipped and the next step hands one over instead
+static inline void recordMetrics(char hasStepped){
+	
+	metricsSample* restrict sample = &sim->simulationMetrics;
+	Uint64 candidatePairs = 0;
+	Uint64 tasksRun = 0;
+	Uint64 tasksStolen = 0;
+	
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		candidatePairs += sim->workerMetrics[workerNum].candidatePairs;
+		tasksRun += sim->workerMetrics[workerNum].tasksRun;
+		tasksStolen += sim->workerMetrics[workerNum].tasksStolen;
+		
+	}
+	
+	if(hasStepped){
+		
+		sample->collisions = sim->stepCollisions;
+		sample->collisionsTotal += sim->stepCollisions;
+		sample->candidatePairs = candidatePairs - sample->candidatePairsTotal;
+		
+		for(int phase = 0; phase < numOfPhases; phase++){
+			
+			sample->phaseSeconds[phase] = (double)sim->phaseTicks[phase] / (double)performanceFrequency();
+			
+		}
+		
+	}
+	
+	sample->candidatePairsTotal = candidatePairs;
+	sample->tasksRun = tasksRun;
+	sample->tasksStolen = tasksStolen;
+	sample->step = sim->simulationStep;
+	sample->particles = sim->length;
+	sample->bondedPairs = sim->bondedPairs;
+	sample->workers = sim->workerCount;
+	sample->particleBytes = (Uint64)particleBytes() * (Uint64)sim->length;
+	
+	// the steps per second are counted over about a second
+	Uint64 now = performanceCounter();
+	
+	if((now - sim->rateStartTick) >= performanceFrequency()){
+		
+		sample->stepsPerSecond = (double)(sim->simulationStep - sim->rateStartStep) * (double)performanceFrequency() / (double)(now - sim->rateStartTick);
+		
+		sim->rateStartTick = now;
+		sim->rateStartStep = sim->simulationStep;
+		
+	}
+	
+	if(tryLockMutex(sim->metricsLock)){
+		
+		sim->latestMetrics = *sample;
+		
+		unlockMutex(sim->metricsLock);
+		
+	}
+	
+	return;
+	
+}
+
+// add a line to the metrics text, leaving it cut short if it ever gets too long
+static inline void appendMetricsLine(int* restrict used, const char* restrict line, int lineLength){
+	
+	lineLength = min(lineLength, (int)sizeof(sim->metricsText) - 1 - *used);
+	
+	if(lineLength > 0){
+		
+		memcpy(&sim->metricsText[*used], line, (size_t)lineLength);
+		*used += lineLength;
+		
+	}
+	
+	return;
+	
+}
+
+// the HELP and TYPE lines every metric starts with
+static inline void appendMetricHeader(int* restrict used, const char* restrict name, const char* restrict type, const char* restrict help){
+	
+	char line[256];
+	
+	appendMetricsLine(used, line, snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type));
+	
+	return;
+	
+}
+
+// one value, with a label if label isn't 0
+static inline void appendMetricValue(int* restrict used, const char* restrict name, const char* restrict label, double value){
+	
+	char line[256];
+	
+	if(label){
+		
+		appendMetricsLine(used, line, snprintf(line, sizeof(line), "%s{%s} %.15g\n", name, label, value));
+		
+	}
+	
+	else{
+		
+		appendMetricsLine(used, line, snprintf(line, sizeof(line), "%s %.15g\n", name, value));
+		
+	}
+	
+	return;
+	
+}
+
+static inline void appendMetric(int* restrict used, const char* restrict name, const char* restrict type, const char* restrict help, double value){
+	
+	appendMetricHeader(used, name, type, help);
+	appendMetricValue(used, name, 0, value);
+	
+	return;
+	
+}
+
+// write the newest sample into metricsText in the Prometheus text format, and return its length
+static inline int formatMetrics(){
+	
+	metricsSample sample;
+	
+	lockMutex(sim->metricsLock);
+	
+	sample = sim->latestMetrics;
+	
+	unlockMutex(sim->metricsLock);
+	
+	int used = 0;
+	
+	appendMetric(&used, "particlesim_steps_total", "counter", "Steps simulated since the start.", (double)sample.step);
+	appendMetric(&used, "particlesim_steps_per_second", "gauge", "Steps simulated in the last second or so.", sample.stepsPerSecond);
+	appendMetric(&used, "particlesim_particles", "gauge", "Particles in the simulation.", (double)sample.particles);
+	appendMetric(&used, "particlesim_bonded_pairs", "gauge", "Pairs of particles bonded together.", (double)sample.bondedPairs);
+	appendMetric(&used, "particlesim_candidate_pairs", "gauge", "Pairs of particles checked for touching in the last step.", (double)sample.candidatePairs);
+	appendMetric(&used, "particlesim_candidate_pairs_total", "counter", "Pairs of particles checked for touching since the start.", (double)sample.candidatePairsTotal);
+	appendMetric(&used, "particlesim_collisions", "gauge", "Collisions resolved in the last step.", (double)sample.collisions);
+	appendMetric(&used, "particlesim_collisions_total", "counter", "Collisions resolved since the start.", (double)sample.collisionsTotal);
+	
+	appendMetricHeader(&used, "particlesim_phase_seconds", "gauge", "How long each phase of the last step took.");
+	
+	for(int phase = 0; phase < numOfPhases; phase++){
+		
+		char label[64];
+		
+		snprintf(label, sizeof(label), "phase=\"%s\"", phaseNames[phase]);
+		
+		appendMetricValue(&used, "particlesim_phase_seconds", label, sample.phaseSeconds[phase]);
+		
+	}
+	
+	appendMetric(&used, "particlesim_worker_threads", "gauge", "Threads the physics runs on.", (double)sample.workers);
+	appendMetric(&used, "particlesim_worker_tasks_total", "counter", "Tasks the physics threads have run.", (double)sample.tasksRun);
+	appendMetric(&used, "particlesim_worker_steals_total", "counter", "Tasks taken from another thread's queue.", (double)sample.tasksStolen);
+	appendMetric(&used, "particlesim_particle_bytes", "gauge", "Memory used by the particles themselves.", (double)sample.particleBytes);
+	
+	if(sim->isRecordingEvents){
+		
+		Uint64 counts[numOfEventKinds][numOfParticleTypes][numOfParticleTypes];
+		double impulses[numOfEventKinds][numOfParticleTypes][numOfParticleTypes];
+		static const char* const kindNames[numOfEventKinds] = {"collision", "bond"};
+		
+		lockMutex(sim->metricsLock);
+		
+		memcpy(counts, sim->latestEventCounts, sizeof(counts));
+		memcpy(impulses, sim->latestEventImpulses, sizeof(impulses));
+		
+		unlockMutex(sim->metricsLock);
+		
+		// only the pairs that have happened, most never will
+		for(int pass = 0; pass < 2; pass++){
+			
+			const char* name = pass ? "particlesim_collision_impulse_total" : "particlesim_collision_events_total";
+			
+			appendMetricHeader(&used, name, "counter", pass ? "Momentum exchanged by each kind of event and pair of types." : "Collisions and bonds between each pair of types.");
+			
+			for(int kind = 0; kind < numOfEventKinds; kind++){
+				
+				for(int a = 0; a < numOfParticleTypes; a++){
+					
+					for(int b = a; b < numOfParticleTypes; b++){
+						
+						if(counts[kind][a][b] == 0){ continue; }
+						
+						char label[96];
+						
+						snprintf(label, sizeof(label), "kind=\"%s\",a=\"%s\",b=\"%s\"", kindNames[kind], particleTypeNames[a], particleTypeNames[b]);
+						
+						appendMetricValue(&used, name, label, pass ? impulses[kind][a][b] : (double)counts[kind][a][b]);
+						
+					}
+					
+				}
+				
+			}
+			
+		}
+		
+		Uint64 dropped = 0;
+		
+		for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+			
+			dropped += (Uint64)(Uint32)atomic_load(&sim->eventRings[workerNum].dropped);
+			
+		}
+		
+		appendMetric(&used, "particlesim_collision_events_dropped_total", "counter", "Events lost because the log thread fell behind.", (double)dropped);
+		
+	}
+	
+#ifdef __linux__
+	
+	// everything the program has in memory, which only Linux makes easy to find out
+	FILE* statm = fopen("/proc/self/statm", "r");
+	
+	if(statm){
+		
+		long residentPages;
+		
+		if(fscanf(statm, "%*s %ld", &residentPages) == 1){
+			
+			appendMetric(&used, "particlesim_resident_bytes", "gauge", "Memory the whole program has in use.", (double)residentPages * (double)sysconf(_SC_PAGESIZE));
+			
+		}
+		
+		fclose(statm);
+		
+	}
+	
+#endif
+	
+	return used;
+	
+}
+
+// write the metrics to a file next to METRICS_FILE, then move it over the old one,
+// so anything reading the file never sees it half written
+static inline void writeMetricsFile(int textLength){
+	
+	char temporary[METRICS_PATH_LENGTH + 4];
+	
+	snprintf(temporary, sizeof(temporary), "%s.tmp", sim->options->METRICS_FILE);
+	
+	FILE* file = fopen(temporary, "w");
+	
+	if(file == 0){
+		
+		return;
+		
+	}
+	
+	fwrite(sim->metricsText, 1, (size_t)textLength, file);
+	fclose(file);
+	
+#ifdef _WIN32
+	
+	// windows won't move a file over one that's already there
+	remove(sim->options->METRICS_FILE);
+	
+#endif
+	
+	rename(temporary, sim->options->METRICS_FILE);
+	
+	return;
+	
+}
+
+#ifdef HAS_UNIX_SOCKETS
+
+// a client that hangs up early would otherwise kill the program with SIGPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// start listening on METRICS_SOCKET. Returns -1 if it can't
+static inline int openMetricsSocket(){
+	
+	struct sockaddr_un address;
+	
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, sim->options->METRICS_SOCKET, sizeof(address.sun_path) - 1);
+	
+	// a socket left behind by a run that didn't quit properly
+	unlink(sim->options->METRICS_SOCKET);
+	
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	
+	if(listener < 0){
+		
+		return -1;
+		
+	}
+	
+	if((bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0) || (listen(listener, 8) != 0)){
+		
+		close(listener);
+		
+		return -1;
+		
+	}
+	
+	return listener;
+	
+}
+
+// send everything, a socket can take less than it was given
+static inline void sendAll(int client, const char* restrict data, int dataLength){
+	
+	while(dataLength > 0){
+		
+		ssize_t sent = send(client, data, (size_t)dataLength, MSG_NOSIGNAL);
+		
+		if(sent <= 0){
+			
+			return;
+			
+		}
+		
+		data += sent;
+		dataLength -= (int)sent;
+		
+	}
+	
+	return;
+	
+}
+
+// send the metrics to a client that just connected, then hang up.
+// An HTTP client (Prometheus, curl --unix-socket) asks for them first and gets
+// them as an HTTP response, anything else (like nc -U) just gets the text
+static inline void answerMetricsClient(int client){
+	
+	char request[512];
+	ssize_t received = 0;
+	struct pollfd waiting = {client, POLLIN, 0};
+	
+	if(poll(&waiting, 1, METRICS_REQUEST_WAIT) > 0){
+		
+		received = recv(client, request, sizeof(request), 0);
+		
+	}
+	
+	int textLength = formatMetrics();
+	
+	if((received >= 4) && !memcmp(request, "GET ", 4)){
+		
+		char header[160];
+		
+		int headerLength = snprintf(header, sizeof(header),
+			"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", textLength);
+		
+		sendAll(client, header, headerLength);
+		
+	}
+	
+	sendAll(client, sim->metricsText, textLength);
+	
+	close(client);
+	
+	return;
+	
+}
+
+#endif
+
+// the metrics thread. It answers METRICS_SOCKET and rewrites METRICS_FILE
+// every METRICS_INTERVAL seconds, so the simulation never waits on either
+static int metricsThread(void* data){
+	
+	sim = data;
+	
+	Uint64 fileInterval = (Uint64)(maxDouble(sim->options->METRICS_INTERVAL, 0.001) * (double)performanceFrequency());
+	Uint64 nextFileTick = performanceCounter();
+	int listener = -1;
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	if(sim->options->METRICS_SOCKET[0]){
+		
+		listener = openMetricsSocket();
+		
+		if(listener < 0){
+			
+			fprintf(stderr, "could not open the metrics socket %s\n", sim->options->METRICS_SOCKET);
+			
+		}
+		
+	}
+	
+#endif
+	
+	while(!atomic_load(&sim->isMetricsFinished)){
+		
+		if(sim->options->METRICS_FILE[0] && (performanceCounter() >= nextFileTick)){
+			
+			writeMetricsFile(formatMetrics());
+			
+			nextFileTick = performanceCounter() + fileInterval;
+			
+		}
+		
+#ifdef HAS_UNIX_SOCKETS
+		
+		// waiting for a client is the thread's sleep
+		if(listener > -1){
+			
+			struct pollfd waiting = {listener, POLLIN, 0};
+			
+			if(poll(&waiting, 1, METRICS_POLL_WAIT) > 0){
+				
+				int client = accept(listener, 0, 0);
+				
+				if(client > -1){
+					
+					answerMetricsClient(client);
+					
+				}
+				
+			}
+			
+			continue;
+			
+		}
+		
+#endif
+		
+		sleepMilliseconds(METRICS_POLL_WAIT);
+		
+	}
+	
+	// one last time, so the file has how the run ended
+	if(sim->options->METRICS_FILE[0]){
+		
+		writeMetricsFile(formatMetrics());
+		
+	}
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	if(listener > -1){
+		
+		close(listener);
+		unlink(sim->options->METRICS_SOCKET);
+		
+	}
+	
+#endif
+	
+	return 0;
+	
+}
+
+// the start of COLLISION_LOG. The events follow it, one collisionEvent
+// each, in the machine's own byte order
+typedef struct collisionLogHeader {
+	
+	char magic[4];
+	Uint32 version;
+	Uint32 eventSize;
+	Uint32 particleTypes;
+	
+} collisionLogHeader;
+
+// how often the log thread empties the rings, in milliseconds
+#define EVENT_DRAIN_WAIT 10
+
+// write out and count everything the threads have published, then give them the space back
+static inline void drainEvents(){
+	
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		eventRing* restrict ring = &sim->eventRings[workerNum];
+		Uint32 head = (Uint32)atomic_load(&ring->head);
+		Uint32 tail = (Uint32)atomic_load(&ring->tail);
+		
+		// the events can't be read before the head that says they're there
+		atomic_thread_fence(memory_order_acquire);
+		
+		while(tail != head){
+			
+			// up to the head, or the end of the ring if it wraps around
+			Uint32 first = tail & (EVENT_RING_SIZE - 1);
+			Uint32 count = (Uint32)min((int)(head - tail), (int)(EVENT_RING_SIZE - first));
+			
+			if(sim->collisionLog){
+				
+				fwrite(&ring->events[first], sizeof(collisionEvent), count, sim->collisionLog);
+				
+			}
+			
+			for(Uint32 e = first; e < (first + count); e++){
+				
+				const collisionEvent* restrict event = &ring->events[e];
+				int a = min(event->typeA, event->typeB);
+				int b = max(event->typeA, event->typeB);
+				
+				sim->eventCounts[event->kind][a][b]++;
+				sim->eventImpulses[event->kind][a][b] += (double)event->impulse;
+				
+			}
+			
+			tail += count;
+			
+		}
+		
+		// everything has been read before the thread can write over it
+		atomic_thread_fence(memory_order_release);
+		
+		atomic_exchange(&ring->tail, (int)tail);
+		
+	}
+	
+	if(sim->isMeasuring){
+		
+		lockMutex(sim->metricsLock);
+		
+		memcpy(sim->latestEventCounts, sim->eventCounts, sizeof(sim->eventCounts));
+		memcpy(sim->latestEventImpulses, sim->eventImpulses, sizeof(sim->eventImpulses));
+		
+		unlockMutex(sim->metricsLock);
+		
+	}
+	
+	return;
+	
+}
+
+// the log thread. It empties the event rings every few milliseconds until the simulation stops
+static int eventLogThread(void* data){
+	
+	sim = data;
+	
+	while(1){
+		
+		// checked before draining, so nothing published before the end is missed
+		int isFinished = atomic_load(&sim->isEventLogFinished);
+		
+		drainEvents();
+		
+		if(isFinished){
+			
+			break;
+			
+		}
+		
+		sleepMilliseconds(EVENT_DRAIN_WAIT);
+		
+	}
+	
+	return 0;
+	
+}
+
+// Checkpoints (CHECKPOINT_FILE). Every CHECKPOINT_STEPS steps or CHECKPOINT_MINUTES
+// minutes, the simulation thread copies everything a restart needs into spare
+// buffers, which only takes as long as copying the particles, and the checkpoint
+// thread writes the copy out while the simulation carries on. If the last one is
+// still being written, the copy waits for the first step after it's done.
+// They take turns between CHECKPOINT_KEEP files, CHECKPOINT_FILE.0, .1 and so on.
+// Each one is written next to its file and then moved over it, so dying halfway
+// through a write only loses the checkpoint that was being written
+
+// how many particles each checkpoint task copies
+#define CHECKPOINT_CHUNK 4096
+
+static inline void checkpointPath(char* restrict path, size_t size, int fileNum){
+	
+	snprintf(path, size, "%s.%d", sim->options->CHECKPOINT_FILE, fileNum);
+	
+	return;
+	
+}
+
+// open checkpoint fileNum and read its header. Returns 0 if it isn't there,
+// or isn't a checkpoint this build of the simulation can carry on from
+static inline FILE* openCheckpoint(int fileNum, checkpointHeader* restrict header){
+	
+	char path[METRICS_PATH_LENGTH + 16];
+	
+	checkpointPath(path, sizeof(path), fileNum);
+	
+	FILE* file = fopen(path, "rb");
+	
+	if(file == 0){
+		
+		return 0;
+		
+	}
+	
+	if((fread(header, sizeof(checkpointHeader), 1, file) != 1) || memcmp(header->magic, "PSCK", 4) || (header->version != 2) ||
+		(header->particleSize != (Uint32)sizeof(particle)) || (header->length < 0) || (header->length > sim->particleCapacity) ||
+		(header->removalCount < 0) || (header->removalCount > header->length) || (header->handleSlots > (Uint32)sim->particleCapacity) ||
+		(header->freeHandleCount > header->handleSlots) || (header->slabRuns > (Uint32)sim->particleCapacity)){
+		
+		fclose(file);
+		
+		return 0;
+		
+	}
+	
+	return file;
+	
+}
+
+// the file number of the newest checkpoint, or -1 if there aren't any.
+// The one after it is the next to be written, so the newest is overwritten last
+static inline int findNewestCheckpoint(){
+	
+	int newest = -1;
+	Uint64 newestSequence = 0;
+	
+	for(int fileNum = 0; fileNum < sim->options->CHECKPOINT_KEEP; fileNum++){
+		
+		checkpointHeader header;
+		FILE* file = openCheckpoint(fileNum, &header);
+		
+		if(file == 0){
+			
+			continue;
+			
+		}
+		
+		fclose(file);
+		
+		if((newest == -1) || (header.sequence > newestSequence)){
+			
+			newest = fileNum;
+			newestSequence = header.sequence;
+			
+		}
+		
+	}
+	
+	sim->checkpointCopy.sequence = newestSequence;
+	sim->nextCheckpointFile = (newest + 1) % sim->options->CHECKPOINT_KEEP;
+	
+	return newest;
+	
+}
+
+// carry on from the newest checkpoint (ENABLE_RESTART), before there are any particles.
+// Returns 0 if there isn't one, or it's broken, and -1 if there wasn't the memory to read it
+static inline int restoreCheckpoint(){
+	
+	if(sim->options->CHECKPOINT_FILE[0] == 0){
+		
+		return 0;
+		
+	}
+	
+	sim->options->CHECKPOINT_KEEP = max(sim->options->CHECKPOINT_KEEP, 1);
+	
+	int newest = findNewestCheckpoint();
+	
+	if(newest == -1){
+		
+		return 0;
+		
+	}
+	
+	checkpointHeader header;
+	FILE* file = openCheckpoint(newest, &header);
+	
+	if(file == 0){
+		
+		return 0;
+		
+	}
+	
+	Uint32* generations = malloc(((size_t)header.handleSlots + 1) * sizeof(Uint32));
+	Uint32* freeSlots = malloc(((size_t)header.freeHandleCount + 1) * sizeof(Uint32));
+	particleHandle* removals = malloc(((size_t)header.removalCount + 1) * sizeof(particleHandle));
+	int* runs = malloc(((size_t)header.slabRuns + 1) * sizeof(int));
+	char* isSlotTaken = calloc((size_t)header.handleSlots + 1, 1);
+	
+	if(generations == 0 || freeSlots == 0 || removals == 0 || runs == 0 || isSlotTaken == 0){
+		
+		free(generations);
+		free(freeSlots);
+		free(removals);
+		free(runs);
+		free(isSlotTaken);
+		
+		return -1;
+		
+	}
+	
+	char isWhole = (fread(sim->particles, sizeof(particle), (size_t)header.length, file) == (size_t)header.length) &&
+		(fread(generations, sizeof(Uint32), header.handleSlots, file) == header.handleSlots) &&
+		(fread(freeSlots, sizeof(Uint32), header.freeHandleCount, file) == header.freeHandleCount) &&
+		(fread(removals, sizeof(particleHandle), (size_t)header.removalCount, file) == (size_t)header.removalCount) &&
+		(fread(runs, sizeof(int), header.slabRuns, file) == header.slabRuns);
+	
+	fclose(file);
+	
+	// anything that would be read out of bounds means it can't be trusted, and so
+	// does a slot that's used twice, since two particles would share one handle
+	for(int i = 0; isWhole && (i < header.length); i++){
+		
+		Uint32 slot = (Uint32)sim->particles[i].handle;
+		
+		isWhole = (sim->particles[i].type < numOfParticleTypes) && (slot < header.handleSlots) && !isSlotTaken[slot];
+		
+		if(isWhole){
+			
+			isSlotTaken[slot] = 1;
+			
+		}
+		
+	}
+	
+	for(Uint32 k = 0; isWhole && (k < header.freeHandleCount); k++){
+		
+		isWhole = (freeSlots[k] < header.handleSlots) && !isSlotTaken[freeSlots[k]];
+		
+		if(isWhole){
+			
+			isSlotTaken[freeSlots[k]] = 1;
+			
+		}
+		
+	}
+	
+	// the slabs have to have had every particle between them
+	int runTotal = 0;
+	
+	for(Uint32 slab = 0; isWhole && (slab < header.slabRuns); slab++){
+		
+		isWhole = (runs[slab] >= 0) && (runs[slab] <= (header.length - runTotal));
+		runTotal += runs[slab];
+		
+	}
+	
+	isWhole = isWhole && ((header.slabRuns == 0) || (runTotal == header.length));
+	
+	if(isWhole){
+		
+		sim->length = header.length;
+		sim->simulationStep = header.step;
+		sim->simulationTime = header.time;
+		sim->randState = header.randState;
+		
+		for(int i = 0; i < sim->length; i++){
+			
+			if(sim->particles[i].nearestNeighbour >= sim->length){ sim->particles[i].nearestNeighbour = -1; }
+			if(sim->particles[i].collidingAwayFrom >= sim->length){ sim->particles[i].collidingAwayFrom = -1; }
+			
+		}
+		
+		adoptLoadedParticles();
+		
+		// the slots nobody is using come back as they were, so
+		// the handles given out from now on are the same ones too
+		memcpy(sim->handleGeneration, generations, (size_t)header.handleSlots * sizeof(Uint32));
+		memcpy(sim->freeHandles, freeSlots, (size_t)header.freeHandleCount * sizeof(Uint32));
+		sim->handleSlotsUsed = (int)header.handleSlots;
+		sim->freeHandleCount = (int)header.freeHandleCount;
+		sim->freeHandlesSorted = 0;
+		
+		for(int k = 0; k < header.removalCount; k++){
+			
+			int particleNum = resolveParticleHandle(removals[k]);
+			
+			if(particleNum > -1){
+				
+				queueParticleRemoval(particleNum);
+				
+			}
+			
+		}
+		
+		// the slabs have to be given the particles too. With as many slabs as
+		// there were, each one gets back the particles it had
+		sim->slabsNeedScatter = 1;
+		
+		if((header.slabRuns > 0) && ((int)header.slabRuns == sim->slabCount)){
+			
+			loadSlabLengths(runs);
+			
+		}
+		
+		printf("restarted from checkpoint %s.%d at step %llu\n", sim->options->CHECKPOINT_FILE, newest, (unsigned long long)sim->simulationStep);
+		fflush(stdout);
+		
+	}
+	
+	free(generations);
+	generations = 0;
+	
+	free(freeSlots);
+	freeSlots = 0;
+	
+	free(removals);
+	removals = 0;
+	
+	free(runs);
+	runs = 0;
+	
+	free(isSlotTaken);
+	isSlotTaken = 0;
+	
+	return isWhole;
+	
+}
+
+static void checkpointKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int i = start; i < end; i++){
+		
+		sim->checkpointParticles[i] = sim->particles[i];
+		
+		// references from before a removal this step have to be fixed first
+		if(sim->removalPending){
+			
+			sim->checkpointParticles[i].nearestNeighbour = remapRemoved(sim->particles[i].nearestNeighbour);
+			sim->checkpointParticles[i].collidingAwayFrom = remapRemoved(sim->particles[i].collidingAwayFrom);
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// copy the simulation for the checkpoint thread, if a checkpoint is due and it's free
+static inline void takeCheckpoint(){
+	
+	if((sim->options->CHECKPOINT_STEPS > 0) && ((sim->simulationStep % (Uint64)sim->options->CHECKPOINT_STEPS) == 0)){
+		
+		sim->isCheckpointDue = 1;
+		
+	}
+	
+	if((sim->checkpointPeriod > 0) && (performanceCounter() >= sim->nextCheckpointTick)){
+		
+		sim->isCheckpointDue = 1;
+		sim->nextCheckpointTick = performanceCounter() + sim->checkpointPeriod;
+		
+	}
+	
+	if(!sim->isCheckpointDue || atomic_load(&sim->isCheckpointBusy)){
+		
+		return;
+		
+	}
+	
+	gatherSlabs();
+	
+	runParallelFor(0, sim->length, CHECKPOINT_CHUNK, checkpointKernel);
+	
+	memcpy(sim->checkpointGenerations, sim->handleGeneration, (size_t)sim->handleSlotsUsed * sizeof(Uint32));
+	memcpy(sim->checkpointFreeHandles, sim->freeHandles, (size_t)sim->freeHandleCount * sizeof(Uint32));
+	
+	int removalCount = atomic_load(&sim->killQueueLength);
+	
+	for(int k = 0; k < removalCount; k++){
+		
+		sim->checkpointRemovals[k] = sim->particles[sim->killQueue[k]].handle;
+		
+	}
+	
+	memcpy(sim->checkpointCopy.magic, "PSCK", 4);
+	sim->checkpointCopy.version = 2;
+	sim->checkpointCopy.particleSize = (Uint32)sizeof(particle);
+	sim->checkpointCopy.length = sim->length;
+	sim->checkpointCopy.removalCount = removalCount;
+	sim->checkpointCopy.randState = sim->randState;
+	sim->checkpointCopy.handleSlots = (Uint32)sim->handleSlotsUsed;
+	sim->checkpointCopy.freeHandleCount = (Uint32)sim->freeHandleCount;
+	sim->checkpointCopy.slabRuns = (Uint32)saveSlabLengths(sim->checkpointSlabRuns);
+	sim->checkpointCopy.sequence++;
+	sim->checkpointCopy.step = sim->simulationStep;
+	sim->checkpointCopy.time = sim->simulationTime;
+	
+	sim->isCheckpointDue = 0;
+	
+	atomic_exchange(&sim->isCheckpointBusy, 1);
+	postSemaphore(sim->checkpointReady);
+	
+	return;
+	
+}
+
+// write the copy next to the next checkpoint file, then move it over it
+static inline void writeCheckpoint(){
+	
+	char path[METRICS_PATH_LENGTH + 16];
+	char temporary[METRICS_PATH_LENGTH + 20];
+	
+	checkpointPath(path, sizeof(path), sim->nextCheckpointFile);
+	snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+	
+	FILE* file = fopen(temporary, "wb");
+	
+	if(file == 0){
+		
+		return;
+		
+	}
+	
+	size_t written = fwrite(&sim->checkpointCopy, sizeof(checkpointHeader), 1, file);
+	size_t expected = 1 + (size_t)sim->checkpointCopy.length + sim->checkpointCopy.handleSlots + sim->checkpointCopy.freeHandleCount + (size_t)sim->checkpointCopy.removalCount + sim->checkpointCopy.slabRuns;
+	
+	written += fwrite(sim->checkpointParticles, sizeof(particle), (size_t)sim->checkpointCopy.length, file);
+	written += fwrite(sim->checkpointGenerations, sizeof(Uint32), sim->checkpointCopy.handleSlots, file);
+	written += fwrite(sim->checkpointFreeHandles, sizeof(Uint32), sim->checkpointCopy.freeHandleCount, file);
+	written += fwrite(sim->checkpointRemovals, sizeof(particleHandle), (size_t)sim->checkpointCopy.removalCount, file);
+	written += fwrite(sim->checkpointSlabRuns, sizeof(int), sim->checkpointCopy.slabRuns, file);
+	
+	// the file has to be on the disk before it's moved over the last checkpoint,
+	// or a crash just after the move can leave the name pointing at nothing
+	int isSynced = (fflush(file) == 0);
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	isSynced = isSynced && (fsync(fileno(file)) == 0);
+	
+#elif defined(_WIN32)
+	
+	isSynced = isSynced && (_commit(_fileno(file)) == 0);
+	
+#endif
+	
+	// a full disk mustn't swap a good checkpoint for half of one
+	if((fclose(file) != 0) || (written != expected) || (isSynced == 0)){
+		
+		remove(temporary);
+		
+		return;
+		
+	}
+	
+#ifdef _WIN32
+	
+	// windows won't move a file over one that's already there
+	remove(path);
+	
+#endif
+	
+	if(rename(temporary, path) != 0){
+		
+		remove(temporary);
+		
+		return;
+		
+	}
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	// the move itself is kept in the directory, so that goes to the disk too
+	char directory[METRICS_PATH_LENGTH + 16];
+	
+	snprintf(directory, sizeof(directory), "%s", path);
+	
+	char* slash = strrchr(directory, '/');
+	
+	if(slash == 0){
+		
+		snprintf(directory, sizeof(directory), ".");
+		
+	}else{
+		
+		slash[(slash == directory) ? 1 : 0] = 0;
+		
+	}
+	
+	int directoryFile = open(directory, O_RDONLY);
+	
+	if(directoryFile >= 0){
+		
+		fsync(directoryFile);
+		close(directoryFile);
+		
+	}
+	
+#endif
+	
+	sim->nextCheckpointFile = (sim->nextCheckpointFile + 1) % sim->options->CHECKPOINT_KEEP;
+	
+	return;
+	
+}
+
+// the checkpoint thread. It writes each copy out as it's made, until the simulation stops
+static int checkpointThread(void* data){
+	
+	sim = data;
+	
+	while(1){
+		
+		waitSemaphore(sim->checkpointReady);
+		
+		if(atomic_load(&sim->isCheckpointBusy)){
+			
+			writeCheckpoint();
+			
+			atomic_exchange(&sim->isCheckpointBusy, 0);
+			
+		}
+		
+		if(atomic_load(&sim->isCheckpointFinished)){
+			
+			break;
+			
+		}
+		
+	}
+	
+	return 0;
+	
+}
+
+// make the spare buffers and start the checkpoint thread. 0 if it
+// couldn't be, stopCheckpoints() frees whatever was made
+static inline char startCheckpoints(){
+	
+	sim->options->CHECKPOINT_KEEP = max(sim->options->CHECKPOINT_KEEP, 1);
+	
+	// carry on from the files already there, without overwriting the newest first
+	findNewestCheckpoint();
+	
+	sim->checkpointParticles = malloc((size_t)sim->particleCapacity * sizeof(particle));
+	sim->checkpointGenerations = malloc((size_t)sim->particleCapacity * sizeof(Uint32));
+	sim->checkpointFreeHandles = malloc((size_t)sim->particleCapacity * sizeof(Uint32));
+	sim->checkpointRemovals = malloc((size_t)sim->particleCapacity * sizeof(particleHandle));
+	sim->checkpointSlabRuns = malloc(((size_t)sim->slabCount + 1) * sizeof(int));
+	
+	if(sim->checkpointParticles == 0 || sim->checkpointGenerations == 0 || sim->checkpointFreeHandles == 0 || sim->checkpointRemovals == 0 || sim->checkpointSlabRuns == 0){ return 0; }
+	
+	sim->checkpointReady = createSemaphore();
+	
+	if(sim->checkpointReady == 0){ return 0; }
+	
+	sim->isCheckpointDue = 0;
+	sim->checkpointPeriod = (Uint64)(maxDouble(sim->options->CHECKPOINT_MINUTES, 0.0) * 60.0 * (double)performanceFrequency());
+	sim->nextCheckpointTick = performanceCounter() + sim->checkpointPeriod;
+	
+	atomic_exchange(&sim->isCheckpointBusy, 0);
+	atomic_exchange(&sim->isCheckpointFinished, 0);
+	
+	sim->checkpointThreadHandle = startThread(checkpointThread, sim);
+	
+	if(sim->checkpointThreadHandle == 0){ return 0; }
+	
+	return 1;
+	
+}
+
+// let the thread finish the checkpoint it has, then free the buffers
+static inline void stopCheckpoints(){
+	
+	if(sim->checkpointThreadHandle){
+		
+		atomic_exchange(&sim->isCheckpointFinished, 1);
+		postSemaphore(sim->checkpointReady);
+		waitThread(sim->checkpointThreadHandle);
+		sim->checkpointThreadHandle = 0;
+		
+	}
+	
+	destroySemaphore(sim->checkpointReady);
+	sim->checkpointReady = 0;
+	
+	free(sim->checkpointParticles);
+	sim->checkpointParticles = 0;
+	
+	free(sim->checkpointGenerations);
+	sim->checkpointGenerations = 0;
+	
+	free(sim->checkpointFreeHandles);
+	sim->checkpointFreeHandles = 0;
+	
+	free(sim->checkpointRemovals);
+	sim->checkpointRemovals = 0;
+	
+	free(sim->checkpointSlabRuns);
+	sim->checkpointSlabRuns = 0;
+	
+	return;
+	
+}
+
+// read the path after an option's name, up to the first space
+// (103 is METRICS_PATH_LENGTH - 1). If there isn't one the option stays off
+static inline void readOptionPath(char* restrict path, const char* restrict from){
+	
+	if(sscanf(from, " %103s", path) != 1){
+		
+		path[0] = 0;
+		
+	}
+	
+	return;
+	
+}
+
+// get the options from the config file
+static inline void getOptions(char* arg){
+	
+	// the file to read the options from
+	FILE* config = 0;
+	
+	if(arg){
+		
+		// read the file supplied by the user
+		config = fopen(arg, "r");
+		
+	}
+	
+	else{
+		
+		config = fopen("config.txt", "r");
+		
+	}
+	
+	// if we can't open the file then we quit
+	if(config == 0){ exit(0); }
+	
+	// max of 128 characters per line
+	char currentLine[128];
+	// max of 20 digits for the value
+	char value[20];
+	
+	// set all enablable options to disabled by default
+	sim->options->ENABLE_STARTING_PARTICLES = 0;
+	sim->options->ENABLE_CIRCLE_PARTICLES = 0;
+	sim->options->ENABLE_BORDER_COLLISION = 0;
+	sim->options->ENABLE_BORDER_CLAMP = 0;
+	sim->options->ENABLE_PARTICLE_COLLISION = 0;
+	sim->options->MAX_MEMORY_ALLOCATION = 32768;
+	sim->options->ENABLE_GENERATE_ONCE = 0;
+	sim->options->NEIGHBOUR_SKIN = 10.0;
+	sim->options->WORKER_THREADS = 0;
+	sim->options->ENABLE_DETERMINISTIC = 0;
+	sim->options->DETERMINISTIC_SEED = 1;
+	sim->options->FIXED_TIMESTEP = 1.0 / 60.0;
+	sim->options->STATE_HASH_INTERVAL = 0;
+	sim->options->STARTING_PARTICLE_COUNT = 0;
+	sim->options->REORDER_INTERVAL = 0;
+	sim->options->ENABLE_CHARGE = 0;
+	sim->options->CHARGE_STRENGTH = 200000.0;
+	sim->options->CHARGE_MESH_SIZE = 8.0;
+	sim->options->MAX_SUBSTEP_LEVEL = 0;
+	sim->options->SUBSTEP_TRAVEL = 0.5;
+	sim->options->ENABLE_BORDER_WRAP = 0;
+	sim->options->ENABLE_BORDER_ABSORB = 0;
+	sim->options->WORLD_WIDTH = 0;
+	sim->options->WORLD_HEIGHT = 0;
+	sim->options->METRICS_SOCKET[0] = 0;
+	sim->options->METRICS_FILE[0] = 0;
+	sim->options->METRICS_INTERVAL = 1.0;
+	sim->options->ENABLE_COLLISION_EVENTS = 0;
+	sim->options->COLLISION_LOG[0] = 0;
+	sim->options->ENABLE_REFERENCE_CHECK = 0;
+	sim->options->REFERENCE_TOLERANCE = 0.000000001;
+	sim->options->SHARED_MEMORY_NAME[0] = 0;
+	sim->options->SLAB_PROCESSES = 0;
+	sim->options->CHECKPOINT_FILE[0] = 0;
+	sim->options->CHECKPOINT_STEPS = 0;
+	sim->options->CHECKPOINT_MINUTES = 0.0;
+	sim->options->CHECKPOINT_KEEP = 3;
+	sim->options->ENABLE_RESTART = 0;
+	sim->options->ENABLE_COMPACT_PARTICLES = 0;
+	
+	sim->forceFieldCount = 0;
+	
+	while(!feof(config)){
+		
+		// stop at the end, otherwise the last line is read twice
+		if(fgets(currentLine, sizeof(currentLine), config) == 0){ break; }
+		
+		// check for comments and empty lines
+		if(currentLine[0] == '#' || currentLine[0] == '\n'){ continue; }
+		
+		for(int i = 0; i < (int)sizeof(currentLine); i++){
+			
+			if(currentLine[i] == ' '){
+				
+				for(int j = 1; j < (int)sizeof(value); j++){
+					
+					if(!((currentLine[i + j] >= '0' && currentLine[i + j] <= '9') || currentLine[i + j] == '.')){
+						
+						memset(&value, 0, sizeof(value));
+						memcpy(&value, &(currentLine[i + 1]), (size_t)(j - 1));
+						
+						break;
+						
+					}
+					
+				}
+				
+				break;
+				
+			}
+			
+		}
+		
+		// for each individual line, check against each option string
+		// and if they are the same, write the corresponding value
+		// in the options struct
+		if(!memcmp(&currentLine, &optStr1, (sizeof(optStr1) - 1))){ sim->options->MAX_PARTICLE_COUNT = atoi(value); }
+		if(!memcmp(&currentLine, &optStr2, (sizeof(optStr2) - 1))){ sim->options->MAX_PARTICLE_SPEED = atof(value); }
+		if(!memcmp(&currentLine, &optStr3, (sizeof(optStr3) - 1))){ sim->options->MIN_PARTICLE_SPEED = atof(value); }
+		if(!memcmp(&currentLine, &optStr7, (sizeof(optStr7) - 1))){ sim->options->MAX_DIRECTION = atof(value); }
+		if(!memcmp(&currentLine, &optStr8, (sizeof(optStr8) - 1))){ sim->options->ENABLE_STARTING_PARTICLES = 1; }
+		if(!memcmp(&currentLine, &optStr12, (sizeof(optStr12) - 1))){ sim->options->ENABLE_CIRCLE_PARTICLES = 1; }
+		if(!memcmp(&currentLine, &optStr16, (sizeof(optStr16) - 1))){ sim->options->ENABLE_BORDER_COLLISION = 1; }
+		if(!memcmp(&currentLine, &optStr17, (sizeof(optStr17) - 1))){ sim->options->ENABLE_BORDER_CLAMP = 1; }
+		if(!memcmp(&currentLine, &optStr18, (sizeof(optStr18) - 1))){ sim->options->ENABLE_PARTICLE_COLLISION = 1; }
+		if(!memcmp(&currentLine, &optStr19, (sizeof(optStr19) - 1))){ sim->options->MAX_MEMORY_ALLOCATION = atoi(value); }
+		if(!memcmp(&currentLine, &optStr27, (sizeof(optStr27) - 1))){ sim->options->ENABLE_GENERATE_ONCE = 1; }
+		if(!memcmp(&currentLine, &optStr33, (sizeof(optStr33) - 1))){ sim->options->WINDOW_WIDTH = atoi(value); }
+		if(!memcmp(&currentLine, &optStr34, (sizeof(optStr34) - 1))){ sim->options->WINDOW_HEIGHT = atoi(value); }
+		if(!memcmp(&currentLine, &optStr35, (sizeof(optStr35) - 1))){ sim->options->FRICTION = atof(value); }
+		if(!memcmp(&currentLine, &optStr36, (sizeof(optStr36) - 1))){ sim->options->NEIGHBOUR_SKIN = atof(value); }
+		if(!memcmp(&currentLine, &optStr37, (sizeof(optStr37) - 1))){ sim->options->WORKER_THREADS = atoi(value); }
+		if(!memcmp(&currentLine, &optStr38, (sizeof(optStr38) - 1))){ sim->options->ENABLE_DETERMINISTIC = 1; }
+		if(!memcmp(&currentLine, &optStr39, (sizeof(optStr39) - 1))){ sim->options->DETERMINISTIC_SEED = atoi(value); }
+		if(!memcmp(&currentLine, &optStr40, (sizeof(optStr40) - 1))){ sim->options->FIXED_TIMESTEP = atof(value); }
+		if(!memcmp(&currentLine, &optStr41, (sizeof(optStr41) - 1))){ sim->options->STATE_HASH_INTERVAL = atoi(value); }
+		if(!memcmp(&currentLine, &optStr43, (sizeof(optStr43) - 1))){ sim->options->STARTING_PARTICLE_COUNT = atoi(value); }
+		if(!memcmp(&currentLine, &optStr44, (sizeof(optStr44) - 1))){ sim->options->REORDER_INTERVAL = atoi(value); }
+		if(!memcmp(&currentLine, &optStr51, (sizeof(optStr51) - 1))){ sim->options->ENABLE_CHARGE = 1; }
+		if(!memcmp(&currentLine, &optStr52, (sizeof(optStr52) - 1))){ sim->options->CHARGE_STRENGTH = atof(value); }
+		if(!memcmp(&currentLine, &optStr53, (sizeof(optStr53) - 1))){ sim->options->CHARGE_MESH_SIZE = atof(value); }
+		if(!memcmp(&currentLine, &optStr54, (sizeof(optStr54) - 1))){ sim->options->MAX_SUBSTEP_LEVEL = min(max(atoi(value), 0), SUBSTEP_LEVEL_LIMIT); }
+		if(!memcmp(&currentLine, &optStr55, (sizeof(optStr55) - 1))){ sim->options->SUBSTEP_TRAVEL = atof(value); }
+		if(!memcmp(&currentLine, &optStr56, (sizeof(optStr56) - 1))){ sim->options->ENABLE_BORDER_WRAP = 1; }
+		if(!memcmp(&currentLine, &optStr57, (sizeof(optStr57) - 1))){ sim->options->ENABLE_BORDER_ABSORB = 1; }
+		if(!memcmp(&currentLine, &optStr58, (sizeof(optStr58) - 1))){ sim->options->WORLD_WIDTH = atoi(value); }
+		if(!memcmp(&currentLine, &optStr59, (sizeof(optStr59) - 1))){ sim->options->WORLD_HEIGHT = atoi(value); }
+		if(!memcmp(&currentLine, &optStr63, (sizeof(optStr63) - 1))){ readOptionPath(sim->options->METRICS_SOCKET, &currentLine[sizeof(optStr63) - 1]); }
+		if(!memcmp(&currentLine, &optStr64, (sizeof(optStr64) - 1))){ readOptionPath(sim->options->METRICS_FILE, &currentLine[sizeof(optStr64) - 1]); }
+		if(!memcmp(&currentLine, &optStr65, (sizeof(optStr65) - 1))){ sim->options->METRICS_INTERVAL = atof(value); }
+		if(!memcmp(&currentLine, &optStr66, (sizeof(optStr66) - 1))){ sim->options->ENABLE_COLLISION_EVENTS = 1; }
+		if(!memcmp(&currentLine, &optStr67, (sizeof(optStr67) - 1))){ readOptionPath(sim->options->COLLISION_LOG, &currentLine[sizeof(optStr67) - 1]); }
+		if(!memcmp(&currentLine, &optStr68, (sizeof(optStr68) - 1))){ sim->options->ENABLE_REFERENCE_CHECK = 1; }
+		if(!memcmp(&currentLine, &optStr69, (sizeof(optStr69) - 1))){ sim->options->REFERENCE_TOLERANCE = atof(value); }
+		if(!memcmp(&currentLine, &optStr70, (sizeof(optStr70) - 1))){ readOptionPath(sim->options->SHARED_MEMORY_NAME, &currentLine[sizeof(optStr70) - 1]); }
+		if(!memcmp(&currentLine, &optStr71, (sizeof(optStr71) - 1))){ sim->options->SLAB_PROCESSES = atoi(value); }
+		if(!memcmp(&currentLine, &optStr72, (sizeof(optStr72) - 1))){ readOptionPath(sim->options->CHECKPOINT_FILE, &currentLine[sizeof(optStr72) - 1]); }
+		if(!memcmp(&currentLine, &optStr73, (sizeof(optStr73) - 1))){ sim->options->CHECKPOINT_STEPS = atoi(value); }
+		if(!memcmp(&currentLine, &optStr74, (sizeof(optStr74) - 1))){ sim->options->CHECKPOINT_MINUTES = atof(value); }
+		if(!memcmp(&currentLine, &optStr75, (sizeof(optStr75) - 1))){ sim->options->CHECKPOINT_KEEP = atoi(value); }
+		if(!memcmp(&currentLine, &optStr76, (sizeof(optStr76) - 1))){ sim->options->ENABLE_RESTART = 1; }
+		if(!memcmp(&currentLine, &optStr77, (sizeof(optStr77) - 1))){ sim->options->ENABLE_COMPACT_PARTICLES = 1; }
+		
+		// the force fields have more than one number, so they read the rest of the line themselves
+		if(!memcmp(&currentLine, &optStr45, (sizeof(optStr45) - 1))){ addForceField(uniformGravity, &currentLine[sizeof(optStr45) - 1]); }
+		if(!memcmp(&currentLine, &optStr46, (sizeof(optStr46) - 1))){ addForceField(pointGravity, &currentLine[sizeof(optStr46) - 1]); }
+		if(!memcmp(&currentLine, &optStr47, (sizeof(optStr47) - 1))){ addForceField(lineGravity, &currentLine[sizeof(optStr47) - 1]); }
+		if(!memcmp(&currentLine, &optStr48, (sizeof(optStr48) - 1))){ addForceField(movingLineGravity, &currentLine[sizeof(optStr48) - 1]); }
+		if(!memcmp(&currentLine, &optStr49, (sizeof(optStr49) - 1))){ addForceField(sineGravity, &currentLine[sizeof(optStr49) - 1]); }
+		if(!memcmp(&currentLine, &optStr50, (sizeof(optStr50) - 1))){ addForceField(airDrag, &currentLine[sizeof(optStr50) - 1]); }
+		
+	}
+	
+	fclose(config);
+	
+	return;
+	
+}
+
+// set up everything the simulation needs, once the options are read and the
+// world size is known, and start the worker threads. Returns 0 if there wasn't
+// the memory for it, and destroySimulation() frees whatever was made
+static inline char createSimulation(){
+	
+	// initialise with 0
+	sim->length = 0;
+	sim->delta = 0.0;
+	sim->simulationStep = 0;
+	sim->randState = (unsigned int)performanceCounter();
+	
+	// in deterministic mode every run starts from the same seed and
+	// takes steps of the same size, no matter how long each frame takes
+	if(sim->options->ENABLE_DETERMINISTIC){
+		
+		// xorshift gets stuck on 0 forever
+		sim->randState = (sim->options->DETERMINISTIC_SEED != 0) ? (unsigned int)sim->options->DETERMINISTIC_SEED : 1u;
+		sim->delta = sim->options->FIXED_TIMESTEP;
+		
+	}
+	
+	// the charges and the sub-steps still work on the particles array. Turning them
+	// off would change what happens without saying, so the particles stay as they are
+	if(sim->options->ENABLE_COMPACT_PARTICLES && (sim->options->ENABLE_CHARGE || (sim->options->MAX_SUBSTEP_LEVEL > 0))){
+		
+		fprintf(stderr, "ENABLE_COMPACT_PARTICLES can't be used with ENABLE_CHARGE or MAX_SUBSTEP_LEVEL, so the particles aren't compact\n");
+		
+		sim->options->ENABLE_COMPACT_PARTICLES = 0;
+		
+	}
+	
+	sim->isCompact = sim->options->ENABLE_COMPACT_PARTICLES;
+	
+	// the compact particles go through the same physics passes, but
+	// these still work on the particles array, so they're turned off
+	if(sim->isCompact){
+		
+		sim->options->REORDER_INTERVAL = 0;
+		sim->options->ENABLE_REFERENCE_CHECK = 0;
+		sim->options->ENABLE_COLLISION_EVENTS = 0;
+		sim->options->SLAB_PROCESSES = 0;
+		sim->options->SHARED_MEMORY_NAME[0] = 0;
+		sim->options->CHECKPOINT_FILE[0] = 0;
+		sim->options->ENABLE_RESTART = 0;
+		
+		sim->particleCapacity = sim->options->MAX_MEMORY_ALLOCATION / (int)COMPACT_PARTICLE_BYTES;
+		
+		sim->compact.x = malloc((size_t)sim->particleCapacity * sizeof(Sint32));
+		sim->compact.y = malloc((size_t)sim->particleCapacity * sizeof(Sint32));
+		sim->compact.velocityX = malloc((size_t)sim->particleCapacity * sizeof(Uint16));
+		sim->compact.velocityY = malloc((size_t)sim->particleCapacity * sizeof(Uint16));
+		sim->compact.bondingWith = malloc((size_t)sim->particleCapacity * sizeof(int));
+		sim->compact.handleSlot = malloc((size_t)sim->particleCapacity * sizeof(Uint32));
+		sim->compact.type = malloc((size_t)sim->particleCapacity * sizeof(Uint8));
+		sim->compact.nearestNeighbour = malloc((size_t)sim->particleCapacity * sizeof(int));
+		sim->compact.collidingAwayFrom = malloc((size_t)sim->particleCapacity * sizeof(int));
+		sim->compact.nearestNeighbourDistance = malloc((size_t)sim->particleCapacity * sizeof(float));
+		
+		if(sim->compact.x == 0 || sim->compact.y == 0 || sim->compact.velocityX == 0 || sim->compact.velocityY == 0 ||
+			sim->compact.bondingWith == 0 || sim->compact.handleSlot == 0 || sim->compact.type == 0 ||
+			sim->compact.nearestNeighbour == 0 || sim->compact.collidingAwayFrom == 0 || sim->compact.nearestNeighbourDistance == 0){ return 0; }
+		
+		// the biggest power of two that still fits four worlds each way into the
+		// fixed point, so particles can go a long way past the borders
+		int biggestSide = max(max(sim->options->WORLD_WIDTH, sim->options->WORLD_HEIGHT), 1);
+		
+		sim->compactScale = ldexp(1.0, (int)floor(log2(2147483648.0 / (4.0 * (double)biggestSide))));
+		sim->compactUnit = 1.0 / sim->compactScale;
+		
+	}
+	
+	else{
+		
+		// allocate MAX_MEMORY_ALLOCATION bytes of memory from heap
+		// for the particle themselves
+		sim->particles = malloc((size_t)(sim->options->MAX_MEMORY_ALLOCATION));
+		
+		// if not able to allocate memory, we print and quit
+		if(sim->particles == 0){ return 0; }
+		
+		// only two particles can bond at the moment
+		sim->bonding = malloc((((size_t)(sim->options->MAX_MEMORY_ALLOCATION) / sizeof(particle))) * sizeof(int));
+		
+		if(sim->bonding == 0){ return 0; }
+		
+		sim->particleCapacity = sim->options->MAX_MEMORY_ALLOCATION / (int)sizeof(particle);
+		
+		// the neighbour lists themselves grow when they need to,
+		// but we need the start, count and last position for every particle
+		sim->neighbourStart = malloc((size_t)sim->particleCapacity * sizeof(int));
+		sim->neighbourCount = malloc((size_t)sim->particleCapacity * sizeof(int));
+		sim->neighbourBuiltX = malloc((size_t)sim->particleCapacity * sizeof(double));
+		sim->neighbourBuiltY = malloc((size_t)sim->particleCapacity * sizeof(double));
+		
+		if(sim->neighbourStart == 0 || sim->neighbourCount == 0 || sim->neighbourBuiltX == 0 || sim->neighbourBuiltY == 0){ return 0; }
+		
+	}
+	
+	sim->neighbourIndices = 0;
+	sim->neighbourCapacity = 0;
+	sim->neighbourBuiltLength = -1;
+	
+	// the grid cells themselves are allocated when the grid is built
+	sim->grid.particleIndices = malloc((size_t)sim->particleCapacity * sizeof(int));
+	sim->grid.particleCell = malloc((size_t)sim->particleCapacity * sizeof(int));
+	
+	if(sim->grid.particleIndices == 0 || sim->grid.particleCell == 0){ return 0; }
+	
+	sim->grid.cellStart = 0;
+	sim->grid.cellRow = 0;
+	sim->grid.cellColumn = 0;
+	sim->grid.cellKeys = 0;
+	sim->grid.cellRank = 0;
+	sim->grid.cellCapacity = 0;
+	sim->grid.cellCount = 0;
+	sim->grid.tableKeys = 0;
+	sim->grid.tableCells = 0;
+	sim->grid.tableCapacity = 0;
+	sim->grid.isStale = 1;
+	sim->largestParticleSize = 1.0;
+	
+	// if the user has selected pixels for the particles, every size (diameter) is 1 pixel
+	for(int type = 0; type < numOfParticleTypes; type++){
+		
+		sim->particleSizes[type] = sim->options->ENABLE_CIRCLE_PARTICLES ? particleTemplates[type].size : 1.0;
+		
+	}
+	
+	sim->bondCandidate = malloc((size_t)sim->particleCapacity * sizeof(int));
+	sim->borderEvents = malloc((size_t)sim->particleCapacity * sizeof(unsigned char));
+	sim->killQueue = malloc((size_t)sim->particleCapacity * sizeof(int));
+	sim->isQueuedForRemoval = calloc((size_t)sim->particleCapacity, sizeof(char));
+	
+	if(sim->bondCandidate == 0 || sim->borderEvents == 0 || sim->killQueue == 0 || sim->isQueuedForRemoval == 0){ return 0; }
+	
+	// each particle makes at most one contact a step
+	sim->contacts = malloc((size_t)sim->particleCapacity * sizeof(collisionContact));
+	sim->colouredContacts = malloc((size_t)sim->particleCapacity * sizeof(collisionContact));
+	sim->usedColours = calloc((size_t)sim->particleCapacity, sizeof(Uint64));
+	
+	if(sim->contacts == 0 || sim->colouredContacts == 0 || sim->usedColours == 0){ return 0; }
+	
+	sim->removalRemap = malloc((size_t)sim->particleCapacity * sizeof(int));
+	sim->removalStamp = calloc((size_t)sim->particleCapacity, sizeof(unsigned int));
+	sim->slotOrigin = malloc((size_t)sim->particleCapacity * sizeof(int));
+	sim->slotOriginStamp = calloc((size_t)sim->particleCapacity, sizeof(unsigned int));
+	
+	if(sim->removalRemap == 0 || sim->removalStamp == 0 || sim->slotOrigin == 0 || sim->slotOriginStamp == 0){ return 0; }
+	
+	atomic_exchange(&sim->killQueueLength, 0);
+	sim->removalEpoch = 0;
+	sim->removalPending = 0;
+	
+	// one handle slot for every particle that can exist
+	sim->handleIndex = malloc((size_t)sim->particleCapacity * sizeof(int));
+	sim->handleGeneration = calloc((size_t)sim->particleCapacity, sizeof(Uint32));
+	sim->freeHandles = malloc((size_t)sim->particleCapacity * sizeof(Uint32));
+	
+	if(sim->handleIndex == 0 || sim->handleGeneration == 0 || sim->freeHandles == 0){ return 0; }
+	
+	sim->freeHandleCount = 0;
+	sim->handleSlotsUsed = 0;
+	
+	// the sub-step levels are only needed if sub-stepping is turned on
+	if(sim->options->MAX_SUBSTEP_LEVEL > 0){
+		
+		sim->subStepLevel = malloc((size_t)sim->particleCapacity * sizeof(unsigned char));
+		sim->subStepOrder = malloc((size_t)sim->particleCapacity * sizeof(int));
+		
+		if(sim->subStepLevel == 0 || sim->subStepOrder == 0){ return 0; }
+		
+	}
+	
+	// the reorder buffers are only needed if the reordering is turned on
+	if(sim->options->REORDER_INTERVAL > 0){
+		
+		sim->mortonKeys = malloc((size_t)sim->particleCapacity * sizeof(Uint32));
+		sim->mortonOrder = malloc((size_t)sim->particleCapacity * sizeof(int));
+		sim->mortonKeysSorted = malloc((size_t)sim->particleCapacity * sizeof(Uint32));
+		sim->mortonOrderSorted = malloc((size_t)sim->particleCapacity * sizeof(int));
+		sim->reorderedTo = malloc((size_t)sim->particleCapacity * sizeof(int));
+		sim->reorderBuffer = malloc((size_t)(sim->options->MAX_MEMORY_ALLOCATION));
+		
+		if(sim->mortonKeys == 0 || sim->mortonOrder == 0 || sim->mortonKeysSorted == 0 || sim->mortonOrderSorted == 0 || sim->reorderedTo == 0 || sim->reorderBuffer == 0){ return 0; }
+		
+	}
+	
+	// the reference check needs a second copy of the particles
+	if(sim->options->ENABLE_REFERENCE_CHECK){
+		
+		sim->referenceParticles = malloc((size_t)(sim->options->MAX_MEMORY_ALLOCATION));
+		sim->referenceScratch = malloc((size_t)sim->particleCapacity * sizeof(int));
+		
+		if(sim->referenceParticles == 0 || sim->referenceScratch == 0){ return 0; }
+		
+		sim->referenceStepsChecked = 0;
+		sim->referenceStepsDiverged = 0;
+		
+	}
+	
+	// the charges and the sub-steps need all of the particles at once. Turning them
+	// off would change what happens without saying, so the slabs are what goes
+	if((sim->options->SLAB_PROCESSES > 1) && (sim->options->ENABLE_CHARGE || (sim->options->MAX_SUBSTEP_LEVEL > 0))){
+		
+		fprintf(stderr, "SLAB_PROCESSES can't split up ENABLE_CHARGE or MAX_SUBSTEP_LEVEL, so everything runs in this process\n");
+		
+		sim->options->SLAB_PROCESSES = 0;
+		
+	}
+	
+	// the slab processes have to be started before any threads are. From here on,
+	// each of them carries on with its own copy of everything made so far
+	if((sim->options->SLAB_PROCESSES > 1) && !startSlabProcesses()){
+		
+		return 0;
+		
+	}
+	
+	if(sim->options->SHARED_MEMORY_NAME[0]){
+		
+		openSharedState();
+		
+	}
+	
+	// start the worker threads, if WORKER_THREADS isn't set
+	// we use every core. The main thread counts as one of them
+	sim->workerCount = (sim->options->WORKER_THREADS > 0) ? sim->options->WORKER_THREADS : cpuCount();
+	
+	// without WORKER_THREADS, the slab processes share the cores out between them
+	if(sim->isSlabProcess && (sim->options->WORKER_THREADS <= 0)){
+		
+		sim->workerCount /= sim->slabCount;
+		
+	}
+	
+	sim->workerCount = max(sim->workerCount, 1);
+	
+	sim->workerDeques = calloc((size_t)sim->workerCount, sizeof(workerDeque));
+	sim->workerThreads = malloc((size_t)sim->workerCount * sizeof(physicsThread*));
+	sim->workerStarts = malloc((size_t)sim->workerCount * sizeof(workerStart));
+	sim->workerMetrics = calloc((size_t)sim->workerCount, sizeof(workerCounters));
+	
+	if(sim->workerDeques == 0 || sim->workerThreads == 0 || sim->workerStarts == 0 || sim->workerMetrics == 0){ return 0; }
+	
+	memset(&sim->cellTasks, 0, sizeof(sim->cellTasks));
+	memset(&sim->rangeTasks, 0, sizeof(sim->rangeTasks));
+	
+	// enough for the starting particles to be spawned without
+	// needing any more memory once the simulation is made
+	if(!reserveWorkerTasks(&sim->rangeTasks, (sim->particleCapacity / SPAWN_CHUNK) + 1)){ return 0; }
+	
+	sim->blockHashes = malloc((((size_t)sim->particleCapacity / STATE_HASH_BLOCK) + 1) * sizeof(Uint64));
+	
+	if(sim->blockHashes == 0){ return 0; }
+	
+	// each worker unpacks a spawn chunk's worth at most, and keeps
+	// the neighbours of the particle it's on, which grow when they need to
+	if(sim->isCompact){
+		
+		sim->compactBlocks = malloc((size_t)sim->workerCount * SPAWN_CHUNK * sizeof(particle));
+		sim->compactNeighbours = calloc((size_t)sim->workerCount, sizeof(int*));
+		sim->compactNeighbourCapacity = calloc((size_t)sim->workerCount, sizeof(int));
+		
+		if(sim->compactBlocks == 0 || sim->compactNeighbours == 0 || sim->compactNeighbourCapacity == 0){ return 0; }
+		
+	}
+	
+	sim->workersQuit = 0;
+	
+	sim->workStart = createSemaphore();
+	sim->workDone = createSemaphore();
+	
+	if(sim->workStart == 0 || sim->workDone == 0){ return 0; }
+	
+	for(int workerNum = 1; workerNum < sim->workerCount; workerNum++){
+		
+		sim->workerStarts[workerNum].simulation = sim;
+		sim->workerStarts[workerNum].workerNum = workerNum;
+		
+		sim->workerThreads[workerNum] = startThread(workerThread, &sim->workerStarts[workerNum]);
+		
+		if(sim->workerThreads[workerNum] == 0){ return 0; }
+		
+		sim->workersStarted = workerNum;
+		
+	}
+	
+	// wait until every worker is running
+	for(int workerNum = 1; workerNum < sim->workerCount; workerNum++){
+		
+		waitSemaphore(sim->workDone);
+		
+	}
+	
+	// the mesh needs to know how many workers there are
+	if(sim->options->ENABLE_CHARGE && !createChargeMesh()){
+		
+		return 0;
+		
+	}
+	
+	buildDirectionTable();
+	
+	// a slab process never goes back to the window
+	if(sim->isSlabProcess){
+		
+		runSlab();
+		
+	}
+	
+	return 1;
+	
+}
+
+// stop the worker threads and free everything createSimulation() made
+static inline void destroySimulation(){
+	
+	// wake up the workers one last time so they can quit
+	sim->workersQuit = 1;
+	
+	for(int workerNum = 1; workerNum <= sim->workersStarted; workerNum++){
+		
+		postSemaphore(sim->workStart);
+		
+	}
+	
+	for(int workerNum = 1; workerNum <= sim->workersStarted; workerNum++){
+		
+		waitThread(sim->workerThreads[workerNum]);
+		
+	}
+	
+	sim->workersStarted = 0;
+	
+	destroySemaphore(sim->workStart);
+	destroySemaphore(sim->workDone);
+	
+	free(sim->particles);
+	sim->particles = 0;
+	
+	free(sim->compact.x);
+	free(sim->compact.y);
+	free(sim->compact.velocityX);
+	free(sim->compact.velocityY);
+	free(sim->compact.bondingWith);
+	free(sim->compact.handleSlot);
+	free(sim->compact.type);
+	free(sim->compact.nearestNeighbour);
+	free(sim->compact.collidingAwayFrom);
+	free(sim->compact.nearestNeighbourDistance);
+	memset(&sim->compact, 0, sizeof(sim->compact));
+	
+	for(int workerNum = 0; sim->compactNeighbours && (workerNum < sim->workerCount); workerNum++){
+		
+		free(sim->compactNeighbours[workerNum]);
+		
+	}
+	
+	free(sim->compactNeighbours);
+	sim->compactNeighbours = 0;
+	
+	free(sim->compactNeighbourCapacity);
+	sim->compactNeighbourCapacity = 0;
+	
+	free(sim->compactBlocks);
+	sim->compactBlocks = 0;
+	
+	free(sim->bonding);
+	sim->bonding = 0;
+	
+	free(sim->neighbourStart);
+	sim->neighbourStart = 0;
+	
+	free(sim->neighbourCount);
+	sim->neighbourCount = 0;
+	
+	free(sim->neighbourIndices);
+	sim->neighbourIndices = 0;
+	
+	free(sim->neighbourBuiltX);
+	sim->neighbourBuiltX = 0;
+	
+	free(sim->neighbourBuiltY);
+	sim->neighbourBuiltY = 0;
+	
+	free(sim->grid.cellStart);
+	sim->grid.cellStart = 0;
+	
+	free(sim->grid.cellRow);
+	sim->grid.cellRow = 0;
+	
+	free(sim->grid.cellColumn);
+	sim->grid.cellColumn = 0;
+	
+	free(sim->grid.cellKeys);
+	sim->grid.cellKeys = 0;
+	
+	free(sim->grid.cellRank);
+	sim->grid.cellRank = 0;
+	
+	free(sim->grid.tableKeys);
+	sim->grid.tableKeys = 0;
+	
+	free(sim->grid.tableCells);
+	sim->grid.tableCells = 0;
+	
+	free(sim->grid.particleIndices);
+	sim->grid.particleIndices = 0;
+	
+	free(sim->grid.particleCell);
+	sim->grid.particleCell = 0;
+	
+	free(sim->bondCandidate);
+	sim->bondCandidate = 0;
+	
+	free(sim->borderEvents);
+	sim->borderEvents = 0;
+	
+	free(sim->workerDeques);
+	sim->workerDeques = 0;
+	
+	free(sim->workerThreads);
+	sim->workerThreads = 0;
+	
+	free(sim->workerStarts);
+	sim->workerStarts = 0;
+	
+	free(sim->workerMetrics);
+	sim->workerMetrics = 0;
+	
+	for(int workerNum = 0; (sim->eventRings != 0) && (workerNum < sim->workerCount); workerNum++){
+		
+		free(sim->eventRings[workerNum].events);
+		
+	}
+	
+	free(sim->eventRings);
+	sim->eventRings = 0;
+	
+	free(sim->cellTasks.tasks);
+	sim->cellTasks.tasks = 0;
+	
+	free(sim->rangeTasks.tasks);
+	sim->rangeTasks.tasks = 0;
+	
+	free(sim->queryResults);
+	sim->queryResults = 0;
+	sim->queryCapacity = 0;
+	
+	free(sim->blockHashes);
+	sim->blockHashes = 0;
+	
+	destroyChargeMesh();
+	
+	free(sim->contacts);
+	sim->contacts = 0;
+	
+	free(sim->colouredContacts);
+	sim->colouredContacts = 0;
+	
+	free(sim->usedColours);
+	sim->usedColours = 0;
+	
+	free(sim->killQueue);
+	sim->killQueue = 0;
+	
+	free(sim->isQueuedForRemoval);
+	sim->isQueuedForRemoval = 0;
+	
+	free(sim->removalRemap);
+	sim->removalRemap = 0;
+	
+	free(sim->removalStamp);
+	sim->removalStamp = 0;
+	
+	free(sim->slotOrigin);
+	sim->slotOrigin = 0;
+	
+	free(sim->slotOriginStamp);
+	sim->slotOriginStamp = 0;
+	
+	free(sim->handleIndex);
+	sim->handleIndex = 0;
+	
+	free(sim->handleGeneration);
+	sim->handleGeneration = 0;
+	
+	free(sim->freeHandles);
+	sim->freeHandles = 0;
+	
+	free(sim->subStepLevel);
+	sim->subStepLevel = 0;
+	
+	free(sim->subStepOrder);
+	sim->subStepOrder = 0;
+	
+	free(sim->mortonKeys);
+	sim->mortonKeys = 0;
+	
+	free(sim->mortonOrder);
+	sim->mortonOrder = 0;
+	
+	free(sim->mortonKeysSorted);
+	sim->mortonKeysSorted = 0;
+	
+	free(sim->mortonOrderSorted);
+	sim->mortonOrderSorted = 0;
+	
+	free(sim->reorderedTo);
+	sim->reorderedTo = 0;
+	
+	free(sim->reorderBuffer);
+	sim->reorderBuffer = 0;
+	
+	if(sim->options->ENABLE_REFERENCE_CHECK){
+		
+		printf("reference check: %llu steps checked, %llu diverged\n", (unsigned long long)sim->referenceStepsChecked, (unsigned long long)sim->referenceStepsDiverged);
+		
+	}
+	
+	free(sim->referenceParticles);
+	sim->referenceParticles = 0;
+	
+	free(sim->referenceScratch);
+	sim->referenceScratch = 0;
+	
+	closeSharedState();
+	
+	stopSlabProcesses();
+	
+	return;
+	
+}
+
+// With SLAB_PROCESSES, the world is cut into that many slabs side by side, and
+// each slab is run by a process of its own with its own worker threads. This
+// process (the coordinator) keeps the window, the commands and everything that
+// gets recorded, and each step it tells the slabs to take a step and gathers up
+// what they did. The slabs talk to each other over a Unix socket across every
+// boundary between them, a bit like MPI would:
+//   - a particle that has left a slab is sent across to the slab on that side,
+//     and it's that slab's particle from then on
+//   - once the particles have moved, everything touching across a boundary is
+//     gathered into one slab (see gatherSlabClusters()), so the interaction
+//     pass sees every pair once, in the same order as one process would
+// Between steps a slab's particles can't point at each other by number, as the
+// one they point at might be in another slab by the next step, so
+// nearestNeighbour and collidingAwayFrom hold handle slots then instead
+typedef enum{
+	
+	slabLoad,
+	slabStep,
+	slabGather,
+	slabQuit
+	
+} slabMessageKind;
+
+// what the coordinator and a slab send each other. slabLoad gives the slab every
+// particle it has from now on, slabStep asks it to take a step, and slabGather
+// asks for all of its particles. count particles come straight after
+typedef struct slabMessage {
+	
+	int kind;
+	int count;
+	
+	double delta;
+	double simulationTime;
+	
+	// the slabs sort their particles on the same steps as everyone else
+	Uint64 step;
+	Uint64 collisions;
+	
+	// what a slab's metrics and event rings picked up in its step. The
+	// events come straight after
+	Uint64 candidatePairs;
+	int events;
+	int droppedEvents;
+	
+} slabMessage;
+
+// how many particles the coordinator sends a slab at a time when it scatters them
+#define SLAB_SCATTER_CHUNK 1024
+
+// send or receive the whole of something, waiting as long as it takes.
+// 0 if the process at the other end has gone
+static inline char sendSlabBytes(int socket, const void* data, size_t size){
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	const char* remaining = (const char*)data;
+	
+	while(size > 0){
+		
+		ssize_t sent = send(socket, remaining, size, MSG_NOSIGNAL);
+		
+		if(sent <= 0){
+			
+			return 0;
+			
+		}
+		
+		remaining += sent;
+		size -= (size_t)sent;
+		
+	}
+	
+	return 1;
+	
+#else
+	
+	(void)socket;
+	(void)data;
+	(void)size;
+	
+	return 0;
+	
+#endif
+	
+}
+
+static inline char receiveSlabBytes(int socket, void* data, size_t size){
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	char* remaining = (char*)data;
+	
+	while(size > 0){
+		
+		ssize_t received = recv(socket, remaining, size, 0);
+		
+		if(received <= 0){
+			
+			return 0;
+			
+		}
+		
+		remaining += received;
+		size -= (size_t)received;
+		
+	}
+	
+	return 1;
+	
+#else
+	
+	(void)socket;
+	(void)data;
+	(void)size;
+	
+	return 0;
+	
+#endif
+	
+}
+
+// a slab process the coordinator can't reach any more. Nothing can
+// carry on without its particles, so neither can this one
+static inline void loseSlab(int slab){
+	
+	fprintf(stderr, "slab process %d has stopped\n", slab);
+	
+	exit(1);
+	
+}
+
+// buffer, with room for at least count things of size bytes
+static inline void* reserveSlabBuffer(void* buffer, int* capacity, int count, size_t size){
+	
+	if(count <= *capacity){
+		
+		return buffer;
+		
+	}
+	
+	*capacity = max(count, *capacity * 2);
+	buffer = realloc(buffer, (size_t)*capacity * size);
+	
+	if(buffer == 0){ exit(0); }
+	
+	return buffer;
+	
+}
+
+// make an array with size bytes for each particle big enough for capacity particles.
+// The arrays that count from 0 (the ones createSimulation() callocs) get their new room zeroed
+static inline void* resizeParticleArray(void* array, int oldCapacity, int capacity, size_t size, char isZeroed){
+	
+	char* resized = realloc(array, (size_t)capacity * size);
+	
+	if(resized == 0){ exit(0); }
+	
+	if(isZeroed && (capacity > oldCapacity)){
+		
+		memset(resized + ((size_t)oldCapacity * size), 0, (size_t)(capacity - oldCapacity) * size);
+		
+	}
+	
+	return resized;
+	
+}
+
+// A slab only has room for its own particles and its halo, rather than for
+// every particle like the coordinator, and makes more when more come over.
+// The handles are the coordinator's, so their arrays stay the size they are
+static inline void resizeSlabArrays(int capacity){
+	
+	int old = sim->particleCapacity;
+	
+	sim->particles = resizeParticleArray(sim->particles, old, capacity, sizeof(particle), 0);
+	sim->bonding = resizeParticleArray(sim->bonding, old, capacity, sizeof(int), 0);
+	sim->neighbourStart = resizeParticleArray(sim->neighbourStart, old, capacity, sizeof(int), 0);
+	sim->neighbourCount = resizeParticleArray(sim->neighbourCount, old, capacity, sizeof(int), 0);
+	sim->neighbourBuiltX = resizeParticleArray(sim->neighbourBuiltX, old, capacity, sizeof(double), 0);
+	sim->neighbourBuiltY = resizeParticleArray(sim->neighbourBuiltY, old, capacity, sizeof(double), 0);
+	sim->grid.particleIndices = resizeParticleArray(sim->grid.particleIndices, old, capacity, sizeof(int), 0);
+	sim->grid.particleCell = resizeParticleArray(sim->grid.particleCell, old, capacity, sizeof(int), 0);
+	sim->bondCandidate = resizeParticleArray(sim->bondCandidate, old, capacity, sizeof(int), 0);
+	sim->borderEvents = resizeParticleArray(sim->borderEvents, old, capacity, sizeof(unsigned char), 0);
+	sim->killQueue = resizeParticleArray(sim->killQueue, old, capacity, sizeof(int), 0);
+	sim->isQueuedForRemoval = resizeParticleArray(sim->isQueuedForRemoval, old, capacity, sizeof(char), 1);
+	sim->contacts = resizeParticleArray(sim->contacts, old, capacity, sizeof(collisionContact), 0);
+	sim->colouredContacts = resizeParticleArray(sim->colouredContacts, old, capacity, sizeof(collisionContact), 0);
+	sim->usedColours = resizeParticleArray(sim->usedColours, old, capacity, sizeof(Uint64), 1);
+	sim->removalRemap = resizeParticleArray(sim->removalRemap, old, capacity, sizeof(int), 0);
+	sim->removalStamp = resizeParticleArray(sim->removalStamp, old, capacity, sizeof(unsigned int), 1);
+	sim->slotOrigin = resizeParticleArray(sim->slotOrigin, old, capacity, sizeof(int), 0);
+	sim->slotOriginStamp = resizeParticleArray(sim->slotOriginStamp, old, capacity, sizeof(unsigned int), 1);
+	sim->slabClusterMarks = resizeParticleArray(sim->slabClusterMarks, old, capacity, sizeof(unsigned char), 0);
+	sim->slabClusterQueue = resizeParticleArray(sim->slabClusterQueue, old, capacity, sizeof(int), 0);
+	sim->slabAbsorbed = resizeParticleArray(sim->slabAbsorbed, old, capacity, sizeof(int), 0);
+	
+	// the slabs can still sort their particles and check them against the reference
+	if(sim->options->REORDER_INTERVAL > 0){
+		
+		sim->mortonKeys = resizeParticleArray(sim->mortonKeys, old, capacity, sizeof(Uint32), 0);
+		sim->mortonOrder = resizeParticleArray(sim->mortonOrder, old, capacity, sizeof(int), 0);
+		sim->mortonKeysSorted = resizeParticleArray(sim->mortonKeysSorted, old, capacity, sizeof(Uint32), 0);
+		sim->mortonOrderSorted = resizeParticleArray(sim->mortonOrderSorted, old, capacity, sizeof(int), 0);
+		sim->reorderedTo = resizeParticleArray(sim->reorderedTo, old, capacity, sizeof(int), 0);
+		sim->reorderBuffer = resizeParticleArray(sim->reorderBuffer, old, capacity, sizeof(particle), 0);
+		
+	}
+	
+	if(sim->options->ENABLE_REFERENCE_CHECK){
+		
+		sim->referenceParticles = resizeParticleArray(sim->referenceParticles, old, capacity, sizeof(particle), 0);
+		sim->referenceScratch = resizeParticleArray(sim->referenceScratch, old, capacity, sizeof(int), 0);
+		
+	}
+	
+	// made after the slabs are started, with however much room there is by then
+	if(sim->blockHashes){
+		
+		sim->blockHashes = resizeParticleArray(sim->blockHashes, (old / STATE_HASH_BLOCK) + 1, (capacity / STATE_HASH_BLOCK) + 1, sizeof(Uint64), 0);
+		
+	}
+	
+	sim->particleCapacity = capacity;
+	
+	return;
+	
+}
+
+// make sure a slab has room for count particles. It can't be given more than
+// the coordinator has room for, but the halo can take it past that
+static inline void reserveSlabArrays(int count){
+	
+	if(count <= sim->particleCapacity){
+		
+		return;
+		
+	}
+	
+	resizeSlabArrays(max(count, sim->particleCapacity * 2));
+	
+	return;
+	
+}
+
+// how long a whole message over a boundary with this header is
+static inline size_t slabMessageSize(const slabHeader* restrict header){
+	
+	return sizeof(slabHeader) + ((size_t)header->count * sizeof(particle));
+	
+}
+
+// the part of a message over a boundary that starts offset bytes in, and how
+// long it is. The header and the particles are the two parts
+static inline char* slabMessagePart(slabHeader* restrict header, particle* particlesPart, size_t offset, size_t* partSize){
+	
+	if(offset < sizeof(slabHeader)){
+		
+		*partSize = sizeof(slabHeader) - offset;
+		
+		return (char*)header + offset;
+		
+	}
+	
+	offset -= sizeof(slabHeader);
+	
+	*partSize = ((size_t)header->count * sizeof(particle)) - offset;
+	
+	return (char*)particlesPart + offset;
+	
+}
+
+// start both boundaries off with nothing to send
+static inline void clearSlabLinks(){
+	
+	for(int side = 0; side < 2; side++){
+		
+		memset(&sim->slabLinks[side].outgoingHeader, 0, sizeof(slabHeader));
+		
+	}
+	
+	return;
+	
+}
+
+// send the outgoing messages over both boundaries and receive the incoming ones.
+// The slabs either side are doing the same thing at the same time, so both ways
+// go together, a bit at a time, whenever a socket is ready. Sending everything
+// first could leave two slabs both waiting for the other to read
+static inline void exchangeSlabParticles(){
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	size_t sent[2] = {0, 0};
+	size_t received[2] = {0, 0};
+	
+	while(1){
+		
+		struct pollfd waiting[2];
+		int waitingSide[2];
+		int waitingCount = 0;
+		
+		for(int side = 0; side < 2; side++){
+			
+			slabLink* link = &sim->slabLinks[side];
+			
+			if(link->socket == -1){
+				
+				continue;
+				
+			}
+			
+			size_t sendSize = slabMessageSize(&link->outgoingHeader);
+			
+			// until the header is in, there's no knowing how much else is coming
+			size_t receiveSize = (received[side] < sizeof(slabHeader)) ? sizeof(slabHeader) : slabMessageSize(&link->incomingHeader);
+			
+			short events = (short)(((sent[side] < sendSize) ? POLLOUT : 0) | ((received[side] < receiveSize) ? POLLIN : 0));
+			
+			if(events){
+				
+				waiting[waitingCount].fd = link->socket;
+				waiting[waitingCount].events = events;
+				waiting[waitingCount].revents = 0;
+				waitingSide[waitingCount] = side;
+				waitingCount++;
+				
+			}
+			
+		}
+		
+		if(waitingCount == 0){
+			
+			break;
+			
+		}
+		
+		if(poll(waiting, (nfds_t)waitingCount, -1) < 0){
+			
+			continue;
+			
+		}
+		
+		for(int w = 0; w < waitingCount; w++){
+			
+			int side = waitingSide[w];
+			slabLink* link = &sim->slabLinks[side];
+			size_t partSize;
+			char isLost = 0;
+			
+			if(waiting[w].revents & POLLOUT){
+				
+				char* part = slabMessagePart(&link->outgoingHeader, link->outgoing, sent[side], &partSize);
+				ssize_t moved = send(link->socket, part, partSize, MSG_NOSIGNAL | MSG_DONTWAIT);
+				
+				if(moved > 0){
+					
+					sent[side] += (size_t)moved;
+					
+				}
+				
+				else if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)){
+					
+					isLost = 1;
+					
+				}
+				
+			}
+			
+			if(!isLost && (waiting[w].revents & (POLLIN | POLLHUP | POLLERR))){
+				
+				char* part = slabMessagePart(&link->incomingHeader, link->incoming, received[side], &partSize);
+				ssize_t moved = recv(link->socket, part, partSize, MSG_DONTWAIT);
+				
+				if(moved > 0){
+					
+					received[side] += (size_t)moved;
+					
+					// the header is in, make room for what comes after it
+					if(received[side] == sizeof(slabHeader)){
+						
+						slabHeader* header = &link->incomingHeader;
+						
+						header->count = min(max(header->count, 0), sim->options->MAX_MEMORY_ALLOCATION / (int)sizeof(particle));
+						
+						link->incoming = reserveSlabBuffer(link->incoming, &link->incomingCapacity, header->count, sizeof(particle));
+						
+					}
+					
+				}
+				
+				// 0 is the other end closing
+				else if((moved == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))){
+					
+					isLost = 1;
+					
+				}
+				
+			}
+			
+			// the slab next door has gone. The coordinator stops when it
+			// sees this one has gone too
+			if(isLost){
+				
+				fprintf(stderr, "slab process %d lost the slab next to it\n", sim->slabNum);
+				
+				_Exit(1);
+				
+			}
+			
+		}
+		
+	}
+	
+#endif
+	
+	return;
+	
+}
+
+// between steps, a reference to another particle is kept as -2 minus its handle
+// slot, which still means the same particle after it has gone to another slab
+static inline int encodeSlabReference(int particleNum){
+	
+	return (particleNum > -1) ? (-2 - (int)(Uint32)sim->particles[particleNum].handle) : particleNum;
+	
+}
+
+// and back to the number of the particle with that handle, or -1 if it isn't here
+static inline int decodeSlabReference(int reference){
+	
+	if(reference > -2){
+		
+		return reference;
+		
+	}
+	
+	Uint32 slot = (Uint32)(-2 - reference);
+	int particleNum = (slot < (Uint32)sim->handleSlotsUsed) ? sim->handleIndex[slot] : -1;
+	
+	if((particleNum < 0) || (particleNum >= sim->length) || ((Uint32)sim->particles[particleNum].handle != slot)){
+		
+		return -1;
+		
+	}
+	
+	return particleNum;
+	
+}
+
+// the particle that decides which slab a particle goes in. A bonded
+// pair has to stay together, so they both go where the one with
+// the smaller handle is
+static inline int slabLeader(int i){
+	
+	int partner = sim->particles[i].bondingWith;
+	
+	return ((partner > -1) && (sim->particles[partner].handle < sim->particles[i].handle)) ? partner : i;
+	
+}
+
+// how far along this slab x is, from 0 at its left edge to slabWidth at its right.
+// When the border wraps, a particle that just went out over the edge of the
+// world is still next to the slab, on the other side of it
+static inline double slabPosition(double x){
+	
+	return (0.5 * sim->slabWidth) + minimumImage(x - (((double)sim->slabNum + 0.5) * sim->slabWidth), (double)sim->options->WORLD_WIDTH);
+	
+}
+
+static inline void queueSlabParticle(int side, int i){
+	
+	slabLink* link = &sim->slabLinks[side];
+	
+	link->outgoing = reserveSlabBuffer(link->outgoing, &link->outgoingCapacity, link->outgoingHeader.count + 1, sizeof(particle));
+	
+	link->outgoing[link->outgoingHeader.count] = sim->particles[i];
+	link->outgoingHeader.count++;
+	
+	return;
+	
+}
+
+// put the particles that came over a boundary on the end. The ones that
+// moved here keep their handle, halo particles only borrow it for this step
+static inline void appendSlabParticles(int side){
+	
+	slabLink* link = &sim->slabLinks[side];
+	
+	reserveSlabArrays(sim->length + link->incomingHeader.count);
+	
+	for(int k = 0; k < link->incomingHeader.count; k++){
+		
+		sim->particles[sim->length] = link->incoming[k];
+		
+		// the partner's number was only right in the other slab
+		sim->particles[sim->length].bondingWith = -1;
+		
+		adoptParticleHandle(sim->length);
+		
+		sim->length++;
+		
+	}
+	
+	return;
+	
+}
+
+// send every particle that has left this slab over the boundary it went
+// over, and receive the ones that came the other way. They're queued for
+// removal here, so removeQueuedParticles() takes them out with the rest
+static inline void sendSlabParticles(){
+	
+	clearSlabLinks();
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		if(sim->isQueuedForRemoval[i]){
+			
+			continue;
+			
+		}
+		
+		double position = slabPosition(sim->particles[slabLeader(i)].x);
+		int side = (position < 0.0) ? 0 : ((position >= sim->slabWidth) ? 1 : -1);
+		
+		// at the edge of a world that doesn't wrap, there's nowhere to send it
+		if((side > -1) && (sim->slabLinks[side].socket != -1)){
+			
+			queueSlabParticle(side, i);
+			queueParticleRemoval(i);
+			
+		}
+		
+	}
+	
+	exchangeSlabParticles();
+	
+	return;
+	
+}
+
+// the particles that came in, once the ones that left are gone
+static inline void receiveSlabParticles(){
+	
+	int firstArrival = sim->length;
+	
+	appendSlabParticles(0);
+	appendSlabParticles(1);
+	
+	// the handles of the particles that left belong to them, not to this slab
+	sim->freeHandleCount = 0;
+	
+	// bonded pairs always move together, so both halves are here now
+	for(int i = firstArrival; i < sim->length; i++){
+		
+		if(sim->particles[i].bondedTo == NULL_PARTICLE_HANDLE){
+			
+			continue;
+			
+		}
+		
+		int partner = resolveParticleHandle(sim->particles[i].bondedTo);
+		
+		// unless the partner was removed at the same time
+		if(partner == -1){
+			
+			sim->particles[i].bondedTo = NULL_PARTICLE_HANDLE;
+			sim->particles[i].mass = particleTemplates[sim->particles[i].type].mass;
+			
+			continue;
+			
+		}
+		
+		sim->particles[i].bondingWith = partner;
+		
+		// count each pair once, at the second of the two
+		sim->bondedPairs += (partner < i);
+		
+	}
+	
+	return;
+	
+}
+
+// the mark gatherSlabClusters() puts on a particle joined to the halo on the left
+#define SLAB_JOINED_LEFT 1
+
+// would the border have taken particle i away this step? For particles
+// that come over a boundary after the border pass has been
+static inline char isAbsorbedByBorder(int i){
+	
+	if(sim->options->ENABLE_BORDER_WRAP || !sim->options->ENABLE_BORDER_ABSORB){
+		
+		return 0;
+		
+	}
+	
+	double radius = 0.5 * sim->particleSizes[sim->particles[i].type];
+	
+	return ((sim->particles[i].x + radius) < 0.0) || ((sim->particles[i].x - radius) > (double)sim->options->WORLD_WIDTH) ||
+		((sim->particles[i].y + radius) < 0.0) || ((sim->particles[i].y - radius) > (double)sim->options->WORLD_HEIGHT);
+	
+}
+
+// tell the slabs either side how far this slab's particles reach over the
+// boundary between them, from the boundary
+static inline void tellSlabReach(){
+	
+	clearSlabLinks();
+	
+	double lowest = INFINITY;
+	double highest = -INFINITY;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		double position = slabPosition(sim->particles[i].x);
+		double radius = 0.5 * sim->particleSizes[sim->particles[i].type];
+		
+		lowest = minDouble(lowest, position - radius);
+		highest = maxDouble(highest, position + radius);
+		
+	}
+	
+	sim->slabLinks[0].outgoingHeader.reach = -lowest;
+	sim->slabLinks[1].outgoingHeader.reach = highest - sim->slabWidth;
+	
+	exchangeSlabParticles();
+	
+	return;
+	
+}
+
+// copy every particle the slab over a boundary could be touching over it, and
+// put the ones that came the other way on the end (the halo). A particle can
+// touch one over there if the gap between them is less than 1, so anything
+// nearer the boundary than 1 past how far that slab's particles reach is sent.
+// One more makes sure rounding doesn't leave one out
+static inline void exchangeSlabStrips(int* restrict firstRight){
+	
+	int owned = sim->length;
+	
+	double leftReach = sim->slabLinks[0].incomingHeader.reach + 2.0;
+	double rightReach = sim->slabLinks[1].incomingHeader.reach + 2.0;
+	
+	clearSlabLinks();
+	
+	for(int i = 0; i < owned; i++){
+		
+		double position = slabPosition(sim->particles[i].x);
+		double radius = 0.5 * sim->particleSizes[sim->particles[i].type];
+		
+		if((sim->slabLinks[0].socket != -1) && ((position - radius) < leftReach)){
+			
+			queueSlabParticle(0, i);
+			
+		}
+		
+		if((sim->slabLinks[1].socket != -1) && ((position + radius) > (sim->slabWidth - rightReach))){
+			
+			queueSlabParticle(1, i);
+			
+		}
+		
+	}
+	
+	exchangeSlabParticles();
+	
+	appendSlabParticles(0);
+	
+	*firstRight = sim->length;
+	
+	appendSlabParticles(1);
+	
+	memset(sim->slabClusterMarks, 0, (size_t)sim->length * sizeof(unsigned char));
+	
+	return;
+	
+}
+
+// mark particle i as joined to the halo on the left and queue it up, unless it already is
+static inline int joinSlabParticle(int i, int queued){
+	
+	if((i == -1) || (sim->slabClusterMarks[i] & SLAB_JOINED_LEFT)){
+		
+		return queued;
+		
+	}
+	
+	sim->slabClusterMarks[i] |= SLAB_JOINED_LEFT;
+	sim->slabClusterQueue[queued] = i;
+	
+	return queued + 1;
+	
+}
+
+// go through everything joined to the queued particles, and everything joined to
+// that, and so on. Two particles are joined if they're touching and either is red
+// or blue (whatever a red or blue touches changes what it does), or if they're
+// bonded. Nothing else can reach a particle in the interaction pass
+static inline void joinSlabCluster(int queued, int owned){
+	
+	for(int next = 0; next < queued; next++){
+		
+		int i = sim->slabClusterQueue[next];
+		
+		int count = findNeighbours(i, 0);
+		
+		sim->slabNeighbours = reserveSlabBuffer(sim->slabNeighbours, &sim->slabNeighbourCapacity, count, sizeof(int));
+		
+		findNeighbours(i, sim->slabNeighbours);
+		
+		char isRedOrBlue = (sim->particles[i].type == red_particle) || (sim->particles[i].type == blue_particle);
+		
+		for(int n = 0; n < count; n++){
+			
+			int j = sim->slabNeighbours[n];
+			
+			if(!isRedOrBlue && (sim->particles[j].type != red_particle) && (sim->particles[j].type != blue_particle)){
+				
+				continue;
+				
+			}
+			
+			if(areTouching(sim->particles[i].x, sim->particles[i].y, sim->particles[i].type, sim->particles[j].x, sim->particles[j].y, sim->particles[j].type)){
+				
+				queued = joinSlabParticle(j, queued);
+				
+			}
+			
+		}
+		
+		// the halo's bonds aren't found again here, but a halo particle's partner is
+		// over there already, and anything of this slab's it touches is in the halo
+		if(i < owned){
+			
+			queued = joinSlabParticle(sim->particles[i].bondingWith, queued);
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// A pair of particles touching across a boundary has to be worked out by one of
+// the slabs, with everything it touches, in handle order, or it would bounce twice
+// and the results wouldn't be the same as in one process. So before the interaction
+// pass, every particle joined to the slab on the left (see joinSlabCluster()) moves
+// over to it:
+//   - the slabs tell each other how far their particles reach over each boundary
+//   - each sends over every particle the other side could be touching, as a halo
+//     that's only here for a moment
+//   - starting from the halo on the left, each slab finds everything joined to
+//     it, throws the halo away, and sends what it found to the left
+// The first slab keeps what it has
+static inline void moveSlabClusters(){
+	
+	tellSlabReach();
+	
+	int owned = sim->length;
+	int firstRight;
+	
+	exchangeSlabStrips(&firstRight);
+	
+	if(sim->slabNum > 0){
+		
+		buildSpatialGrid();
+		
+		// round a wrapping world, the slab on the right is the first slab too
+		int lastSeed = sim->options->ENABLE_BORDER_WRAP ? sim->length : firstRight;
+		int queued = 0;
+		
+		for(int i = owned; i < lastSeed; i++){
+			
+			queued = joinSlabParticle(i, queued);
+			
+		}
+		
+		joinSlabCluster(queued, owned);
+		
+	}
+	
+	// the handles the halo borrowed stop working
+	for(int i = owned; i < sim->length; i++){
+		
+		sim->handleGeneration[(Uint32)sim->particles[i].handle]++;
+		
+	}
+	
+	sim->length = owned;
+	
+	// what the border absorbed this step has to stay until the next one, like it
+	// would in one process, so it's put aside while the ones leaving are taken out
+	int absorbed = atomic_load(&sim->killQueueLength);
+	
+	memcpy(sim->slabAbsorbed, sim->killQueue, (size_t)absorbed * sizeof(int));
+	
+	for(int k = 0; k < absorbed; k++){
+		
+		sim->isQueuedForRemoval[sim->slabAbsorbed[k]] = 0;
+		
+	}
+	
+	atomic_store(&sim->killQueueLength, 0);
+	
+	clearSlabLinks();
+	
+	for(int i = 0; i < owned; i++){
+		
+		if(sim->slabClusterMarks[i] & SLAB_JOINED_LEFT){
+			
+			queueSlabParticle(0, i);
+			queueParticleRemoval(i);
+			
+		}
+		
+	}
+	
+	exchangeSlabParticles();
+	
+	char hasLeavers = atomic_load(&sim->killQueueLength) > 0;
+	
+	removeQueuedParticles();
+	
+	for(int k = 0; k < absorbed; k++){
+		
+		int i = hasLeavers ? remapRemoved(sim->slabAbsorbed[k]) : sim->slabAbsorbed[k];
+		
+		if(i > -1){
+			
+			queueParticleRemoval(i);
+			
+		}
+		
+	}
+	
+	int firstArrival = sim->length;
+	
+	receiveSlabParticles();
+	
+	// and the ones that came here absorbed go the same way
+	for(int i = firstArrival; i < sim->length; i++){
+		
+		if(isAbsorbedByBorder(i)){
+			
+			queueParticleRemoval(i);
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// A group joined across several slabs gets one slab nearer the first slab each
+// time round, so after one less time than there are slabs, every group is all in
+// one slab, with no halo, and each pair is only seen once. The groups are only
+// as big as the particles make them, so in a crowded world most of them can end
+// up in the first slab. This is also where the references stop being handle
+// slots for the rest of the step
+static inline void gatherSlabClusters(){
+	
+	for(int round = 1; round < sim->slabCount; round++){
+		
+		moveSlabClusters();
+		
+	}
+	
+	// everything that could be touching is here now, so the references can be numbers
+	// again. What a particle is colliding away from can be in another slab by now, but
+	// it still mustn't collide with it if it comes back, so that keeps its handle slot
+	for(int i = 0; i < sim->length; i++){
+		
+		int awayFrom = decodeSlabReference(sim->particles[i].collidingAwayFrom);
+		
+		sim->particles[i].nearestNeighbour = decodeSlabReference(sim->particles[i].nearestNeighbour);
+		sim->particles[i].collidingAwayFrom = (awayFrom > -1) ? awayFrom : sim->particles[i].collidingAwayFrom;
+		
+	}
+	
+	// and they're the numbers from now, so there's nothing for the interaction pass to fix
+	sim->removalPending = 0;
+	
+	// the particles are different every step, so the lists are always made again
+	sim->neighbourBuiltLength = -1;
+	sim->grid.isStale = 1;
+	
+	return;
+	
+}
+
+// once the interaction pass is done, the references go back to being handle slots
+static inline void encodeSlabReferences(){
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		sim->particles[i].nearestNeighbour = encodeSlabReference(sim->particles[i].nearestNeighbour);
+		sim->particles[i].collidingAwayFrom = encodeSlabReference(sim->particles[i].collidingAwayFrom);
+		
+	}
+	
+	return;
+	
+}
+
+// particles that were made somewhere else keep the handles
+// they had, and find their bonds again by them
+static inline void adoptLoadedParticles(){
+	
+	releaseAllParticleHandles();
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		adoptParticleHandle(i);
+		
+		// they were never spawned here, so the grid cells have to be made big enough for them
+		sim->largestParticleSize = maxDouble(sim->largestParticleSize, sim->particleSizes[sim->particles[i].type]);
+		
+	}
+	
+	sim->bondedPairs = 0;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		sim->particles[i].bondingWith = resolveParticleHandle(sim->particles[i].bondedTo);
+		sim->bondedPairs += (sim->particles[i].bondingWith > -1);
+		
+	}
+	
+	sim->bondedPairs /= 2;
+	
+	sim->neighbourBuiltLength = -1;
+	sim->grid.isStale = 1;
+	
+	return;
+	
+}
+
+// a slab's new particles have come from the coordinator
+static inline void loadSlabParticles(){
+	
+	// anything still queued for removal has gone with the old particles
+	for(int k = 0; k < atomic_load(&sim->killQueueLength); k++){
+		
+		sim->isQueuedForRemoval[sim->killQueue[k]] = 0;
+		
+	}
+	
+	atomic_exchange(&sim->killQueueLength, 0);
+	sim->removalPending = 0;
+	
+	adoptLoadedParticles();
+	
+	return;
+	
+}
+
+// the slab a particle on the coordinator belongs in
+static inline int slabOf(int i){
+	
+	return min(max((int)floor(sim->particles[slabLeader(i)].x / sim->slabWidth), 0), sim->slabCount - 1);
+	
+}
+
+// send the particles waiting in a slab's part of slabBuffer
+static inline void sendScatteredParticles(int slab){
+	
+	if(!sendSlabBytes(sim->slabSockets[slab], &sim->slabBuffer[slab * SLAB_SCATTER_CHUNK], (size_t)sim->slabCounts[slab] * sizeof(particle))){
+		
+		loseSlab(slab);
+		
+	}
+	
+	sim->slabCounts[slab] = 0;
+	
+	return;
+	
+}
+
+// give every slab the particles in it, replacing the ones it had. Each slab
+// gets them SLAB_SCATTER_CHUNK at a time, so there's never a second copy of them all
+static inline void scatterSlabs(){
+	
+	// anything spawned or removed since the gather means sorting them again
+	char isInOrder = sim->slabsInOrder && (sim->length == sim->gatheredLength);
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		sim->slabCounts[slab] = isInOrder ? sim->slabLengths[slab] : 0;
+		
+	}
+	
+	for(int i = 0; !isInOrder && (i < sim->length); i++){
+		
+		sim->slabCounts[slabOf(i)]++;
+		
+	}
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		slabMessage message = {.kind = slabLoad, .count = sim->slabCounts[slab], .delta = sim->delta, .simulationTime = sim->simulationTime, .step = sim->simulationStep};
+		
+		if(!sendSlabBytes(sim->slabSockets[slab], &message, sizeof(message))){
+			
+			loseSlab(slab);
+			
+		}
+		
+		sim->slabCounts[slab] = 0;
+		
+	}
+	
+	// in order, the slab a particle goes to is the one whose run it's in
+	int runOwner = 0;
+	int runEnd = isInOrder ? sim->slabLengths[0] : 0;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		while(isInOrder && (i >= runEnd)){
+			
+			runOwner++;
+			runEnd += sim->slabLengths[runOwner];
+			
+		}
+		
+		int slab = isInOrder ? runOwner : slabOf(i);
+		particle* restrict sorted = &sim->slabBuffer[(slab * SLAB_SCATTER_CHUNK) + sim->slabCounts[slab]];
+		
+		*sorted = sim->particles[i];
+		
+		// references from before a removal this step have to be fixed first
+		sorted->nearestNeighbour = encodeSlabReference(sim->removalPending ? remapRemoved(sim->particles[i].nearestNeighbour) : sim->particles[i].nearestNeighbour);
+		sorted->collidingAwayFrom = encodeSlabReference(sim->removalPending ? remapRemoved(sim->particles[i].collidingAwayFrom) : sim->particles[i].collidingAwayFrom);
+		
+		sim->slabCounts[slab]++;
+		
+		if(sim->slabCounts[slab] == SLAB_SCATTER_CHUNK){
+			
+			sendScatteredParticles(slab);
+			
+		}
+		
+	}
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		sendScatteredParticles(slab);
+		
+	}
+	
+	sim->removalPending = 0;
+	sim->slabsNeedScatter = 0;
+	sim->slabsInOrder = isInOrder;
+	sim->gatheredLength = sim->length;
+	
+	return;
+	
+}
+
+// pass the events a slab recorded on to the log thread, through the simulation
+// thread's ring. They already have the coordinator's handles, the particles
+// brought theirs with them
+static inline void receiveSlabEvents(int slab, int count){
+	
+	collisionEvent events[256];
+	
+	while(count > 0){
+		
+		int received = min(count, 256);
+		
+		if(!receiveSlabBytes(sim->slabSockets[slab], events, (size_t)received * sizeof(collisionEvent))){
+			
+			loseSlab(slab);
+			
+		}
+		
+		// a program using the library has no log thread, and no rings
+		for(int e = 0; sim->isRecordingEvents && (e < received); e++){
+			
+			collisionEvent* restrict event = nextEvent(&sim->eventRings[0]);
+			
+			if(event){
+				
+				*event = events[e];
+				sim->eventRings[0].writeHead++;
+				
+			}
+			
+		}
+		
+		count -= received;
+		
+	}
+	
+	return;
+	
+}
+
+// send everything this slab's threads have recorded since the last step to the
+// coordinator, and give the rings their space back. Nothing else reads them here
+static inline char sendSlabEvents(){
+	
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		eventRing* restrict ring = &sim->eventRings[workerNum];
+		Uint32 head = (Uint32)atomic_load(&ring->head);
+		Uint32 tail = (Uint32)atomic_load(&ring->tail);
+		
+		while(tail != head){
+			
+			// up to the head, or the end of the ring if it wraps around
+			Uint32 first = tail & (EVENT_RING_SIZE - 1);
+			Uint32 count = (Uint32)min((int)(head - tail), (int)(EVENT_RING_SIZE - first));
+			
+			if(!sendSlabBytes(sim->slabCoordinator, &ring->events[first], (size_t)count * sizeof(collisionEvent))){
+				
+				return 0;
+				
+			}
+			
+			tail += count;
+			
+		}
+		
+		atomic_exchange(&ring->tail, (int)tail);
+		
+	}
+	
+	return 1;
+	
+}
+
+// how many events this slab's threads have recorded since the last step,
+// and how many they had to drop, which starts again from 0
+static inline int countSlabEvents(int* restrict dropped){
+	
+	int count = 0;
+	
+	*dropped = 0;
+	
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		count += (int)((Uint32)atomic_load(&sim->eventRings[workerNum].head) - (Uint32)atomic_load(&sim->eventRings[workerNum].tail));
+		
+		*dropped += atomic_exchange(&sim->eventRings[workerNum].dropped, 0);
+		
+	}
+	
+	return count;
+	
+}
+
+// how many pairs of particles this process's threads have checked so far
+static inline Uint64 countCandidatePairs(){
+	
+	Uint64 candidatePairs = 0;
+	
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		candidatePairs += sim->workerMetrics[workerNum].candidatePairs;
+		
+	}
+	
+	return candidatePairs;
+	
+}
+
+// put every slab's particles together, one slab after the other, if they've
+// stepped since last time. Everything that looks at the particles here calls
+// this first, so they only come back when something actually needs them
+static inline void gatherSlabs(){
+	
+	if(!sim->slabsHaveStepped){
+		
+		return;
+		
+	}
+	
+	sim->slabsHaveStepped = 0;
+	
+	slabMessage message = {.kind = slabGather, .delta = sim->delta, .simulationTime = sim->simulationTime, .step = sim->simulationStep};
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		if(!sendSlabBytes(sim->slabSockets[slab], &message, sizeof(message))){
+			
+			loseSlab(slab);
+			
+		}
+		
+	}
+	
+	// mark every handle there was, so the ones that don't come back
+	// (the particles the slabs removed) can be let go
+	for(int i = 0; i < sim->length; i++){
+		
+		sim->handleIndex[(Uint32)sim->particles[i].handle] = -2;
+		
+	}
+	
+	// they come straight into the particles, the old ones aren't needed any more
+	int gathered = 0;
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		slabMessage reply;
+		
+		// a slab can't have more than it was given, they never make particles
+		if(!receiveSlabBytes(sim->slabSockets[slab], &reply, sizeof(reply)) || (reply.count < 0) || ((gathered + reply.count) > sim->particleCapacity) ||
+			!receiveSlabBytes(sim->slabSockets[slab], &sim->particles[gathered], (size_t)reply.count * sizeof(particle))){
+			
+			loseSlab(slab);
+			
+		}
+		
+		gathered += reply.count;
+		sim->slabLengths[slab] = reply.count;
+		
+	}
+	
+	sim->length = gathered;
+	sim->slabsInOrder = 1;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		moveParticleHandle(i);
+		
+	}
+	
+	for(int slot = 0; slot < sim->handleSlotsUsed; slot++){
+		
+		if(sim->handleIndex[slot] == -2){
+			
+			sim->handleIndex[slot] = -1;
+			
+			releaseParticleHandle(((particleHandle)sim->handleGeneration[slot] << 32) | (particleHandle)slot);
+			
+		}
+		
+	}
+	
+	sim->bondedPairs = 0;
+	
+	for(int i = 0; i < sim->length; i++){
+		
+		sim->particles[i].bondingWith = resolveParticleHandle(sim->particles[i].bondedTo);
+		sim->particles[i].nearestNeighbour = decodeSlabReference(sim->particles[i].nearestNeighbour);
+		sim->particles[i].collidingAwayFrom = decodeSlabReference(sim->particles[i].collidingAwayFrom);
+		
+		sim->bondedPairs += (sim->particles[i].bondingWith > -1);
+		
+	}
+	
+	sim->bondedPairs /= 2;
+	sim->gatheredLength = sim->length;
+	
+	sim->neighbourBuiltLength = -1;
+	sim->grid.isStale = 1;
+	
+	return;
+	
+}
+
+// copy how many particles each slab had into runs, for a checkpoint. Returns how
+// many slabs there are, or 0 if the particles here aren't the slabs' own in order
+static inline int saveSlabLengths(int* restrict runs){
+	
+	if(!sim->slabsInOrder || (sim->length != sim->gatheredLength)){
+		
+		return 0;
+		
+	}
+	
+	memcpy(runs, sim->slabLengths, (size_t)sim->slabCount * sizeof(int));
+	
+	return sim->slabCount;
+	
+}
+
+// the other way around, for a restart from a checkpoint. The next
+// scatter gives each slab back the particles it had when it was taken
+static inline void loadSlabLengths(const int* restrict runs){
+	
+	memcpy(sim->slabLengths, runs, (size_t)sim->slabCount * sizeof(int));
+	
+	sim->slabsInOrder = 1;
+	sim->gatheredLength = sim->length;
+	
+	return;
+	
+}
+
+// the coordinator's step: the slabs do the physics, all at the same time,
+// and only send back what they counted and recorded
+static inline void stepSlabs(){
+	
+	// particles removed from here go before the slabs are given anything
+	if(atomic_load(&sim->killQueueLength) > 0){
+		
+		gatherSlabs();
+		
+		removeQueuedParticles();
+		
+		sim->slabsNeedScatter = 1;
+		sim->slabsInOrder = 0;
+		
+	}
+	
+	if(sim->slabsNeedScatter || (sim->length != sim->gatheredLength)){
+		
+		scatterSlabs();
+		
+	}
+	
+	slabMessage message = {.kind = slabStep, .delta = sim->delta, .simulationTime = sim->simulationTime, .step = sim->simulationStep};
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		if(!sendSlabBytes(sim->slabSockets[slab], &message, sizeof(message))){
+			
+			loseSlab(slab);
+			
+		}
+		
+	}
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		slabMessage reply;
+		
+		if(!receiveSlabBytes(sim->slabSockets[slab], &reply, sizeof(reply)) || (reply.events < 0)){
+			
+			loseSlab(slab);
+			
+		}
+		
+		sim->stepCollisions += reply.collisions;
+		sim->simulationTime = reply.simulationTime;
+		
+		// the simulation thread is worker 0, so they're added to its counters and ring
+		sim->workerMetrics[0].candidatePairs += reply.candidatePairs;
+		
+		receiveSlabEvents(slab, reply.events);
+		
+		if(sim->isRecordingEvents){
+			
+			atomic_fetch_add(&sim->eventRings[0].dropped, reply.droppedEvents);
+			
+		}
+		
+	}
+	
+	if(sim->isRecordingEvents){
+		
+		publishEvents(0);
+		
+	}
+	
+	sim->slabsHaveStepped = 1;
+	
+	return;
+	
+}
+
+// start a process for each slab. Each one is a copy of this one, so it
+// carries on through createSimulation() with everything set up so far,
+// and never comes back out of it (see runSlab()). 0 if there wasn't the memory
+static inline char startSlabProcesses(){
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	// a slab is wider than two particles can touch from, so particles that are
+	// touching are never more than one slab apart
+	double largestSize = 1.0;
+	
+	for(int type = 0; type < numOfParticleTypes; type++){
+		
+		largestSize = maxDouble(largestSize, sim->particleSizes[type]);
+		
+	}
+	
+	sim->slabHaloWidth = 2.0 * (largestSize + 1.0);
+	
+	// the slabs never spawn anything themselves, so their grid
+	// cells have to be big enough for any type that comes across
+	sim->largestParticleSize = largestSize;
+	
+	// touching particles can't be more than one slab apart
+	sim->slabCount = min(sim->options->SLAB_PROCESSES, (int)((double)sim->options->WORLD_WIDTH / (2.0 * sim->slabHaloWidth)));
+	
+	// the groups gatherSlabClusters() moves go towards the first slab, but round a
+	// wrapping world there isn't a first one to stop at unless there are only two
+	if(sim->options->ENABLE_BORDER_WRAP && (sim->slabCount > 2)){
+		
+		fprintf(stderr, "SLAB_PROCESSES can only split a world with ENABLE_BORDER_WRAP in two\n");
+		
+		sim->slabCount = 2;
+		
+	}
+	
+	if(sim->slabCount < 2){
+		
+		fprintf(stderr, "the world is too narrow to split into slabs\n");
+		
+		sim->slabCount = 0;
+		
+		return 1;
+		
+	}
+	
+	sim->slabWidth = (double)sim->options->WORLD_WIDTH / (double)sim->slabCount;
+	
+	// one pair of sockets across each boundary, including the edge of the world if it wraps
+	int boundaryCount = sim->options->ENABLE_BORDER_WRAP ? sim->slabCount : (sim->slabCount - 1);
+	int (*boundaries)[2] = malloc((size_t)boundaryCount * sizeof(int[2]));
+	
+	sim->slabSockets = malloc((size_t)sim->slabCount * sizeof(int));
+	sim->slabProcesses = malloc((size_t)sim->slabCount * sizeof(int));
+	sim->slabCounts = malloc((size_t)sim->slabCount * sizeof(int));
+	sim->slabLengths = malloc((size_t)sim->slabCount * sizeof(int));
+	sim->slabBuffer = malloc((size_t)sim->slabCount * SLAB_SCATTER_CHUNK * sizeof(particle));
+	
+	if(boundaries == 0 || sim->slabSockets == 0 || sim->slabProcesses == 0 || sim->slabCounts == 0 || sim->slabLengths == 0 || sim->slabBuffer == 0){
+		
+		free(boundaries);
+		
+		// there aren't any processes for stopSlabProcesses() to stop yet
+		sim->slabCount = 0;
+		
+		return 0;
+		
+	}
+	
+	for(int boundary = 0; boundary < boundaryCount; boundary++){
+		
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, boundaries[boundary]) != 0){
+			
+			fprintf(stderr, "could not connect the slabs\n");
+			
+			exit(1);
+			
+		}
+		
+	}
+	
+	// anything still waiting to be written would be written by every process
+	fflush(0);
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		int coordinatorPair[2];
+		
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, coordinatorPair) != 0){
+			
+			fprintf(stderr, "could not connect the slabs\n");
+			
+			exit(1);
+			
+		}
+		
+		int process = (int)fork();
+		
+		if(process < 0){
+			
+			fprintf(stderr, "could not start the slab processes\n");
+			
+			exit(1);
+			
+		}
+		
+		if(process == 0){
+			
+			// the slab only keeps its own end of its socket to the coordinator,
+			// and the boundaries either side of it. Boundary b is between slab b
+			// on its left and the slab after it on its right
+			int left = (slab > 0) ? (slab - 1) : (sim->options->ENABLE_BORDER_WRAP ? (sim->slabCount - 1) : -1);
+			int right = (slab < boundaryCount) ? slab : -1;
+			
+			close(coordinatorPair[0]);
+			
+			for(int earlier = 0; earlier < slab; earlier++){
+				
+				close(sim->slabSockets[earlier]);
+				
+			}
+			
+			for(int boundary = 0; boundary < boundaryCount; boundary++){
+				
+				if(boundary != right){ close(boundaries[boundary][0]); }
+				if(boundary != left){ close(boundaries[boundary][1]); }
+				
+			}
+			
+			memset(sim->slabLinks, 0, sizeof(sim->slabLinks));
+			sim->slabLinks[0].socket = (left > -1) ? boundaries[left][1] : -1;
+			sim->slabLinks[1].socket = (right > -1) ? boundaries[right][0] : -1;
+			
+			sim->isSlabProcess = 1;
+			sim->slabNum = slab;
+			sim->slabCoordinator = coordinatorPair[1];
+			
+			free(boundaries);
+			
+			free(sim->slabSockets);
+			sim->slabSockets = 0;
+			
+			free(sim->slabProcesses);
+			sim->slabProcesses = 0;
+			
+			free(sim->slabCounts);
+			sim->slabCounts = 0;
+			
+			free(sim->slabLengths);
+			sim->slabLengths = 0;
+			
+			free(sim->slabBuffer);
+			sim->slabBuffer = 0;
+			
+			// the coordinator does these for all of the particles
+			sim->options->SHARED_MEMORY_NAME[0] = 0;
+			sim->options->STATE_HASH_INTERVAL = 0;
+			
+			// start small, the arrays grow with the particles that come here
+			resizeSlabArrays(SLAB_SCATTER_CHUNK);
+			
+			return 1;
+			
+		}
+		
+		close(coordinatorPair[1]);
+		
+		sim->slabSockets[slab] = coordinatorPair[0];
+		sim->slabProcesses[slab] = process;
+		
+	}
+	
+	for(int boundary = 0; boundary < boundaryCount; boundary++){
+		
+		close(boundaries[boundary][0]);
+		close(boundaries[boundary][1]);
+		
+	}
+	
+	free(boundaries);
+	
+	sim->slabsNeedScatter = 1;
+	sim->slabsInOrder = 0;
+	sim->gatheredLength = 0;
+	
+#else
+	
+	fprintf(stderr, "SLAB_PROCESSES needs Unix sockets, so everything runs in this process\n");
+	
+#endif
+	
+	return 1;
+	
+}
+
+// tell every slab process to quit, and wait until they have
+static inline void stopSlabProcesses(){
+	
+#ifdef HAS_UNIX_SOCKETS
+	
+	slabMessage message = {.kind = slabQuit};
+	
+	for(int slab = 0; slab < sim->slabCount; slab++){
+		
+		sendSlabBytes(sim->slabSockets[slab], &message, sizeof(message));
+		close(sim->slabSockets[slab]);
+		
+		waitpid((pid_t)sim->slabProcesses[slab], 0, 0);
+		
+	}
+	
+#endif
+	
+	sim->slabCount = 0;
+	
+	free(sim->slabSockets);
+	sim->slabSockets = 0;
+	
+	free(sim->slabProcesses);
+	sim->slabProcesses = 0;
+	
+	free(sim->slabCounts);
+	sim->slabCounts = 0;
+	
+	free(sim->slabLengths);
+	sim->slabLengths = 0;
+	
+	free(sim->slabBuffer);
+	sim->slabBuffer = 0;
+	
+	return;
+	
+}
+
+// what a slab process does instead of opening a window: whatever the coordinator
+// tells it to, until it's told to quit or the coordinator has gone
+static inline void runSlab(){
+	
+	slabMessage message;
+	
+	// the collisions are recorded here, and sent on to the coordinator's log thread.
+	// Without them the slab is as good as lost, so it goes the same way
+	if(sim->options->ENABLE_COLLISION_EVENTS && !createEventRings()){
+		
+		fflush(0);
+		_Exit(1);
+		
+	}
+	
+	char isQuitting = 0;
+	
+	while(receiveSlabBytes(sim->slabCoordinator, &message, sizeof(message))){
+		
+		if(message.kind == slabQuit){
+			
+			isQuitting = 1;
+			
+			break;
+			
+		}
+		
+		if(message.kind == slabLoad){
+			
+			sim->length = min(max(message.count, 0), sim->options->MAX_MEMORY_ALLOCATION / (int)sizeof(particle));
+			
+			reserveSlabArrays(sim->length);
+			
+			if(!receiveSlabBytes(sim->slabCoordinator, sim->particles, (size_t)sim->length * sizeof(particle))){
+				
+				break;
+				
+			}
+			
+			sim->simulationTime = message.simulationTime;
+			sim->simulationStep = message.step;
+			
+			loadSlabParticles();
+			
+		}
+		
+		else if(message.kind == slabStep){
+			
+			sim->delta = message.delta;
+			
+			Uint64 candidatePairs = countCandidatePairs();
+			
+			simulateStep();
+			
+			int droppedEvents = 0;
+			int events = sim->isRecordingEvents ? countSlabEvents(&droppedEvents) : 0;
+			
+			slabMessage reply = {.kind = slabStep, .delta = sim->delta, .simulationTime = sim->simulationTime, .step = sim->simulationStep, .collisions = sim->stepCollisions,
+				.candidatePairs = countCandidatePairs() - candidatePairs, .events = events, .droppedEvents = droppedEvents};
+			
+			if(!sendSlabBytes(sim->slabCoordinator, &reply, sizeof(reply)) || (sim->isRecordingEvents && !sendSlabEvents())){
+				
+				break;
+				
+			}
+			
+		}
+		
+		else if(message.kind == slabGather){
+			
+			slabMessage reply = {.kind = slabGather, .count = sim->length, .delta = sim->delta, .simulationTime = sim->simulationTime, .step = sim->simulationStep};
+			
+			if(!sendSlabBytes(sim->slabCoordinator, &reply, sizeof(reply)) || !sendSlabBytes(sim->slabCoordinator, sim->particles, (size_t)sim->length * sizeof(particle))){
+				
+				break;
+				
+			}
+			
+		}
+		
+	}
+	
+	if(sim->options->ENABLE_REFERENCE_CHECK){
+		
+		printf("slab %d reference check: %llu steps checked, %llu diverged\n", sim->slabNum, (unsigned long long)sim->referenceStepsChecked, (unsigned long long)sim->referenceStepsDiverged);
+		
+	}
+	
+	// leave straight away. Everything else in this process is a copy of the
+	// coordinator's, and the coordinator cleans that up. Losing the coordinator
+	// before it said to quit is a failure, so anything running this sees it
+	fflush(0);
+	_Exit(isQuitting ? 0 : 1);
+	
+}
+
+// The library interface in particlesim.h. A particlesim has everything the
+// physics uses, and each call points this thread's sim at the one it's given
+
+// start what a simulation records and sends out while it runs: the metrics,
+// the collision log and the checkpoints, whichever the options ask for.
+// 0 if one of them couldn't be started, stopSimulationServices() stops the rest
+static inline char startSimulationServices(){
+	
+	// the metrics are only worked out if there is somewhere to send them
+	sim->isMeasuring = (sim->options->METRICS_SOCKET[0] != 0) || (sim->options->METRICS_FILE[0] != 0);
+	memset(&sim->simulationMetrics, 0, sizeof(sim->simulationMetrics));
+	memset(&sim->latestMetrics, 0, sizeof(sim->latestMetrics));
+	sim->rateStartTick = performanceCounter();
+	sim->rateStartStep = sim->simulationStep;
+	sim->metricsLock = createMutex();
+	
+	if(sim->metricsLock == 0){ return 0; }
+	
+	if(sim->options->ENABLE_COLLISION_EVENTS){
+		
+		if(!createEventRings()){ return 0; }
+		
+		if(sim->options->COLLISION_LOG[0]){
+			
+			sim->collisionLog = fopen(sim->options->COLLISION_LOG, "wb");
+			
+			if(sim->collisionLog){
+				
+				collisionLogHeader header = {{'P', 'S', 'C', 'E'}, 1, (Uint32)sizeof(collisionEvent), numOfParticleTypes};
+				
+				fwrite(&header, sizeof(header), 1, sim->collisionLog);
+				
+			}
+			
+		}
+		
+		atomic_exchange(&sim->isEventLogFinished, 0);
+		
+		sim->eventLogThreadHandle = startThread(eventLogThread, sim);
+		
+		if(sim->eventLogThreadHandle == 0){ return 0; }
+		
+	}
+	
+	// a checkpoint is only taken if there is somewhere to put it and something says when
+	sim->isCheckpointing = (sim->options->CHECKPOINT_FILE[0] != 0) && ((sim->options->CHECKPOINT_STEPS > 0) || (sim->options->CHECKPOINT_MINUTES > 0.0));
+	
+	if(sim->isCheckpointing){
+		
+		if(!startCheckpoints()){ return 0; }
+		
+	}
+	
+	if(sim->isMeasuring){
+		
+		atomic_exchange(&sim->isMetricsFinished, 0);
+		
+		sim->metricsThreadHandle = startThread(metricsThread, sim);
+		
+		if(sim->metricsThreadHandle == 0){ return 0; }
+		
+	}
+	
+	return 1;
+	
+}
+
+// stop them again, once the simulation isn't going to step any more
+static inline void stopSimulationServices(){
+	
+	// no more events can come, so the log thread can finish up
+	if(sim->eventLogThreadHandle){
+		
+		atomic_exchange(&sim->isEventLogFinished, 1);
+		waitThread(sim->eventLogThreadHandle);
+		sim->eventLogThreadHandle = 0;
+		
+	}
+	
+	if(sim->collisionLog){
+		
+		fclose(sim->collisionLog);
+		sim->collisionLog = 0;
+		
+	}
+	
+	// the last checkpoint might still be being written
+	if(sim->isCheckpointing){
+		
+		stopCheckpoints();
+		
+	}
+	
+	// it writes the file one last time on the way out
+	if(sim->metricsThreadHandle){
+		
+		atomic_exchange(&sim->isMetricsFinished, 1);
+		waitThread(sim->metricsThreadHandle);
+		sim->metricsThreadHandle = 0;
+		
+	}
+	
+	if(sim->metricsLock){
+		
+		destroyMutex(sim->metricsLock);
+		sim->metricsLock = 0;
+		
+	}
+	
+	return;
+	
+}
+
+// stop everything a simulation started and free everything it has, which works
+// just as well on one that ran out of memory halfway through being made
+static inline void freeSimulation(){
+	
+	stopSimulationServices();
+	
+	destroySimulation();
+	
+	free(sim->options);
+	free(sim);
+	sim = 0;
+	
+	return;
+	
+}
+
+particlesim* particlesimCreateWith(const char* configPath, const particlesimSettings* settings){
+	
+	// getOptions() quits if it can't open the file, a library shouldn't
+	FILE* file = fopen(configPath, "r");
+	
+	if(file == 0){
+		
+		return 0;
+		
+	}
+	
+	fclose(file);
+	
+	particlesimSettings noSettings;
+	
+	if(settings == 0){
+		
+		memset(&noSettings, 0, sizeof(noSettings));
+		settings = &noSettings;
+		
+	}
+	
+	sim = calloc(1, sizeof(particlesim));
+	
+	if(sim == 0){ return 0; }
+	
+	sim->options = malloc(sizeof(configOptions));
+	
+	if(sim->options == 0){
+		
+		free(sim);
+		sim = 0;
+		
+		return 0;
+		
+	}
+	
+	getOptions((char*)configPath);
+	
+	// the view points straight into the particles, which compact particles haven't
+	// got, and the slab processes are forks of the whole program
+	if((sim->options->ENABLE_COMPACT_PARTICLES && !settings->allowCompactParticles) ||
+		((sim->options->SLAB_PROCESSES > 1) && !settings->allowSlabProcesses)){
+		
+		free(sim->options);
+		free(sim);
+		sim = 0;
+		
+		return 0;
+		
+	}
+	
+	// a world without a size is the size the host asks for, or the window would be
+	if(sim->options->WORLD_WIDTH <= 0){
+		
+		sim->options->WORLD_WIDTH = (settings->worldWidth > 0) ? settings->worldWidth : sim->options->WINDOW_WIDTH;
+		
+	}
+	
+	if(sim->options->WORLD_HEIGHT <= 0){
+		
+		sim->options->WORLD_HEIGHT = (settings->worldHeight > 0) ? settings->worldHeight : sim->options->WINDOW_HEIGHT;
+		
+	}
+	
+	if(!createSimulation()){
+		
+		// a slab process is a fork of the host program, and mustn't go back into it
+		if(sim->isSlabProcess){
+			
+			fflush(0);
+			_Exit(1);
+			
+		}
+		
+		freeSimulation();
+		
+		return 0;
+		
+	}
+	
+	// red is the default particle to add
+	sim->spawnType = red_particle;
+	
+	// carry on from the newest checkpoint if there is one. If not, generate
+	// initial particles, either exactly STARTING_PARTICLE_COUNT
+	// or a random amount like every other frame
+	int isRestarted = sim->options->ENABLE_RESTART ? restoreCheckpoint() : 0;
+	
+	if(isRestarted < 0){
+		
+		freeSimulation();
+		
+		return 0;
+		
+	}
+	
+	if(sim->options->ENABLE_STARTING_PARTICLES && !isRestarted){
+		
+		if(sim->options->STARTING_PARTICLE_COUNT > 0){
+			
+			spawnParticles(sim->options->STARTING_PARTICLE_COUNT, -1, -1);
+			
+		}
+		
+		else{
+			
+			generateRandomParticles(-1, -1, sim->options->ENABLE_GENERATE_ONCE);
+			
+		}
+		
+	}
+	
+	if(!startSimulationServices()){
+		
+		freeSimulation();
+		
+		return 0;
+		
+	}
+	
+	return sim;
+	
+}
+
+particlesim* particlesimCreate(const char* configPath){
+	
+	return particlesimCreateWith(configPath, 0);
+	
+}
+
+void particlesimDestroy(particlesim* simulation){
+	
+	if(simulation == 0){
+		
+		return;
+		
+	}
+	
+	sim = simulation;
+	
+	freeSimulation();
+	
+	return;
+	
+}
+
+void particlesimStep(particlesim* simulation, double seconds){
+	
+	sim = simulation;
+	
+	sim->delta = seconds;
+	
+	simulateStep();
+	
+	if(sim->isCheckpointing){
+		
+		takeCheckpoint();
+		
+	}
+	
+	if(sim->isMeasuring){
+		
+		recordMetrics(1);
+		
+	}
+	
+	return;
+	
+}
+
+int particlesimSpawn(particlesim* simulation, int count, int x, int y, int type){
+	
+	sim = simulation;
+	
+	if((type < -1) || (type >= numOfParticleTypes)){
+		
+		return 0;
+		
+	}
+	
+	gatherSlabs();
+	
+	int before = sim->length;
+	
+	sim->spawnType = type;
+	
+	spawnParticles(count, x, y);
+	
+	return sim->length - before;
+	
+}
+
+int particlesimSpawnRandom(particlesim* simulation, int x, int y, int type, int once){
+	
+	sim = simulation;
+	
+	if((type < -1) || (type >= numOfParticleTypes)){
+		
+		return 0;
+		
+	}
+	
+	gatherSlabs();
+	
+	int before = sim->length;
+	
+	sim->spawnType = type;
+	
+	generateRandomParticles(x, y, (char)(once != 0));
+	
+	return sim->length - before;
+	
+}
+
+int particlesimRemove(particlesim* simulation, uint64_t handle){
+	
+	sim = simulation;
+	
+	gatherSlabs();
+	
+	int particleNum = resolveParticleHandle((particleHandle)handle);
+	
+	if(particleNum == -1){
+		
+		return 0;
+		
+	}
+	
+	queueParticleRemoval(particleNum);
+	
+	return 1;
+	
+}
+
+void particlesimClear(particlesim* simulation){
+	
+	sim = simulation;
+	
+	gatherSlabs();
+	
+	sim->length = 0;
+	sim->bondedPairs = 0;
+	sim->grid.isStale = 1;
+	sim->neighbourBuiltLength = -1;
+	
+	releaseAllParticleHandles();
+	
+	// forget anything that was waiting to be removed
+	for(int k = 0; k < atomic_load(&sim->killQueueLength); k++){
+		
+		sim->isQueuedForRemoval[sim->killQueue[k]] = 0;
+		
+	}
+	
+	atomic_exchange(&sim->killQueueLength, 0);
+	
+	sim->slabsNeedScatter = 1;
+	
+	return;
+	
+}
+
+int particlesimSetVelocity(particlesim* simulation, uint64_t handle, double velocityX, double velocityY){
+	
+	sim = simulation;
+	
+	gatherSlabs();
+	
+	int particleNum = resolveParticleHandle((particleHandle)handle);
+	
+	if(particleNum == -1){
+		
+		return 0;
+		
+	}
+	
+	if(sim->isCompact){
+		
+		packCompactVelocity(particleNum, velocityX, velocityY);
+		
+		if(sim->compact.bondingWith[particleNum] > -1){
+			
+			sim->compact.velocityX[sim->compact.bondingWith[particleNum]] = sim->compact.velocityX[particleNum];
+			sim->compact.velocityY[sim->compact.bondingWith[particleNum]] = sim->compact.velocityY[particleNum];
+			
+		}
+		
+	}
+	
+	else{
+		
+		sim->particles[particleNum].velocityX = velocityX;
+		sim->particles[particleNum].velocityY = velocityY;
+		
+		if(sim->particles[particleNum].bondingWith > -1){
+			
+			// Equal amounts of force are put on both particles in a single bond
+			sim->particles[sim->particles[particleNum].bondingWith].velocityX = velocityX;
+			sim->particles[sim->particles[particleNum].bondingWith].velocityY = velocityY;
+			
+		}
+		
+	}
+	
+	// the slabs have to be given the new velocities
+	sim->slabsNeedScatter = 1;
+	
+	return 1;
+	
+}
+
+void particlesimGetView(particlesim* simulation, particlesimView* view){
+	
+	sim = simulation;
+	
+	gatherSlabs();
+	
+	view->length = sim->length;
+	view->stride = sizeof(particle);
+	
+	// compact particles are packed up, so there is nothing to point at
+	if(sim->isCompact){
+		
+		view->length = 0;
+		view->x = view->y = view->velocityX = view->velocityY = 0;
+		view->handle = 0;
+		
+		return;
+		
+	}
+	
+	view->x = &sim->particles[0].x;
+	view->y = &sim->particles[0].y;
+	view->velocityX = &sim->particles[0].velocityX;
+	view->velocityY = &sim->particles[0].velocityY;
+	view->handle = &sim->particles[0].handle;
+	
+	return;
+	
+}
+
+// how many particles each snapshot task copies
+#define SNAPSHOT_CHUNK 4096
+
+static void snapshotKernel(int start, int end, int workerNum){
+	
+	(void)workerNum;
+	
+	for(int n = start; n < end; n++){
+		
+		int i = sim->grid.particleIndices[n];
+		particlesimSnapshotParticle* restrict to = &sim->snapshotting->particles[n];
+		
+		if(sim->isCompact){
+			
+			to->x = (float)unpackPosition(sim->compact.x[i]);
+			to->y = (float)unpackPosition(sim->compact.y[i]);
+			to->type = sim->compact.type[i];
+			to->handle = compactHandle(i);
+			
+			continue;
+			
+		}
+		
+		const particle* restrict from = &sim->particles[i];
+		
+		to->x = (float)from->x;
+		to->y = (float)from->y;
+		to->type = from->type;
+		to->handle = from->handle;
+		
+	}
+	
+	return;
+	
+}
+
+int particlesimTakeSnapshot(particlesim* simulation, particlesimSnapshot* snapshot, uint64_t selected){
+	
+	sim = simulation;
+	
+	Uint64 tick = performanceCounter();
+	
+	gatherSlabs();
+	
+	updateSpatialGrid();
+	
+	// the snapshot only ever grows, so it stops reallocating once the particles settle down
+	if(sim->length > snapshot->capacity){
+		
+		int capacity = max(sim->length, snapshot->capacity << 1);
+		particlesimSnapshotParticle* grown = realloc(snapshot->particles, (size_t)capacity * sizeof(particlesimSnapshotParticle));
+		
+		if(grown == 0){
+			
+			return 0;
+			
+		}
+		
+		snapshot->particles = grown;
+		snapshot->capacity = capacity;
+		
+	}
+	
+	if((sim->grid.cellCount + 1) > snapshot->cellCapacity){
+		
+		int capacity = max(sim->grid.cellCount + 1, snapshot->cellCapacity << 1);
+		uint64_t* grownKeys = realloc(snapshot->cellKeys, (size_t)capacity * sizeof(uint64_t));
+		
+		if(grownKeys == 0){
+			
+			return 0;
+			
+		}
+		
+		snapshot->cellKeys = grownKeys;
+		
+		int* grownStarts = realloc(snapshot->cellStart, (size_t)capacity * sizeof(int));
+		
+		if(grownStarts == 0){
+			
+			return 0;
+			
+		}
+		
+		snapshot->cellStart = grownStarts;
+		snapshot->cellCapacity = capacity;
+		
+	}
+	
+	snapshot->length = sim->length;
+	snapshot->cellCount = sim->grid.cellCount;
+	snapshot->cellWidth = sim->grid.cellWidth;
+	snapshot->cellHeight = sim->grid.cellHeight;
+	snapshot->columns = sim->grid.columns;
+	snapshot->rows = sim->grid.rows;
+	snapshot->largestParticleSize = sim->largestParticleSize;
+	snapshot->wrapWidth = sim->options->ENABLE_BORDER_WRAP ? (double)sim->options->WORLD_WIDTH : 0.0;
+	snapshot->wrapHeight = sim->options->ENABLE_BORDER_WRAP ? (double)sim->options->WORLD_HEIGHT : 0.0;
+	
+	memcpy(snapshot->typeSizes, sim->particleSizes, sizeof(snapshot->typeSizes));
+	memcpy(snapshot->cellKeys, sim->grid.cellKeys, (size_t)sim->grid.cellCount * sizeof(Uint64));
+	memcpy(snapshot->cellStart, sim->grid.cellStart, (size_t)(sim->grid.cellCount + 1) * sizeof(int));
+	
+	sim->snapshotting = snapshot;
+	
+	runParallelFor(0, sim->length, SNAPSHOT_CHUNK, snapshotKernel);
+	
+	sim->snapshotting = 0;
+	
+	int selectedNum = resolveParticleHandle((particleHandle)selected);
+	
+	snapshot->hasSelected = (selectedNum > -1);
+	
+	if((selectedNum > -1) && sim->isCompact){
+		
+		snapshot->selectedX = unpackPosition(sim->compact.x[selectedNum]);
+		snapshot->selectedY = unpackPosition(sim->compact.y[selectedNum]);
+		snapshot->selectedSize = sim->particleSizes[sim->compact.type[selectedNum]];
+		
+	}
+	
+	else if(selectedNum > -1){
+		
+		snapshot->selectedX = sim->particles[selectedNum].x;
+		snapshot->selectedY = sim->particles[selectedNum].y;
+		snapshot->selectedSize = sim->particleSizes[sim->particles[selectedNum].type];
+		
+	}
+	
+	endPhase(publishPhase, tick);
+	
+	return 1;
+	
+}
+
+void particlesimFreeSnapshot(particlesimSnapshot* snapshot){
+	
+	free(snapshot->particles);
+	free(snapshot->cellKeys);
+	free(snapshot->cellStart);
+	
+	memset(snapshot, 0, sizeof(particlesimSnapshot));
+	
+	return;
+	
+}
+
+// get the grid up to date and make it a source. The slabs have the particles
+// in a step, so they're gathered first. 0 if there isn't room for maxResults
+static inline char startLiveQuery(spatialSource* restrict source, int maxResults){
+	
+	if(maxResults > sim->queryCapacity){
+		
+		int* grown = realloc(sim->queryResults, (size_t)maxResults * sizeof(int));
+		
+		if(grown == 0){
+			
+			return 0;
+			
+		}
+		
+		sim->queryResults = grown;
+		sim->queryCapacity = maxResults;
+		
+	}
+	
+	gatherSlabs();
+	
+	updateSpatialGrid();
+	
+	liveSpatialSource(source, 1);
+	
+	return 1;
+	
+}
+
+uint64_t particlesimPick(particlesim* simulation, double x, double y){
+	
+	sim = simulation;
+	
+	spatialSource source;
+	
+	startLiveQuery(&source, 0);
+	
+	int picked = spatialPick(&source, x, y);
+	
+	return (picked > -1) ? particleHandleOf(picked) : PARTICLESIM_NO_HANDLE;
+	
+}
+
+int particlesimQueryRadius(particlesim* simulation, double x, double y, double radius, uint64_t* handles, int maxResults){
+	
+	sim = simulation;
+	
+	spatialSource source;
+	
+	if(!startLiveQuery(&source, maxResults)){
+		
+		return 0;
+		
+	}
+	
+	int count = spatialQueryRadius(&source, x, y, radius, sim->queryResults, maxResults);
+	
+	for(int n = 0; n < count; n++){
+		
+		handles[n] = particleHandleOf(sim->queryResults[n]);
+		
+	}
+	
+	return count;
+	
+}
+
+int particlesimQueryRect(particlesim* simulation, double left, double top, double right, double bottom, uint64_t* handles, int maxResults){
+	
+	sim = simulation;
+	
+	spatialSource source;
+	
+	if(!startLiveQuery(&source, maxResults)){
+		
+		return 0;
+		
+	}
+	
+	int count = spatialQueryRect(&source, left, top, right, bottom, sim->queryResults, maxResults);
+	
+	for(int n = 0; n < count; n++){
+		
+		handles[n] = particleHandleOf(sim->queryResults[n]);
+		
+	}
+	
+	return count;
+	
+}
+
+int particlesimQueryNearest(particlesim* simulation, double x, double y, int k, uint64_t* handles, double* distances){
+	
+	sim = simulation;
+	
+	spatialSource source;
+	
+	if(!startLiveQuery(&source, k)){
+		
+		return 0;
+		
+	}
+	
+	int count = spatialQueryNearest(&source, x, y, k, sim->queryResults, distances);
+	
+	for(int n = 0; n < count; n++){
+		
+		handles[n] = particleHandleOf(sim->queryResults[n]);
+		
+	}
+	
+	return count;
+	
+}
+
+uint64_t particlesimSnapshotPick(const particlesimSnapshot* snapshot, double x, double y){
+	
+	spatialSource source;
+	
+	snapshotSpatialSource(&source, snapshot);
+	
+	int picked = spatialPick(&source, x, y);
+	
+	return (picked > -1) ? snapshot->particles[picked].handle : PARTICLESIM_NO_HANDLE;
+	
+}
+
+int particlesimSnapshotQueryRect(const particlesimSnapshot* snapshot, double left, double top, double right, double bottom, int* results, int maxResults){
+	
+	spatialSource source;
+	
+	snapshotSpatialSource(&source, snapshot);
+	
+	return spatialQueryRect(&source, left, top, right, bottom, results, maxResults);
+	
+}
+
+void particlesimGetWorldSize(particlesim* simulation, int* width, int* height){
+	
+	*width = simulation->options->WORLD_WIDTH;
+	*height = simulation->options->WORLD_HEIGHT;
+	
+	return;
+	
+}
+
+int particlesimCount(particlesim* simulation){
+	
+	sim = simulation;
+	
+	gatherSlabs();
+	
+	return sim->length;
+	
+}
+
+size_t particlesimParticleBytes(particlesim* simulation){
+	
+	sim = simulation;
+	
+	return particleBytes();
+	
+}
+
+uint64_t particlesimSteps(particlesim* simulation){
+	
+	return simulation->simulationStep;
+	
+}
+
+uint64_t particlesimHash(particlesim* simulation){
+	
+	sim = simulation;
+	
+	gatherSlabs();
+	
+	return hashSimulationState();
+	
+}
@@ -0,0 +1,210 @@
+// The physics of particlesimSDL as a library, for programs that want to run
+// the simulation themselves without a window. particlesimSDL's own window is
+// one of these programs too. Build particlesim.c into it:
+//   gcc -O2 -c particlesim.c
+//   gcc -O2 yourProgram.c particlesim.o -o yourProgram -lm -lpthread
+//
+// It doesn't need SDL: the worker pool runs on pthreads (or Windows threads),
+// and the kill queue and the worker deques use C11 atomics.
+//
+// Each simulation is its own particlesim, with its own particles, options,
+// worker threads, metrics, collision log and checkpoints, made from a config file
+// like the one particlesimSDL reads. A program can have as many as it likes, and
+// step different ones on different threads at the same time. Each one can only
+// be used from one thread at a time though
+
+#ifndef PARTICLESIM_H
+#define PARTICLESIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct particlesim particlesim;
+
+// how many types of particle there are: 0 red, 1 blue, 2 green, 3 yellow and 4 pink
+#define PARTICLESIM_TYPES 5
+
+// a handle no particle ever has, so it can mean none
+#define PARTICLESIM_NO_HANDLE 0
+
+// the particles, as they are right now. Each particle is stride bytes after
+// the one before it, so particle i's x is particlesimValue(view.x, view.stride, i).
+// The pointers are only good until the next call on the same simulation, which
+// can move, add or remove particles
+typedef struct particlesimView {
+	
+	int length;
+	size_t stride;
+	
+	const double* x;
+	const double* y;
+	const double* velocityX;
+	const double* velocityY;
+	
+	// stays the same for a particle, however much the others move around
+	const uint64_t* handle;
+	
+} particlesimView;
+
+static inline double particlesimValue(const double* values, size_t stride, int i){ return *(const double*)((const char*)values + ((size_t)i * stride)); }
+static inline uint64_t particlesimHandle(const uint64_t* handles, size_t stride, int i){ return *(const uint64_t*)((const char*)handles + ((size_t)i * stride)); }
+
+// what a program can tell particlesimCreateWith() on top of the config file.
+// All zero is what particlesimCreate() uses
+typedef struct particlesimSettings {
+	
+	// how big the world is if the config doesn't set WORLD_WIDTH and WORLD_HEIGHT.
+	// 0 makes it the WINDOW_WIDTH and WINDOW_HEIGHT the config asks for
+	int worldWidth;
+	int worldHeight;
+	
+	// ENABLE_COMPACT_PARTICLES packs the particles up, so there'd be nothing for
+	// a view to point at. If this is set the views are just empty, if not the
+	// simulation isn't made
+	int allowCompactParticles;
+	
+	// SLAB_PROCESSES forks the program, with everything it has open, while the
+	// simulation is being made. It's only done if this is set, and the program
+	// should make the simulation before it starts any threads of its own or SDL's video
+	int allowSlabProcesses;
+	
+} particlesimSettings;
+
+// read the config file and make a simulation. It carries on from the newest
+// checkpoint if ENABLE_RESTART is set and there is one, and if not it starts
+// with STARTING_PARTICLE_COUNT particles if ENABLE_STARTING_PARTICLES is set.
+// The metrics, the collision log and the checkpoints start with it, and stop
+// (writing their files one last time) when it's destroyed.
+// 0 if the file can't be opened, if the settings don't allow what it asks for, or if
+// there isn't the memory or the threads for it (a particle array growing later on,
+// in the middle of a step, still quits the program). settings can be 0
+particlesim* particlesimCreateWith(const char* configPath, const particlesimSettings* settings);
+
+// particlesimCreateWith() with no settings
+particlesim* particlesimCreate(const char* configPath);
+
+void particlesimDestroy(particlesim* sim);
+
+// move the simulation on by seconds, then take a checkpoint and
+// hand the metrics over if they're due
+void particlesimStep(particlesim* sim, double seconds);
+
+// add count particles at (x, y), or all over the world if x is negative.
+// type is 0 red, 1 blue, 2 green, 3 yellow, 4 pink, or -1 for random ones.
+// Returns how many were added, which is 0 if MAX_MEMORY_ALLOCATION is full
+int particlesimSpawn(particlesim* sim, int count, int x, int y, int type);
+
+// add a random number of particles, up to MAX_PARTICLE_COUNT, the same way as
+// particlesimSpawn(). Just the one if once is set
+int particlesimSpawnRandom(particlesim* sim, int x, int y, int type, int once);
+
+// remove the particle with this handle at the start of the next step.
+// Returns 0 if it's already gone
+int particlesimRemove(particlesim* sim, uint64_t handle);
+
+// remove every particle straight away
+void particlesimClear(particlesim* sim);
+
+// give the particle with this handle a new velocity, and the particle it's
+// bonded to the same one. Returns 0 if it's gone
+int particlesimSetVelocity(particlesim* sim, uint64_t handle, double velocityX, double velocityY);
+
+void particlesimGetView(particlesim* sim, particlesimView* view);
+
+// how big the world is, and how many particles are in it
+void particlesimGetWorldSize(particlesim* sim, int* width, int* height);
+int particlesimCount(particlesim* sim);
+
+// how much memory each particle takes up
+size_t particlesimParticleBytes(particlesim* sim);
+
+// a particle as a snapshot has it, with only what it takes to draw it.
+// Floats are still far finer than a pixel
+typedef struct particlesimSnapshotParticle {
+	
+	uint64_t handle;
+	
+	float x;
+	float y;
+	
+	uint8_t type;
+	
+} particlesimSnapshotParticle;
+
+// a copy of the particles, for a program to look at while the simulation
+// carries on. It belongs to the program: zero it before the first
+// particlesimTakeSnapshot(), which grows it as it needs to, and hand it to
+// particlesimFreeSnapshot() at the end
+typedef struct particlesimSnapshot {
+	
+	// the particles, in the same order as the grid has them
+	particlesimSnapshotParticle* particles;
+	int length;
+	int capacity;
+	
+	// the grid cells with particles in. The particles in cell c are particles[cellStart[c]]
+	// up to particles[cellStart[c + 1]], and cellKeys[c] is its row << 32 | its column,
+	// in order, so the cells are in row major order
+	uint64_t* cellKeys;
+	int* cellStart;
+	int cellCount;
+	int cellCapacity;
+	double cellWidth;
+	double cellHeight;
+	int columns;
+	int rows;
+	
+	// the diameter of each type, and of the biggest one there has been
+	double typeSizes[PARTICLESIM_TYPES];
+	double largestParticleSize;
+	
+	// how far it is round the world each way if the border wraps, otherwise 0
+	double wrapWidth;
+	double wrapHeight;
+	
+	// where the particle particlesimTakeSnapshot() was asked about is, if it's still there
+	int hasSelected;
+	double selectedX;
+	double selectedY;
+	double selectedSize;
+	
+} particlesimSnapshot;
+
+// copy the particles into the snapshot, along with where the particle with the
+// handle selected is (0 for none). Returns 0 if the snapshot couldn't grow,
+// and then it isn't changed
+int particlesimTakeSnapshot(particlesim* sim, particlesimSnapshot* snapshot, uint64_t selected);
+
+void particlesimFreeSnapshot(particlesimSnapshot* snapshot);
+
+// The spatial queries, which only look at the grid cells that can hold an answer.
+// Across a wrapping border they measure the short way round. Each one writes up to
+// maxResults handles and returns how many it wrote, or 0 if there wasn't the memory
+// to keep that many
+
+// the particle under a point, the one with the closest centre if it's over a few.
+// PARTICLESIM_NO_HANDLE if there isn't one
+uint64_t particlesimPick(particlesim* sim, double x, double y);
+
+// every particle with its centre within radius of a point
+int particlesimQueryRadius(particlesim* sim, double x, double y, double radius, uint64_t* handles, int maxResults);
+
+// every particle that overlaps a rectangle, even if only its edge does
+int particlesimQueryRect(particlesim* sim, double left, double top, double right, double bottom, uint64_t* handles, int maxResults);
+
+// the k closest particles to a point, closest first, and how far away each one is.
+// Both arrays need room for k
+int particlesimQueryNearest(particlesim* sim, double x, double y, int k, uint64_t* handles, double* distances);
+
+// the same pick and rectangle on a snapshot, which doesn't touch the simulation, so
+// they can be asked on any thread while it steps. The rectangle gives each particle's
+// place in snapshot->particles instead of its handle
+uint64_t particlesimSnapshotPick(const particlesimSnapshot* snapshot, double x, double y);
+int particlesimSnapshotQueryRect(const particlesimSnapshot* snapshot, double left, double top, double right, double bottom, int* results, int maxResults);
+
+// how many steps it's taken, and a hash of every particle (the same one
+// STATE_HASH_INTERVAL prints) to check two runs against each other
+uint64_t particlesimSteps(particlesim* sim);
+uint64_t particlesimHash(particlesim* sim);
+
+#endif
@@ -0,0 +1,443 @@
+// particlesimBench times the physics and drawing kernels of particlesimSDL on
+// the same made up particles every run, so the speed of a change can be checked
+// without playing with the window. It includes the whole of particlesim.c and
+// particlesimSDL.c, so it can get at the kernels inside them. Build it with:
+//   gcc -O2 particlesimBench.c -o particlesimBench `sdl2-config --cflags --libs` -lm -lpthread
+// and run it with a config file (config.txt if left out) and how many particles
+// to use. -s saves the results and -b compares them against saved ones:
+//   ./particlesimBench config.txt 100000 -s baseline.txt
+//   ./particlesimBench config.txt 100000 -b baseline.txt
+// The particles always start from DETERMINISTIC_SEED, in a world big enough that
+// every particle has about BENCH_AREA_PER_PARTICLE square pixels to itself
+
+#include "particlesim.c"
+
+#define PARTICLESIM_NO_MAIN
+#include "particlesimSDL.c"
+
+// how many untimed runs warm the caches up, and how many are timed after.
+// The median of the timed runs is reported, so one slow run doesn't matter
+#define BENCH_WARMUP 3
+#define BENCH_REPEATS 15
+
+// the default amount of particles, and how much room each one gets
+#define BENCH_DEFAULT_PARTICLES 100000
+#define BENCH_AREA_PER_PARTICLE 400.0
+
+// the most kernels that can be timed, and read back from a baseline
+#define MAX_BENCH_RESULTS 16
+
+// the timing of one kernel. A kernel that doesn't work on pairs has 0 ns per pair
+typedef struct benchResult {
+	
+	char name[32];
+	
+	double nsPerParticle;
+	double nsPerPair;
+	
+} benchResult;
+
+static benchResult results[MAX_BENCH_RESULTS];
+static int resultCount;
+
+static benchResult baseline[MAX_BENCH_RESULTS];
+static int baselineCount;
+
+// the particles every run starts from
+static particle* restrict savedParticles;
+static int savedLength;
+static int savedBondedPairs;
+
+// random pairs of particles for handleElasticCollision, and how far apart they are
+static int* restrict pairA;
+static int* restrict pairB;
+static double* restrict pairDistance;
+static int pairCount;
+
+// the drawing goes into a surface instead of a window
+static SDL_Surface* restrict benchSurface;
+
+// put every particle back where it started, so each run does the same work
+static inline void restoreParticles(){
+	
+	memcpy(sim->particles, savedParticles, (size_t)savedLength * sizeof(particle));
+	
+	sim->length = savedLength;
+	sim->bondedPairs = savedBondedPairs;
+	sim->grid.isStale = 1;
+	
+	return;
+	
+}
+
+static inline Uint64 totalCandidatePairs(){
+	
+	Uint64 total = 0;
+	
+	for(int workerNum = 0; workerNum < sim->workerCount; workerNum++){
+		
+		total += sim->workerMetrics[workerNum].candidatePairs;
+		
+	}
+	
+	return total;
+	
+}
+
+static int compareDoubles(const void* a, const void* b){
+	
+	double difference = *(const double*)a - *(const double*)b;
+	
+	return (difference > 0.0) - (difference < 0.0);
+	
+}
+
+// the kernels being timed, wrapped up so they can all be run the same way
+static void benchElasticCollision(void){
+	
+	for(int k = 0; k < pairCount; k++){
+		
+		handleElasticCollision(pairA[k], pairB[k], pairDistance[k]);
+		
+	}
+	
+	return;
+	
+}
+
+static void benchInteraction(void){
+	
+	handleParticleInteraction();
+	
+	return;
+	
+}
+
+static void benchUpdate(void){
+	
+	updateParticles();
+	
+	return;
+	
+}
+
+static void benchBorder(void){
+	
+	handleBorderCollision(0, sim->length);
+	
+	return;
+	
+}
+
+static void benchDrawCircles(void){
+	
+	for(int i = 0; i < shown->length; i++){
+		
+		drawCircle(i, -1, -1, 0, options->ENABLE_CIRCLE_FILLED);
+		
+	}
+	
+	return;
+	
+}
+
+// the kernels being timed take nothing, and work on the bench's simulation
+typedef void (*benchKernel)(void);
+
+// time a kernel, and how many pairs it looked at if it counts them.
+// pairsPerRun is used instead for kernels that don't count their own
+static inline void timeKernel(const char* restrict name, benchKernel kernel, int particleCount, Uint64 pairsPerRun){
+	
+	double nanoseconds[BENCH_REPEATS];
+	Uint64 pairs = 0;
+	
+	for(int run = 0; run < (BENCH_WARMUP + BENCH_REPEATS); run++){
+		
+		restoreParticles();
+		
+		Uint64 pairsBefore = totalCandidatePairs();
+		Uint64 start = SDL_GetPerformanceCounter();
+		
+		kernel();
+		
+		Uint64 end = SDL_GetPerformanceCounter();
+		
+		if(run >= BENCH_WARMUP){
+			
+			nanoseconds[run - BENCH_WARMUP] = (double)(end - start) * 1e9 / (double)SDL_GetPerformanceFrequency();
+			pairs = pairsPerRun ? pairsPerRun : (totalCandidatePairs() - pairsBefore);
+			
+		}
+		
+	}
+	
+	qsort(nanoseconds, BENCH_REPEATS, sizeof(double), compareDoubles);
+	
+	double median = nanoseconds[BENCH_REPEATS / 2];
+	
+	benchResult* restrict result = &results[resultCount];
+	
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->nsPerParticle = (particleCount > 0) ? (median / (double)particleCount) : 0.0;
+	result->nsPerPair = (pairs > 0) ? (median / (double)pairs) : 0.0;
+	
+	resultCount++;
+	
+	return;
+	
+}
+
+// read results saved with -s, one kernel per line
+static inline void readBaseline(const char* restrict path){
+	
+	FILE* file = fopen(path, "r");
+	
+	if(file == 0){
+		
+		fprintf(stderr, "couldn't open the baseline %s\n", path);
+		
+		return;
+		
+	}
+	
+	benchResult* restrict reading = &baseline[0];
+	
+	while((baselineCount < MAX_BENCH_RESULTS) && (fscanf(file, "%31s %lf %lf", reading->name, &reading->nsPerParticle, &reading->nsPerPair) == 3)){
+		
+		baselineCount++;
+		reading = &baseline[baselineCount];
+		
+	}
+	
+	fclose(file);
+	
+	return;
+	
+}
+
+static inline void saveResults(const char* restrict path){
+	
+	FILE* file = fopen(path, "w");
+	
+	if(file == 0){
+		
+		fprintf(stderr, "couldn't write the results to %s\n", path);
+		
+		return;
+		
+	}
+	
+	for(int k = 0; k < resultCount; k++){
+		
+		fprintf(file, "%s %.4f %.4f\n", results[k].name, results[k].nsPerParticle, results[k].nsPerPair);
+		
+	}
+	
+	fclose(file);
+	
+	return;
+	
+}
+
+// print every result, and how much faster or slower it is than the baseline
+static inline void printResults(){
+	
+	printf("%-20s %14s %14s %10s\n", "kernel", "ns/particle", "ns/pair", "change");
+	
+	for(int k = 0; k < resultCount; k++){
+		
+		printf("%-20s %14.4f %14.4f", results[k].name, results[k].nsPerParticle, results[k].nsPerPair);
+		
+		for(int b = 0; b < baselineCount; b++){
+			
+			if(strcmp(baseline[b].name, results[k].name) || (baseline[b].nsPerParticle <= 0.0)){
+				
+				continue;
+				
+			}
+			
+			// a positive change is slower than the baseline
+			printf(" %+9.1f%%", 100.0 * ((results[k].nsPerParticle / baseline[b].nsPerParticle) - 1.0));
+			
+		}
+		
+		printf("\n");
+		
+	}
+	
+	return;
+	
+}
+
+int main(int argc, char** argv){
+	
+	char* configPath = 0;
+	char* baselinePath = 0;
+	char* savePath = 0;
+	int particleCount = BENCH_DEFAULT_PARTICLES;
+	char hasParticleCount = 0;
+	
+	for(int arg = 1; arg < argc; arg++){
+		
+		if(!strcmp(argv[arg], "-b") && ((arg + 1) < argc)){ baselinePath = argv[++arg]; }
+		else if(!strcmp(argv[arg], "-s") && ((arg + 1) < argc)){ savePath = argv[++arg]; }
+		else if(configPath == 0){ configPath = argv[arg]; }
+		else if(!hasParticleCount){ particleCount = max(atoi(argv[arg]), 2); hasParticleCount = 1; }
+		
+	}
+	
+	if(configPath == 0){ configPath = "config.txt"; }
+	
+	// the simulation is made by hand instead of with particlesimCreate,
+	// so its options can be changed before it starts
+	sim = calloc(1, sizeof(particlesim));
+	
+	if(sim == 0){ exit(0); }
+	
+	sim->options = malloc(sizeof(configOptions));
+	
+	if(sim->options == 0){ exit(0); }
+	
+	getOptions(configPath);
+	
+	// the drawing has options of its own
+	options = malloc(sizeof(windowOptions));
+	
+	if(options == 0){ exit(0); }
+	
+	getWindowOptions(configPath);
+	
+	// the same particles every time, in a world just big enough for them.
+	// Circles are drawn and the border is bounced off, so every kernel has work to do
+	sim->options->ENABLE_DETERMINISTIC = 1;
+	sim->options->ENABLE_PARTICLE_COLLISION = 1;
+	sim->options->ENABLE_CIRCLE_PARTICLES = 1;
+	sim->options->ENABLE_BORDER_COLLISION = 1;
+	sim->options->ENABLE_BORDER_WRAP = 0;
+	sim->options->ENABLE_BORDER_ABSORB = 0;
+	sim->options->WORLD_WIDTH = (int)sqrt((double)particleCount * BENCH_AREA_PER_PARTICLE);
+	sim->options->WORLD_HEIGHT = sim->options->WORLD_WIDTH;
+	sim->options->MAX_MEMORY_ALLOCATION = particleCount * (int)sizeof(particle);
+	options->ENABLE_CIRCLE_PARTICLES = 1;
+	
+	// the kernels work on the particles array, which compact particles haven't got
+	sim->options->ENABLE_COMPACT_PARTICLES = 0;
+	
+	SDL_Init(0);
+	
+	if(!createSimulation()){ exit(0); }
+	
+	sim->spawnType = -1;
+	spawnParticles(particleCount, -1, -1);
+	
+	int length = sim->length;
+	
+	savedParticles = malloc((size_t)length * sizeof(particle));
+	
+	if(savedParticles == 0){ exit(0); }
+	
+	memcpy(savedParticles, sim->particles, (size_t)length * sizeof(particle));
+	savedLength = length;
+	savedBondedPairs = sim->bondedPairs;
+	
+	const particle* restrict particles = sim->particles;
+	
+	// every particle collides once with another random one
+	pairCount = length;
+	pairA = malloc((size_t)pairCount * sizeof(int));
+	pairB = malloc((size_t)pairCount * sizeof(int));
+	pairDistance = malloc((size_t)pairCount * sizeof(double));
+	
+	if(pairA == 0 || pairB == 0 || pairDistance == 0){ exit(0); }
+	
+	unsigned int pairSeed = sim->randState;
+	
+	for(int k = 0; k < pairCount; k++){
+		
+		pairA[k] = k;
+		pairB[k] = (k + 1 + (int)(randu(&pairSeed) % (unsigned int)(length - 1))) % length;
+		
+		double dx = minimumImage(particles[pairB[k]].x - particles[k].x, (double)sim->options->WORLD_WIDTH);
+		double dy = minimumImage(particles[pairB[k]].y - particles[k].y, (double)sim->options->WORLD_HEIGHT);
+		
+		pairDistance[k] = maxDouble(sqrt((dx * dx) + (dy * dy)), 1.0);
+		
+	}
+	
+	// the window's worth of the world is drawn into a surface, from a snapshot like the real thing
+	benchSurface = SDL_CreateRGBSurfaceWithFormat(0, options->WINDOW_WIDTH, options->WINDOW_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+	
+	if(benchSurface == 0){ exit(0); }
+	
+	winRend = SDL_CreateSoftwareRenderer(benchSurface);
+	
+	if(winRend == 0){ exit(0); }
+	
+	camera.x = 0.0;
+	camera.y = 0.0;
+	camera.zoom = 1.0;
+	
+	memset(snapshots, 0, sizeof(snapshots));
+	
+	if(!particlesimTakeSnapshot(sim, &snapshots[0], PARTICLESIM_NO_HANDLE)){ exit(0); }
+	
+	shown = &snapshots[0];
+	
+	printf("%d particles, %d threads, %d x %d world\n", length, sim->workerCount, sim->options->WORLD_WIDTH, sim->options->WORLD_HEIGHT);
+	
+	timeKernel("elastic_collision", benchElasticCollision, pairCount, (Uint64)pairCount);
+	timeKernel("interaction", benchInteraction, length, 0);
+	timeKernel("update", benchUpdate, length, 0);
+	timeKernel("border", benchBorder, length, 0);
+	timeKernel("draw_circle", benchDrawCircles, shown->length, 0);
+	
+	if(baselinePath){
+		
+		readBaseline(baselinePath);
+		
+	}
+	
+	printResults();
+	
+	if(savePath){
+		
+		saveResults(savePath);
+		
+	}
+	
+	destroySimulation();
+	
+	free(sim->options);
+	free(sim);
+	sim = 0;
+	
+	particlesimFreeSnapshot(&snapshots[0]);
+	
+	shown = 0;
+	
+	SDL_DestroyRenderer(winRend);
+	winRend = 0;
+	
+	SDL_FreeSurface(benchSurface);
+	benchSurface = 0;
+	
+	free(savedParticles);
+	savedParticles = 0;
+	
+	free(pairA);
+	pairA = 0;
+	
+	free(pairB);
+	pairB = 0;
+	
+	free(pairDistance);
+	pairDistance = 0;
+	
+	free(options);
+	options = 0;
+	
+	SDL_Quit();
+	
+	return 0;
+	
+}
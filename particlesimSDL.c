@@ -8,23 +8,20 @@
 #include <math.h>
 #include <string.h>
 
-// all these variables are explained in the config file
-typedef struct configOptions{
+// the physics is in particlesim.c, which the window uses
+// through the library interface like any other program
+#include "particlesim.h"
+
+// the options the window needs, explained in the config file.
+// The simulation reads the same file for its own
+typedef struct windowOptions{
 	
-	int MAX_PARTICLE_COUNT;
 	double MAX_PARTICLE_SPEED;
-	double MIN_PARTICLE_SPEED;
-	double MAX_DIRECTION;
-	char ENABLE_STARTING_PARTICLES;
 	char ENABLE_BENCHMARK;
 	double MAX_BENCHMARK_SPF;
 	char ENABLE_AUTO_ADD_PARTICLES;
 	char ENABLE_CIRCLE_PARTICLES;
 	char ENABLE_CIRCLE_FILLED;
-	char ENABLE_BORDER_COLLISION;
-	char ENABLE_BORDER_CLAMP;
-	char ENABLE_PARTICLE_COLLISION;
-	int MAX_MEMORY_ALLOCATION;
 	double BACKGROUND_COL_R;
 	double BACKGROUND_COL_G;
 	double BACKGROUND_COL_B;
@@ -36,80 +33,59 @@ typedef struct configOptions{
 	double BUTTON_COL_B;
 	int WINDOW_WIDTH;
 	int WINDOW_HEIGHT;
-	double FRICTION;
-	
-} configOptions;
-
-const char optStr1[] = "MAX_PARTICLE_COUNT";
-const char optStr2[] = "MAX_PARTICLE_SPEED";
-const char optStr3[] = "MIN_PARTICLE_SPEED";
-const char optStr7[] = "MAX_DIRECTION";
-const char optStr8[] = "ENABLE_STARTING_PARTICLES";
-const char optStr9[] = "ENABLE_BENCHMARK";
-const char optStr10[] = "MAX_BENCHMARK_SPF";
-const char optStr11[] = "ENABLE_AUTO_ADD_PARTICLES";
-const char optStr12[] = "ENABLE_CIRCLE_PARTICLES";
-const char optStr13[] = "ENABLE_CIRCLE_FILLED";
-const char optStr16[] = "ENABLE_BORDER_COLLISION";
-const char optStr17[] = "ENABLE_BORDER_CLAMP";
-const char optStr18[] = "ENABLE_PARTICLE_COLLISION";
-const char optStr19[] = "MAX_MEMORY_ALLOCATION";
-const char optStr24[] = "BACKGROUND_COL_R";
-const char optStr25[] = "BACKGROUND_COL_G";
-const char optStr26[] = "BACKGROUND_COL_B";
-const char optStr27[] = "ENABLE_GENERATE_ONCE";
-const char optStr28[] = "BUTTON_PADDING";
-const char optStr29[] = "BUTTON_TRANSPARENCY";
-const char optStr30[] = "BUTTON_COL_R";
-const char optStr31[] = "BUTTON_COL_G";
-const char optStr32[] = "BUTTON_COL_B";
-const char optStr33[] = "WINDOW_WIDTH";
-const char optStr34[] = "WINDOW_HEIGHT";
-const char optStr35[] = "FRICTION";
-
-// list of particles types. Each particle share some or all of the 
-// forces, and interact with each other in unique ways.
-// particles can change into a different type, emit,
-// absorb, bond or be annihilated depending on the type
-typedef enum {
-	
-	red_particle,
-	blue_particle,
-	green_particle,
-	yellow_particle,
-	pink_particle,
-	
-	numOfParticleTypes
-	
-} particleType;
-
-// the particle structure with all the properties each particle will have
-typedef struct particle {
-	
-	double x;
-	double y;
-	
-	double velocityX;
-	double velocityY;
-	
-	double r;
-	double g;
-	double b;
-	
-	double size;
-	
-	double mass;
-	
-	particleType type;
+	char ENABLE_DETERMINISTIC;
+	double FIXED_TIMESTEP;
+	int MAX_STEPS;
+	double RENDER_RATE;
+	char ENABLE_VSYNC;
+	double SIMULATION_RATE;
+	int SLAB_PROCESSES;
+	
+} windowOptions;
+
+const char windowOptStr1[] = "MAX_PARTICLE_SPEED";
+const char windowOptStr2[] = "ENABLE_BENCHMARK";
+const char windowOptStr3[] = "MAX_BENCHMARK_SPF";
+const char windowOptStr4[] = "ENABLE_AUTO_ADD_PARTICLES";
+const char windowOptStr5[] = "ENABLE_CIRCLE_PARTICLES";
+const char windowOptStr6[] = "ENABLE_CIRCLE_FILLED";
+const char windowOptStr7[] = "BACKGROUND_COL_R";
+const char windowOptStr8[] = "BACKGROUND_COL_G";
+const char windowOptStr9[] = "BACKGROUND_COL_B";
+const char windowOptStr10[] = "ENABLE_GENERATE_ONCE";
+const char windowOptStr11[] = "BUTTON_PADDING";
+const char windowOptStr12[] = "BUTTON_TRANSPARENCY";
+const char windowOptStr13[] = "BUTTON_COL_R";
+const char windowOptStr14[] = "BUTTON_COL_G";
+const char windowOptStr15[] = "BUTTON_COL_B";
+const char windowOptStr16[] = "WINDOW_WIDTH";
+const char windowOptStr17[] = "WINDOW_HEIGHT";
+const char windowOptStr18[] = "ENABLE_DETERMINISTIC";
+const char windowOptStr19[] = "FIXED_TIMESTEP";
+const char windowOptStr20[] = "MAX_STEPS";
+const char windowOptStr21[] = "RENDER_RATE";
+const char windowOptStr22[] = "ENABLE_VSYNC";
+const char windowOptStr23[] = "SIMULATION_RATE";
+const char windowOptStr24[] = "SLAB_PROCESSES";
+
+// the colour each type of particle is drawn in, red, blue, green, yellow and pink
+typedef struct particleColour {
 	
-	int nearestNeighbour;
-	double nearestNeighbourDistance;
+	Uint8 r;
+	Uint8 g;
+	Uint8 b;
 	
-	int collidingAwayFrom;
+} particleColour;
+
+static const particleColour particleColours[PARTICLESIM_TYPES] = {
 	
-	int bondingWith;
+	{255, 0, 0},
+	{0, 0, 255},
+	{0, 255, 0},
+	{255, 255, 0},
+	{255, 0, 255}
 	
-} particle;
+};
 
 // what to do on mouse button down / finger tap
 // more will be added later
@@ -120,44 +96,34 @@ typedef enum{
 	
 } tapMode;
 
-// how many particles are currently on the screen
-static int length;
-
-// the restrict keyword tells the compiler that
-// this pointer will never change - ie, this pointer wil be pointing
-// at the same address for the entirety of the program's life,
-// allowing the compiler to do optimisations on it
-static particle* restrict particles;
-
-// how many bonding there are between particles
-static int bondLength;
-
-// a 2D array containing the particle numbers of bonding particles
-static int* restrict bonding;
-
-// needed to convert degrees to radians
-static const double halfPi = M_PI / 180.0;
+#ifndef PARTICLESIM_NO_MAIN
 
 // our particle window
 static SDL_Window* win;
 
+#endif
+
 // the renderer that will draw particles on the window
 static SDL_Renderer* winRend;
 
-// time last frame took to render
-static double delta;
+// our options struct
+static windowOptions* restrict options;
 
-// file to read the options from
-static FILE* config;
+#ifndef PARTICLESIM_NO_MAIN
 
-// our options struct
-static configOptions* restrict options;
+// how long the next step is: FIXED_TIMESTEP in deterministic mode,
+// otherwise how long the last one took
+static double delta;
+
+// keeps track if the particle window is open.
+// Both threads read it, and either can stop the program
+static SDL_atomic_t isRunning;
 
-// keeps track if the particle window is open
-static char isRunning;
+#endif
 
-// keeps track if the particles are moving or paused
-static char isSimulating;
+// keeps track if the particles are moving or paused.
+// The pause button sets it, the simulation thread reads it
+static SDL_atomic_t isSimulating;
 
 // the buttons that will be drawn on the screen
 static SDL_Rect* restrict buttons;
@@ -165,15 +131,18 @@ static SDL_Rect* restrict buttons;
 // keep track of which button is being pressed
 static int buttonPressed;
 
-// which particle to add. User can change this by 
+// which particle to add. User can change this by
 // pressing the "particle colour" button
 static int addParticleType;
 
 // keeps track of what to do when user taps/presses
 static tapMode mode;
 
-// the user has selected a particle to change velocity
-static int selectedParticle;
+// the user has selected a particle to change velocity.
+// It's a handle, so it goes invalid if the particle is removed.
+// Only the simulation thread uses it, the window finds out where
+// the particle is from the snapshot
+static uint64_t selectedParticle;
 
 // the velocity to change the selected particle to
 static double velocityXToChange, velocityYToChange;
@@ -181,37 +150,134 @@ static double velocityXToChange, velocityYToChange;
 // we need to know where on the window the user has pressed
 static SDL_Event mouseDown;
 
+#ifndef PARTICLESIM_NO_MAIN
+
 // used for debugging
 static FILE* restrict debug;
 
-// draw a circle, outlined or filled, for each particle.
+#endif
+
+// The simulation runs on a thread of its own, and the main thread only looks
+// after the window. After stepping, the simulation thread takes a snapshot of
+// what the screen needs, and the main thread draws the newest one whenever it's
+// time for a frame, so the simulation can run at 1000 steps a second while the
+// screen is only drawn 60 times.
+// There are three snapshots: the one being drawn, the one being written and the
+// newest finished one waiting in the middle, so neither thread waits for the other
+static particlesimSnapshot snapshots[3];
+
+// the simulation writes to backSnapshot and the main thread draws frontSnapshot.
+// middleSnapshot is the one in between, with SNAPSHOT_FRESH added
+// until the main thread has taken it
+static int backSnapshot;
+static int frontSnapshot;
+static SDL_atomic_t middleSnapshot;
+
+#define SNAPSHOT_FRESH 4
+
+// the snapshot being drawn on the screen
+static const particlesimSnapshot* restrict shown;
+
+// The window can't touch the particles while the simulation is stepping,
+// so anything the user does to them is queued up and done by the
+// simulation thread before its next step
+typedef enum{
+	
+	spawnCommand,
+	resetCommand,
+	selectCommand,
+	releaseCommand
+	
+} simulationCommandType;
+
+typedef struct simulationCommand {
+	
+	simulationCommandType type;
+	
+	// where to spawn particles (negative spreads them over the world),
+	// which type they are (-1 for random) and if only one is added
+	int x;
+	int y;
+	int particleType;
+	char once;
+	
+	// the particle to select
+	uint64_t handle;
+	
+	// the velocity to give the selected particle when it's let go
+	double velocityX;
+	double velocityY;
+	
+} simulationCommand;
+
+// if the simulation falls this far behind, the rest are dropped
+#define MAX_SIMULATION_COMMANDS 256
+
+static simulationCommand queuedCommands[MAX_SIMULATION_COMMANDS];
+static int queuedCommandCount;
+static SDL_mutex* commandLock;
+
+// the simulation takes the queue in one go, so it isn't locked while they run
+static simulationCommand runningCommands[MAX_SIMULATION_COMMANDS];
+
+// the window's simulation, made and stepped through particlesim.h
+static particlesim* simulation;
+
+#ifndef PARTICLESIM_NO_MAIN
+
+// the simulation thread, and how long each of its steps and the
+// window's frames should take in performance counter ticks (0 is as fast as possible)
+static SDL_Thread* simulationThreadHandle;
+static Uint64 simulationPeriod;
+static Uint64 renderPeriod;
+
+#endif
+
+// what part of the world is on the screen. The world point (x, y) is
+// at the top left of the window, and everything is drawn zoom times bigger
+typedef struct viewCamera {
+	
+	double x;
+	double y;
+	double zoom;
+	
+} viewCamera;
+
+static viewCamera camera;
+
+// how far the mouse wheel can zoom, and how much each notch zooms by
+#define CAMERA_MIN_ZOOM 0.125
+#define CAMERA_MAX_ZOOM 64.0
+#define CAMERA_ZOOM_STEP 1.25
+
+#ifndef PARTICLESIM_NO_MAIN
+
+// the user is dragging the view around with the right mouse button
+static char isPanning;
+
+#endif
+
+// the places in the shown snapshot of the particles on the screen, which
+// drawParticles() asks the snapshot for each frame
+static int* restrict drawnParticles;
+static int drawnParticlesCapacity;
+
+// going between the world and the pixels on the screen
+static inline int worldToScreenX(double x){ return (int)((x - camera.x) * camera.zoom); }
+static inline int worldToScreenY(double y){ return (int)((y - camera.y) * camera.zoom); }
+static inline double screenToWorldX(int x){ return camera.x + ((double)x / camera.zoom); }
+static inline double screenToWorldY(int y){ return camera.y + ((double)y / camera.zoom); }
+
+// draw a circle, outlined or filled, around a point on the screen.
 // this function uses the midpoint circle algorithm, in particular Jesko's method
 // the static inline keywords tell the compiler that we don't want to
 // treat this as a separate function, but rather bake the code inside the 
 // function inside the code that called it - to remove the overhead
 // of calling a function, which includes setting up the stack, copying
 // arguments etc
-static inline void drawCircle(int particleNum, int xPos, int yPos, int diameter, char filled){
-	
-	int centreX, centreY, x;
-	
-	// drawing circles for the buttons
-	if(xPos < 0){
-		
-		centreX = (int)particles[particleNum].x; 
-		centreY = (int)particles[particleNum].y;
-		x = (int)(0.5 * particles[particleNum].size); // grab the radius
-		
-	}
-	
-	else{
-		
-		centreX = xPos; 
-		centreY = yPos;
-		x = diameter >> 1;
-		
-	}
+static inline void drawCircleAt(int centreX, int centreY, int radius, char filled){
 	
+	int x = radius;
 	int y = 0;
 	int tx;
 	int ty = x / 16;
@@ -260,10 +326,26 @@ static inline void drawCircle(int particleNum, int xPos, int yPos, int diameter,
    
 }
 
-// C doesn't have standard integer min() and max()???? WTF?????
-// this is the closest thing we have to lambda functions in C
-static inline int max(int a, int b){ return ((a > b) ? a : b); }
-static inline int min(int a, int b){ return ((a < b) ? a : b); }
+// draw a particle of the snapshot on the screen (where the camera puts it) if xPos
+// is negative, otherwise a circle of the given diameter for the buttons
+static inline void drawCircle(int particleNum, int xPos, int yPos, int diameter, char filled){
+	
+	if(xPos < 0){
+		
+		drawCircleAt(worldToScreenX(shown->particles[particleNum].x), worldToScreenY(shown->particles[particleNum].y),
+			(int)(0.5 * shown->typeSizes[shown->particles[particleNum].type] * camera.zoom), filled);
+		
+	}
+	
+	else{
+		
+		drawCircleAt(xPos, yPos, diameter >> 1, filled);
+		
+	}
+	
+	return;
+	
+}
 
 // draw a triangle
 static inline void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3, char fill){
@@ -307,9 +389,9 @@ static inline void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3,
 		// the bottom two Y positions are the same, therefore the flat side is on the bottom
 		if(y2 == y3){
 			
-			for(int i = 0; i <  (max(x2, x3) - min(x2, x3)); i++){
+			for(int i = 0; i <  (SDL_max(x2, x3) - SDL_min(x2, x3)); i++){
 				
-				SDL_RenderDrawLine(winRend, (min(x2, x3) + i), y2, x1, y1);
+				SDL_RenderDrawLine(winRend, (SDL_min(x2, x3) + i), y2, x1, y1);
 				
 			}
 			
@@ -318,9 +400,9 @@ static inline void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3,
 		// top 2 y positions are the same
 		else if(y1 == y2){
 			
-			for(int i = 0; i < (max(x1, x2) - min(x1, x2)); i++){
+			for(int i = 0; i < (SDL_max(x1, x2) - SDL_min(x1, x2)); i++){
 				
-				SDL_RenderDrawLine(winRend, (min(x1, x2) + i), y2, x3, y3);
+				SDL_RenderDrawLine(winRend, (SDL_min(x1, x2) + i), y2, x3, y3);
 				
 			}
 			
@@ -329,7 +411,7 @@ static inline void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3,
 		// the triangle has one of its side straight on the Y axis
 		else if(x1 == x3){
 			
-			for(int i = 0; i < (max(y1, y3) - min(y1, y3)); i++){
+			for(int i = 0; i < (SDL_max(y1, y3) - SDL_min(y1, y3)); i++){
 				
 				SDL_RenderDrawLine(winRend, x1, (y1 + i), x2, y2);
 				
@@ -342,15 +424,15 @@ static inline void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3,
 			// cut the triangle in half and draw the two smaller triangles
 			int middleX = x1 + (int)((((double)(y2 - y1)) / ((double)(y3 - y1))) * ((double)(x3 - x1)));
 			
-			for(int i = 0; i < (max(x2, middleX) - min(x2, middleX)); i++){
+			for(int i = 0; i < (SDL_max(x2, middleX) - SDL_min(x2, middleX)); i++){
 				
-				SDL_RenderDrawLine(winRend, (min(x2, middleX) + i), y2, x1, y1);
+				SDL_RenderDrawLine(winRend, (SDL_min(x2, middleX) + i), y2, x1, y1);
 				
 			}
 			
-			for(int i = 0; i < (max(x2, middleX) - min(x2, middleX)); i++){
+			for(int i = 0; i < (SDL_max(x2, middleX) - SDL_min(x2, middleX)); i++){
 				
-				SDL_RenderDrawLine(winRend, (min(x2, middleX) + i), y2, x3, y3);
+				SDL_RenderDrawLine(winRend, (SDL_min(x2, middleX) + i), y2, x3, y3);
 				
 			}
 			
@@ -541,380 +623,222 @@ static inline void drawChangeVelocityIcon(){
 	
 }
 
-// stores the state for the PRNG
-unsigned int randState;
-
-// generate a pseudo random number between 0 and 2^32
-// Uses the xorshift32 algorithm, and is thread safe
-static inline unsigned int randu(unsigned int* seed){
-	
-	*seed ^= *seed << 13;
-	*seed ^= *seed >> 17;
-	*seed ^= *seed << 5;
-	
-	return *seed;
-	
-}
-
-// get the random number, cast to double & divide by the maximum
-// possible number for an unsigned int so it will return 
-// a nunber between 0 and 1
-// Thread safe as well
-static inline double randf(unsigned int* seed){
-	
-	return (double)(randu(seed)) / (double)(0xFFFFFFFFu);
-	
-}
-
-// generate random particles at x, y
-// position. if either is negative, then the particles
-// will be spread over the window
-static inline void generateRandomParticles(int x, int y){
+// wait until period ticks after the last time this loop started.
+// SDL_Delay only waits whole milliseconds, so the start times are kept on a
+// schedule and a wait that was too short is made up for on the next one.
+// If the loop falls more than a whole period behind, the schedule starts again from now
+static inline void waitForNextTick(Uint64* restrict nextTick, Uint64 period){
 	
-	// generate a random number of particles to add
-	int particleCount = (int)(randf(&randState) * (double)options->MAX_PARTICLE_COUNT);
-	
-	if(options->ENABLE_GENERATE_ONCE){
+	if(period == 0){
 		
-		particleCount = 1;
+		return;
 		
 	}
 	
-	if(particleCount == 0){
+	*nextTick += period;
+	
+	Uint64 now = SDL_GetPerformanceCounter();
+	
+	if(now >= *nextTick){
+		
+		if((now - *nextTick) > period){
+			
+			*nextTick = now;
+			
+		}
 		
 		return;
 		
 	}
 	
-	// we need to check if the allocated memory is enough to hold
-	// the amount of particles, if it's too much particles will stop generating 
-	if(((length + particleCount) * (int)sizeof(particle)) > options->MAX_MEMORY_ALLOCATION){
+	Uint32 milliseconds = (Uint32)(((*nextTick - now) * 1000) / SDL_GetPerformanceFrequency());
+	
+	if(milliseconds > 0){
 		
-		return;
+		SDL_Delay(milliseconds);
 		
 	}
+	
+	return;
+	
+}
+
+static inline void createButtons(){
+	
+	// height and width for each button
+	int width = (SDL_max(options->WINDOW_WIDTH, options->WINDOW_HEIGHT) / 10) - (options->BUTTON_PADDING << 1);
+	int height = (SDL_min(options->WINDOW_WIDTH, options->WINDOW_HEIGHT) / 8) - (options->BUTTON_PADDING << 1);
+	
+	// first button(pasue/resume) will be located at the top left of the screen
+	buttons[0].x = options->BUTTON_PADDING;
+	buttons[0].y = options->BUTTON_PADDING;
+	buttons[0].w = width;
+	buttons[0].h = height;
+	
+	// second button(select particle) will be located under the first
+	buttons[1].x = options->BUTTON_PADDING;
+	buttons[1].y = height + (options->BUTTON_PADDING << 1);
+	buttons[1].w = width;
+	buttons[1].h = height;
+	
+	buttons[2].x = options->BUTTON_PADDING;
+	buttons[2].y = (height << 1) + (options->BUTTON_PADDING * 3);
+	buttons[2].w = width;
+	buttons[2].h = height;
+	
+	buttons[3].x = options->BUTTON_PADDING;
+	buttons[3].y = (height * 3) + (options->BUTTON_PADDING * 4);
+	buttons[3].w = width;
+	buttons[3].h = height;
+	
+	buttons[4].x = options->BUTTON_PADDING;
+	buttons[4].y = (height * 4) + (options->BUTTON_PADDING * 5);
+	buttons[4].w = width;
+	buttons[4].h = height;
+	
+	return;
+	
+}
 
-	// loop over every particle, giving it random values
-	for(int i = length; i < (length + particleCount); i++){
+static inline void drawButtons(){
+	
+	// iterate through each button and draw the boxes of the correct
+	// transparency (the selected box will be twice as opaque)
+	for(int i = 0; i < 5; i++){
 		
-		if(x < 0 || y < 0){
+		if(i == buttonPressed){
 			
-			particles[i].x = randf(&randState) * (double)options->WINDOW_WIDTH;
-			particles[i].y = randf(&randState) * (double)options->WINDOW_HEIGHT;
+			SDL_SetRenderDrawColor(winRend, (Uint8)(options->BUTTON_COL_R),
+				(Uint8)(options->BUTTON_COL_G), (Uint8)(options->BUTTON_COL_B), 
+				(Uint8)(options->BUTTON_TRANSPARENCY * 2));
 			
 		}
 		
 		else{
 			
-			particles[i].x = (double)x;
-			particles[i].y = (double)y;
+			SDL_SetRenderDrawColor(winRend, (Uint8)(options->BUTTON_COL_R),
+				(Uint8)(options->BUTTON_COL_G), (Uint8)(options->BUTTON_COL_B), 
+				(Uint8)(options->BUTTON_TRANSPARENCY));
 			
 		}
 		
-		// select a random particle type
-		if(addParticleType == -1){
-			
-			particles[i].type = (int)(randf(&randState) * (double)numOfParticleTypes);
-			
-		}
+		SDL_RenderFillRect(winRend, &(buttons[i]));
 		
-		// add specific particle type 
-		else{
-			
-			particles[i].type = addParticleType;
-			
-		}
+	}
+	
+	// set the colour of the play/pause icon to white
+	SDL_SetRenderDrawColor(winRend, 255, 255, 255, 255);
+	
+	// draw the "pause" logo
+	if(!SDL_AtomicGet(&isSimulating)){
 		
-		// select mass, size and colour based on type
-		switch(particles[i].type){
-			
-			case red_particle:
-			
-				particles[i].r = 255.0;
-				particles[i].g = 0.0;
-				particles[i].b = 0.0;
-				particles[i].size = 20.0;
-				particles[i].mass = 1.0;
-				
-				// red is large, and light
-				
-				break;
-				
-			case blue_particle:
-			
-				particles[i].r = 0.0;
-				particles[i].g = 0.0;
-				particles[i].b = 255.0;
-				particles[i].size = 25.0;
-				particles[i].mass = 1.2f;
-				
-				// blue is larger, and a bit heavier
-				
-				break;
-				
-			case green_particle:
-			
-				particles[i].r = 0.0;
-				particles[i].g = 255.0;
-				particles[i].b = 0.0;
-				particles[i].size = 10.0;
-				particles[i].mass = 0.01f;
-				
-				// green is small and very light
-				
-				break;
-				
-			case yellow_particle:
+		for(int i = 0; i < (buttons[0].w / 3); i++){
 			
-				particles[i].r = 255.0;
-				particles[i].g = 255.0;
-				particles[i].b = 0.0;
-				particles[i].size = 5.0;
-				particles[i].mass = 10.0;
-				
-				// yellow is very small and very heavy 
+			if((i > (buttons[0].w / 9)) && (i < ((buttons[0].w / 9) << 1))){
 				
-				break;
+				continue;
 				
-			case pink_particle:
+			}
 			
-				particles[i].r = 255.0;
-				particles[i].g = 0.0;
-				particles[i].b = 255.0;
-				particles[i].size = 2.0;
-				particles[i].mass = 0.0001f;
-				
-				// pink is extremely small and extremely light
-				
-				break;
+			SDL_RenderDrawLine(winRend, 
+				(buttons[0].x + i + (buttons[0].w / 3)),
+				(buttons[0].y + (buttons[0].h / 6)),
+				(buttons[0].x + i + (buttons[0].w / 3)),
+				(buttons[0].y + (((buttons[0].h / 6) * 5))));
 			
-			default:
-				 
-				 break;
-				
 		}
 		
-		// if the user has selected pixels for the particles, set the size (diameter) to 1 pixel
-		if(!(options->ENABLE_CIRCLE_PARTICLES)){
-			
-			particles[i].size = 1.0;
-			
-		}
+	}
+	
+	// draw the "play" logo
+	else{
+		
+		drawTriangle((buttons[0].x + (buttons[0].w / 3)),
+			(buttons[0].y + (buttons[0].h / 6)), 
+			(buttons[0].x + ((buttons[0].w / 3) << 1)),
+			(buttons[0].y + (buttons[0].h >> 1)),
+			(buttons[0].x + (buttons[0].w / 3)),
+			(buttons[0].y + ((buttons[0].h / 6) * 5)), 1);
+		
+	}
+	
+	// pick the right colour to draw on the particle type button
+	if(addParticleType > -1){
 		
-		// select a random direction and speed
-		double direction = ((randf(&randState) * (options->MAX_DIRECTION)) - (0.5 * options->MAX_DIRECTION)) - 90.0;
-		double speed = (randf(&randState) * (options->MAX_PARTICLE_SPEED - options->MIN_PARTICLE_SPEED)) + options->MIN_PARTICLE_SPEED;
+		SDL_SetRenderDrawColor(winRend, particleColours[addParticleType].r, particleColours[addParticleType].g, particleColours[addParticleType].b, 255);
 		
-		//calculate the velocity from direction and speed
-		particles[i].velocityX = cos(direction * halfPi) * speed;
-		particles[i].velocityY = sin(direction * halfPi) * speed;
+	}
+	
+	else{
+		
+		// draw all colours next to each other
+		SDL_SetRenderDrawColor(winRend, 255, 0, 0, 255);
+		drawCircle(0, (buttons[1].x + ((buttons[1].w >> 1)) - (buttons[1].h / 6)), 
+			((buttons[1].y + (buttons[1].h >> 1)) - (buttons[1].h / 6)), ((buttons[1].h / 6) << 1), 1);
+			
+		SDL_SetRenderDrawColor(winRend, 0, 0, 255, 255);
+		drawCircle(0, (buttons[1].x + ((buttons[1].w >> 1)) - (buttons[1].h / 6)), 
+			((buttons[1].y + (buttons[1].h >> 1)) + (buttons[1].h / 6)), ((buttons[1].h / 6) << 1), 1);
+			
+		SDL_SetRenderDrawColor(winRend, 0, 255, 0, 255);
+		drawCircle(0, (buttons[1].x + ((buttons[1].w >> 1)) + (buttons[1].h / 6)), 
+			((buttons[1].y + (buttons[1].h >> 1)) - (buttons[1].h / 6)), ((buttons[1].h / 6) << 1), 1);
 		
-		particles[i].nearestNeighbour = -1;
-		particles[i].nearestNeighbourDistance = 0.0;
+		SDL_SetRenderDrawColor(winRend, 255, 255, 0, 255);
+		drawCircle(0, (buttons[1].x + ((buttons[1].w >> 1)) + (buttons[1].h / 6)), 
+			((buttons[1].y + (buttons[1].h >> 1)) + (buttons[1].h / 6)), ((buttons[1].h / 6) << 1), 1);
 		
-		particles[i].collidingAwayFrom = -1;
+		SDL_SetRenderDrawColor(winRend, 255, 0, 255, 255);
+		drawCircle(0, (buttons[1].x + (buttons[1].w >> 1)), 
+			(buttons[1].y + (buttons[1].h >> 1)), ((buttons[1].h / 6) << 1), 1);
 		
-		particles[i].bondingWith = -1;
-
 	}
 	
-	length += particleCount; // add to total amount
+	//draw the single ball
+	if(addParticleType > -1){
+		
+		drawCircle(0, (buttons[1].x + (buttons[1].w >> 1)), 
+			(buttons[1].y + (buttons[1].h >> 1)), ((buttons[1].h / 6) * 4), 1);
+			
+	}
 	
-	return;
+	// white particle 
+	SDL_SetRenderDrawColor(winRend, 255, 255, 255, 255);
 	
-}
-
-//border collision
-static inline void handleBorderCollision(){
+	// check whether to draw one particle per tap/click or multiple
+	if(options->ENABLE_GENERATE_ONCE){
+		
+		drawCircle(0, (buttons[2].x + (buttons[2].w >> 1)), 
+			(buttons[2].y + (buttons[2].h >> 1)), ((buttons[2].h / 6) * 4), 1);
+		
+	}
 	
-	if(options->ENABLE_BORDER_COLLISION){
+	else{
 		
-		for(int particleNum = 0; particleNum < length; particleNum++){
-			
-			// we need the radius
-			double radius = 0.5 * particles[particleNum].size;
+		// draw 3 particles in a diagional, showing multiple particles
+		drawCircle(0, (buttons[2].x + (buttons[2].w >> 1)), 
+			(buttons[2].y + (buttons[2].h >> 1)), (buttons[2].h / 4), 1);
 			
-			// collision with the left border
-			if(((particles[particleNum].x - radius) < 0.0)){
-				
-				// check if velocity is going past the border
-				if(particles[particleNum].velocityX < 0.0){
-					
-					particles[particleNum].velocityX = -particles[particleNum].velocityX;
-					particles[particleNum].nearestNeighbour = -1;
-					particles[particleNum].collidingAwayFrom = -1;
-					
-					if(particles[particleNum].bondingWith > -1){
-						
-						particles[particles[particleNum].bondingWith].velocityX = -particles[particles[particleNum].bondingWith].velocityX;
-						particles[particles[particleNum].bondingWith].nearestNeighbour = -1;
-						particles[particles[particleNum].bondingWith].collidingAwayFrom = -1;
-						
-					}
-					
-				}
-				
-				if(options->ENABLE_BORDER_CLAMP){
-					
-					particles[particleNum].x = radius;
-					
-				}
-				
-			}
-			
-			// right border
-			else if((particles[particleNum].x + radius) > options->WINDOW_WIDTH){
-				
-				if(particles[particleNum].velocityX > 0.0){
-					
-					particles[particleNum].velocityX = -particles[particleNum].velocityX;
-					particles[particleNum].nearestNeighbour = -1;
-					particles[particleNum].collidingAwayFrom = -1;
-					
-					if(particles[particleNum].bondingWith > -1){
-						
-						particles[particles[particleNum].bondingWith].velocityX = -particles[particles[particleNum].bondingWith].velocityX;
-						particles[particles[particleNum].bondingWith].nearestNeighbour = -1;
-						particles[particles[particleNum].bondingWith].collidingAwayFrom = -1;
-						
-					}
-					
-				}
-				
-				if(options->ENABLE_BORDER_CLAMP){
-					
-					particles[particleNum].x = (double)(options->WINDOW_WIDTH) - radius;
-					
-				}
-				
-			}
-			
-			// top border
-			if(((particles[particleNum].y - radius) < 0.0)){
-				
-				if(particles[particleNum].velocityY < 0.0){
-					
-					particles[particleNum].velocityY = -particles[particleNum].velocityY;
-					particles[particleNum].nearestNeighbour = -1;
-					particles[particleNum].collidingAwayFrom = -1;
-					
-					if(particles[particleNum].bondingWith > -1){
-						
-						particles[particles[particleNum].bondingWith].velocityY = -particles[particles[particleNum].bondingWith].velocityY;
-						particles[particles[particleNum].bondingWith].nearestNeighbour = -1;
-						particles[particles[particleNum].bondingWith].collidingAwayFrom = -1;
-						
-					}
-					
-				}
-				
-				if(options->ENABLE_BORDER_CLAMP){
-					
-					particles[particleNum].y = radius;
-					
-				}
-				
-			}
+		drawCircle(0, (buttons[2].x + ((buttons[2].w >> 1)) + (buttons[1].h / 6)), 
+			((buttons[2].y + (buttons[2].h >> 1)) + (buttons[1].h / 6)), (buttons[2].h / 4), 1);
 			
-			// bottom border
-			else if(((particles[particleNum].y + radius) > options->WINDOW_HEIGHT)){
-				
-				if(particles[particleNum].velocityY > 0.0){
-					
-					particles[particleNum].velocityY = -particles[particleNum].velocityY;
-					particles[particleNum].nearestNeighbour = -1;
-					particles[particleNum].collidingAwayFrom = -1;
-					
-					if(particles[particleNum].bondingWith > -1){
-						
-						particles[particles[particleNum].bondingWith].velocityY = -particles[particles[particleNum].bondingWith].velocityY;
-						particles[particles[particleNum].bondingWith].nearestNeighbour = -1;
-						particles[particles[particleNum].bondingWith].collidingAwayFrom = -1;
-						
-					}
-					
-				}
-				
-				if(options->ENABLE_BORDER_CLAMP){
-					
-					particles[particleNum].y = (double)(options->WINDOW_HEIGHT) - radius;
-					
-				}
-				
-			}
-		
-		}
+		drawCircle(0, (buttons[2].x + ((buttons[2].w >> 1)) - (buttons[1].h / 6)), 
+			((buttons[2].y + (buttons[2].h >> 1)) - (buttons[1].h / 6)), (buttons[2].h / 4), 1);
 		
 	}
 	
-	return;
-	
-}
-
-// check if two particles are bonded to anything
-static inline char isBonding(int particleNum, int particleNumTo){
+	//draw the reset icon
+	drawResetIcon();
 	
-	for(int i = 0; i < bondLength; i+= 2){
-		
-		if((*(bonding + i) == particleNum) || (*(bonding + i + 1) == particleNum)
-		|| (*(bonding + i) == particleNumTo) || (*(bonding + i + 1) == particleNumTo)){
-			
-			return 1;
-			
-		}
+	if(mode == addParticle){
 		
-	}
-	
-	return 0;
+		drawAddParticleIcon();
 	
-}
-
-// handle elastic collision (for particles
-// that only exchanges kinetic energy on collison)
-static inline void handleElasticCollision(int particleNumA, int particleNumB, double distance){
-	
-	double velXA = particles[particleNumA].velocityX;
-	double velYA = particles[particleNumA].velocityY;
-	double velXB = particles[particleNumB].velocityX;
-	double velYB = particles[particleNumB].velocityY;
-	double massA = particles[particleNumA].mass;
-	double massB = particles[particleNumB].mass;
-	
-	// stolen from Javidx9's circle vs circle collision video, thanks! :)
-	// some sort of maths magic going on here.... I have no idea what's
-	// happening but it works great
-	
-	// get the normal vector between the two particles
-	double nx = (particles[particleNumB].x - particles[particleNumA].x) / distance;
-	double ny = (particles[particleNumB].y - particles[particleNumA].y) / distance;
-	
-	double kx = (velXA - velXB);
-	double ky = (velYA - velYB);
-	double p = 2.0 * (nx * kx + ny * ky) / (massA + massB);
-	velXA = velXA - p * massB * nx;
-	velYA = velYA - p * massB * ny;
-	velXB = velXB + p * massA * nx;
-	velYB = velYB + p * massA * ny;
-	
-	// apply the new velocities to both particles
-	particles[particleNumA].velocityX = velXA;
-	particles[particleNumA].velocityY = velYA;
-	particles[particleNumB].velocityX = velXB;
-	particles[particleNumB].velocityY = velYB;
-	
-	// also collide with bonded particles
-	// The particles have spin 0 for now, which means that they don't rotate. Therefore, any collision
-	// affect both particles equally
-	if(particles[particleNumA].bondingWith > -1){
-		
-		particles[particles[particleNumA].bondingWith].velocityX = velXA;
-		particles[particles[particleNumA].bondingWith].velocityY = velYA;
-		
 	}
+	
+	else{
 		
-	if(particles[particleNumB].bondingWith > -1){
-		particles[particles[particleNumB].bondingWith].velocityX = velXB;
-		particles[particles[particleNumB].bondingWith].velocityY = velYB;
+		drawChangeVelocityIcon();
 		
 	}
 	
@@ -922,824 +846,560 @@ static inline void handleElasticCollision(int particleNumA, int particleNumB, do
 	
 }
 
-// handle red and blue particle bonding
-static inline void handleRedBlueBond(int i, int j){
-	
-	// the new velocities of the particles will be the average of both old ones
-	double avgVelX = (particles[i].velocityX + particles[j].velocityX) / 2.0;
-	double avgVelY = (particles[i].velocityY + particles[j].velocityY) / 2.0;
-	
-	particles[i].velocityX = avgVelX;
-	particles[i].velocityY = avgVelY;
-	particles[j].velocityX = avgVelX;
-	particles[j].velocityY = avgVelY;
+static inline void drawSelectedParticle(){
 	
-	double temp = particles[i].mass;
+	// where the selected particle was when the snapshot was taken
+	double selectedX = shown->selectedX;
+	double selectedY = shown->selectedY;
 	
-	particles[i].mass += particles[j].mass;
-	particles[j].mass += temp;
+	// where the mouse is in the world, so the velocity doesn't change with the zoom
+	int mouseX = (int)screenToWorldX(mouseDown.button.x);
+	int mouseY = (int)screenToWorldY(mouseDown.button.y);
 	
-	particles[i].bondingWith = j;
-	particles[j].bondingWith = i;
+	// get the distance between the particle and mouse and 
+	// check if the velocity exceeds MAX_PARTICLE_SPEED
+	int diffX = mouseX - (int)(selectedX);
+	int diffY = mouseY - (int)(selectedY);
 	
-}
-
-// handle particle repulsion
-// Assume that I is the closest to J.
-static inline void handleCollision(){
+	double distance = sqrt(((double)diffX * (double)diffX) + ((double)diffY * (double)diffY));
 	
-	for(int i = 0; i < length; i++){
-		
-		if(particles[i].nearestNeighbour == -1) continue;
-		
-		// both particles aren't bonded, but we still need to check if the other particle is closer to another.
-		if((particles[i].bondingWith == -1) && (particles[particles[i].nearestNeighbour].bondingWith == -1)){
-			
-			//if(i == 0) fprintf(debug, "particle 1 - nearestNeighbour = %d, distance = %d, nearestNeighbour's nearestNeighbour = %d", );
-			
-			if(particles[i].collidingAwayFrom != particles[i].nearestNeighbour){
-				
-				handleElasticCollision(i, particles[i].nearestNeighbour, particles[i].nearestNeighbourDistance);
-				
-				particles[i].collidingAwayFrom = particles[i].nearestNeighbour;
-				
-			}
-			
-		}
-
-	}
+	velocityXToChange = (double)(-diffX);
+	velocityYToChange = (double)(-diffY);
 	
-	/*
+	int triangleSizeX, triangleSizeY, triangleEndX, triangleEndY;
 	
-	// particle I is bonded, while J is not
-	else if(particles[i].bondingWith > -1 && particles[j].bondingWith == -1){
+	// we will stop the triangle length and width when it exceeds the maximum
+	// possible particle velocity
+	if(distance > (options->MAX_PARTICLE_SPEED / 2.0)){
 		
-		if(particles[particles[i].bondingWith].nearestNeighbour > -1){
-			
-			// we need to ckeck if our bonded particle is closer to another particle
-			if(particles[i].nearestNeighbourDistance < particles[particles[i].bondingWith].nearestNeighbourDistance){
-				
-				handleElasticCollision(i, j, particles[i].nearestNeighbour);
-				
-			}
-			
-		}
+		// get the angle between the mouse and particle
+		double angle = atan2((selectedY - (double)mouseY),
+			(selectedX - (double)mouseX));
 		
-		else{
-			
-			handleElasticCollision(i, j, particles[i].nearestNeighbour);
-			
-		}
+		// get the new direction
+		// we set the amount of velocity to add to the maximum speed
+		double dx = (cos(angle) * (options->MAX_PARTICLE_SPEED * 0.5));
+		double dy = (sin(angle) * (options->MAX_PARTICLE_SPEED * 0.5));
 		
-	}
-	
-	// vice versa
-	else if(particles[i].bondingWith == -1 && particles[j].bondingWith > -1){
+		velocityXToChange = selectedX - dx;
+		velocityYToChange = selectedY - dy;
 		
-		if(particles[particles[j].bondingWith].nearestNeighbour > -1){
-			
-			// we need to ckeck if our bonded particle is closer to another particle
-			if(particles[i].nearestNeighbourDistance < particles[particles[j].bondingWith].nearestNeighbourDistance){
-				
-				if(particles[i].nearestNeighbourDistance < particles[j].nearestNeighbourDistance){
-					
-					handleElasticCollision(i, j, particles[i].nearestNeighbour);
-					
-				}
-				
-			}
-			
-		}
+		diffX = (int)(velocityXToChange - selectedX);
+		diffY = (int)(velocityYToChange - selectedY);
 		
-		else{
-			
-			if(particles[i].nearestNeighbourDistance < particles[j].nearestNeighbourDistance){
-				
-				handleElasticCollision(i, j, particles[i].nearestNeighbour);
-				
-			}
-			
-		}
+		// We calculate how wide the triangle is based on the velocity we are about to apply,
+		// the maximum width of the triangle is the same as the maximum particle speed / 2
+		triangleSizeX = (int)(velocityXToChange) - (diffY >> 2);
+		triangleSizeY = (int)(velocityYToChange) + (diffX >> 2);
+		triangleEndX = (int)(velocityXToChange) + (diffY >> 2);
+		triangleEndY = (int)(velocityYToChange) - (diffX >> 2);
 		
+		velocityXToChange = (double)(-diffX);
+		velocityYToChange = (double)(-diffY);
 	}
 	
 	else{
 		
-		
+		// We calculate how wide the triangle is based on the velocity we are about to appply
+		triangleSizeX = mouseX - (int)((double)diffY * (distance / (options->MAX_PARTICLE_SPEED * 2.0)));
+		triangleSizeY = mouseY + (int)((double)diffX * (distance / (options->MAX_PARTICLE_SPEED * 2.0)));
+		triangleEndX = mouseX + (int)((double)diffY * (distance / (options->MAX_PARTICLE_SPEED * 2.0)));
+		triangleEndY = mouseY - (int)((double)diffX * (distance / (options->MAX_PARTICLE_SPEED * 2.0)));
 		
 	}
 	
-	*/
+	// everything above is in the world, the camera says where it goes on the screen
+	int particleX = worldToScreenX(selectedX);
+	int particleY = worldToScreenY(selectedY);
 	
-}
-
-// If particles are touching each other, we need to decide what to do with each 
-static inline void handleParticleInteraction(){ // new name, suits it better
+	SDL_SetRenderDrawColor(winRend, 255, 255, 255, 255);
 	
-	// check for collision with other particles
-	if(options->ENABLE_PARTICLE_COLLISION){
-			
-		// loop through all particles checking for collision
-		// then updating their closest neighbours
-		for(int i = 0; i < length; i++){
-			
-			// we need to check if the particle is colliding with anything
-			char hasCollided = 0;
-			
-			for(int j = 0; j < length; j++){
-			
-				if(i != j){
-					
-					// particles that are bonded do not act on any force against each other, they simply
-					// behave as one big, with mass equal to the sum of the two particles, FOR NOW.....
-					if(particles[i].bondingWith == j){
-						
-						continue;
-						
-					}
-					
-					// copy to the stack for faster processing & syntatic sugar :P
-					double xa = particles[i].x;
-					double ya = particles[i].y;
-					double radiusA = 0.5 * particles[i].size;
-					
-					double xb = particles[j].x;
-					double yb = particles[j].y;
-					double radiusB = 0.5 * particles[j].size;
-					
-					// getting the distance with good old Pythagoras' Theorem
-					double distance = sqrt((((xa - xb) * (xa - xb)) + ((ya - yb) * (ya - yb))));
-					
-					// check if the distance between them is
-					// less than their radiuses combined
-					// the + 1 is for floating point error
-					if(distance < (radiusA + radiusB + 1.0)){
-						
-						hasCollided = 1;
-						
-						if(particles[i].nearestNeighbour == -1){
-							
-							particles[i].nearestNeighbourDistance = radiusA + radiusB + 2.0;
-							
-						}
-						
-						switch (particles[i].type){
-						
-							case red_particle:
-								
-								if(particles[j].type == red_particle){
-									
-									if(distance < particles[i].nearestNeighbourDistance){
-										
-										particles[i].nearestNeighbourDistance = distance;
-										particles[i].nearestNeighbour = j;
-										
-									}
-									
-								}
-								
-								else if(particles[j].type == blue_particle){
-									
-									if((particles[i].bondingWith == -1) && (particles[j].bondingWith == -1)){
-										
-										handleRedBlueBond(i, j);
-										
-									}
-									
-									else{
-										
-										if(distance < particles[i].nearestNeighbourDistance){
-											
-											particles[i].nearestNeighbourDistance = distance;
-											particles[i].nearestNeighbour = j;
-											
-										}
-										
-									}
-									
-								}
-								
-								break;
-								
-							case blue_particle:
-								
-								if(particles[j].type == blue_particle){
-									
-									if(distance < particles[i].nearestNeighbourDistance){
-										
-										particles[i].nearestNeighbourDistance = distance;
-										particles[i].nearestNeighbour = j;
-										
-									}
-										
-								}
-								
-								else if(particles[j].type == red_particle){
-									
-									if((particles[i].bondingWith == -1) && (particles[j].bondingWith == -1)){
-										
-										handleRedBlueBond(i, j);
-										
-									}
-									
-									else{
-										
-										if(distance < particles[i].nearestNeighbourDistance){
-											
-											particles[i].nearestNeighbourDistance = distance;
-											particles[i].nearestNeighbour = j;
-											
-										}
-										
-									}
-									
-								}
-								
-								break;
-								
-							case green_particle:
-								
-								break;
-								
-							case yellow_particle:
-								
-								break;
-								
-							case pink_particle:
-								
-								break;
-								
-							default:
-								
-								break;
-								
-						}
-						
-						continue;
-						
-					}
-					
-				}
-				
-			}
-			
-			if(hasCollided == 0){
-				
-				particles[i].nearestNeighbour = -1;
-				
-			}
-			
-		}
-		
-		handleCollision();
-		
-	}
+	//draw a line too, in case the triangle is too thin
+	SDL_RenderDrawLine(winRend, particleX, particleY,
+		worldToScreenX(selectedX - velocityXToChange), 
+		worldToScreenY(selectedY - velocityYToChange));
 	
-	return;
+	//draw the triangle, the pointy part on the particle
+	drawTriangle(worldToScreenX((double)triangleSizeX), worldToScreenY((double)triangleSizeY),
+		particleX, particleY,
+		worldToScreenX((double)triangleEndX), worldToScreenY((double)triangleEndY), 1);
 	
-}
-
-// update the position of each particle
-// and handle border collision
-static inline void updateParticles(){
+	velocityXToChange *= 2.0;
+	velocityYToChange *= 2.0;
 	
-	// loop through each particle
-	for(int particleNum = 0; particleNum < length; particleNum++){
-		
-		// move the x and y position by the velocity and frame delta time
-		particles[particleNum].x += particles[particleNum].velocityX * delta;
-		particles[particleNum].y += particles[particleNum].velocityY * delta;
+	// draw a white circle outline on the selected particle
+	// to give us better visibility
+	for(int i = 0; i < 5; i++){
 		
-		// check if we need to reduce the speed via friction
-		if(options->FRICTION > 0.0){
+		drawCircleAt(particleX, particleY, ((int)(shown->selectedSize * camera.zoom) + i) >> 1, 0);
 		
-			// if both velocities are already at zero, no need to reduce them anymore, otherwise sqrt() will
-			// return an undefined double
-			if((particles[particleNum].velocityX != 0.0) && (particles[particleNum].velocityY != 0.0)){
-				
-				// reduce the speed of the vector by the friction * mass
-				double speed = sqrt((particles[particleNum].velocityX * particles[particleNum].velocityX) +
-					(particles[particleNum].velocityY * particles[particleNum].velocityY));
-				
-				double speedToReduce;
-				
-				if(particles[particleNum].bondingWith > -1){
-					
-					double totalMass = particles[particleNum].mass + particles[particles[particleNum].bondingWith].mass;
-					
-					speedToReduce = (1.0 / totalMass) * options->FRICTION;
-					
-				}
-				
-				else{
-					
-					speedToReduce = (1.0 / particles[particleNum].mass) * options->FRICTION;
-					
-				}
-				
-				// we need to check if the velocity has hit zero, if so, then stop drcreasing the magnitude
-				char zero = particles[particleNum].velocityX > 0.0;
-				
-				particles[particleNum].velocityX -= ((particles[particleNum].velocityX / speed) * speedToReduce);
-				
-				if((zero && (particles[particleNum].velocityX < 0.0)) || ((zero == 0) && (particles[particleNum].velocityX > 0.0))){
-					
-					particles[particleNum].velocityX = 0.0;
-					
-				}
-				
-				
-				
-				zero = particles[particleNum].velocityY > 0.0;
-				
-				particles[particleNum].velocityY -= ((particles[particleNum].velocityY / speed) * speedToReduce);
-				
-				if((zero && (particles[particleNum].velocityY < 0.0)) || ((zero == 0) && (particles[particleNum].velocityY > 0.0))){
-					
-					particles[particleNum].velocityY = 0.0;
-					
-				}
-				
-			}
-		
-		}
-	
 	}
 	
 	return;
-	
 }
 
-// get the options from the config file
-static inline void getOptions(char* arg){
-	
-	// get the options
-	config = 0;
+// The snapshot is asked which particles overlap the screen, which only
+// looks at the cells on it, so drawing takes time close to the number
+// of particles on screen
+static inline void drawParticles(){
 	
-	if(arg){
+	if(shown->cellCount == 0){
 		
-		// read the file supplied by the user
-		config = fopen(arg, "r");
+		return;
 		
 	}
 	
-	else{
+	// there can't be more on the screen than are in the snapshot
+	if(shown->length > drawnParticlesCapacity){
+		
+		drawnParticles = realloc(drawnParticles, shown->length * sizeof(int));
 		
-		config = fopen("config.txt", "r");
+		if(drawnParticles == 0){ exit(0); }
+		
+		drawnParticlesCapacity = shown->length;
 		
 	}
 	
-	// if we can't open the file then we quit
-	if(config == 0){ exit(0); }
+	// the part of the world on the screen
+	int drawnCount = particlesimSnapshotQueryRect(shown, camera.x, camera.y,
+		screenToWorldX(options->WINDOW_WIDTH), screenToWorldY(options->WINDOW_HEIGHT), drawnParticles, shown->length);
 	
-	// max of 128 characters per line
-	char currentLine[128];
-	// max of 20 digits for the value
-	char value[20];
+	// a pixel particle still covers a whole pixel when zoomed in
+	int pixelSize = SDL_max(1, (int)camera.zoom);
 	
-	// set all enablable options to disabled by default
-	options->ENABLE_STARTING_PARTICLES = 0;
-	options->ENABLE_BENCHMARK = 0;
-	options->ENABLE_AUTO_ADD_PARTICLES = 0;
-	options->ENABLE_CIRCLE_PARTICLES = 0;
-	options->ENABLE_CIRCLE_FILLED = 0;
-	options->ENABLE_BORDER_COLLISION = 0;
-	options->ENABLE_BORDER_CLAMP = 0;
-	options->ENABLE_PARTICLE_COLLISION = 0;
-	options->MAX_MEMORY_ALLOCATION = 32768;
-	options->ENABLE_GENERATE_ONCE = 0;
-	
-	while(!feof(config)){
+	for(int d = 0; d < drawnCount; d++){
 		
-		fgets(currentLine, sizeof(currentLine), config);
+		int i = drawnParticles[d];
 		
-		// check for comments and empty lines
-		if(currentLine[0] == '#' || currentLine[0] == '\n'){ continue; }
+		const particlesimSnapshotParticle* restrict drawn = &shown->particles[i];
 		
-		for(int i = 0; i < (int)sizeof(currentLine); i++){
+		// pick the colour, which comes from the type
+		const particleColour* restrict colour = &particleColours[drawn->type];
+		
+		SDL_SetRenderDrawColor(winRend, colour->r, colour->g, colour->b, 255);
+		
+		// if circle particles are enabled, draw a circle
+		// otherwise, draw a pixel
+		if(options->ENABLE_CIRCLE_PARTICLES){
 			
-			if(currentLine[i] == ' '){
-				
-				for(int j = 1; j < (int)sizeof(value); j++){
-					
-					if(!((currentLine[i + j] >= '0' && currentLine[i + j] <= '9') || currentLine[i + j] == '.')){
-						
-						memset(&value, 0, sizeof(value));
-						memcpy(&value, &(currentLine[i + 1]), (size_t)(j - 1));
-						
-						break;
-						
-					}
-					
-				}
-				
-				break;
-				
-			}
+			drawCircle(i, -1, -1, 0, options->ENABLE_CIRCLE_FILLED);
 			
 		}
 		
-		// for each individual line, check against each option string
-		// and if they are the same, write the corresponding value
-		// in the options struct
-		if(!memcmp(&currentLine, &optStr1, (sizeof(optStr1) - 1))){ options->MAX_PARTICLE_COUNT = atoi(value); }
-		if(!memcmp(&currentLine, &optStr2, (sizeof(optStr2) - 1))){ options->MAX_PARTICLE_SPEED = atof(value); }
-		if(!memcmp(&currentLine, &optStr3, (sizeof(optStr3) - 1))){ options->MIN_PARTICLE_SPEED = atof(value); }
-		if(!memcmp(&currentLine, &optStr7, (sizeof(optStr7) - 1))){ options->MAX_DIRECTION = atof(value); }
-		if(!memcmp(&currentLine, &optStr8, (sizeof(optStr8) - 1))){ options->ENABLE_STARTING_PARTICLES = 1; }
-		if(!memcmp(&currentLine, &optStr9, (sizeof(optStr9) - 1))){ options->ENABLE_BENCHMARK = 1; }
-		if(!memcmp(&currentLine, &optStr10, (sizeof(optStr10) - 1))){ options->MAX_BENCHMARK_SPF = atof(value); }
-		if(!memcmp(&currentLine, &optStr11, (sizeof(optStr11) - 1))){ options->ENABLE_AUTO_ADD_PARTICLES = 1; }
-		if(!memcmp(&currentLine, &optStr12, (sizeof(optStr12) - 1))){ options->ENABLE_CIRCLE_PARTICLES = 1; }
-		if(!memcmp(&currentLine, &optStr13, (sizeof(optStr13) - 1))){ options->ENABLE_CIRCLE_FILLED = 1; }
-		if(!memcmp(&currentLine, &optStr16, (sizeof(optStr16) - 1))){ options->ENABLE_BORDER_COLLISION = 1; }
-		if(!memcmp(&currentLine, &optStr17, (sizeof(optStr17) - 1))){ options->ENABLE_BORDER_CLAMP = 1; }
-		if(!memcmp(&currentLine, &optStr18, (sizeof(optStr18) - 1))){ options->ENABLE_PARTICLE_COLLISION = 1; }
-		if(!memcmp(&currentLine, &optStr19, (sizeof(optStr19) - 1))){ options->MAX_MEMORY_ALLOCATION = atoi(value); }
-		if(!memcmp(&currentLine, &optStr24, (sizeof(optStr24) - 1))){ options->BACKGROUND_COL_R = atof(value); }
-		if(!memcmp(&currentLine, &optStr25, (sizeof(optStr25) - 1))){ options->BACKGROUND_COL_G = atof(value); }
-		if(!memcmp(&currentLine, &optStr26, (sizeof(optStr26) - 1))){ options->BACKGROUND_COL_B = atof(value); }
-		if(!memcmp(&currentLine, &optStr27, (sizeof(optStr27) - 1))){ options->ENABLE_GENERATE_ONCE = 1; }
-		if(!memcmp(&currentLine, &optStr28, (sizeof(optStr28) - 1))){ options->BUTTON_PADDING = atoi(value); }
-		if(!memcmp(&currentLine, &optStr29, (sizeof(optStr29) - 1))){ options->BUTTON_TRANSPARENCY = atof(value); }
-		if(!memcmp(&currentLine, &optStr30, (sizeof(optStr30) - 1))){ options->BUTTON_COL_R = atof(value); }
-		if(!memcmp(&currentLine, &optStr31, (sizeof(optStr31) - 1))){ options->BUTTON_COL_G = atof(value); }
-		if(!memcmp(&currentLine, &optStr32, (sizeof(optStr32) - 1))){ options->BUTTON_COL_B = atof(value); }
-		if(!memcmp(&currentLine, &optStr33, (sizeof(optStr33) - 1))){ options->WINDOW_WIDTH = atoi(value); }
-		if(!memcmp(&currentLine, &optStr34, (sizeof(optStr34) - 1))){ options->WINDOW_HEIGHT = atoi(value); }
-		if(!memcmp(&currentLine, &optStr35, (sizeof(optStr35) - 1))){ options->FRICTION = atof(value); }
+		else if(pixelSize == 1){
+			
+			SDL_RenderDrawPoint(winRend, worldToScreenX(drawn->x), worldToScreenY(drawn->y));
+			
+		}
+		
+		else{
+			
+			SDL_Rect pixel = {worldToScreenX(drawn->x), worldToScreenY(drawn->y), pixelSize, pixelSize};
+			
+			SDL_RenderFillRect(winRend, &pixel);
+			
+		}
 		
 	}
 	
-	fclose(config);
-	config = 0;
-	
 	return;
 	
 }
 
-static inline void createButtons(){
+// draw the newest snapshot from now on, if the simulation has published one
+static inline void takeNewestSnapshot(){
 	
-	// height and width for each button
-	int width = (max(options->WINDOW_WIDTH, options->WINDOW_HEIGHT) / 10) - (options->BUTTON_PADDING << 1);
-	int height = (min(options->WINDOW_WIDTH, options->WINDOW_HEIGHT) / 8) - (options->BUTTON_PADDING << 1);
+	// only this thread takes the fresh mark off, so it can't go between checking and swapping
+	if(SDL_AtomicGet(&middleSnapshot) & SNAPSHOT_FRESH){
+		
+		frontSnapshot = SDL_AtomicSet(&middleSnapshot, frontSnapshot) & ~SNAPSHOT_FRESH;
+		
+		// and nothing in it can be read before the swap
+		SDL_MemoryBarrierAcquire();
+		
+	}
 	
-	// first button(pasue/resume) will be located at the top left of the screen
-	buttons[0].x = options->BUTTON_PADDING;
-	buttons[0].y = options->BUTTON_PADDING;
-	buttons[0].w = width;
-	buttons[0].h = height;
+	shown = &snapshots[frontSnapshot];
 	
-	// second button(select particle) will be located under the first
-	buttons[1].x = options->BUTTON_PADDING;
-	buttons[1].y = height + (options->BUTTON_PADDING << 1);
-	buttons[1].w = width;
-	buttons[1].h = height;
+	return;
 	
-	buttons[2].x = options->BUTTON_PADDING;
-	buttons[2].y = (height << 1) + (options->BUTTON_PADDING * 3);
-	buttons[2].w = width;
-	buttons[2].h = height;
+}
+
+// zoom in or out by a number of mouse wheel notches, keeping
+// the point of the world under the mouse where it is
+static inline void zoomCamera(int notches){
 	
-	buttons[3].x = options->BUTTON_PADDING;
-	buttons[3].y = (height * 3) + (options->BUTTON_PADDING * 4);
-	buttons[3].w = width;
-	buttons[3].h = height;
+	int mouseX, mouseY;
 	
-	buttons[4].x = options->BUTTON_PADDING;
-	buttons[4].y = (height * 4) + (options->BUTTON_PADDING * 5);
-	buttons[4].w = width;
-	buttons[4].h = height;
+	SDL_GetMouseState(&mouseX, &mouseY);
+	
+	double anchorX = screenToWorldX(mouseX);
+	double anchorY = screenToWorldY(mouseY);
+	
+	camera.zoom = SDL_max(CAMERA_MIN_ZOOM, SDL_min(CAMERA_MAX_ZOOM, camera.zoom * pow(CAMERA_ZOOM_STEP, (double)notches)));
+	
+	camera.x = anchorX - ((double)mouseX / camera.zoom);
+	camera.y = anchorY - ((double)mouseY / camera.zoom);
 	
 	return;
 	
 }
 
-static inline void drawButtons(){
+// take a snapshot into the back one, then swap it with the one
+// in the middle for the main thread to take
+static inline void publishSnapshot(){
 	
-	// iterate through each button and draw the boxes of the correct
-	// transparency (the selected box will be twice as opaque)
-	for(int i = 0; i < 5; i++){
-		
-		if(i == buttonPressed){
-			
-			SDL_SetRenderDrawColor(winRend, (Uint8)(options->BUTTON_COL_R),
-				(Uint8)(options->BUTTON_COL_G), (Uint8)(options->BUTTON_COL_B), 
-				(Uint8)(options->BUTTON_TRANSPARENCY * 2));
-			
-		}
-		
-		else{
-			
-			SDL_SetRenderDrawColor(winRend, (Uint8)(options->BUTTON_COL_R),
-				(Uint8)(options->BUTTON_COL_G), (Uint8)(options->BUTTON_COL_B), 
-				(Uint8)(options->BUTTON_TRANSPARENCY));
-			
-		}
-		
-		SDL_RenderFillRect(winRend, &(buttons[i]));
-		
-	}
+	if(!particlesimTakeSnapshot(simulation, &snapshots[backSnapshot], selectedParticle)){ exit(0); }
 	
-	// set the colour of the play/pause icon to white
-	SDL_SetRenderDrawColor(winRend, 255, 255, 255, 255);
+	// everything in it has to be written before the main thread can see it
+	SDL_MemoryBarrierRelease();
 	
-	// draw the "pause" logo
-	if(!isSimulating){
-		
-		for(int i = 0; i < (buttons[0].w / 3); i++){
-			
-			if((i > (buttons[0].w / 9)) && (i < ((buttons[0].w / 9) << 1))){
-				
-				continue;
-				
-			}
-			
-			SDL_RenderDrawLine(winRend, 
-				(buttons[0].x + i + (buttons[0].w / 3)),
-				(buttons[0].y + (buttons[0].h / 6)),
-				(buttons[0].x + i + (buttons[0].w / 3)),
-				(buttons[0].y + (((buttons[0].h / 6) * 5))));
-			
-		}
-		
-	}
+	backSnapshot = SDL_AtomicSet(&middleSnapshot, backSnapshot | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
 	
-	// draw the "play" logo
-	else{
-		
-		drawTriangle((buttons[0].x + (buttons[0].w / 3)),
-			(buttons[0].y + (buttons[0].h / 6)), 
-			(buttons[0].x + ((buttons[0].w / 3) << 1)),
-			(buttons[0].y + (buttons[0].h >> 1)),
-			(buttons[0].x + (buttons[0].w / 3)),
-			(buttons[0].y + ((buttons[0].h / 6) * 5)), 1);
-		
-	}
+	return;
 	
-	// pick the right colour to draw on the particle type button
-	switch(addParticleType){
-		
-		case red_particle:
-			
-			SDL_SetRenderDrawColor(winRend, 255, 0, 0, 255);
-			
-			break;
-		
-		case blue_particle:
-			
-			SDL_SetRenderDrawColor(winRend, 0, 0, 255, 255);
+}
 
-			break;
-		
-		case green_particle:
-			
-			SDL_SetRenderDrawColor(winRend, 0, 255, 0, 255);
-		
-			break;
-		
-		case yellow_particle:
-			
-			SDL_SetRenderDrawColor(winRend, 255, 255, 0, 255);
-			
-			break;
-		
-		case pink_particle:
-			
-			SDL_SetRenderDrawColor(winRend, 255, 0, 255, 255);
+// run everything the window has asked for since last time.
+// Returns 1 if anything was done, so there's something new to show
+static inline char runSimulationCommands(){
+	
+	SDL_LockMutex(commandLock);
+	
+	int commandCount = queuedCommandCount;
+	
+	memcpy(runningCommands, queuedCommands, (size_t)commandCount * sizeof(simulationCommand));
+	queuedCommandCount = 0;
+	
+	SDL_UnlockMutex(commandLock);
+	
+	for(int c = 0; c < commandCount; c++){
 		
-			break;
+		const simulationCommand* restrict command = &runningCommands[c];
 		
-		case -1:
+		switch(command->type){
 			
-			// draw all colours next to each other
-			SDL_SetRenderDrawColor(winRend, 255, 0, 0, 255);
-			drawCircle(0, (buttons[1].x + ((buttons[1].w >> 1)) - (buttons[1].h / 6)), 
-				((buttons[1].y + (buttons[1].h >> 1)) - (buttons[1].h / 6)), ((buttons[1].h / 6) << 1), 1);
+			case spawnCommand:
 				
-			SDL_SetRenderDrawColor(winRend, 0, 0, 255, 255);
-			drawCircle(0, (buttons[1].x + ((buttons[1].w >> 1)) - (buttons[1].h / 6)), 
-				((buttons[1].y + (buttons[1].h >> 1)) + (buttons[1].h / 6)), ((buttons[1].h / 6) << 1), 1);
+				particlesimSpawnRandom(simulation, command->x, command->y, command->particleType, command->once);
 				
-			SDL_SetRenderDrawColor(winRend, 0, 255, 0, 255);
-			drawCircle(0, (buttons[1].x + ((buttons[1].w >> 1)) + (buttons[1].h / 6)), 
-				((buttons[1].y + (buttons[1].h >> 1)) - (buttons[1].h / 6)), ((buttons[1].h / 6) << 1), 1);
-			
-			SDL_SetRenderDrawColor(winRend, 255, 255, 0, 255);
-			drawCircle(0, (buttons[1].x + ((buttons[1].w >> 1)) + (buttons[1].h / 6)), 
-				((buttons[1].y + (buttons[1].h >> 1)) + (buttons[1].h / 6)), ((buttons[1].h / 6) << 1), 1);
-			
-			SDL_SetRenderDrawColor(winRend, 255, 0, 255, 255);
-			drawCircle(0, (buttons[1].x + (buttons[1].w >> 1)), 
-				(buttons[1].y + (buttons[1].h >> 1)), ((buttons[1].h / 6) << 1), 1);
-			
+				break;
 			
-			break;
-	}
-	
-	//draw the single ball
-	if(addParticleType > -1){
-		
-		drawCircle(0, (buttons[1].x + (buttons[1].w >> 1)), 
-			(buttons[1].y + (buttons[1].h >> 1)), ((buttons[1].h / 6) * 4), 1);
+			case resetCommand:
+				
+				particlesimClear(simulation);
+				
+				break;
 			
-	}
-	
-	// white particle 
-	SDL_SetRenderDrawColor(winRend, 255, 255, 255, 255);
-	
-	// check whether to draw one particle per tap/click or multiple
-	if(options->ENABLE_GENERATE_ONCE){
-		
-		drawCircle(0, (buttons[2].x + (buttons[2].w >> 1)), 
-			(buttons[2].y + (buttons[2].h >> 1)), ((buttons[2].h / 6) * 4), 1);
-		
-	}
-	
-	else{
-		
-		// draw 3 particles in a diagional, showing multiple particles
-		drawCircle(0, (buttons[2].x + (buttons[2].w >> 1)), 
-			(buttons[2].y + (buttons[2].h >> 1)), (buttons[2].h / 4), 1);
+			case selectCommand:
+				
+				selectedParticle = command->handle;
+				
+				break;
 			
-		drawCircle(0, (buttons[2].x + ((buttons[2].w >> 1)) + (buttons[1].h / 6)), 
-			((buttons[2].y + (buttons[2].h >> 1)) + (buttons[1].h / 6)), (buttons[2].h / 4), 1);
+			case releaseCommand:
+				
+				// the selected particle might not be there any more, which is fine
+				particlesimSetVelocity(simulation, selectedParticle, command->velocityX, command->velocityY);
+				
+				selectedParticle = PARTICLESIM_NO_HANDLE;
+				
+				break;
 			
-		drawCircle(0, (buttons[2].x + ((buttons[2].w >> 1)) - (buttons[1].h / 6)), 
-			((buttons[2].y + (buttons[2].h >> 1)) - (buttons[1].h / 6)), (buttons[2].h / 4), 1);
+		}
 		
 	}
 	
-	//draw the reset icon
-	drawResetIcon();
+	return (commandCount > 0);
 	
-	if(mode == addParticle){
-		
-		drawAddParticleIcon();
+}
+
+// ask the simulation thread to do something. If it has fallen
+// so far behind that the queue is full, the command is dropped
+static inline void sendSimulationCommand(const simulationCommand* restrict command){
 	
-	}
+	SDL_LockMutex(commandLock);
 	
-	else{
+	if(queuedCommandCount < MAX_SIMULATION_COMMANDS){
 		
-		drawChangeVelocityIcon();
+		queuedCommands[queuedCommandCount] = *command;
+		queuedCommandCount++;
 		
 	}
 	
+	SDL_UnlockMutex(commandLock);
+	
 	return;
 	
 }
 
-static inline void drawSelectedParticle(){
+// get the window's options from the config file
+static inline void getWindowOptions(const char* path){
 	
-	// get the distance between the particle and mouse and 
-	// check if the velocity exceeds MAX_PARTICLE_SPEED
-	int diffX = mouseDown.button.x - (int)(particles[selectedParticle].x);
-	int diffY = mouseDown.button.y - (int)(particles[selectedParticle].y);
+	// the file to read the options from
+	FILE* config = fopen(path, "r");
 	
-	double distance = sqrt(((double)diffX * (double)diffX) + ((double)diffY * (double)diffY));
+	// if we can't open the file then we quit
+	if(config == 0){ exit(0); }
 	
-	velocityXToChange = (double)(-diffX);
-	velocityYToChange = (double)(-diffY);
+	// max of 128 characters per line
+	char currentLine[128];
+	// max of 20 digits for the value
+	char value[20];
 	
-	int triangleSizeX, triangleSizeY, triangleEndX, triangleEndY;
+	// set all enablable options to disabled by default
+	options->ENABLE_BENCHMARK = 0;
+	options->ENABLE_AUTO_ADD_PARTICLES = 0;
+	options->ENABLE_CIRCLE_PARTICLES = 0;
+	options->ENABLE_CIRCLE_FILLED = 0;
+	options->ENABLE_GENERATE_ONCE = 0;
+	options->ENABLE_DETERMINISTIC = 0;
+	options->FIXED_TIMESTEP = 1.0 / 60.0;
+	options->MAX_STEPS = 0;
+	options->RENDER_RATE = 60.0;
+	options->ENABLE_VSYNC = 0;
+	options->SIMULATION_RATE = 0.0;
+	options->SLAB_PROCESSES = 0;
 	
-	// we will stop the triangle length and width when it exceeds the maximum
-	// possible particle velocity
-	if(distance > (options->MAX_PARTICLE_SPEED / 2.0)){
-		
-		// get the angle between the mouse and particle
-		double angle = atan2((particles[selectedParticle].y - (double)mouseDown.button.y),
-			(particles[selectedParticle].x - (double)mouseDown.button.x));
+	while(!feof(config)){
 		
-		// get the new direction
-		// we set the amount of velocity to add to the maximum speed
-		double dx = (cos(angle) * (options->MAX_PARTICLE_SPEED * 0.5));
-		double dy = (sin(angle) * (options->MAX_PARTICLE_SPEED * 0.5));
+		// stop at the end, otherwise the last line is read twice
+		if(fgets(currentLine, sizeof(currentLine), config) == 0){ break; }
 		
-		velocityXToChange = particles[selectedParticle].x - dx;
-		velocityYToChange = particles[selectedParticle].y - dy;
+		// check for comments and empty lines
+		if(currentLine[0] == '#' || currentLine[0] == '\n'){ continue; }
 		
-		diffX = (int)(velocityXToChange - particles[selectedParticle].x);
-		diffY = (int)(velocityYToChange - particles[selectedParticle].y);
+		for(int i = 0; i < (int)sizeof(currentLine); i++){
+			
+			if(currentLine[i] == ' '){
+				
+				for(int j = 1; j < (int)sizeof(value); j++){
+					
+					if(!((currentLine[i + j] >= '0' && currentLine[i + j] <= '9') || currentLine[i + j] == '.')){
+						
+						memset(&value, 0, sizeof(value));
+						memcpy(&value, &(currentLine[i + 1]), (size_t)(j - 1));
+						
+						break;
+						
+					}
+					
+				}
+				
+				break;
+				
+			}
+			
+		}
 		
-		// We calculate how wide the triangle is based on the velocity we are about to apply,
-		// the maximum width of the triangle is the same as the maximum particle speed / 2
-		triangleSizeX = (int)(velocityXToChange) - (diffY >> 2);
-		triangleSizeY = (int)(velocityYToChange) + (diffX >> 2);
-		triangleEndX = (int)(velocityXToChange) + (diffY >> 2);
-		triangleEndY = (int)(velocityYToChange) - (diffX >> 2);
+		// for each individual line, check against each option string
+		// and if they are the same, write the corresponding value
+		// in the options struct
+		if(!memcmp(&currentLine, &windowOptStr1, (sizeof(windowOptStr1) - 1))){ options->MAX_PARTICLE_SPEED = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr2, (sizeof(windowOptStr2) - 1))){ options->ENABLE_BENCHMARK = 1; }
+		if(!memcmp(&currentLine, &windowOptStr3, (sizeof(windowOptStr3) - 1))){ options->MAX_BENCHMARK_SPF = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr4, (sizeof(windowOptStr4) - 1))){ options->ENABLE_AUTO_ADD_PARTICLES = 1; }
+		if(!memcmp(&currentLine, &windowOptStr5, (sizeof(windowOptStr5) - 1))){ options->ENABLE_CIRCLE_PARTICLES = 1; }
+		if(!memcmp(&currentLine, &windowOptStr6, (sizeof(windowOptStr6) - 1))){ options->ENABLE_CIRCLE_FILLED = 1; }
+		if(!memcmp(&currentLine, &windowOptStr7, (sizeof(windowOptStr7) - 1))){ options->BACKGROUND_COL_R = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr8, (sizeof(windowOptStr8) - 1))){ options->BACKGROUND_COL_G = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr9, (sizeof(windowOptStr9) - 1))){ options->BACKGROUND_COL_B = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr10, (sizeof(windowOptStr10) - 1))){ options->ENABLE_GENERATE_ONCE = 1; }
+		if(!memcmp(&currentLine, &windowOptStr11, (sizeof(windowOptStr11) - 1))){ options->BUTTON_PADDING = atoi(value); }
+		if(!memcmp(&currentLine, &windowOptStr12, (sizeof(windowOptStr12) - 1))){ options->BUTTON_TRANSPARENCY = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr13, (sizeof(windowOptStr13) - 1))){ options->BUTTON_COL_R = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr14, (sizeof(windowOptStr14) - 1))){ options->BUTTON_COL_G = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr15, (sizeof(windowOptStr15) - 1))){ options->BUTTON_COL_B = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr16, (sizeof(windowOptStr16) - 1))){ options->WINDOW_WIDTH = atoi(value); }
+		if(!memcmp(&currentLine, &windowOptStr17, (sizeof(windowOptStr17) - 1))){ options->WINDOW_HEIGHT = atoi(value); }
+		if(!memcmp(&currentLine, &windowOptStr18, (sizeof(windowOptStr18) - 1))){ options->ENABLE_DETERMINISTIC = 1; }
+		if(!memcmp(&currentLine, &windowOptStr19, (sizeof(windowOptStr19) - 1))){ options->FIXED_TIMESTEP = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr20, (sizeof(windowOptStr20) - 1))){ options->MAX_STEPS = atoi(value); }
+		if(!memcmp(&currentLine, &windowOptStr21, (sizeof(windowOptStr21) - 1))){ options->RENDER_RATE = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr22, (sizeof(windowOptStr22) - 1))){ options->ENABLE_VSYNC = 1; }
+		if(!memcmp(&currentLine, &windowOptStr23, (sizeof(windowOptStr23) - 1))){ options->SIMULATION_RATE = atof(value); }
+		if(!memcmp(&currentLine, &windowOptStr24, (sizeof(windowOptStr24) - 1))){ options->SLAB_PROCESSES = atoi(value); }
 		
-		velocityXToChange = (double)(-diffX);
-		velocityYToChange = (double)(-diffY);
 	}
 	
-	else{
-		
-		// We calculate how wide the triangle is based on the velocity we are about to appply
-		triangleSizeX = mouseDown.button.x - (int)((double)diffY * (distance / (options->MAX_PARTICLE_SPEED * 2.0)));
-		triangleSizeY = mouseDown.button.y + (int)((double)diffX * (distance / (options->MAX_PARTICLE_SPEED * 2.0)));
-		triangleEndX = mouseDown.button.x + (int)((double)diffY * (distance / (options->MAX_PARTICLE_SPEED * 2.0)));
-		triangleEndY = mouseDown.button.y - (int)((double)diffX * (distance / (options->MAX_PARTICLE_SPEED * 2.0)));
-		
-	}
+	fclose(config);
 	
-	SDL_SetRenderDrawColor(winRend, 255, 255, 255, 255);
+	return;
 	
-	//draw a line too, in case the triangle is too thin
-	SDL_RenderDrawLine(winRend, (int)(particles[selectedParticle].x), 
-		(int)(particles[selectedParticle].y),
-		(int)(particles[selectedParticle].x - velocityXToChange), 
-		(int)(particles[selectedParticle].y - velocityYToChange));
+}
+
+// particlesimBench.c includes this file with PARTICLESIM_NO_MAIN defined,
+// so it can call the drawing without opening a window
+#ifndef PARTICLESIM_NO_MAIN
+
+// the simulation thread. It steps the particles SIMULATION_RATE times a second
+// and publishes a snapshot whenever the window is ready for a new one
+static int simulationThread(void* data){
 	
-	//draw the triangle, the pointy part on the particle
-	drawTriangle(triangleSizeX, triangleSizeY,
-		(int)(particles[selectedParticle].x),
-		(int)(particles[selectedParticle].y),
-		triangleEndX, triangleEndY, 1);
+	(void)data;
 	
-	velocityXToChange *= 2.0;
-	velocityYToChange *= 2.0;
+	double tickSpeed = (double)SDL_GetPerformanceFrequency();
+	Uint64 nextStepTick = SDL_GetPerformanceCounter();
+	Uint64 lastPublishTick = 0;
 	
-	// draw a white circle outline on the selected particle
-	// to give us better visibility
-	for(int i = 0; i < 5; i++){
+	// the first snapshot shows the starting particles
+	char isSnapshotDue = 1;
+	
+	while(SDL_AtomicGet(&isRunning)){
 		
-		drawCircle(0, (int)(particles[selectedParticle].x), (int)(particles[selectedParticle].y),
-			(int)(particles[selectedParticle].size) + i, 0);
+		Uint64 startStepTick = SDL_GetPerformanceCounter();
 		
-	}
-	
-	return;
-}
-
-static inline void drawParticles(){
-	
-	// draw particles
-	for(int i = 0; i < length; i++){
+		if(runSimulationCommands()){
+			
+			isSnapshotDue = 1;
+			
+		}
+		
+		// update each particle and handle border and particle collisions
+		if(SDL_AtomicGet(&isSimulating)){
+			
+			particlesimStep(simulation, delta);
+			
+			isSnapshotDue = 1;
+			
+			if((options->MAX_STEPS > 0) && (particlesimSteps(simulation) >= (Uint64)options->MAX_STEPS)){
+				
+				SDL_AtomicSet(&isRunning, 0);
+				
+			}
+			
+			if(options->ENABLE_BENCHMARK){
+				
+				double stepTime = (double)(SDL_GetPerformanceCounter() - startStepTick) / tickSpeed;
+				
+				// will stop the program when a step takes longer than
+				// the specified amount and writes the amount of
+				// particles to a file called benchmark.txt, the amount of memory used
+				// and the the amount of different particles we have
+				if(stepTime > options->MAX_BENCHMARK_SPF){
+					
+					int length = particlesimCount(simulation);
+					
+					FILE* benchmark = fopen("benchmark.txt", "w+");
+					fprintf(benchmark, "\n%s%.2f%s%d\n", "Number of particles visible at ", options->MAX_BENCHMARK_SPF, " seconds per step: ", length);
+					fprintf(benchmark, "%s%d%s\n", "Memory used: ", (int)(particlesimParticleBytes(simulation) * (size_t)length), " bytes");
+					
+					fclose(benchmark);
+					SDL_AtomicSet(&isRunning, 0);
+					
+				}
+				
+			}
+			
+		}
 		
-		// if a particle is outside of the window border, then we don't need to draw it
-		if(((particles[i].x + (0.5 * particles[i].size )) < 0.0) || ((particles[i].x - (0.5 * particles[i].size)) > options->WINDOW_WIDTH)){ continue; }
-		if(((particles[i].y + (0.5 * particles[i].size)) < 0.0) || ((particles[i].y - (0.5 * particles[i].size)) > options->WINDOW_HEIGHT)){ continue; }
+		// publish once the window has taken the last snapshot, or if the one
+		// still waiting for it is already half a frame old
+		if(isSnapshotDue && (!(SDL_AtomicGet(&middleSnapshot) & SNAPSHOT_FRESH) ||
+			((SDL_GetPerformanceCounter() - lastPublishTick) >= (renderPeriod >> 1)))){
+			
+			publishSnapshot();
+			
+			lastPublishTick = SDL_GetPerformanceCounter();
+			isSnapshotDue = 0;
+			
+		}
 		
-		// pick the colour
-		SDL_SetRenderDrawColor(winRend, (Uint8)particles[i].r, (Uint8)particles[i].g, (Uint8)particles[i].b, 255);
+		waitForNextTick(&nextStepTick, simulationPeriod);
 		
-		// if circle particles are enabled, draw a circle
-		// otherwise, draw a pixel
-		if(options->ENABLE_CIRCLE_PARTICLES){
+		// with nothing to step and no limit, don't spin a core doing nothing
+		if((simulationPeriod == 0) && !SDL_AtomicGet(&isSimulating)){
 			
-			drawCircle(i, -1, -1, 0, options->ENABLE_CIRCLE_FILLED);
+			SDL_Delay(1);
 			
 		}
 		
-		else{
+		// take the next delta clock, the whole step including the wait
+		if(!options->ENABLE_DETERMINISTIC){
 			
-			SDL_RenderDrawPoint(winRend, (int)particles[i].x, (int)particles[i].y);
+			delta = (double)(SDL_GetPerformanceCounter() - startStepTick) / tickSpeed;
 			
 		}
 		
 	}
 	
-	return;
+	return 0;
 	
 }
 
 int main(int argc, char** argv){
 	
-	debug = fopen("debug.txt", "w"); 
+	debug = fopen("debug.txt", "w");
+	
+	// the config file the user supplied, or the one next to the program
+	const char* configPath = (argc > 1) ? argv[1] : "config.txt";
 	
-	// allocate memory for the options
-	options = malloc(sizeof(configOptions));
+	// allocate memory for the options the window needs. The simulation
+	// reads its own when it's made
+	options = malloc(sizeof(windowOptions));
 	
 	// check if we were able to allocate successfully
 	if(options == 0){ exit(0); }
 	
-	if(argc > 1){
-		
-		// get the required options
-		getOptions(argv[1]);
-		
-	}
+	// get the required options
+	getWindowOptions(configPath);
 	
-	else{
+	// the first step is FIXED_TIMESTEP long in deterministic mode,
+	// otherwise it waits to see how long the first one takes
+	delta = options->ENABLE_DETERMINISTIC ? options->FIXED_TIMESTEP : 0.0;
+	
+	// the simulation is made like any other program's, and brings its own options
+	particlesimSettings settings;
+	memset(&settings, 0, sizeof(settings));
+	
+	settings.allowCompactParticles = 1;
+	settings.allowSlabProcesses = 1;
+	
+	// the slab processes are forked while the simulation is made, and mustn't
+	// get a copy of SDL's video. So with slabs it's made before SDL starts,
+	// and a world without a size is the size the window is asked to be
+	char isForking = options->SLAB_PROCESSES > 1;
+	
+	if(isForking){
 		
-		getOptions(0);
+		simulation = particlesimCreateWith(configPath, &settings);
+		
+		if(simulation == 0){ exit(0); }
 		
 	}
 	
 	// init SDL
 	SDL_Init(SDL_INIT_VIDEO);
 	
+	// vsync has to be asked for before the renderer is made
+	SDL_SetHint(SDL_HINT_RENDER_VSYNC, options->ENABLE_VSYNC ? "1" : "0");
+	
 	//create a window and renderer objects
 	SDL_CreateWindowAndRenderer(options->WINDOW_WIDTH, options->WINDOW_HEIGHT, SDL_WINDOW_SHOWN, &win, &winRend);
 	
 	// update x and y window size with actual values
-	// cos on android it automatically changes
+	// (cos on android it automatically changes)
 	SDL_GetWindowSize(win, &options->WINDOW_WIDTH, &options->WINDOW_HEIGHT);
 	
+	// without a world size, the world is the window, which is the actual size it came out as
+	if(!isForking){
+		
+		settings.worldWidth = options->WINDOW_WIDTH;
+		settings.worldHeight = options->WINDOW_HEIGHT;
+		
+		simulation = particlesimCreateWith(configPath, &settings);
+		
+		if(simulation == 0){ exit(0); }
+		
+	}
+	
+	int worldWidth, worldHeight;
+	
+	particlesimGetWorldSize(simulation, &worldWidth, &worldHeight);
+	
 	// we have three buttons right now - one to pause/resume,
 	// one to select the particle type to add and one to toggle
-	// ENABLE_GENERATE_ONCE on or off 
+	// ENABLE_GENERATE_ONCE on or off
 	buttons = malloc(sizeof(SDL_Rect) * 5);
 	
 	if(buttons == 0){ exit(0); }
@@ -1752,7 +1412,7 @@ int main(int argc, char** argv){
 	
 	buttonPressed = -1;
 	
-	selectedParticle = -1;
+	selectedParticle = PARTICLESIM_NO_HANDLE;
 	
 	// set the title of our window, very nice :)
 	SDL_SetWindowTitle(win, "Particle Simulator v1.0");
@@ -1761,48 +1421,53 @@ int main(int argc, char** argv){
 	// because the buttons will be slightly transparent
 	SDL_SetRenderDrawBlendMode(winRend, SDL_BLENDMODE_BLEND);
 	
-	// initialise with 0
-	length = 0;
-	delta = 0.0;
-	randState = (unsigned int)SDL_GetPerformanceCounter();
-	
-	// allocate MAX_MEMORY_ALLOCATION bytes of memory from heap
-	// for the particle themselves
-	particles = malloc((size_t)(options->MAX_MEMORY_ALLOCATION));
-	
-	// if not able to allocate memory, we print and quit
-	if(particles == 0){ exit(0); }
+	SDL_AtomicSet(&isRunning, 1);
 	
-	// only two particles can bond at the moment
-	bonding = malloc((((size_t)(options->MAX_MEMORY_ALLOCATION) / sizeof(particle))) * sizeof(int));
-	
-	if(bonding == 0){ exit(0); }
-	
-	isRunning = 1;
-	
-	// set the game to paused on startup
-	isSimulating = 0;
+	// set the game to paused on startup, unless we
+	// are rerunning a scenario in deterministic mode
+	SDL_AtomicSet(&isSimulating, options->ENABLE_DETERMINISTIC);
 	SDL_Event event;
 	mouseDown.button.x = 0;
 	mouseDown.button.y = 0;
+	
+	// start with the whole window in view
+	camera.x = 0.0;
+	camera.y = 0.0;
+	camera.zoom = 1.0;
+	isPanning = 0;
 	char isHoldingDown = 0;
-	Uint64 startFrameTick, endFrameTick;
-	double tickSpeed = (double)SDL_GetPerformanceFrequency();
 	
 	// red is the default particle to add
-	addParticleType = red_particle;
+	addParticleType = 0;
 	
+	// how long a frame and a step take, a SIMULATION_RATE of 0 steps once a frame
+	renderPeriod = (options->RENDER_RATE > 0.0) ? (Uint64)((double)SDL_GetPerformanceFrequency() / options->RENDER_RATE) : 0;
+	simulationPeriod = (options->SIMULATION_RATE > 0.0) ? (Uint64)((double)SDL_GetPerformanceFrequency() / options->SIMULATION_RATE) : renderPeriod;
 	
-	// generate initial particles
-	if(options->ENABLE_STARTING_PARTICLES){
-		
-		generateRandomParticles(-1, -1);
-		
-	}
+	// nothing has been published yet, so the window draws an empty snapshot
+	memset(snapshots, 0, sizeof(snapshots));
+	frontSnapshot = 0;
+	backSnapshot = 2;
+	SDL_AtomicSet(&middleSnapshot, 1);
+	shown = &snapshots[frontSnapshot];
+	
+	queuedCommandCount = 0;
+	commandLock = SDL_CreateMutex();
+	
+	if(commandLock == 0){ exit(0); }
+	
+	// from here on only the simulation thread touches the simulation
+	simulationThreadHandle = SDL_CreateThread(simulationThread, "simulation", 0);
+	
+	if(simulationThreadHandle == 0){ exit(0); }
 	
-	while(isRunning){
+	Uint64 nextFrameTick = SDL_GetPerformanceCounter();
+	simulationCommand command;
+	
+	memset(&command, 0, sizeof(command));
+	
+	while(SDL_AtomicGet(&isRunning)){
 		
-		startFrameTick = SDL_GetPerformanceCounter();
 		// poll events
 		
 		while(SDL_PollEvent(&event)){
@@ -1811,20 +1476,29 @@ int main(int argc, char** argv){
 				
 				case SDL_MOUSEBUTTONDOWN:
 					
+					// the right button drags the view around
+					if(event.button.button == SDL_BUTTON_RIGHT){
+						
+						isPanning = 1;
+						
+						break;
+						
+					}
+					
 					// check if pressing pause/play button
 					if(event.button.x > buttons[0].x && event.button.y > buttons[0].y &&
 						event.button.x < (buttons[0].x + buttons[0].w) &&
 						event.button.y < (buttons[0].y + buttons[0].h)){
 						
-						if(isSimulating){
+						if(SDL_AtomicGet(&isSimulating)){
 							
-							isSimulating = 0;
+							SDL_AtomicSet(&isSimulating, 0);
 							
 						}
 						
 						else{
 							
-							isSimulating = 1;
+							SDL_AtomicSet(&isSimulating, 1);
 							
 						}
 						
@@ -1840,7 +1514,7 @@ int main(int argc, char** argv){
 						// switch to the next type
 						addParticleType += 1;
 						
-						if(addParticleType == numOfParticleTypes){
+						if(addParticleType == PARTICLESIM_TYPES){
 							
 							addParticleType = -1;
 							
@@ -1866,7 +1540,9 @@ int main(int argc, char** argv){
 						event.button.x < (buttons[3].x + buttons[3].w) &&
 						event.button.y < (buttons[3].y + buttons[3].h)){
 						
-						length = 0;
+						command.type = resetCommand;
+						
+						sendSimulationCommand(&command);
 						
 						buttonPressed = 3;
 						
@@ -1893,27 +1569,23 @@ int main(int argc, char** argv){
 					}
 					
 					else{
-					
+						
 						if(!(event.button.x > options->WINDOW_WIDTH || event.button.x < 0.0 || 
 							event.button.y > options->WINDOW_HEIGHT || event.button.y < 0.0)){
 							
 							isHoldingDown = 1;
 							
 							if(mode == changeVelocity){
+								
+								// ask the snapshot which particle the mouse is over
+								uint64_t picked = particlesimSnapshotPick(shown, screenToWorldX(mouseDown.button.x), screenToWorldY(mouseDown.button.y));
+								
+								if(picked != PARTICLESIM_NO_HANDLE){
 									
-								//loop through each particle and check if the mouse is over them
-								for(int i = 0; i < length; i++){
-									
-									double w = (double)(mouseDown.button.x) - particles[i].x;
-									double h = (double)(mouseDown.button.y) - particles[i].y;
-									
-									double distance = sqrt((w * w) + (h * h));
+									command.type = selectCommand;
+									command.handle = picked;
 									
-									if(distance < (particles[i].size * 0.5)){
-										
-										selectedParticle = i;
-										
-									}
+									sendSimulationCommand(&command);
 									
 								}
 								
@@ -1926,33 +1598,31 @@ int main(int argc, char** argv){
 					}
 					
 					break;
-					
-				case SDL_MOUSEBUTTONUP:
 				
-					isHoldingDown = 0;
-					buttonPressed = -1;
+				case SDL_MOUSEBUTTONUP:
 					
-					if(selectedParticle > -1){
+					if(event.button.button == SDL_BUTTON_RIGHT){
 						
-						particles[selectedParticle].velocityX = velocityXToChange;
-						particles[selectedParticle].velocityY = velocityYToChange;
-						
-						if(particles[selectedParticle].bondingWith > -1){
-							
-							// Equal amounts of force are put on both particles in a single bond
-							particles[particles[selectedParticle].bondingWith].velocityX = velocityXToChange;
-							particles[particles[selectedParticle].bondingWith].velocityY = velocityYToChange;
-							
-						}
+						isPanning = 0;
 						
-						selectedParticle = -1;
+						break;
 						
 					}
 					
-					break;
+					isHoldingDown = 0;
+					buttonPressed = -1;
 					
-				case SDL_MOUSEMOTION:
+					// give the selected particle (if there still is one) its new velocity
+					command.type = releaseCommand;
+					command.velocityX = velocityXToChange;
+					command.velocityY = velocityYToChange;
+					
+					sendSimulationCommand(&command);
+					
+					break;
 				
+				case SDL_MOUSEMOTION:
+					
 					// need to check if the mouse is inside the window
 					// (there is a bug in SDL, sometimes when the user
 					// clicks outside the window SDL will still capture it)
@@ -1966,22 +1636,36 @@ int main(int argc, char** argv){
 						
 					}
 					
+					// move the world along with the mouse
+					if(isPanning){
+						
+						camera.x -= (double)event.motion.xrel / camera.zoom;
+						camera.y -= (double)event.motion.yrel / camera.zoom;
+						
+					}
+					
 					break;
+				
+				case SDL_MOUSEWHEEL:
 					
-				case SDL_KEYDOWN:
+					zoomCamera(event.wheel.y);
+					
+					break;
 				
+				case SDL_KEYDOWN:
+					
 					if(event.key.keysym.scancode == SDL_SCANCODE_ESCAPE){
 						
-						isRunning = 0;
+						SDL_AtomicSet(&isRunning, 0);
 						
 					}
 					
 					break;
-					
+				
 				case SDL_QUIT:
 					
-					isRunning = 0;
-					
+					SDL_AtomicSet(&isRunning, 0);
+				
 			}
 			
 		}
@@ -1996,9 +1680,20 @@ int main(int argc, char** argv){
 				
 			}
 			
-			if(mode == addParticle){
+			// the particles go where the mouse is in the world, if that's inside it
+			int worldX = (int)screenToWorldX(mouseDown.button.x);
+			int worldY = (int)screenToWorldY(mouseDown.button.y);
+			
+			if((mode == addParticle) && (worldX >= 0) && (worldY >= 0) &&
+				(worldX <= worldWidth) && (worldY <= worldHeight)){
+				
+				command.type = spawnCommand;
+				command.x = worldX;
+				command.y = worldY;
+				command.particleType = addParticleType;
+				command.once = options->ENABLE_GENERATE_ONCE;
 				
-				generateRandomParticles(mouseDown.button.x, mouseDown.button.y);
+				sendSimulationCommand(&command);
 				
 			}
 			
@@ -2007,21 +1702,18 @@ int main(int argc, char** argv){
 		// add particles every frame, regardless of input from user
 		if(options->ENABLE_AUTO_ADD_PARTICLES){
 			
-			generateRandomParticles(-1, -1);
-			
-		}
-		
-		// update each particle and handle border and particle collisions
-		if(isSimulating){
-			
-			updateParticles();
-			
-			handleBorderCollision();
+			command.type = spawnCommand;
+			command.x = -1;
+			command.y = -1;
+			command.particleType = addParticleType;
+			command.once = options->ENABLE_GENERATE_ONCE;
 			
-			handleParticleInteraction();
+			sendSimulationCommand(&command);
 			
 		}
 		
+		takeNewestSnapshot();
+		
 		// clear the screen first
 		SDL_SetRenderDrawColor(winRend, (Uint8)options->BACKGROUND_COL_R, 
 			(Uint8)options->BACKGROUND_COL_G, (Uint8)options->BACKGROUND_COL_B, 255);
@@ -2031,7 +1723,7 @@ int main(int argc, char** argv){
 		drawParticles();
 		
 		// draw line to add velocity to the selected particle
-		if(selectedParticle > -1){
+		if(shown->hasSelected){
 			
 			drawSelectedParticle();
 			
@@ -2043,33 +1735,25 @@ int main(int argc, char** argv){
 		// flip buffers
 		SDL_RenderPresent(winRend);
 		
-		// take the next delta clock
-		endFrameTick = SDL_GetPerformanceCounter();
-		delta = (double)(endFrameTick - startFrameTick) / tickSpeed;
-		
-		if(options->ENABLE_BENCHMARK){
-			
-			// will stop the program when the FPS drops below 
-			// the specified amount and writes the amount of 
-			// particles to a file called benchmark.txt, the amount of memory used
-			// and the the amount of different particles we have
-			if(delta > options->MAX_BENCHMARK_SPF){
-				
-				FILE* benchmark = fopen("benchmark.txt", "w+");
-				fprintf(benchmark, "\n%s%.2f%s%d\n", "Number of particles visible at ", options->MAX_BENCHMARK_SPF, " seconds per frame: ", length);
-				fprintf(benchmark, "%s%d%s\n", "Memory used: ", (int)(sizeof(particle) * (size_t)length), " bytes");
-				
-				fclose(benchmark);
-				isRunning = 0;
-				
-			}
-			
-		}
+		// with vsync on, presenting already waited for the screen.
+		// RENDER_RATE can still hold it below the refresh rate
+		waitForNextTick(&nextFrameTick, renderPeriod);
 		
 	}
 	
+	// the simulation might be halfway through a step
+	SDL_WaitThread(simulationThreadHandle, 0);
+	simulationThreadHandle = 0;
+	
+	SDL_DestroyMutex(commandLock);
+	commandLock = 0;
+	
 	fclose(debug);
 	
+	// its checkpoints, metrics and collision log are stopped with it
+	particlesimDestroy(simulation);
+	simulation = 0;
+	
 	// free all memory
 	SDL_DestroyRenderer(winRend);
 	winRend = 0;
@@ -2077,20 +1761,28 @@ int main(int argc, char** argv){
 	SDL_DestroyWindow(win);
 	win = 0;
 	
-	free(options);
-	options = 0;
-	
 	free(buttons);
 	buttons = 0;
 	
-	free(particles);
-	particles = 0;
+	free(drawnParticles);
+	drawnParticles = 0;
+	drawnParticlesCapacity = 0;
+	
+	for(int i = 0; i < 3; i++){
+		
+		particlesimFreeSnapshot(&snapshots[i]);
+		
+	}
+	
+	free(options);
+	options = 0;
 	
-	free(bonding);
-	bonding = 0;
+	shown = 0;
 	
 	SDL_Quit();
 	
 	return 0;
 	
-}
\ No newline at end of file
+}
+
+#endif